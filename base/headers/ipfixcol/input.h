@@ -214,6 +214,66 @@ API int get_packet(void *config, struct input_info** info, char **packet, int *s
  */
 API int input_close(void **config);
 
+/**
+ * \brief Callback passing received data into the ipfixcol core.
+ *
+ * Arguments have the same meaning as the output arguments of get_packet(),
+ * \p len is the value get_packet() would return. The callback may be called
+ * concurrently from several threads of the input plugin as long as each
+ * source (exporter, ODID) is always passed by the same thread.
+ */
+typedef void (*input_callback)(void *packet, int len, struct input_info *info, int source_status);
+
+/**
+ * \struct input_socket_stats
+ * \brief Receive statistics of one socket (receiver thread) of the input plugin.
+ */
+struct input_socket_stats {
+	uint64_t packets;           /**< number of received packets */
+	uint64_t drops;             /**< number of packets dropped by the kernel */
+};
+
+/**
+ * \brief Start receiving data in threads of the input plugin (optional).
+ *
+ * When the plugin exports this function, ipfixcol core calls it before
+ * polling get_packet(). If the plugin has its own receiver threads, it starts
+ * them and passes all data through \p callback; get_packet() is not called
+ * until the threads are stopped. The function may be called repeatedly and
+ * must not start the threads again when they are running.
+ *
+ * Signals are handled by the main thread; receiver threads should block them.
+ *
+ * \param[in] config   Plugin-specific configuration data prepared by init
+ * \param[in] callback Function processing received data
+ * \return 0 when receiver threads are running, nonzero when the core should
+ * use get_packet().
+ */
+API int input_start(void *config, input_callback callback);
+
+/**
+ * \brief Stop receiver threads of the input plugin (optional).
+ *
+ * The function returns after all threads have passed their last data to the
+ * callback. input_close() has to stop the threads too, when they are running.
+ *
+ * \param[in] config  Plugin-specific configuration data prepared by init
+ * \return 0 on success, nonzero else.
+ */
+API int input_stop(void *config);
+
+/**
+ * \brief Get receive statistics of the input plugin (optional).
+ *
+ * Called periodically by the statistics thread of ipfixcol core.
+ *
+ * \param[in]  config  Plugin-specific configuration data prepared by init
+ * \param[out] stats   Array for the statistics of each socket
+ * \param[in]  max     Size of the array
+ * \return number of filled structures.
+ */
+API int input_stats(void *config, struct input_socket_stats *stats, int max);
+
 #endif /* IPFIXCOL_INPUT_H_ */
 
 /**@}*/
@@ -95,6 +95,21 @@ API int intermediate_close(void *config);
  */
 API int intermediate_process_message(void *config, void *message);
 
+/**
+ * \brief Process batch of IPFIX messages (optional)
+ *
+ * If the plugin exports this function, it is called instead of
+ * "intermediate_process_message" with all messages ready in the input queue.
+ * Each message must be passed to "pass_message" or "drop_message" in the same
+ * way as by the single message function.
+ *
+ * \param[in] config
+ * \param[in] messages Array of IPFIX messages
+ * \param[in] count Number of messages in the array
+ * \return 0 on success, nonzero else.
+ */
+API int intermediate_process_messages(void *config, struct ipfix_message **messages, int count);
+
 /**
 * \brief Pass processed IPFIX message to the output queue.
 *
@@ -160,6 +160,15 @@ API const ipfix_element_t *get_element_by_id(uint16_t id, uint32_t en);
 API ipfix_element_result_t get_element_by_name(const char *name, 
 	bool case_sens);
 
+/**
+ * \brief Get a revision of the description of IPFIX elements
+ *
+ * The revision changes every time the description is reloaded. Plugins that
+ * cache results of get_element_by_id() must drop them when it changes.
+ * \return Revision number
+ */
+API unsigned int get_elements_revision();
+
 #endif /* _IPFIX_ELEMENTS_ */
 
 /**@}*/
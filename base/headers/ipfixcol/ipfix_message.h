@@ -82,10 +82,63 @@ API struct ipfix_message *message_create_clone(struct ipfix_message *msg);
 /**
  * \brief Create empty IPFIX message
  *
+ * Lists of sets have the maximal capacity.
+ *
  * \return new instance of ipfix_message structure.
  */
 API struct ipfix_message *message_create_empty();
 
+/**
+ * \brief Create IPFIX message structure with lists of sets of given capacity
+ *
+ * The structure and the lists are allocated as one zeroed memory block taken
+ * from the message pool of the calling thread. The block can be freed by
+ * free(), but message_recycle() returns it to the pool.
+ *
+ * \param[in] templ_sets Maximal number of Template Sets
+ * \param[in] opt_templ_sets Maximal number of Options Template Sets
+ * \param[in] data_couples Maximal number of Data Sets
+ * \return new instance of ipfix_message structure, NULL on error
+ */
+API struct ipfix_message *message_create_sized(int templ_sets, int opt_templ_sets, int data_couples);
+
+/**
+ * \brief Create IPFIX message structure able to hold the sets of given message
+ *
+ * \param[in] msg IPFIX message
+ * \return new instance of ipfix_message structure, NULL on error
+ */
+API struct ipfix_message *message_create_sized_as(const struct ipfix_message *msg);
+
+/**
+ * \brief Allocate buffer for a packet from the message pool of calling thread
+ *
+ * The buffer is not initialized. It can be freed by free() or passed to the
+ * collector as a packet, it is returned to the pool with the message.
+ *
+ * \param[in] size Size of the buffer
+ * \return pointer to the buffer, NULL on error
+ */
+API void *message_packet_alloc(size_t size);
+
+/**
+ * \brief Allocate zeroed array of metadata from the message pool of calling thread
+ *
+ * \param[in] count Number of metadata structures
+ * \return pointer to the array, NULL on error
+ */
+API struct metadata *message_metadata_alloc(int count);
+
+/**
+ * \brief Dispose IPFIX message including its packet and metadata
+ *
+ * Message, packet and metadata are returned to the pools of the threads which
+ * allocated them. References to templates are not changed.
+ *
+ * \param[in] msg IPFIX message to dispose
+ */
+API void message_recycle(struct ipfix_message *msg);
+
 /**
  * \brief Get data from IPFIX message.
  *
@@ -144,6 +197,60 @@ API int message_free(struct ipfix_message *msg);
  */
 API uint8_t *data_record_get_field(uint8_t *record, struct ipfix_template *templ, uint32_t enterprise, uint16_t id, int *data_length);
 
+/**
+ * \brief Position of field data in data record
+ */
+struct ipfix_field_position {
+	uint16_t offset; /**< Offset of field data (without length prefix) */
+	uint16_t length; /**< Length of field data */
+};
+
+/**
+ * \brief Data record with positions of all fields decoded in one pass
+ *
+ * Useful when many fields of a record with variable-length fields are
+ * read, the template is walked only once per record. The structure has to
+ * be zeroed before the first use and can be reused for any number of
+ * records; release it with data_record_decoder_clear().
+ */
+struct data_record_decoder {
+	uint8_t *record;                        /**< Decoded data record */
+	struct ipfix_template *templ;           /**< Template of the data record */
+	uint16_t length;                        /**< Length of the data record */
+	uint16_t capacity;                      /**< Number of allocated positions */
+	int decoded;                            /**< Positions are valid for the record */
+	struct ipfix_field_position *positions; /**< Positions of template fields */
+};
+
+/**
+ * \brief Decode positions of all fields of data record
+ *
+ * \param[in,out] dec Decoder
+ * \param[in] record Pointer to data record
+ * \param[in] templ Data record's template
+ * \return 0 on success, -1 on memory allocation error (the decoder still
+ * works, but each field is looked up by walking the template)
+ */
+API int data_record_decode(struct data_record_decoder *dec, uint8_t *record, struct ipfix_template *templ);
+
+/**
+ * \brief Get data from decoded record
+ *
+ * \param[in] dec Decoder
+ * \param[in] enterprise Enterprise number
+ * \param[in] id Field id
+ * \param[out] data_length Length of returned data
+ * \return Pointer to field
+ */
+API uint8_t *data_record_decoder_get_field(struct data_record_decoder *dec, uint32_t enterprise, uint16_t id, int *data_length);
+
+/**
+ * \brief Free memory of data record decoder
+ *
+ * \param[in] dec Decoder
+ */
+API void data_record_decoder_clear(struct data_record_decoder *dec);
+
 /**
  * \brief Set field value
  *
@@ -149,6 +149,7 @@ API void *profile_get_channel(void *profile, uint16_t index);
  * Each matching channel is stored into an array
  * Profiles are NOT stored (they're accessible by calling
  * channel_get_profile on matched channel)
+ * To match all records of a message use profile_match_message().
  *
  * \param[in] profile
  * \param[in] msg IPFIX message
@@ -157,6 +158,20 @@ API void *profile_get_channel(void *profile, uint16_t index);
  */
 API void **profile_match_data(void *profile, struct ipfix_message *msg, struct metadata *mdata);
 
+/**
+ * \brief Match profile with all data records of the message
+ *
+ * Same as calling profile_match_data() for each data record, but each
+ * filter is evaluated over the whole sequence of records, so fields are
+ * located once per template instead of once per record.
+ * Matching channels of each record are stored into its metadata
+ * (NULL when no channel matches).
+ *
+ * \param[in] profile
+ * \param[in,out] msg IPFIX message
+ */
+API void profile_match_message(void *profile, struct ipfix_message *msg);
+
 /**
  * \brief Get all profiles in the tree
  *
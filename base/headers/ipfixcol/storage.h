@@ -108,6 +108,10 @@ struct __attribute__((packed)) metadata {
 /**
  * \struct ipfix_message
  * \brief Structure covering main parts of the IPFIX packet by pointers into it.
+ *
+ * Lists of sets are sized according to the packet content and are stored in
+ * the same memory block as the structure itself, so the message must be
+ * created by message_create_from_mem() or message_create_sized().
  */
 struct __attribute__((__packed__)) ipfix_message {
 	/** IPFIX header*/
@@ -124,16 +128,19 @@ struct __attribute__((__packed__)) ipfix_message {
 	uint16_t                          templ_records_count;
 	/** Number of options template records in message */
 	uint16_t                          opt_templ_records_count;
-	/** List of Template Sets in the packet */
-	struct ipfix_template_set         *templ_set[MSG_MAX_TEMPL_SETS];
-	/** List of Options Template Sets in the packet */
-	struct ipfix_options_template_set *opt_templ_set[MSG_MAX_OTEMPL_SETS];
-	/** List of Data Sets (with a link to corresponding template) in the packet */
-	struct data_template_couple       data_couple[MSG_MAX_DATA_COUPLES];
+	/** NULL terminated list of Template Sets in the packet */
+	struct ipfix_template_set         **templ_set;
+	/** NULL terminated list of Options Template Sets in the packet */
+	struct ipfix_options_template_set **opt_templ_set;
+	/** List of Data Sets (with a link to corresponding template) in the packet,
+	 * terminated by a couple with NULL data_set */
+	struct data_template_couple       *data_couple;
 	/** Pointer to the live profile */
 	void *live_profile;
 	/** List of metadata structures */
 	struct metadata *metadata;
+	/** Message pool of the thread which created the message (internal) */
+	void *pool;
 };
 
 /**
@@ -169,6 +176,25 @@ API int storage_init (char *params, void **config);
 API int store_packet (void *config, const struct ipfix_message *ipfix_msg,
 		const struct ipfix_template_mgr *template_mgr);
 
+/**
+ * \brief Pass batch of IPFIX messages into the storage plugin (optional).
+ *
+ * If the plugin exports this function, it is called instead of store_packet()
+ * with all messages ready in the queue of the Data Manager, so that the plugin
+ * can amortize flushes and system calls over the batch. Messages are in the
+ * order of arrival.
+ *
+ * \param[in] config     Plugin-specific configuration data prepared by init
+ * function.
+ * \param[in] ipfix_msgs Array of IPFIX messages.
+ * \param[in] count      Number of messages in the array.
+ * \param[in] templates  The list of preprocessed templates for possible
+ * better/faster data processing.
+ * \return 0 on success, nonzero else.
+ */
+API int store_packets (void *config, const struct ipfix_message **ipfix_msgs, int count,
+		const struct ipfix_template_mgr *template_mgr);
+
 /**
  * \brief Announce willing to store currently processing data.
  *
@@ -103,6 +103,32 @@ struct ipfix_offsets {
 	int bytes;          /**< Size of field */
 };
 
+/**
+ * \brief Compiled description of one template field
+ */
+struct ipfix_template_field {
+	uint32_t enterprise; /**< Enterprise number (0 if not enterprise-specific) */
+	uint16_t id;         /**< Field ID without the enterprise bit */
+	uint16_t length;     /**< Field length (VAR_IE_LENGTH for variable-length field) */
+	int32_t offset;      /**< Offset in data record, -1 if it follows a variable-length field */
+	int32_t next;        /**< Index of the next field with the same ID, -1 if there is none */
+};
+
+/**
+ * \brief Compiled fields of template
+ *
+ * Created together with the template by the Template Manager. Gives the
+ * index of a field by (enterprise, ID) in constant time and static offsets
+ * of all fields preceding the first variable-length field.
+ */
+struct ipfix_template_map {
+	uint16_t field_count; /**< Number of fields */
+	uint16_t var_first;   /**< Index of the first variable-length field (field_count if none) */
+	uint16_t hash_mask;   /**< Size of hash table - 1 */
+	uint16_t *hash;       /**< Hash table, index of field + 1 (0 means empty slot) */
+	struct ipfix_template_field fields[]; /**< Fields in template order */
+};
+
 /**
  * \struct ipfix_template
  * \brief Structure for storing Template Record/Options Template Record
@@ -134,18 +160,30 @@ struct ipfix_template {
 	                              * length of the Data Record has to be
 	                              * calculated somehow else. For more information,
 	                              * see section 7 in RFC 5101. */
+	uint64_t serial;             /** Unique number of the template assigned by
+	                              * tm_create_template(). Never reused (unlike
+	                              * the address of the structure), so plugins
+	                              * can key their per-template caches on it. */
 	struct ipfix_offsets offsets[OF_COUNT]; /** Offsets of common elements    */
+	struct ipfix_template_map *map; /** Compiled fields, shares memory block with
+	                                 *  the template (NULL if not compiled) */
 	template_ie fields[1];       /** Template fields */
 };
 
 /**
  * \struct ipfix_template_mgr
  * \brief Template Manager structure.
+ *
+ * Records are stored in an open addressing hash table indexed by ODID and
+ * source CRC. Lookups (tm_get_template) are lock-free, modifications are
+ * serialized by tmr_lock and memory removed from the table is released
+ * only after all readers that could see it have left.
  */
 struct ipfix_template_mgr {
-	struct ipfix_template_mgr_record *first; /** list of template manager's record for each source */
-	struct ipfix_template_mgr_record *last;  /** last member of list */
-	pthread_mutex_t tmr_lock;
+	struct ipfix_template_mgr_table *table; /** hash table of template manager's records */
+	pthread_mutex_t tmr_lock;               /** serializes modifications */
+	uint32_t epoch;                         /** grace period counter */
+	uint32_t readers[2];                    /** number of lock-free readers in each grace period */
 };
 
 /**
@@ -158,18 +196,26 @@ struct ipfix_template_key {
 	uint32_t tid;	/** Template ID */
 };
 
+/** Number of templates in one page of the template index */
+#define TM_INDEX_PAGE_SIZE 256
+
+/** Number of pages of the template index (covers all 16b template IDs) */
+#define TM_INDEX_PAGES (65536 / TM_INDEX_PAGE_SIZE)
+
 /**
  * \struct ipfix_template_mgr_record
  * \brief Record of Template Manager's structure
+ *
+ * Templates are indexed directly by their ID. Pages of the index are
+ * allocated on first use, so a source with a few templates costs only
+ * one or two pages.
  */
 struct ipfix_template_mgr_record {
-	struct ipfix_template **templates;/**array of pointers to Templates */
-	uint16_t max_length;    /**< maximum length of array */
-	uint16_t counter;       /**< number of templates in array */
 	uint64_t key;           /**< unique identifier (combination of odid and crc from ipfix_template_key) */
 	uint16_t registrations; /**< Number of reservations (from sources) */
+	struct ipfix_template **index[TM_INDEX_PAGES]; /**< pages of templates indexed by template ID */
 
-	struct ipfix_template_mgr_record *next; /** pointer to next record in template manager's list */
+	struct ipfix_template_mgr_record *next; /** pointer to next record in list of removed records */
 };
 
 /**
@@ -333,6 +379,16 @@ API int template_get_field_offset(struct ipfix_template *templ, uint16_t eid, ui
  */
 API int template_get_field_length(struct ipfix_template *templ, uint16_t eid, uint16_t fid);
 
+/**
+ * \brief Find field in compiled template
+ *
+ * \param[in] map Compiled template fields (ipfix_template.map)
+ * \param[in] enterprise Enterprise number
+ * \param[in] id Field ID
+ * \return Index of the first field with given ID, -1 if not found
+ */
+API int template_map_find(const struct ipfix_template_map *map, uint32_t enterprise, uint16_t id);
+
 /**
  * \brief Increment number of references to template
  *
@@ -361,6 +361,11 @@ int config_add_input(configurator *config, struct plugin_config *plugin, int ind
 		goto err;
 	}
 
+	/* Receiver threads and statistics are optional */
+	config->input.start = dlsym(config->input.dll_handler, "input_start");
+	config->input.stop = dlsym(config->input.dll_handler, "input_stop");
+	config->input.stats = dlsym(config->input.dll_handler, "input_stats");
+
 	/* Extend the process name variable by input name */
 	snprintf(config->process_name, 16, "%s:%s", PACKAGE, plugin->conf.name);
 
@@ -438,6 +443,9 @@ int config_add_inter(configurator *config, struct plugin_config *plugin, int ind
 		goto err;
 	}
 	
+	/* Batch API is optional */
+	im_plugin->intermediate_process_messages = dlsym(im_plugin->dll_handler, "intermediate_process_messages");
+
 	im_plugin->intermediate_init = dlsym(im_plugin->dll_handler, "intermediate_init");
 	if (im_plugin->intermediate_init == NULL) {
 		MSG_ERROR(msg_module, "Unable to load intermediate xml_conf (%s)", dlerror());
@@ -562,6 +570,9 @@ int config_add_storage(configurator *config, struct plugin_config *plugin, int i
 		goto err;
 	}
 	
+	/* Batch API is optional */
+	st_plugin->store_batch = dlsym(st_plugin->dll_handler, "store_packets");
+
 	st_plugin->store_now = dlsym(st_plugin->dll_handler, "store_now");
 	if (!st_plugin->store_now) {
 		MSG_ERROR(msg_module, "[%d] Unable to load storage xml_conf (%s)", config->proc_id, dlerror());
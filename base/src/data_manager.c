@@ -90,6 +90,39 @@ static inline void data_manager_free (struct data_manager_config* config)
 	}
 }
 
+/** Release flags of messages read by storage plugin thread */
+enum release_flag {
+	RELEASE_NONE,   /**< Message is not referenced by this thread */
+	RELEASE_KEEP,   /**< Remove reference, but do not free the message */
+	RELEASE_FREE    /**< Remove reference and free the message */
+};
+
+/**
+ * \brief Remove references on processed messages
+ *
+ * Messages with the same release flag on consecutive positions are removed
+ * at once.
+ *
+ * \param[in] queue Ring buffer
+ * \param[in] index Index of the first message
+ * \param[in] release Release flags
+ * \param[in] count Number of messages
+ */
+static void storage_release_batch(struct ring_buffer *queue, unsigned int index,
+		const uint8_t *release, unsigned int count)
+{
+	unsigned int start, i = 0;
+
+	while (i < count) {
+		for (start = i; i < count && release[i] == release[start]; ++i) {}
+
+		if (release[start] != RELEASE_NONE) {
+			rbuffer_remove_references(queue, (index + start) % queue->size, i - start,
+					release[start] == RELEASE_FREE);
+		}
+	}
+}
+
 /**
  * \brief Thread for storage plugin
  */
@@ -97,8 +130,12 @@ static void* storage_plugin_thread(void *cfg)
 {
     struct storage *config = (struct storage*) cfg; 
 	struct ipfix_message *msg, *starting_msg = NULL;
+	struct ipfix_message *batch[RBUFFER_BATCH_SIZE];
+	const struct ipfix_message *data[RBUFFER_BATCH_SIZE];
+	uint8_t release[RBUFFER_BATCH_SIZE];
 	int can_read = 0, stop = 0;
-	unsigned int index = config->thread_config->queue->read_offset;
+	unsigned int i, count, data_count;
+	unsigned int index = rbuffer_read_offset(config->thread_config->queue);
 
 	/* set the thread name to reflect the configuration */
 	prctl(PR_SET_NAME, config->thread_name, 0, 0, 0);
@@ -106,41 +143,63 @@ static void* storage_plugin_thread(void *cfg)
     /* loop will break upon receiving NULL from buffer */
 	while (!stop) {
 		/* get next data */
-		msg = rbuffer_read(config->thread_config->queue, &index);
-		if (msg == NULL) {
+		count = rbuffer_read_batch(config->thread_config->queue, &index, batch, RBUFFER_BATCH_SIZE);
+		if (batch[0] == NULL) {
 			MSG_INFO("storage plugin thread", "[%u] No more data from Data Manager", config->odid);
             break;
 		}
 		
-		/* Decode message type */
-		switch (msg->plugin_status) {
-		case PLUGIN_STOP: /* Stop working */
-			if (msg->plugin_id == config->id) {
-				stop = 1;
-			}
-			rbuffer_remove_reference(config->thread_config->queue, index, 1);
-			break;
-		case PLUGIN_START: /* Start reading */
-			if (msg->plugin_id == config->id) {
-				can_read = 1;
-				if (starting_msg) {
-					free(starting_msg);
+		data_count = 0;
+		for (i = 0; i < count && !stop; ++i) {
+			msg = batch[i];
+			release[i] = RELEASE_NONE;
+
+			/* Decode message type */
+			switch (msg->plugin_status) {
+			case PLUGIN_STOP: /* Stop working */
+				if (msg->plugin_id == config->id) {
+					stop = 1;
 				}
+				release[i] = RELEASE_FREE;
+				break;
+			case PLUGIN_START: /* Start reading */
+				if (msg->plugin_id == config->id) {
+					can_read = 1;
+					if (starting_msg) {
+						free(starting_msg);
+					}
 
-				starting_msg = msg;
-				rbuffer_remove_reference(config->thread_config->queue, index, 0);
+					starting_msg = msg;
+					release[i] = RELEASE_KEEP;
+				}
+				break;
+			default: /* DATA */
+				if (can_read) {
+					data[data_count++] = msg;
+					release[i] = RELEASE_FREE;
+				}
+				break;
 			}
-			break;
-		default: /* DATA */
-			if (can_read) {
-				config->store(config->config, msg, config->thread_config->template_mgr);
-				rbuffer_remove_reference(config->thread_config->queue, index, 1);
+		}
+
+		/* Messages after STOP are not processed */
+		count = i;
+
+		/* Store data */
+		if (data_count > 0) {
+			if (config->store_batch) {
+				config->store_batch(config->config, data, data_count, config->thread_config->template_mgr);
+			} else {
+				for (i = 0; i < data_count; ++i) {
+					config->store(config->config, data[i], config->thread_config->template_mgr);
+				}
 			}
-			break;
 		}
 
+		storage_release_batch(config->thread_config->queue, index, release, count);
+
 		/* move the index */
-		index = (index + 1) % config->thread_config->queue->size;
+		index = (index + count) % config->thread_config->queue->size;
 	}
 
 	if (starting_msg) {
@@ -220,7 +279,11 @@ int data_manager_add_plugin(struct data_manager_config *config, struct storage *
 	}
 	
 	/* Create START message */
-	struct ipfix_message *msg = calloc(1, sizeof(struct ipfix_message));
+	struct ipfix_message *msg = message_create_sized(0, 0, 0);
+	if (!msg) {
+		return 0;
+	}
+
 	msg->plugin_status = PLUGIN_START;
 	msg->plugin_id = plugin->id;
 
@@ -251,7 +314,11 @@ int data_manager_remove_plugin(struct data_manager_config* config, int id)
 	
 	if (plugin) {
 		/* Create STOP message */
-		struct ipfix_message *msg = calloc(1, sizeof(struct ipfix_message));
+		struct ipfix_message *msg = message_create_sized(0, 0, 0);
+		if (!msg) {
+			return 1;
+		}
+
 		msg->plugin_status = PLUGIN_STOP;
 		msg->plugin_id = plugin->id;
 		
@@ -62,6 +62,9 @@
 #include <libxml/tree.h>
 #include <time.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
 
 #include <ipfixcol.h>
 #include "convert.h"
@@ -74,7 +77,6 @@
 #	define DEFAULT_SERVER_CERT_FILE "/etc/ssl/certs/collector.crt"
 #	define DEFAULT_SERVER_PKEY_FILE "/etc/ssl/private/collector.key"
 #	define DEFAULT_CA_FILE          "/etc/ssl/private/ca.crt"
-#	define DEFAULT_SIZE_SSL_LIST 100
 #endif
 
 /* API version constant */
@@ -86,8 +88,12 @@ IPFIXCOL_API_VERSION;
 #define DEFAULT_PORT "4739"
 /* backlog for tcp connections */
 #define BACKLOG SOMAXCONN
-/* initial size of array of socket addresses */
-#define ADDR_ARRAY_INITIAL_SIZE 50
+/* maximal number of events returned by one epoll_wait() call */
+#define TCP_MAX_EVENTS 64
+/* number of messages read from one connection before serving the others */
+#define TCP_READ_BATCH 16
+/* timeout of epoll_wait() in reader threads (ms); readers check the stop flag after it */
+#define TCP_READER_TIMEOUT 100
 
 /** Identifier to MSG_* macros */
 static char *msg_module = "TCP input";
@@ -101,19 +107,14 @@ static char *msg_module = "TCP input";
  * structure is filled during init and used to initialize new input info
  * structures for new connections.
  *
- * When connection is accepted, new input_info_list
- * is created and added to global list. This input info does not have ODID filled yet.
- * After data is received for this input info (based on source address and port),
- * ODID is filled in. Any other ODID from this source will create new input info as
- * a copy of the existing one with new ODID and zeroed counters.
- *
- * When input is closed, one of the input infos is selected and returned together
- * with INPUT_CLOSED code. Others for the same source have their status changed to CLOSED
- * and are returned in subsequent calls to get_packet.
- *
- * When input is closed without any data being received, it is not reported to
- * the rest of the collector, but it is silently discarded.
+ * Each connection has its own list of input infos, one for each ODID received
+ * over the connection. Input info is created together with the first message
+ * of the ODID, so connections closed without any data being received are not
+ * reported to the rest of the collector.
  *
+ * When connection is closed, all its input infos are reported to the collector
+ * with INPUT_CLOSED code (one per call of get_packet) and moved to the list
+ * of used input infos, which are freed when the plugin is closed.
  */
 struct input_info_list {
 	struct input_info_network info;
@@ -124,6 +125,57 @@ struct input_info_list {
 #endif
 };
 
+struct tcp_reader;
+
+/**
+ * \struct tcp_connection
+ * \brief  Connection of one exporter
+ *
+ * Data are read from non-blocking socket into the reassembly buffer until
+ * whole IPFIX message is available, so partial messages never block the
+ * reader. Buffer holding exactly one message is passed to the collector
+ * without copying.
+ */
+struct tcp_connection {
+	int socket; /**< connection socket */
+	struct sockaddr_in6 address; /**< address of the exporter */
+	struct tcp_reader *reader; /**< reader the connection is assigned to */
+	struct input_info_list *info_list; /**< input infos of the connection (one per ODID) */
+	char *buffer; /**< reassembly buffer */
+	uint32_t start; /**< offset of the first unprocessed byte in the buffer */
+	uint32_t length; /**< offset of the end of received data in the buffer */
+	uint32_t capacity; /**< size of the buffer */
+	int ready; /**< connection is in the ready list of the reader */
+	struct tcp_connection *ready_next; /**< next connection in the ready list */
+	struct tcp_connection *prev; /**< previous connection of the reader */
+	struct tcp_connection *next; /**< next connection of the reader */
+#ifdef TLS_SUPPORT
+	SSL *ssl; /**< TLS connection */
+	X509 *peer_cert; /**< certificate of the exporter */
+#endif
+};
+
+/**
+ * \struct tcp_reader
+ * \brief  Reader of a group of connections
+ *
+ * Each reader waits for its connections with its own edge-triggered epoll
+ * instance. Connections with (possibly) more data to read are kept in the
+ * ready list and served in round-robin order, so a busy exporter cannot stall
+ * the others.
+ */
+struct tcp_reader {
+	int epoll_fd; /**< epoll instance of the reader */
+	pthread_t thread; /**< reader thread (when running in threads) */
+	int id; /**< index of the reader */
+	struct plugin_conf *conf; /**< plugin configuration */
+	pthread_mutex_t lock; /**< protects the list of connections */
+	struct tcp_connection *connections; /**< connections of the reader */
+	struct tcp_connection *ready_head; /**< first connection with data to read */
+	struct tcp_connection *ready_tail; /**< last connection with data to read */
+	int polls_skipped; /**< messages read since the last check for new events */
+};
+
 /**
  * \struct plugin_conf
  * \brief  Plugin configuration structure passed by the collector
@@ -131,47 +183,37 @@ struct input_info_list {
 struct plugin_conf {
 	int socket; /**< listening socket */
 	struct input_info_network info; /**< basic information structure */
-	fd_set master; /**< set of all active sockets */
-	int fd_max; /**< max file descriptor number */
-	struct sockaddr_in6 **sock_addresses; /*< array of addresses indexed by sockets */
-	uint16_t sock_addresses_max;
-	struct input_info_list *info_list; /**< list of information structures
-										* passed to collector */
+	struct tcp_reader *readers; /**< readers of the connections */
+	int readers_count; /**< number of readers */
+	int workers; /**< readers run in their own threads */
+	unsigned int next_reader; /**< reader of the next accepted connection */
+	input_callback callback; /**< passes data read by reader threads to the collector */
+	int running; /**< reader threads are running */
+	int stop; /**< reader threads should stop */
+	pthread_mutex_t info_lock; /**< protects the lists of closed and used input infos */
+	struct input_info_list *closed_info_list; /**< input infos of closed connections to be reported */
 	struct input_info_list *used_info_list; /**< list of old input infos to be deleted */
-	int info_to_remove; /**< Number of closed input info structures */
 #ifdef TLS_SUPPORT
 	uint8_t tls;                  /**< TLS enabled? 0 = no, 1 = yes */
 	SSL_CTX *ctx;                 /**< CTX structure */
-	SSL **ssl_list;               /**< list of all SSL structures */
-	uint16_t ssl_list_size;       /**< number of SSL structures in the list */
 	char *ca_cert_file;           /**< CA certificate in PEM format */
 	char *server_cert_file;       /**< server's certifikate in PEM format */
 	char *server_pkey_file;       /**< server's private key */
 #endif
 };
 
-#ifdef TLS_SUPPORT
-/* auxiliary structure for error handling */
-struct cleanup {
-	struct sockaddr_in6 *address;
-	SSL *ssl;
-	X509 *peer_cert;
-} maid;
-#endif
-
-pthread_mutex_t mutex;
 pthread_t listen_thread;
 
 /**
- * \brief Free address variable on input_listen exit
+ * \brief Free connection on input_listen exit
  *
- * \param[in] address Address to free on exit
+ * \param[in] conn Connection to free on exit
  * \return void
  */
-void input_listen_cleanup(void *address)
+void input_listen_cleanup(void *conn)
 {
-	if (address != NULL) {
-		free(address);
+	if (conn != NULL) {
+		free(conn);
 	}
 }
 
@@ -179,142 +221,111 @@ void input_listen_cleanup(void *address)
 /**
  * \brief Free TLS related things when TLS connection fails from some reason
  *
- * \param[in] config  plugin configuration structure
- * \param[in] maid  structure containing all pointers to free
+ * \param[in] conn connection being accepted
  * \return  nothing
  */
-void input_listen_tls_cleanup(void *config, struct cleanup *maid)
+void input_listen_tls_cleanup(struct tcp_connection *conn)
 {
-	struct plugin_conf *conf;
-	int fd;
 	int ret;
 
-	conf = (struct plugin_conf *) config;
-
-	/* TLS enabled? */
-	if (conf->tls) {
-		if (maid->address != NULL) {
-			free(maid->address);
-		}
-
-		if (maid->ssl != NULL) {
-			fd = SSL_get_fd(maid->ssl);
-			if (fd >=0) {
-				/* TLS shutdown */
-				ret = SSL_shutdown(maid->ssl);
-				if (ret == -1) {
-					MSG_WARNING(msg_module, "Error during TLS connection teardown");
-				}
+	if (conn->ssl != NULL) {
+		if (SSL_get_fd(conn->ssl) >= 0) {
+			/* TLS shutdown */
+			ret = SSL_shutdown(conn->ssl);
+			if (ret == -1) {
+				MSG_WARNING(msg_module, "Error during TLS connection teardown");
 			}
-			SSL_free(maid->ssl);
-		}
-
-		if (maid->peer_cert != NULL) {
-			X509_free(maid->peer_cert);
 		}
+		SSL_free(conn->ssl);
+		conn->ssl = NULL;
 	}
-}
-#endif
 
-/**
- * \brief Resizes socket addresses storage
- * \param conf plugin configuration
- * \return true on success
- */
-bool enlarge_sock_addresses(struct plugin_conf *conf)
-{
-	uint16_t old_max = conf->sock_addresses_max;
-	conf->sock_addresses_max += ADDR_ARRAY_INITIAL_SIZE;
-
-	struct sockaddr_in6 **new_addresses = realloc(conf->sock_addresses, conf->sock_addresses_max * sizeof(void*));
-	if (new_addresses == NULL) {
-		MSG_ERROR(msg_module, "Cannot allocate memory: %s", strerror(errno));
-		conf->sock_addresses_max = old_max;
-		return false;
+	if (conn->peer_cert != NULL) {
+		X509_free(conn->peer_cert);
+		conn->peer_cert = NULL;
 	}
 
-	// Initializes newly allocated memory
-	conf->sock_addresses = new_addresses;
-	memset(&(conf->sock_addresses[old_max]), 0, ADDR_ARRAY_INITIAL_SIZE * sizeof(void*));
-
-	return true;
+	close(conn->socket);
 }
 
 /**
- * \brief Stores socket address and resizes array if needed
- * \param conf plugin configuration
- * \param address socket address
- * \param position socket address position (socket file descriptor)
- * \return true on success
+ * \brief Establish TLS connection with the exporter
+ *
+ * The handshake is performed on the blocking socket.
+ *
+ * \param[in] conf plugin configuration structure
+ * \param[in,out] conn accepted connection
+ * \return 0 on success, nonzero when the connection was closed
  */
-bool add_sock_address(struct plugin_conf *conf, struct sockaddr_in6 *address, uint16_t position)
+int input_listen_tls_accept(struct plugin_conf *conf, struct tcp_connection *conn)
 {
-	if (position >= conf->sock_addresses_max) {
-		if (!enlarge_sock_addresses(conf)) {
-			return false;
-		}
+	int ret;
+
+	/* create a new SSL structure for the connection */
+	conn->ssl = SSL_new(conf->ctx);
+	if (!conn->ssl) {
+		MSG_ERROR(msg_module, "Unable to create SSL structure");
+		ERR_print_errors_fp(stderr);
+		/* cleanup */
+		input_listen_tls_cleanup(conn);
+		return 1;
 	}
 
-	conf->sock_addresses[position] = address;
-	return true;
-}
+	/* connect the SSL object with the socket */
+	ret = SSL_set_fd(conn->ssl, conn->socket);
+	if (ret != 1) {
+		MSG_ERROR(msg_module, "Unable to connect the SSL object with the socket");
+		ERR_print_errors_fp(stderr);
+		/* cleanup */
+		input_listen_tls_cleanup(conn);
+		return 1;
+	}
 
-/**
- * \brief Removes socket address and frees memory
- * \param conf plugin configuration
- * \param position address position (socket file descriptor)
- */
-void remove_sock_address(struct plugin_conf *conf, uint16_t position)
-{
-	if (conf->sock_addresses[position] != NULL) {
-		free(conf->sock_addresses[position]);
-		conf->sock_addresses[position] = NULL;
+	/* TLS handshake */
+	ret = SSL_accept(conn->ssl);
+	if (ret != 1) {
+		/* handshake wasn't successful */
+		MSG_ERROR(msg_module, "TLS handshake was not successful");
+		ERR_print_errors_fp(stderr);
+		/* cleanup */
+		input_listen_tls_cleanup(conn);
+		return 1;
 	}
-}
 
-/**
- * \brief Removes all addresses and destroys storage
- * \param conf plugin configuration
- */
-void destroy_sock_addresses(struct plugin_conf *conf)
-{
-	if (conf->sock_addresses == NULL) {
-		return;
+	/* obtain peer's certificate */
+	conn->peer_cert = SSL_get_peer_certificate(conn->ssl);
+	if (!conn->peer_cert) {
+		MSG_ERROR(msg_module, "No certificate was presented by the peer");
+		/* cleanup */
+		input_listen_tls_cleanup(conn);
+		return 1;
 	}
 
-	for (int i = 0; i < conf->sock_addresses_max; ++i) {
-		if (conf->sock_addresses[i] != NULL) {
-			free(conf->sock_addresses[i]);
-		}
+	/* verify peer's certificate */
+	if (SSL_get_verify_result(conn->ssl) != X509_V_OK) {
+		MSG_ERROR(msg_module, "Client sent bad certificate; verification failed");
+		/* cleanup */
+		input_listen_tls_cleanup(conn);
+		return 1;
 	}
 
-	free(conf->sock_addresses);
-	conf->sock_addresses = NULL;
+	return 0;
 }
+#endif
 
 /**
- * \brief Creates input info list strucutre based on an existing input_info
+ * \brief Creates input info for new ODID of the connection
  *
- * Adds new input_info_list to the list held in plugin configuration
- * Address or src_info argument should be used to set source address
+ * Adds new input_info_list to the list of the connection
  *
  * \param conf Plugin configuration
- * \param src_info Input info to use as source for the new one. Use info from conf if NULL
- * \param address Address structure to use for input_info. Can be NULL
+ * \param conn Connection
+ * \param odid Observation Domain ID
  * \return New input_info_list structure
  */
-struct input_info_list *create_input_info(struct plugin_conf *conf,
-	struct input_info_list *src_info, struct sockaddr_in6 *address)
+struct input_info_list *create_input_info(struct plugin_conf *conf, struct tcp_connection *conn, uint32_t odid)
 {
 	struct input_info_list *input_info = NULL;
-	struct input_info_network *src_info_net = NULL;
-
-	/* Use default info (new connection) or given info to create new one */
-	if (src_info == NULL) {
-		src_info_net = &conf->info;
-	} else {
-		src_info_net = &src_info->info;
-	}
 
 	/* Create new input_info for this connection */
 	input_info = calloc(1, sizeof(struct input_info_list));
@@ -323,84 +334,118 @@ struct input_info_list *create_input_info(struct plugin_conf *conf,
 		return NULL;
 	}
 
-	memcpy(&input_info->info, src_info_net, sizeof(struct input_info_network));
+	memcpy(&input_info->info, &conf->info, sizeof(struct input_info_network));
 
 	/* Set status to new connection */
 	input_info->info.status = SOURCE_STATUS_NEW;
+	input_info->info.odid = odid;
 
 	/* Reset counters */
 	input_info->info.sequence_number = 0;
 	input_info->info.packets = 0;
 	input_info->info.data_records = 0;
 
-	/* Add to list */
-	input_info->next = conf->info_list;
-	conf->info_list = input_info;
-
-	/* When no address is given, do not setup address and ports */
-	if (address == NULL) {
-		return input_info;
-	}
-
 	/* Copy address and port */
-	if (address->sin6_family == AF_INET) {
+	if (conn->address.sin6_family == AF_INET) {
 		/* Copy src IPv4 address */
 		input_info->info.src_addr.ipv4.s_addr =
-				((struct sockaddr_in*) address)->sin_addr.s_addr;
+				((struct sockaddr_in*) &conn->address)->sin_addr.s_addr;
 		/* Copy port */
-		input_info->info.src_port = ntohs(((struct sockaddr_in*)  address)->sin_port);
+		input_info->info.src_port = ntohs(((struct sockaddr_in*) &conn->address)->sin_port);
 	} else {
 		/* Copy src IPv6 address */
 		int i;
 		for (i = 0; i < 4; i++) {
-			input_info->info.src_addr.ipv6.s6_addr32[i] = address->sin6_addr.s6_addr32[i];
+			input_info->info.src_addr.ipv6.s6_addr32[i] = conn->address.sin6_addr.s6_addr32[i];
 		}
 
 		/* Copy port */
-		input_info->info.src_port = ntohs(address->sin6_port);
+		input_info->info.src_port = ntohs(conn->address.sin6_port);
 	}
 
+#ifdef TLS_SUPPORT
+	/* fill in certificates */
+	input_info->collector_cert = conf->server_cert_file;
+	input_info->exporter_cert = conn->peer_cert;
+#endif
+
+	/* Add to list */
+	input_info->next = conn->info_list;
+	conn->info_list = input_info;
+
 	return input_info;
 }
 
 /**
- * \brief Removes given input info from global list
+ * \brief Add connection to the end of the ready list of its reader
  *
- * \param conf Plugin configuration
- * \param info Input info list structure to be removed
- * \param delete Add to list of infos to be deleted later (inform collector)
+ * \param[in] reader reader of the connection
+ * \param[in] conn connection
  */
-void remove_input_info(struct plugin_conf *conf, struct input_info_list *info, int delete)
+static void reader_ready_push(struct tcp_reader *reader, struct tcp_connection *conn)
 {
-	struct input_info_list *info_list = NULL, *info_list_prev = NULL;
+	if (conn->ready) {
+		return;
+	}
 
-	for (info_list = conf->info_list; info_list != NULL; info_list = info_list->next) {
-		if (info_list == info) {
-			if (info_list_prev) {
-				/* Removing ith element from list, i>1 */
-				info_list_prev->next = info->next;
-			} else {
-				/* Removing the first element from list */
-				conf->info_list = info->next;
-			}
+	conn->ready = 1;
+	conn->ready_next = NULL;
+	if (reader->ready_tail) {
+		reader->ready_tail->ready_next = conn;
+	} else {
+		reader->ready_head = conn;
+	}
+	reader->ready_tail = conn;
+}
 
-			/* Add to list of input_infos to be deleted */
-			if (delete) {
-				info->next = conf->used_info_list;
-				conf->used_info_list = info;
-			}
-			break;
+/**
+ * \brief Take the first connection from the ready list of the reader
+ *
+ * \param[in] reader reader
+ * \return connection or NULL when the list is empty
+ */
+static struct tcp_connection *reader_ready_pop(struct tcp_reader *reader)
+{
+	struct tcp_connection *conn = reader->ready_head;
+
+	if (conn) {
+		reader->ready_head = conn->ready_next;
+		if (!reader->ready_head) {
+			reader->ready_tail = NULL;
 		}
+		conn->ready = 0;
+	}
 
-		/* Remember previous element */
-		info_list_prev = info_list;
+	return conn;
+}
+
+/**
+ * \brief Wait for events on connections of the reader
+ *
+ * Connections with events are added to the ready list.
+ *
+ * \param[in] reader reader
+ * \param[in] timeout timeout in milliseconds
+ * \return number of events, -1 on error (errno is set)
+ */
+static int reader_poll(struct tcp_reader *reader, int timeout)
+{
+	struct epoll_event events[TCP_MAX_EVENTS];
+	int i, count;
+
+	count = epoll_wait(reader->epoll_fd, events, TCP_MAX_EVENTS, timeout);
+	for (i = 0; i < count; i++) {
+		reader_ready_push(reader, (struct tcp_connection *) events[i].data.ptr);
 	}
+
+	reader->polls_skipped = 0;
+	return count;
 }
 
 /**
  * \brief Function that listens for new connections
  *
- * Runs in a thread and adds new connections to plugin_conf->master set
+ * Runs in a thread and assigns new connections to the readers
  *
  * \param[in, out] config Plugin configuration structure
  * \return NULL always
@@ -408,152 +453,77 @@ void remove_input_info(struct plugin_conf *conf, struct input_info_list *info, i
 void *input_listen(void *config)
 {
 	struct plugin_conf *conf = (struct plugin_conf *) config;
-	int new_sock;
-	/* use IPv6 sockaddr structure to store address information (IPv4 fits easily) */
-	struct sockaddr_in6 *address = NULL;
+	struct tcp_connection *conn = NULL;
+	struct tcp_reader *reader;
+	struct epoll_event event;
 	socklen_t addr_length;
 	char src_addr[INET6_ADDRSTRLEN];
-	struct input_info_list *input_info;
-#ifdef TLS_SUPPORT
-	int ret;
-	int i;
-	SSL *ssl = NULL;           /* structure for TLS connection */
-	X509 *peer_cert = NULL;    /* peer's certificate */
-	struct cleanup maid;       /* auxiliary struct for TLS error handling */
-#endif
+	int accepted;
 
 	/* loop ends when thread is cancelled by pthread_cancel() function */
 	while (1) {
-		/* allocate space for the address */
-		addr_length = sizeof(struct sockaddr_in6);
-		address = malloc(addr_length);
-		if (!address) {
+		/* allocate new connection */
+		conn = calloc(1, sizeof(struct tcp_connection));
+		if (!conn) {
 			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 			break;
 		}
 
-		/* ensure that address will be freed when thread is canceled */
-		pthread_cleanup_push(input_listen_cleanup, (void *) address);
+		/* ensure that connection will be freed when thread is canceled */
+		pthread_cleanup_push(input_listen_cleanup, (void *) conn);
+		accepted = 1;
 
-		if ((new_sock = accept(conf->socket, (struct sockaddr*) address, &addr_length)) == -1) {
+		addr_length = sizeof(struct sockaddr_in6);
+		if ((conn->socket = accept(conf->socket, (struct sockaddr*) &conn->address, &addr_length)) == -1) {
 			MSG_ERROR(msg_module, "Cannot accept new socket: %s", strerror(errno));
 			/* exit and call cleanup */
 			pthread_exit(0);
 		}
 #ifdef TLS_SUPPORT
-		/* preparation for TLS error handling */
-		maid.address = address;
-		maid.ssl = NULL;
-		maid.peer_cert = NULL;
-
-		if (conf->tls) {
-			/* create a new SSL structure for the connection */
-			ssl = SSL_new(conf->ctx);
-			if (!ssl) {
-				MSG_ERROR(msg_module, "Unable to create SSL structure");
-				ERR_print_errors_fp(stderr);
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
-			}
-			maid.ssl = ssl;
-
-			/* connect the SSL object with the socket */
-			ret = SSL_set_fd(ssl, new_sock);
-			if (ret != 1) {
-				MSG_ERROR(msg_module, "Unable to connect the SSL object with the socket");
-				ERR_print_errors_fp(stderr);
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
+		if (conf->tls && input_listen_tls_accept(conf, conn) != 0) {
+			/* connection closed; the cleanup handler frees it */
+			accepted = 0;
+		}
+#endif
+		if (accepted) {
+			/* data are read without blocking */
+			if (fcntl(conn->socket, F_SETFL, fcntl(conn->socket, F_GETFL, 0) | O_NONBLOCK) == -1) {
+				MSG_WARNING(msg_module, "Cannot switch socket to non-blocking mode: %s", strerror(errno));
 			}
 
-			/* TLS handshake */
-			ret = SSL_accept(ssl);
-			if (ret != 1) {
-				/* handshake wasn't successful */
-				MSG_ERROR(msg_module, "TLS handshake was not successful");
-				ERR_print_errors_fp(stderr);
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
+			/* print info */
+			if (conf->info.l3_proto == 4) {
+				inet_ntop(AF_INET, (void *)&((struct sockaddr_in*) &conn->address)->sin_addr, src_addr, INET6_ADDRSTRLEN);
+			} else {
+				inet_ntop(AF_INET6, &conn->address.sin6_addr, src_addr, INET6_ADDRSTRLEN);
 			}
+			MSG_INFO(msg_module, "Exporter connected from address %s", src_addr);
 
-			/* obtain peer's certificate */
-			peer_cert = SSL_get_peer_certificate(ssl);
-			if (!peer_cert) {
-				MSG_ERROR(msg_module, "No certificate was presented by the peer");
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
-			}
-			maid.peer_cert = peer_cert;
-
-			/* verify peer's certificate */
-			if (SSL_get_verify_result(ssl) != X509_V_OK) {
-				MSG_ERROR(msg_module, "Client sent bad certificate; verification failed");
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
-			}
+			/* assign the connection to a reader */
+			reader = &conf->readers[conf->next_reader++ % conf->readers_count];
+			conn->reader = reader;
 
-			/* put new SSL structure into the conf->ssl_list */
-			for (i = 0; i < conf->ssl_list_size; i++) {
-				if (conf->ssl_list[i] == NULL) {
-					conf->ssl_list[i] = ssl;
-					break;
-				}
+			pthread_mutex_lock(&reader->lock);
+			conn->next = reader->connections;
+			if (reader->connections) {
+				reader->connections->prev = conn;
 			}
-
-			if (i == conf->ssl_list_size) {
-				/* limit reached. no space for new SSL structure */
-				MSG_WARNING(msg_module, "Reached limit on the number of TLS connections; tearing down this connection...");
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
+			reader->connections = conn;
+			pthread_mutex_unlock(&reader->lock);
+
+			/* start watching the connection; data already received trigger the first event */
+			event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+			event.data.ptr = conn;
+			if (epoll_ctl(reader->epoll_fd, EPOLL_CTL_ADD, conn->socket, &event) == -1) {
+				MSG_ERROR(msg_module, "Cannot watch new socket: %s", strerror(errno));
 			}
-		}
-#endif
-		pthread_mutex_lock(&mutex);
-		FD_SET(new_sock, &conf->master);
-
-		if (conf->fd_max < new_sock) {
-			conf->fd_max = new_sock;
-		}
 
-		/* copy socket address to config structure */
-		if (!add_sock_address(conf, address, new_sock)) {
-			MSG_ERROR(msg_module, "Cannot store another socket address");
-			break;
+			/* connection belongs to the reader now */
+			conn = NULL;
 		}
 
-		/* print info */
-		if (conf->info.l3_proto == 4) {
-			inet_ntop(AF_INET, (void *)&((struct sockaddr_in*) address)->sin_addr, src_addr, INET6_ADDRSTRLEN);
-		} else {
-			inet_ntop(AF_INET6, &address->sin6_addr, src_addr, INET6_ADDRSTRLEN);
-		}
-		MSG_INFO(msg_module, "Exporter connected from address %s", src_addr);
-
-		pthread_mutex_unlock(&mutex);
-
-		/* Create new input_info for this connection */
-		input_info = create_input_info(conf, NULL, address);
-		if (!input_info) {
-			/* Failed to create input info, listen for new connection */
-			break;
-		}
-
-#ifdef TLS_SUPPORT
-		/* fill in certificates */
-		input_info->collector_cert = conf->server_cert_file;
-		input_info->exporter_cert = peer_cert;
-#endif
-
-		/* unset the address so that we do not free it incidentally */
-		address = NULL;
-
-		pthread_cleanup_pop(0);
+		/* free the connection unless it has been passed to a reader */
+		pthread_cleanup_pop(conn != NULL);
 	}
 	return NULL;
 }
@@ -574,11 +544,11 @@ int input_init(char *params, void **config)
 	int ai_family = AF_INET6; /* IPv6 is default */
 	char dst_addr[INET6_ADDRSTRLEN];
 	int ret, ipv6_only = 0, retval = 0, yes = 1; /* yes is for setsockopt */
+	int i, workers = 0;
 	/* 1 when using default port - don't free memory */
 	int def_port = 0;
 #ifdef TLS_SUPPORT
 	SSL_CTX *ctx = NULL;       /* SSL context structure */
-	SSL **ssl_list = NULL;     /* list of SSL connection structures */
 	xmlNode *cur_node_parent;
 #endif
 
@@ -595,14 +565,7 @@ int input_init(char *params, void **config)
 		goto out;
 	}
 
-	if (!enlarge_sock_addresses(conf)) {
-		MSG_ERROR(msg_module, "Cannot initialize array for socket address");
-		retval = 1;
-		goto out;
-	}
-
-	/* empty the master set */
-	FD_ZERO(&conf->master);
+	pthread_mutex_init(&conf->info_lock, NULL);
 
 	/* parse xml string */
 	doc = xmlParseDoc(BAD_CAST params);
@@ -702,6 +665,9 @@ int input_init(char *params, void **config)
 				conf->info.template_life_packet = tmp_val;
 			} else if (xmlStrEqual(cur_node->name, BAD_CAST "optionsTemplateLifePacket")) {
 				conf->info.options_template_life_packet = tmp_val;
+			} else if (xmlStrEqual(cur_node->name, BAD_CAST "workers")) { /* number of reader threads */
+				workers = atoi(tmp_val);
+				free(tmp_val);
 			} else { /* unknown parameter, ignore */
 				/* Free the tmp_val for unknown elements */
 				free(tmp_val);
@@ -843,22 +809,36 @@ int input_init(char *params, void **config)
 		/* set peer certificate verification parameters */
 		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE, NULL);
 
-		ssl_list = (SSL **) malloc(sizeof(SSL *) * DEFAULT_SIZE_SSL_LIST);
-		if (ssl_list == NULL) {
-			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-			retval = 1;
-			goto out;
-		}
-		memset(ssl_list, 0, DEFAULT_SIZE_SSL_LIST * sizeof(SSL *));
+		/* non-blocking reads may be repeated with a different buffer */
+		SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
-		conf->ssl_list_size = DEFAULT_SIZE_SSL_LIST;
 		conf->ctx = ctx;
-		conf->ssl_list = ssl_list;
 	}
 #endif  /* TLS */
 
+	/* create readers; single reader is served by get_packet() */
+	conf->workers = (workers > 1);
+	conf->readers_count = conf->workers ? workers : 1;
+	conf->readers = calloc(conf->readers_count, sizeof(struct tcp_reader));
+	if (conf->readers == NULL) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		retval = 1;
+		goto out;
+	}
+
+	for (i = 0; i < conf->readers_count; i++) {
+		conf->readers[i].id = i;
+		conf->readers[i].conf = conf;
+		pthread_mutex_init(&conf->readers[i].lock, NULL);
+		conf->readers[i].epoll_fd = epoll_create1(0);
+		if (conf->readers[i].epoll_fd == -1) {
+			MSG_ERROR(msg_module, "Cannot create epoll instance: %s", strerror(errno));
+			retval = 1;
+			goto out;
+		}
+	}
+
 	/* fill in general information */
-	conf->info_to_remove = 0;
 	conf->info.type = SOURCE_TYPE_TCP;
 	conf->info.dst_port = atoi(port);
 	if (addrinfo->ai_family == AF_INET) { /* IPv4 */
@@ -891,6 +871,9 @@ int input_init(char *params, void **config)
 
 	/* print info */
 	MSG_INFO(msg_module, "Input plugin listening on %s, port %s", dst_addr, port);
+	if (conf->workers) {
+		MSG_INFO(msg_module, "Using %d reader threads", conf->readers_count);
+	}
 
 	/* start listening thread */
 	if (pthread_create(&listen_thread, NULL, &input_listen, (void *) conf) != 0) {
@@ -940,416 +923,609 @@ out:
 		if (conf->info.options_template_life_packet != NULL) {
 			free (conf->info.options_template_life_packet);
 		}
-		free(conf);
-
-	}
-
-#ifdef TLS_SUPPORT
-	/* error occurs, clean up */
-	if ((retval != 0) && (conf != NULL)) {
-		if (ssl_list) {
-			free(ssl_list);
+		if (conf->readers != NULL) {
+			for (i = 0; i < conf->readers_count && conf->readers[i].epoll_fd > 0; i++) {
+				close(conf->readers[i].epoll_fd);
+			}
+			free(conf->readers);
 		}
-
+		if (conf->socket > 0) {
+			close(conf->socket);
+		}
+#ifdef TLS_SUPPORT
 		if (ctx) {
 			SSL_CTX_free(ctx);
 		}
-	}
 #endif
+		free(conf);
+	}
 
 	return retval;
 }
 
+#ifdef TLS_SUPPORT
 /**
- * \brief Checks whether input_info matches the given address
- *
- * Compares L3 protocol, IP addresses and source port. ODID is not checked.
+ * \brief Wrapper function for SSL_read() function
  *
- * \param[in] info_list structure to compare
- * \param[in] address structure to compare
- * \return 0 if input_info matches the address, 1 otherwise
+ * The wrapper function prints error messages. The socket is non-blocking, so
+ * SSL_ERROR_WANT_READ/SSL_ERROR_WANT_WRITE just mean that there are no data to read.
+ * \param[in]  ssl TLS/SSL connection
+ * \param[in]  buf Buffer where to store loaded data
+ * \param[in]  num Number of bytes to read
+ * \param[out] err Error code from SSL_get_error (if NULL, no value is set)
+ * \return Same as SSL_read()
  */
-int compare_input_info(struct input_info_list *info_list, struct sockaddr_in6 *address)
+int wrapper_SSL_read(SSL *ssl, void *buf, int num, int *err)
 {
-	/* ports must match */
-	if (info_list->info.src_port == ntohs(((struct sockaddr_in*) address)->sin_port)) {
-		/* Compare addresses, dependent on IP protocol version*/
-		if (info_list->info.l3_proto == 4) {
-			if (info_list->info.src_addr.ipv4.s_addr == ((struct sockaddr_in*) address)->sin_addr.s_addr) {
-				return 0;
-			}
-		} else {
-			if (info_list->info.src_addr.ipv6.s6_addr32[0] == address->sin6_addr.s6_addr32[0] &&
-					info_list->info.src_addr.ipv6.s6_addr32[1] == address->sin6_addr.s6_addr32[1] &&
-					info_list->info.src_addr.ipv6.s6_addr32[2] == address->sin6_addr.s6_addr32[2] &&
-					info_list->info.src_addr.ipv6.s6_addr32[3] == address->sin6_addr.s6_addr32[3]) {
-				return 0;
-			}
+	// First, clear all current thread's errors, or SSL_get_error() will not work reliably
+	ERR_clear_error();
+	// Try to read the message
+	const int res = SSL_read(ssl, buf, num);
+	if (res > 0) {
+		// Success
+		if (err != NULL) {
+			*err = SSL_ERROR_NONE;
 		}
+		return res;
+	}
+
+	// Something bad happened
+	int ssl_err = SSL_get_error(ssl, res);
+	int errno_backup = errno; // Preserve errno!
+
+	switch (ssl_err) {
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		// No data available now
+		break;
+	case SSL_ERROR_ZERO_RETURN:
+		MSG_WARNING(msg_module, "SSL_read() failed: TLS/SSL connection closed!", '\0');
+		break;
+	case SSL_ERROR_SYSCALL:
+		MSG_WARNING(msg_module, "SSL_read() failed: non-recoverable I/O error", '\0');
+		break;
+	case SSL_ERROR_SSL:
+		MSG_WARNING(msg_module, "SSL_read() failed: SSL library failure", '\0');
+		break;
+	default:
+		MSG_WARNING(msg_module, "SSL_read() failed: unexpected return code '%d'", ssl_err);
+		break;
 	}
 
-	return 1;
+	// Failed!
+	if (err != NULL) {
+		*err = ssl_err;
+	}
+
+	errno = errno_backup;
+	return res;
 }
+#endif
+
+/** No complete message can be read from the connection now */
+#define TCP_AGAIN 0
+/** Connection was closed or has to be closed */
+#define TCP_CLOSED -1
 
-#ifdef TLS_SUPPORT
 /**
- * \brief Wrapper function for SSL_read() function
+ * \brief Receive available data into the reassembly buffer of the connection
  *
- * The wrapper function prints error messages and handles operation repeat in suitable situations.
- * \param[in]  ssl TLS/SSL connection
- * \param[in]  buf Buffer where to store loaded data
- * \param[in]  num Number of bytes to read
- * \param[out] err Error code from SSL_get_error (if NULL, no value is set)
- * \return Same as SSL_read()
+ * \param[in,out] conn connection
+ * \return number of received bytes, TCP_AGAIN when no data are available,
+ * TCP_CLOSED when connection was closed or failed
  */
-int wrapper_SSL_read(SSL *ssl, void *buf, int num, int *err)
+static int tcp_connection_receive(struct tcp_connection *conn)
 {
-	while (true) {
-		// First, clear all current thread's errors, or SSL_get_error() will not work reliably
-		ERR_clear_error();
-		// Try to read the message
-		const int res = SSL_read(ssl, buf, num);
-		if (res > 0) {
-			// Success
-			if (err != NULL) {
-				*err = SSL_ERROR_NONE;
-			}
-			return res;
+	ssize_t len;
+	size_t space = conn->capacity - conn->length;
+
+#ifdef TLS_SUPPORT
+	if (conn->ssl) {
+		int ssl_err;
+		len = wrapper_SSL_read(conn->ssl, conn->buffer + conn->length, space, &ssl_err);
+		if (len > 0) {
+			return len;
 		}
 
-		// Something bad happened
-		int ssl_err = SSL_get_error(ssl, res);
-		int errno_backup = errno; // Preserve errno!
-
-		switch (ssl_err) {
-		case SSL_ERROR_WANT_READ:
-		case SSL_ERROR_WANT_WRITE:
-			MSG_DEBUG(msg_module, "SSL_read() failed: WANT_READ/WANT_WRITE", '\0');
-			continue; // Try again...
-		case SSL_ERROR_ZERO_RETURN:
-			MSG_WARNING(msg_module, "SSL_read() failed: TLS/SSL connection closed!", '\0');
-			break;
-		case SSL_ERROR_SYSCALL:
-			MSG_WARNING(msg_module, "SSL_read() failed: non-recoverable I/O error", '\0');
-			break;
-		case SSL_ERROR_SSL:
-			MSG_WARNING(msg_module, "SSL_read() failed: SSL library failure", '\0');
-			break;
-		default:
-			MSG_WARNING(msg_module, "SSL_read() failed: unexpected return code '%d'", ssl_err);
-			break;
+		if (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) {
+			return TCP_AGAIN;
 		}
 
-		// Failed!
-		if (err != NULL) {
-			*err = ssl_err;
+		if (ssl_err == SSL_ERROR_SYSCALL && errno == EINTR) {
+			return TCP_AGAIN;
 		}
 
-		errno = errno_backup;
-		return res;
+		return TCP_CLOSED;
 	}
-}
 #endif
 
+	do {
+		len = recv(conn->socket, conn->buffer + conn->length, space, 0);
+	} while (len == -1 && errno == EINTR);
 
+	if (len > 0) {
+		return len;
+	} else if (len == 0) {
+		return TCP_CLOSED;
+	} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+		return TCP_AGAIN;
+	}
+
+	MSG_WARNING(msg_module, "Failed to receive IPFIX data: %s", strerror(errno));
+	return TCP_CLOSED;
+}
 
 /**
- * \brief Pass input data from the input plugin into the ipfixcol core.
+ * \brief Take the first complete message from the reassembly buffer
  *
- * IP addresses are passed as returned by recvfrom and getsockname,
- * ports are in host byte order
+ * When the buffer contains exactly one message, the buffer itself is passed
+ * out. Otherwise the message is copied so that the rest of the data can stay.
  *
- * \param[in] config  plugin_conf structure
- * \param[out] info   Information structure describing the source of the data.
- * \param[out] packet Flow information data in the form of IPFIX packet.
- * \param[out] source_status Status of source (new, opened, closed)
- * \return the length of packet on success, INPUT_CLOSE when some connection
- *  closed, INPUT_ERROR on error or INPUT_SIGINT when interrupted.
+ * \param[in,out] conn connection
+ * \param[out] packet IPFIX message
+ * \return length of the message, TCP_AGAIN when the message is not complete,
+ * TCP_CLOSED when the data are not valid
  */
-int get_packet(void *config, struct input_info **info, char **packet, int *source_status)
+static int tcp_connection_extract(struct tcp_connection *conn, char **packet)
 {
-	/* temporary socket set */
-	fd_set tmp_set;
-	ssize_t len = 0;
-	uint16_t max_msg_len = BUFF_LEN * sizeof(char);
+	struct ipfix_header *header;
+	uint32_t available = conn->length - conn->start;
 	uint16_t packet_len;
-	struct timeval tv;
-	char src_addr[INET6_ADDRSTRLEN];
-	struct sockaddr_in6 *address;
-	struct plugin_conf *conf = config;
-	int retval = 0, sock;
-	struct input_info_list *info_list, *tmp_list = NULL;
-#ifdef TLS_SUPPORT
-	int i;
-	SSL *ssl = NULL;        /* SSL structure for active socket */
-#endif
 
-	/* Handle closed connections first */
-	if (conf->info_to_remove > 0) {
-		/* Find first info to be removed and remove it */
-		for (info_list = conf->info_list; info_list != NULL; info_list = info_list->next) {
-			if (info_list->info.status == SOURCE_STATUS_CLOSED) {
-				*info = (struct input_info*) &info_list->info;
-				*source_status = SOURCE_STATUS_CLOSED;
-				remove_input_info(conf, info_list, 1);
-				return INPUT_CLOSED;
-			}
-		}
+	if (available < IPFIX_HEADER_LENGTH) {
+		return TCP_AGAIN;
+	}
 
-		/* One less info to be removed */
-		conf->info_to_remove--;
+	header = (struct ipfix_header *) (conn->buffer + conn->start);
+	if (ntohs(header->version) != IPFIX_VERSION) {
+		MSG_WARNING(msg_module, "Received invalid message: IPFIX version doesn't match; closing connection...");
+		return TCP_CLOSED;
 	}
 
-	/* allocate memory for packet, if needed */
+	packet_len = ntohs(header->length);
+	if (packet_len < IPFIX_HEADER_LENGTH) {
+		MSG_WARNING(msg_module, "Received invalid message: IPFIX length is too short; closing connection...");
+		return TCP_CLOSED;
+	}
+
+	if (available < packet_len) {
+		return TCP_AGAIN;
+	}
+
+	if (conn->start == 0 && available == packet_len) {
+		/* pass the whole buffer, a new one is allocated when data arrive */
+		*packet = conn->buffer;
+		conn->buffer = NULL;
+		conn->capacity = conn->length = 0;
+		return packet_len;
+	}
+
+	*packet = message_packet_alloc(packet_len);
 	if (*packet == NULL) {
-		*packet = malloc(max_msg_len);
-		if (*packet == NULL) {
-			MSG_ERROR(msg_module, "Cannot allocate memory for the packet, malloc failed: %s", strerror(errno));
-			return INPUT_ERROR;
-		}
+		return TCP_CLOSED;
 	}
 
-	/* wait until some socket is ready */
-	while (retval <= 0) {
-		/* copy all sockets from master to tmp_set */
-		FD_ZERO(&tmp_set);
-		pthread_mutex_lock(&mutex);
-		tmp_set = conf->master;
-		pthread_mutex_unlock(&mutex);
+	memcpy(*packet, conn->buffer + conn->start, packet_len);
+	conn->start += packet_len;
+	if (conn->start == conn->length) {
+		conn->start = conn->length = 0;
+	}
 
-		/* wait at most one second - give time to check for new sockets */
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
+	return packet_len;
+}
 
-		/* select active connections */
-		retval = select(conf->fd_max + 1, &tmp_set, NULL, NULL, &tv);
-		if (retval == -1) {
-			if (errno == EINTR) {
-				return INPUT_INTR;
+/**
+ * \brief Read next IPFIX message from the connection without blocking
+ *
+ * \param[in,out] conn connection
+ * \param[out] packet IPFIX message
+ * \return length of the message, TCP_AGAIN when no complete message is
+ * available, TCP_CLOSED when connection was closed or has to be closed
+ */
+static int tcp_connection_read(struct tcp_connection *conn, char **packet)
+{
+	int ret;
+	uint16_t packet_len;
+
+	while (1) {
+		ret = tcp_connection_extract(conn, packet);
+		if (ret != TCP_AGAIN) {
+			return ret;
+		}
+
+		/* make space for the rest of the message */
+		if (conn->buffer == NULL) {
+			conn->buffer = message_packet_alloc(BUFF_LEN);
+			if (conn->buffer == NULL) {
+				return TCP_CLOSED;
+			}
+			conn->capacity = BUFF_LEN;
+		} else if (conn->start > 0) {
+			memmove(conn->buffer, conn->buffer + conn->start, conn->length - conn->start);
+			conn->length -= conn->start;
+			conn->start = 0;
+		}
+
+		if (conn->length >= IPFIX_HEADER_LENGTH) {
+			packet_len = ntohs(((struct ipfix_header *) conn->buffer)->length);
+			if (packet_len > conn->capacity) {
+				char *new_buffer = realloc(conn->buffer, packet_len);
+				if (new_buffer == NULL) {
+					MSG_ERROR(msg_module, "Packet too big and realloc failed: %s", strerror(errno));
+					return TCP_CLOSED;
+				}
+
+				conn->buffer = new_buffer;
+				conn->capacity = packet_len;
+			}
+		}
+
+		ret = tcp_connection_receive(conn);
+		if (ret <= 0) {
+			if (ret == TCP_CLOSED && conn->length > conn->start) {
+				MSG_WARNING(msg_module, "Connection closed with incomplete IPFIX message");
 			}
-			MSG_WARNING(msg_module, "Failed to select active connection: %s", strerror(errno));
-			return INPUT_ERROR;
+			return ret;
 		}
+
+		conn->length += ret;
 	}
+}
 
-	/* find first socket that is ready */
-	for (sock=0; sock <= conf->fd_max; sock++) {
-		/* fetch first active connection */
-		if (FD_ISSET(sock, &tmp_set)) {
+/**
+ * \brief Get input info of the connection for given ODID
+ *
+ * \param[in] conf plugin configuration
+ * \param[in,out] conn connection
+ * \param[in] packet received IPFIX message
+ * \param[out] source_status status of the source
+ * \return input info or NULL when it cannot be created
+ */
+static struct input_info_list *tcp_connection_get_info(struct plugin_conf *conf, struct tcp_connection *conn,
+		char *packet, int *source_status)
+{
+	struct input_info_list *info_list;
+	uint32_t odid = ntohl(((struct ipfix_header *) packet)->observation_domain_id);
+
+	for (info_list = conn->info_list; info_list != NULL; info_list = info_list->next) {
+		if (info_list->info.odid == odid) {
 			break;
 		}
 	}
 
-	/* receive ipfix packet header */
-#ifdef TLS_SUPPORT
-	if (conf->tls) {
-		/* TLS enabled */
-		/* TODO - ugly piece of code... use epoll() instead of select()
-		 * find corresponding SSL structure for socket */
-		for (i = 0; ; i++) {
-			if (conf->ssl_list[i] && (SSL_get_fd(conf->ssl_list[i]) == sock)) {
-				ssl = conf->ssl_list[i];
-				break;
-			}
+	/* Handle new ODIDs */
+	if (info_list == NULL) {
+		info_list = create_input_info(conf, conn, odid);
+		if (info_list == NULL) {
+			return NULL;
 		}
+	}
 
-		int ssl_err;
-		len = wrapper_SSL_read(ssl, *packet, IPFIX_HEADER_LENGTH, &ssl_err);
-		if (len <= 0) {
-			/* read operation was not successful */
-			if (ssl_err == SSL_ERROR_SYSCALL) {
-				if (errno == EINTR) {
-					return INPUT_INTR;
-				}
+	/* Set source status; the first message opens the source */
+	*source_status = info_list->info.status;
+	info_list->info.status = SOURCE_STATUS_OPENED;
 
-				MSG_ERROR(msg_module, "Failed to receive IPFIX packet header: %s", strerror(errno));
-				return INPUT_ERROR;
-			}
+	return info_list;
+}
 
-			// This will close the connection
-			len = 0;
+/**
+ * \brief Close the connection
+ *
+ * Input infos of the connection are marked as closed and moved to the list of
+ * closed input infos (to be reported by get_packet()) or, when reader threads
+ * are running, reported to the collector right away.
+ *
+ * \param[in] conf plugin configuration
+ * \param[in] conn connection
+ */
+static void tcp_connection_close(struct plugin_conf *conf, struct tcp_connection *conn)
+{
+	struct tcp_reader *reader = conn->reader;
+	struct input_info_list *info_list, *next;
+	char src_addr[INET6_ADDRSTRLEN];
+
+#ifdef TLS_SUPPORT
+	if (conn->ssl) {
+		if (SSL_get_shutdown(conn->ssl) != SSL_RECEIVED_SHUTDOWN) {
+			MSG_WARNING(msg_module, "SSL shutdown is incomplete");
 		}
-	} else {
-#endif
-		/* receive without TLS */
-		len = recv(sock, *packet, IPFIX_HEADER_LENGTH, MSG_WAITALL);
-		if (len == -1) {
-			if (errno == EINTR) {
-				return INPUT_INTR;
-			}
 
-			MSG_ERROR(msg_module, "Failed to receive IPFIX packet header: %s", strerror(errno));
-			return INPUT_ERROR;
+		/* Send "close notify" shutdown alert back to the peer */
+		if (SSL_shutdown(conn->ssl) == -1) {
+			MSG_ERROR(msg_module, "Fatal error occured during TLS close notify");
 		}
-#ifdef TLS_SUPPORT
+
+		SSL_free(conn->ssl);
+	}
+
+	if (conn->peer_cert) {
+		X509_free(conn->peer_cert);
 	}
 #endif
 
-	if (len >= IPFIX_HEADER_LENGTH) { /* header received */
-		if (ntohs(((struct ipfix_header *) *packet)->version) != IPFIX_VERSION) {
-			// Unexpected version
-			MSG_WARNING(msg_module, "Received invalid message: IPFIX version doesn't match.", '\0');
-			return INPUT_ERROR;
-		}
+	/* Print info */
+	if (conf->info.l3_proto == 4) {
+		inet_ntop(AF_INET, (void *)&((struct sockaddr_in*) &conn->address)->sin_addr, src_addr, INET6_ADDRSTRLEN);
+	} else {
+		inet_ntop(AF_INET6, &conn->address.sin6_addr, src_addr, INET6_ADDRSTRLEN);
+	}
+	MSG_INFO(msg_module, "Exporter on address %s closed connection", src_addr);
 
-		/* get packet total length and check whether buffer is big enough */
-		packet_len = ntohs(((struct ipfix_header *) *packet)->length);
-		if (packet_len > BUFF_LEN) {
-			*packet = realloc(*packet, packet_len);
-			if (*packet == NULL) {
-				MSG_ERROR(msg_module, "Packet too big and realloc failed: %s", strerror(errno));
-				return INPUT_ERROR;
-			}
-		}
+	/* closing the socket removes it from the epoll set */
+	pthread_mutex_lock(&reader->lock);
+	close(conn->socket);
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		reader->connections = conn->next;
+	}
+	if (conn->next) {
+		conn->next->prev = conn->prev;
+	}
+	pthread_mutex_unlock(&reader->lock);
 
-		char *body_ptr = (*packet) + IPFIX_HEADER_LENGTH;
-		int body_size = packet_len - IPFIX_HEADER_LENGTH;
+	/* Report closed sources */
+	for (info_list = conn->info_list; info_list != NULL; info_list = next) {
+		next = info_list->next;
+		info_list->info.status = SOURCE_STATUS_CLOSED;
 #ifdef TLS_SUPPORT
-		if (conf->tls) {
-			int ssl_err;
-			len = wrapper_SSL_read(ssl, body_ptr, body_size, &ssl_err);
-			if (len <= 0) {
-				if (ssl_err == SSL_ERROR_SYSCALL && errno == EINTR) {
-					return INPUT_INTR;
-				}
-				return INPUT_ERROR;
-			}
-		} else {
+		/* certificate is freed with the connection */
+		info_list->exporter_cert = NULL;
 #endif
-			len = recv(sock, (*packet) + IPFIX_HEADER_LENGTH, packet_len - IPFIX_HEADER_LENGTH,
-				MSG_WAITALL);
-			if (len == -1) {
+
+		if (conf->running) {
+			conf->callback(NULL, INPUT_CLOSED, (struct input_info *) &info_list->info, SOURCE_STATUS_CLOSED);
+
+			pthread_mutex_lock(&conf->info_lock);
+			info_list->next = conf->used_info_list;
+			conf->used_info_list = info_list;
+			pthread_mutex_unlock(&conf->info_lock);
+		} else {
+			info_list->next = conf->closed_info_list;
+			conf->closed_info_list = info_list;
+		}
+	}
+
+	free(conn->buffer);
+	free(conn);
+}
+
+/**
+ * \brief Pass input data from the input plugin into the ipfixcol core.
+ *
+ * IP addresses are passed as returned by recvfrom and getsockname,
+ * ports are in host byte order
+ *
+ * \param[in] config  plugin_conf structure
+ * \param[out] info   Information structure describing the source of the data.
+ * \param[out] packet Flow information data in the form of IPFIX packet.
+ * \param[out] source_status Status of source (new, opened, closed)
+ * \return the length of packet on success, INPUT_CLOSE when some connection
+ *  closed, INPUT_ERROR on error or INPUT_SIGINT when interrupted.
+ */
+int get_packet(void *config, struct input_info **info, char **packet, int *source_status)
+{
+	struct plugin_conf *conf = config;
+	struct tcp_reader *reader = &conf->readers[0];
+	struct tcp_connection *conn;
+	struct input_info_list *info_list;
+	int len, ret;
+
+	/* Handle closed connections first */
+	if (conf->closed_info_list) {
+		info_list = conf->closed_info_list;
+		conf->closed_info_list = info_list->next;
+
+		/* Keep it until the plugin is closed, messages may still point to it */
+		info_list->next = conf->used_info_list;
+		conf->used_info_list = info_list;
+
+		*info = (struct input_info *) &info_list->info;
+		*source_status = SOURCE_STATUS_CLOSED;
+		return INPUT_CLOSED;
+	}
+
+	while (1) {
+		/* wait until some connection is ready, check for new events regularly */
+		if (reader->ready_head == NULL || reader->polls_skipped >= TCP_READ_BATCH) {
+			/* wait at most one second if there is nothing to read */
+			ret = reader_poll(reader, reader->ready_head ? 0 : 1000);
+			if (ret == -1) {
 				if (errno == EINTR) {
 					return INPUT_INTR;
 				}
-				MSG_WARNING(msg_module, "Failed to receive IPFIX packet: %s", strerror(errno));
+				MSG_WARNING(msg_module, "Failed to wait for active connection: %s", strerror(errno));
 				return INPUT_ERROR;
+			} else if (ret == 0 && reader->ready_head == NULL) {
+				/* no data, let the collector check its state */
+				return INPUT_INTR;
 			}
-#ifdef TLS_SUPPORT
-		}
-#endif
-		if (len < body_size) {
-			MSG_WARNING(msg_module, "Read IPFIX data is too short (%i): %s", len, strerror(errno));
+			continue;
 		}
 
-		len += IPFIX_HEADER_LENGTH;
+		conn = reader_ready_pop(reader);
+		len = tcp_connection_read(conn, packet);
+		if (len > 0) {
+			/* connection may have more data; serve the others first */
+			reader_ready_push(reader, conn);
+			reader->polls_skipped++;
+			break;
+		}
 
-		/* Check if lengths are the same */
-		if (len < htons(((struct ipfix_header *) *packet)->length)) {
-			return INPUT_INTR;
-		} else if (len > htons(((struct ipfix_header *) *packet)->length)) {
-			len = htons(((struct ipfix_header*) *packet)->length);
+		if (len == TCP_CLOSED) {
+			tcp_connection_close(conf, conn);
+			if (conf->closed_info_list) {
+				return get_packet(config, info, packet, source_status);
+			}
 		}
-	} else if (len != 0) {
-		MSG_WARNING(msg_module, "Packet header is incomplete; closing connection...");
+	}
 
-		/* this will close the connection */
-		len = 0;
+	/* find input info of the source */
+	info_list = tcp_connection_get_info(conf, conn, *packet, source_status);
+	if (info_list == NULL) {
+		return INPUT_INTR;
 	}
 
-	/* get peer address from configuration */
-	address = conf->sock_addresses[sock];
+	/* Pass info to the collector */
+	*info = (struct input_info*) &info_list->info;
 
-	/* go through input_info_list */
-	for (info_list = conf->info_list; info_list != NULL; info_list = info_list->next) {
-		if (compare_input_info(info_list, address) == 0) {
-			if (info_list->info.status == SOURCE_STATUS_NEW) {
-				/* First ODID for this connection, no ODID yet. Use it */
-				break;
-			} else {
-				/* Remember the match and use it for new ODID */
-				tmp_list = info_list;
+	return len;
+}
+
+/**
+ * \brief Reader thread
+ *
+ * Reads messages from connections assigned to the reader and passes them to
+ * the collector until the plugin is stopped.
+ *
+ * \param[in] arg tcp_reader structure
+ * \return NULL
+ */
+static void *tcp_reader_thread(void *arg)
+{
+	struct tcp_reader *reader = (struct tcp_reader *) arg;
+	struct plugin_conf *conf = reader->conf;
+	struct tcp_connection *conn, *last;
+	struct input_info_list *info_list;
+	char thread_name[16];
+	char *packet;
+	int i, len, source_status;
+
+	snprintf(thread_name, 16, "ipfixcol:tcp:%d", reader->id);
+	prctl(PR_SET_NAME, thread_name, 0, 0, 0);
 
-				/* ODIDs must match or connection must be closing*/
-				if (len == 0 ||
-					(len > 0 && info_list->info.odid == ntohl(((struct ipfix_header *) *packet)->observation_domain_id))) {
+	while (!__atomic_load_n(&conf->stop, __ATOMIC_ACQUIRE)) {
+		if (reader_poll(reader, reader->ready_head ? 0 : TCP_READER_TIMEOUT) == -1 && errno != EINTR) {
+			MSG_WARNING(msg_module, "Failed to wait for active connection: %s", strerror(errno));
+			usleep(TCP_READER_TIMEOUT * 1000);
+			continue;
+		}
+
+		/* serve each ready connection once, at most TCP_READ_BATCH messages */
+		last = reader->ready_tail;
+		while ((conn = reader_ready_pop(reader)) != NULL) {
+			for (i = 0; i < TCP_READ_BATCH; i++) {
+				packet = NULL;
+				len = tcp_connection_read(conn, &packet);
+				if (len <= 0) {
 					break;
 				}
+
+				info_list = tcp_connection_get_info(conf, conn, packet, &source_status);
+				if (info_list == NULL) {
+					free(packet);
+					continue;
+				}
+
+				conf->callback(packet, len, (struct input_info *) &info_list->info, source_status);
+			}
+
+			if (i == TCP_READ_BATCH) {
+				/* connection may have more data */
+				reader_ready_push(reader, conn);
+			} else if (len == TCP_CLOSED) {
+				tcp_connection_close(conf, conn);
+			}
+
+			if (conn == last) {
+				break;
 			}
 		}
 	}
 
-	/* Handle new ODIDs for existing source */
-	if (info_list == NULL && tmp_list != NULL) {
-		info_list = create_input_info(conf, tmp_list, NULL);
+	return NULL;
+}
+
+/**
+ * \brief Start reader threads
+ *
+ * \param[in] config plugin_conf structure
+ * \param[in] callback function passing data to the collector
+ * \return 0 when the threads are running, 1 when get_packet() should be used
+ */
+int input_start(void *config, input_callback callback)
+{
+	struct plugin_conf *conf = (struct plugin_conf *) config;
+	struct input_info_list *info_list;
+	sigset_t set, old_set;
+	int i, ret;
+
+	if (!conf->workers) {
+		return 1;
 	}
 
-	/* Check whether we have the input_info */
-	if (info_list == NULL) {
-		MSG_WARNING(msg_module, "input_info not found, passing packet with NULL input info");
-	} else {
-		/* Set source status */
-		*source_status = info_list->info.status;
-		/* Get ODID for opened connection */
-		if (len > 0 && info_list->info.status == SOURCE_STATUS_NEW) {
-			info_list->info.status = SOURCE_STATUS_OPENED;
-			info_list->info.odid = ntohl(((struct ipfix_header *) *packet)->observation_domain_id);
-		}
+	if (conf->running) {
+		return 0;
 	}
 
-	/* Pass info to the collector */
-	*info = (struct input_info*) &info_list->info;
+	conf->callback = callback;
+	conf->stop = 0;
 
-	/* Check whether socket closed */
-	if (len == 0) {
-#ifdef TLS_SUPPORT
-		if (conf->tls) {
-			if (SSL_get_shutdown(ssl) != SSL_RECEIVED_SHUTDOWN) {
-				MSG_WARNING(msg_module, "SSL shutdown is incomplete");
-			}
+	/* sources closed before the start are reported first */
+	while (conf->closed_info_list) {
+		info_list = conf->closed_info_list;
+		conf->closed_info_list = info_list->next;
 
-			/* Send "close notify" shutdown alert back to the peer */
-			retval = SSL_shutdown(ssl);
-			if (retval == -1) {
-				MSG_ERROR(msg_module, "Fatal error occured during TLS close notify");
-			}
-		}
-#endif
-		/* Print info */
-		if (conf->info.l3_proto == 4) {
-			inet_ntop(AF_INET, (void *)&((struct sockaddr_in*) conf->sock_addresses[sock])->sin_addr, src_addr, INET6_ADDRSTRLEN);
-		} else {
-			inet_ntop(AF_INET6, &conf->sock_addresses[sock]->sin6_addr, src_addr, INET6_ADDRSTRLEN);
-		}
-		MSG_INFO(msg_module, "Exporter on address %s closed connection", src_addr);
+		callback(NULL, INPUT_CLOSED, (struct input_info *) &info_list->info, SOURCE_STATUS_CLOSED);
 
-		/* Set source status */
-		*source_status = SOURCE_STATUS_CLOSED;
+		info_list->next = conf->used_info_list;
+		conf->used_info_list = info_list;
+	}
 
-		/* Remove current input_info from list */
-		remove_input_info(conf, info_list, (*info)->status != SOURCE_STATUS_NEW);
+	/* signals are handled by the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old_set);
 
-		/* Set status of all other input_infos from this source
-		 * The current one is not affected, it is removed from the list */
-		for (tmp_list = conf->info_list; tmp_list != NULL; tmp_list = tmp_list->next) {
-			if (compare_input_info(tmp_list, address) == 0) {
-				tmp_list->info.status = SOURCE_STATUS_CLOSED;
-				conf->info_to_remove++;
-			}
+	/* reader threads report closed connections through the callback */
+	conf->running = 1;
+
+	for (i = 0; i < conf->readers_count; i++) {
+		if ((ret = pthread_create(&conf->readers[i].thread, NULL, tcp_reader_thread, &conf->readers[i])) != 0) {
+			MSG_ERROR(msg_module, "Cannot create reader thread: %s", strerror(ret));
+			break;
 		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
 
-		/* Use mutex so that listening thread does not reuse the socket too quickly */
-		pthread_mutex_lock(&mutex);
-		close(sock);
-		FD_CLR(sock, &conf->master);
-		remove_sock_address(conf, sock);
-		pthread_mutex_unlock(&mutex);
-
-		/* Do not send input_info for closing sources with no data. ODID is not filled in that case */
-		if ((*info)->status == SOURCE_STATUS_NEW) {
-			/* No messages point to this input_info, free here */
-			free(info_list);
-			*info = NULL;
-			return INPUT_INTR;
+	if (i < conf->readers_count) {
+		/* connections of the missing readers would not be served, stop all and try again later */
+		__atomic_store_n(&conf->stop, 1, __ATOMIC_RELEASE);
+		while (i-- > 0) {
+			pthread_join(conf->readers[i].thread, NULL);
 		}
 
-		/* Set current input_info status to closed */
-		(*info)->status = SOURCE_STATUS_CLOSED;
+		conf->running = 0;
+		return 1;
+	}
 
-		return INPUT_CLOSED;
+	MSG_INFO(msg_module, "Started %d reader threads", conf->readers_count);
+
+	return 0;
+}
+
+/**
+ * \brief Stop reader threads
+ *
+ * \param[in] config plugin_conf structure
+ * \return 0 on success
+ */
+int input_stop(void *config)
+{
+	struct plugin_conf *conf = (struct plugin_conf *) config;
+	int i;
+
+	if (!conf->running) {
+		return 0;
 	}
 
-	return len;
+	__atomic_store_n(&conf->stop, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < conf->readers_count; i++) {
+		pthread_join(conf->readers[i].thread, NULL);
+	}
+
+	conf->running = 0;
+	return 0;
 }
 
 /**
@@ -1360,9 +1536,10 @@ int get_packet(void *config, struct input_info **info, char **packet, int *sourc
  */
 int input_close(void **config)
 {
-	int ret, error = 0, sock=0;
+	int ret, error = 0, i;
 	struct plugin_conf *conf = (struct plugin_conf*) *config;
 	struct input_info_list *info_list;
+	struct tcp_connection *conn;
 
 	/* kill the listening thread */
 	if(pthread_cancel(listen_thread) != 0) {
@@ -1371,54 +1548,60 @@ int input_close(void **config)
 		pthread_join(listen_thread, NULL);
 	}
 
+	/* stop reader threads */
+	input_stop(conf);
+
+	/* close listening socket */
+	if ((ret = close(conf->socket)) == -1) {
+		error++;
+		MSG_ERROR(msg_module, "Cannot close listening socket: %s", strerror(errno));
+	}
+
+	/* close open connections; their input infos may still be used by the collector */
+	for (i = 0; i < conf->readers_count; i++) {
+		while ((conn = conf->readers[i].connections) != NULL) {
+			conf->readers[i].connections = conn->next;
 #ifdef TLS_SUPPORT
-	if (conf->tls) {
-		/* close TLS connection, if any */
-		for (sock = 0; sock < conf->ssl_list_size; sock++) {
-			if (conf->ssl_list[sock] == NULL) {
-				continue;
-			}
-			ret = SSL_get_fd(conf->ssl_list[sock]);
-			if (ret >= 0) {
+			if (conn->ssl) {
 				/* send close notify */
-				ret = SSL_shutdown(conf->ssl_list[sock]);
+				ret = SSL_shutdown(conn->ssl);
 				if (ret == -1) {
 					MSG_ERROR(msg_module, "Fatal error occured during TLS close notify");
 				}
+
+				SSL_free(conn->ssl);
+			}
+#endif
+			if ((ret = close(conn->socket)) == -1) {
+				error++;
+				MSG_ERROR(msg_module, "Cannot close socket: %s", strerror(errno));
 			}
 
-			SSL_free(conf->ssl_list[sock]);
+			free(conn->buffer);
+			free(conn);
 		}
 
+		close(conf->readers[i].epoll_fd);
+		pthread_mutex_destroy(&conf->readers[i].lock);
+	}
+	free(conf->readers);
+
+#ifdef TLS_SUPPORT
+	if (conf->tls) {
 		/* we are done here */
 		SSL_CTX_free(conf->ctx);
 	}
 #endif
 
-	/* close listening socket */
-	if ((ret = close(conf->socket)) == -1) {
-		error++;
-		MSG_ERROR(msg_module, "Cannot close listening socket: %s", strerror(errno));
-	}
-
-	/* close open sockets */
-	for (sock = 0; sock <= conf->fd_max; sock++) {
-		if (FD_ISSET(sock, &conf->master)) {
-			if ((ret = close(sock)) == -1) {
-				error++;
-				MSG_ERROR(msg_module, "Cannot close socket: %s", strerror(errno));
-			}
-		}
+	/* free used input_info list */
+	while (conf->closed_info_list) {
+		info_list = conf->closed_info_list->next;
+		free(conf->closed_info_list);
+		conf->closed_info_list = info_list;
 	}
 
-	destroy_sock_addresses(conf);
-
-	/* free used input_info list */
 	while (conf->used_info_list) {
 		info_list = conf->used_info_list->next;
-#ifdef TLS_SUPPORT
-		X509_free(conf->used_info_list->exporter_cert);
-#endif
 		free(conf->used_info_list);
 		conf->used_info_list = info_list;
 	}
@@ -1450,7 +1633,7 @@ int input_close(void **config)
 #endif
 
 	/* free allocated structures */
-	FD_ZERO(&conf->master);
+	pthread_mutex_destroy(&conf->info_lock);
 	free(*config);
 	convert_close();
 	*config = NULL;
@@ -47,6 +47,7 @@
  * @{
  */
 
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <netinet/in.h>
 #include <unistd.h>
@@ -59,6 +60,9 @@
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/prctl.h>
 
 #include <ipfixcol.h>
 #include "convert.h"
@@ -72,6 +76,12 @@ IPFIXCOL_API_VERSION;
 /* default port for udp collector */
 #define DEFAULT_PORT "4739"
 
+/* number of datagrams received by one recvmmsg() call of a worker */
+#define RECV_BATCH 32
+
+/* receive timeout of worker sockets (microseconds); workers check the stop flag after it */
+#define WORKER_TIMEOUT 100000
+
 /** Identifier to MSG_* macros */
 static char *msg_module = "UDP input";
 
@@ -89,6 +99,29 @@ struct input_info_list {
 	uint16_t packets_sent;
 };
 
+struct plugin_conf;
+
+/**
+ * \struct udp_worker
+ * \brief  Receiver thread draining one of the SO_REUSEPORT sockets
+ *
+ * The kernel distributes datagrams among the sockets by a hash of the source
+ * address and port, so each exporter is always served by the same worker.
+ * Workers thus keep their own lists of sources and pass packets of their
+ * exporters to the collector independently of each other.
+ */
+struct udp_worker {
+	pthread_t thread; /**< receiver thread */
+	int socket; /**< socket drained by the thread */
+	int id; /**< index of the worker */
+	struct plugin_conf *conf; /**< plugin configuration */
+	struct input_info_list *info_list; /**< sources served by the worker */
+	char *buffers[RECV_BATCH]; /**< receive buffers, refilled after passing the packet to the collector */
+	uint64_t packets; /**< number of received datagrams */
+	uint64_t drops; /**< number of datagrams dropped by the kernel */
+	uint32_t last_ovfl; /**< last value of the SO_RXQ_OVFL counter */
+};
+
 /**
  * \struct plugin_conf
  * \brief  Plugin configuration structure passed by the collector
@@ -97,8 +130,82 @@ struct plugin_conf {
 	int socket; /**< listening socket */
 	struct input_info_network info; /**< infromation structure passed to collector */
 	struct input_info_list *info_list; /**< list of infromation structures passed to collector */
+	int workers_count; /**< number of receiver threads, 0 when get_packet() is used */
+	struct udp_worker *workers; /**< receiver threads */
+	input_callback callback; /**< passes packets received by workers to the collector */
+	int running; /**< receiver threads are running */
+	int stop; /**< receiver threads should stop */
 };
 
+/** Packet conversion keeps its state in global variables */
+static pthread_mutex_t convert_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Receiver threads are read by input_stats() from the statistics thread */
+static pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \brief Create and bind UDP socket
+ *
+ * \param[in] addrinfo address to bind to
+ * \param[in] reuseport share the port with other sockets of the plugin
+ * \return socket on success, -1 otherwise
+ */
+static int udp_open_socket(struct addrinfo *addrinfo, int reuseport)
+{
+	int sock, ipv6_only = 0, on = 1;
+
+	/* create socket */
+	sock = socket(addrinfo->ai_family, addrinfo->ai_socktype, addrinfo->ai_protocol);
+
+	/* Retry with IPv4 when the implementation does not support the specified address family */
+	if (sock == -1 && errno == EAFNOSUPPORT && addrinfo->ai_family == AF_INET6) {
+		addrinfo->ai_family = AF_INET;
+		sock = socket(addrinfo->ai_family, addrinfo->ai_socktype, addrinfo->ai_protocol);
+	}
+	if (sock == -1) {
+		MSG_ERROR(msg_module, "Cannot create socket: %s", strerror(errno));
+		return -1;
+	}
+
+	/* allow IPv4 connections on IPv6 */
+	if ((addrinfo->ai_family == AF_INET6) &&
+			(setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6_only, sizeof(ipv6_only)) == -1)) {
+		MSG_WARNING(msg_module, "Cannot turn off socket option IPV6_V6ONLY; plugin may not accept IPv4 connections...");
+	}
+
+	if (reuseport) {
+		struct timeval timeout = {0, WORKER_TIMEOUT};
+
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+			MSG_ERROR(msg_module, "Cannot set socket option SO_REUSEPORT: %s", strerror(errno));
+			close(sock);
+			return -1;
+		}
+
+		if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) {
+			MSG_ERROR(msg_module, "Cannot set socket receive timeout: %s", strerror(errno));
+			close(sock);
+			return -1;
+		}
+
+#ifdef SO_RXQ_OVFL
+		/* report number of dropped datagrams */
+		if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == -1) {
+			MSG_WARNING(msg_module, "Cannot set socket option SO_RXQ_OVFL; drops will not be reported...");
+		}
+#endif
+	}
+
+	/* bind socket to address */
+	if (bind(sock, addrinfo->ai_addr, addrinfo->ai_addrlen) != 0) {
+		MSG_ERROR(msg_module, "Cannot bind socket: %s", strerror(errno));
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
 /**
  * \brief Input plugin initializtion function
  *
@@ -114,7 +221,7 @@ int input_init(char *params, void **config)
 	char *port = NULL, *address = NULL;
 	int ai_family = AF_INET6; /* IPv6 is default */
 	char dst_addr[INET6_ADDRSTRLEN];
-	int ret, ipv6_only = 0, retval = 0;
+	int ret, retval = 0, i;
 
 	/* 1 when using default port - don't free memory */
 	int default_port = 0;
@@ -205,6 +312,9 @@ int input_init(char *params, void **config)
 					free(conf->info.options_template_life_packet);
 				}
 				conf->info.options_template_life_packet = tmp_val;
+			} else if (xmlStrEqual(cur_node->name, BAD_CAST "workers")) { /* number of receiver threads */
+				conf->workers_count = atoi(tmp_val);
+				free(tmp_val);
 			} else { /* unknown parameter, ignore */
 				free(tmp_val);
 			}
@@ -233,31 +343,36 @@ int input_init(char *params, void **config)
 		goto out;
 	}
 
-	/* create socket */
-	conf->socket = socket(addrinfo->ai_family, addrinfo->ai_socktype, addrinfo->ai_protocol);
-
-	/* Retry with IPv4 when the implementation does not support the specified address family */
-	if (conf->socket == -1 && errno == EAFNOSUPPORT && addrinfo->ai_family == AF_INET6) {
-		addrinfo->ai_family = AF_INET;
-		conf->socket = socket(addrinfo->ai_family, addrinfo->ai_socktype, addrinfo->ai_protocol);
+	/* single socket is read by get_packet() */
+	if (conf->workers_count <= 1) {
+		conf->workers_count = 0;
 	}
+
+	/* create socket */
+	conf->socket = udp_open_socket(addrinfo, conf->workers_count > 0);
 	if (conf->socket == -1) {
-		MSG_ERROR(msg_module, "Cannot create socket: %s", strerror(errno));
 		retval = 1;
 		goto out;
 	}
 
-	/* allow IPv4 connections on IPv6 */
-	if ((addrinfo->ai_family == AF_INET6) &&
-			(setsockopt(conf->socket, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6_only, sizeof(ipv6_only)) == -1)) {
-		MSG_WARNING(msg_module, "Cannot turn off socket option IPV6_V6ONLY; plugin may not accept IPv4 connections...");
-	}
+	/* create sockets of the receiver threads sharing the same port */
+	if (conf->workers_count > 0) {
+		conf->workers = calloc(conf->workers_count, sizeof(struct udp_worker));
+		if (conf->workers == NULL) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			retval = 1;
+			goto out;
+		}
 
-	/* bind socket to address */
-	if (bind(conf->socket, addrinfo->ai_addr, addrinfo->ai_addrlen) != 0) {
-		MSG_ERROR(msg_module, "Cannot bind socket: %s", strerror(errno));
-		retval = 1;
-		goto out;
+		for (i = 0; i < conf->workers_count; i++) {
+			conf->workers[i].id = i;
+			conf->workers[i].conf = conf;
+			conf->workers[i].socket = (i == 0) ? conf->socket : udp_open_socket(addrinfo, 1);
+			if (conf->workers[i].socket == -1) {
+				retval = 1;
+				goto out;
+			}
+		}
 	}
 
 	/* fill in general information */
@@ -292,6 +407,9 @@ int input_init(char *params, void **config)
 
 	/* print info */
 	MSG_INFO(msg_module, "Input plugin listening on %s, port %s", dst_addr, port);
+	if (conf->workers_count > 0) {
+		MSG_INFO(msg_module, "Using %d receiver threads", conf->workers_count);
+	}
 
 	/* and pass it to the collector */
 	*config = (void*) conf;
@@ -334,6 +452,15 @@ out:
 		if (conf->info.options_template_life_packet != NULL) {
 			free (conf->info.options_template_life_packet);
 		}
+		if (conf->workers != NULL) {
+			for (i = 1; i < conf->workers_count && conf->workers[i].socket > 0; i++) {
+				close(conf->workers[i].socket);
+			}
+			free(conf->workers);
+		}
+		if (conf->socket > 0) {
+			close(conf->socket);
+		}
 		free(conf);
 	}
 
@@ -341,48 +468,27 @@ out:
 }
 
 /**
- * \brief Pass input data from the input plugin into the ipfixcol core.
+ * \brief Check received packet and find information structure of its source
  *
- * IP addresses are passed as returned by recvfrom and getsockname,
- * ports are in host byte order
+ * Packets in other formats than IPFIX are converted. Sources not present in
+ * the list are added to it.
  *
- * \param[in] config  plugin_conf structure
- * \param[out] info   Information structure describing the source of the data.
- * \param[out] packet Flow information data in the form of IPFIX packet.
+ * \param[in] conf plugin_conf structure
+ * \param[in,out] list list of sources known to the receiving thread
+ * \param[in,out] packet received packet
+ * \param[in] len length of the received data
+ * \param[in] address source address of the packet
+ * \param[out] info Information structure describing the source of the data.
  * \param[out] source_status Status of source (new, opened, closed)
- * \return the length of packet on success, INPUT_CLOSE when some connection
- *  closed, INPUT_ERROR on error.
+ * \return the length of packet on success, INPUT_INTR when the packet should
+ * be skipped.
  */
-int get_packet(void *config, struct input_info **info, char **packet, int *source_status)
+static int udp_process_packet(struct plugin_conf *conf, struct input_info_list **list, char **packet,
+		ssize_t len, struct sockaddr_in6 *address, struct input_info **info, int *source_status)
 {
-	/* get socket */
-	int sock = ((struct plugin_conf*) config)->socket;
-	ssize_t len = 0;
 	uint16_t max_msg_len = BUFF_LEN * sizeof(char);
-	socklen_t addr_len = sizeof(struct sockaddr_in6);
-	struct sockaddr_in6 address;
-	struct plugin_conf *conf = config;
 	struct input_info_list *info_list;
-
-	/* allocate memory for packet, if needed */
-	if (!*packet) {
-		*packet = malloc(max_msg_len);
-		if (!*packet) {
-			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-			return INPUT_ERROR;
-		}
-	}
-
-	/* receive packet */
-	len = recvfrom(sock, *packet, BUFF_LEN, 0, (struct sockaddr*) &address, &addr_len);
-	if (len == -1) {
-		if (errno == EINTR) {
-			return INPUT_INTR;
-		}
-
-		MSG_ERROR(msg_module, "Failed to receive packet: %s", strerror(errno));
-		return INPUT_ERROR;
-	}
+	int ret;
 
 	if (len < IPFIX_HEADER_LENGTH) {
 		MSG_WARNING(msg_module, "Packet header is incomplete; skipping message...");
@@ -391,7 +497,11 @@ int get_packet(void *config, struct input_info **info, char **packet, int *sourc
 
 	/* Try to convert packet from Netflow v5/v9/sflow to IPFIX */
 	if (htons(((struct ipfix_header *) (*packet))->version) != IPFIX_VERSION) {
-		if (convert_packet(packet, &len, max_msg_len, (char *) conf->info_list) != 0) {
+		pthread_mutex_lock(&convert_lock);
+		ret = convert_packet(packet, &len, max_msg_len, (char *) *list);
+		pthread_mutex_unlock(&convert_lock);
+
+		if (ret != 0) {
 			MSG_WARNING(msg_module, "Message conversion error; skipping message...");
 			return INPUT_INTR;
 		}
@@ -405,21 +515,21 @@ int get_packet(void *config, struct input_info **info, char **packet, int *sourc
 	}
 
 	/* Loop over input_info_list */
-	for (info_list = conf->info_list; info_list != NULL; info_list = info_list->next) {
+	for (info_list = *list; info_list != NULL; info_list = info_list->next) {
 		/* Ports must match */
-		if (info_list->info.src_port == ntohs(((struct sockaddr_in*) &address)->sin_port)) {
+		if (info_list->info.src_port == ntohs(((struct sockaddr_in*) address)->sin_port)) {
 			/* ODIDs must match */
 			if (info_list->info.odid == ntohl(((struct ipfix_header *) *packet)->observation_domain_id)) {
 				/* Compare addresses, dependent on IP protocol version*/
 				if (info_list->info.l3_proto == 4) {
-					if (info_list->info.src_addr.ipv4.s_addr == ((struct sockaddr_in*) &address)->sin_addr.s_addr) {
+					if (info_list->info.src_addr.ipv4.s_addr == ((struct sockaddr_in*) address)->sin_addr.s_addr) {
 						break;
 					}
 				} else {
-					if (info_list->info.src_addr.ipv6.s6_addr32[0] == address.sin6_addr.s6_addr32[0]
-							&& info_list->info.src_addr.ipv6.s6_addr32[1] == address.sin6_addr.s6_addr32[1]
-							&& info_list->info.src_addr.ipv6.s6_addr32[2] == address.sin6_addr.s6_addr32[2]
-							&& info_list->info.src_addr.ipv6.s6_addr32[3] == address.sin6_addr.s6_addr32[3]) {
+					if (info_list->info.src_addr.ipv6.s6_addr32[0] == address->sin6_addr.s6_addr32[0]
+							&& info_list->info.src_addr.ipv6.s6_addr32[1] == address->sin6_addr.s6_addr32[1]
+							&& info_list->info.src_addr.ipv6.s6_addr32[2] == address->sin6_addr.s6_addr32[2]
+							&& info_list->info.src_addr.ipv6.s6_addr32[3] == address->sin6_addr.s6_addr32[3]) {
 						break;
 					}
 				}
@@ -433,35 +543,40 @@ int get_packet(void *config, struct input_info **info, char **packet, int *sourc
 
 		/* create new input_info */
 		info_list = calloc(1, sizeof(struct input_info_list));
+		if (info_list == NULL) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return INPUT_INTR;
+		}
+
 		memcpy(&info_list->info, &conf->info, sizeof(struct input_info_network));
 
 		info_list->info.status = SOURCE_STATUS_NEW;
 		info_list->info.odid = ntohl(((struct ipfix_header *) *packet)->observation_domain_id);
 
 		/* copy address and port */
-		if (address.sin6_family == AF_INET) {
+		if (address->sin6_family == AF_INET) {
 			/* copy src IPv4 address */
 			info_list->info.src_addr.ipv4.s_addr =
-					((struct sockaddr_in*) &address)->sin_addr.s_addr;
+					((struct sockaddr_in*) address)->sin_addr.s_addr;
 
 			/* copy port */
-			info_list->info.src_port = ntohs(((struct sockaddr_in*)  &address)->sin_port);
+			info_list->info.src_port = ntohs(((struct sockaddr_in*) address)->sin_port);
 		} else {
 			/* copy src IPv6 address */
 			int i;
 			for (i = 0; i < 4; i++) {
-				info_list->info.src_addr.ipv6.s6_addr32[i] = address.sin6_addr.s6_addr32[i];
+				info_list->info.src_addr.ipv6.s6_addr32[i] = address->sin6_addr.s6_addr32[i];
 			}
 
 			/* copy port */
-			info_list->info.src_port = ntohs(address.sin6_port);
+			info_list->info.src_port = ntohs(address->sin6_port);
 		}
 
 		/* add to list */
-		info_list->next = conf->info_list;
+		info_list->next = *list;
 		info_list->last_sent = ((struct ipfix_header *)(*packet))->export_time;
 		info_list->packets_sent = 1;
-		conf->info_list = info_list;
+		*list = info_list;
 	} else {
 		info_list->info.status = SOURCE_STATUS_OPENED;
 	}
@@ -475,6 +590,316 @@ int get_packet(void *config, struct input_info **info, char **packet, int *sourc
 	return len;
 }
 
+/**
+ * \brief Pass input data from the input plugin into the ipfixcol core.
+ *
+ * IP addresses are passed as returned by recvfrom and getsockname,
+ * ports are in host byte order
+ *
+ * \param[in] config  plugin_conf structure
+ * \param[out] info   Information structure describing the source of the data.
+ * \param[out] packet Flow information data in the form of IPFIX packet.
+ * \param[out] source_status Status of source (new, opened, closed)
+ * \return the length of packet on success, INPUT_CLOSE when some connection
+ *  closed, INPUT_ERROR on error.
+ */
+int get_packet(void *config, struct input_info **info, char **packet, int *source_status)
+{
+	/* get socket */
+	int sock = ((struct plugin_conf*) config)->socket;
+	ssize_t len = 0;
+	uint16_t max_msg_len = BUFF_LEN * sizeof(char);
+	socklen_t addr_len = sizeof(struct sockaddr_in6);
+	struct sockaddr_in6 address;
+	struct plugin_conf *conf = config;
+
+	/* allocate memory for packet, if needed (recycled with the message) */
+	if (!*packet) {
+		*packet = message_packet_alloc(max_msg_len);
+		if (!*packet) {
+			return INPUT_ERROR;
+		}
+	}
+
+	/* receive packet */
+	len = recvfrom(sock, *packet, BUFF_LEN, 0, (struct sockaddr*) &address, &addr_len);
+	if (len == -1) {
+		/* receive timeout is set when receiver threads could not be started */
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+			return INPUT_INTR;
+		}
+
+		MSG_ERROR(msg_module, "Failed to receive packet: %s", strerror(errno));
+		return INPUT_ERROR;
+	}
+
+	return udp_process_packet(conf, &conf->info_list, packet, len, &address, info, source_status);
+}
+
+/**
+ * \brief Update number of datagrams dropped on the socket of the worker
+ *
+ * \param[in,out] worker receiver thread
+ * \param[in] msg received message with control data
+ */
+static void udp_worker_update_drops(struct udp_worker *worker, struct msghdr *msg)
+{
+#ifdef SO_RXQ_OVFL
+	struct cmsghdr *cmsg;
+	uint32_t ovfl;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+			/* the kernel reports total number of drops, which may wrap */
+			memcpy(&ovfl, CMSG_DATA(cmsg), sizeof(ovfl));
+			__atomic_store_n(&worker->drops, worker->drops + (uint32_t) (ovfl - worker->last_ovfl), __ATOMIC_RELAXED);
+			worker->last_ovfl = ovfl;
+		}
+	}
+#else
+	(void) worker;
+	(void) msg;
+#endif
+}
+
+/**
+ * \brief Receiver thread
+ *
+ * Receives batches of datagrams with recvmmsg() and passes them to the
+ * collector. Buffers passed to the collector are replaced by new ones from
+ * the message pool of the thread.
+ *
+ * \param[in] arg udp_worker structure
+ * \return NULL
+ */
+static void *udp_worker_thread(void *arg)
+{
+	struct udp_worker *worker = (struct udp_worker *) arg;
+	struct plugin_conf *conf = worker->conf;
+	struct mmsghdr msgs[RECV_BATCH];
+	struct iovec iovecs[RECV_BATCH];
+	struct sockaddr_in6 addresses[RECV_BATCH];
+#ifdef SO_RXQ_OVFL
+	char controls[RECV_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+#endif
+	struct input_info *info;
+	char thread_name[16];
+	int i, count, len, source_status;
+
+	snprintf(thread_name, 16, "ipfixcol:udp:%d", worker->id);
+	prctl(PR_SET_NAME, thread_name, 0, 0, 0);
+
+	while (!__atomic_load_n(&conf->stop, __ATOMIC_ACQUIRE)) {
+		/* refill buffers passed to the collector */
+		for (i = 0; i < RECV_BATCH; i++) {
+			if (!worker->buffers[i]) {
+				worker->buffers[i] = message_packet_alloc(BUFF_LEN);
+				if (!worker->buffers[i]) {
+					break;
+				}
+			}
+
+			iovecs[i].iov_base = worker->buffers[i];
+			iovecs[i].iov_len = BUFF_LEN;
+
+			memset(&msgs[i], 0, sizeof(struct mmsghdr));
+			msgs[i].msg_hdr.msg_name = &addresses[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+			msgs[i].msg_hdr.msg_iov = &iovecs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef SO_RXQ_OVFL
+			msgs[i].msg_hdr.msg_control = controls[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+#endif
+		}
+
+		if (i == 0) {
+			/* no memory for buffers, try again later */
+			usleep(WORKER_TIMEOUT);
+			continue;
+		}
+
+		/* wait for the first datagram, take all other ready ones */
+		count = recvmmsg(worker->socket, msgs, i, MSG_WAITFORONE, NULL);
+		if (count == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				MSG_ERROR(msg_module, "Failed to receive packets: %s", strerror(errno));
+				usleep(WORKER_TIMEOUT);
+			}
+
+			continue;
+		}
+
+		__atomic_store_n(&worker->packets, worker->packets + count, __ATOMIC_RELAXED);
+
+		for (i = 0; i < count; i++) {
+			udp_worker_update_drops(worker, &msgs[i].msg_hdr);
+
+			len = udp_process_packet(conf, &worker->info_list, &worker->buffers[i], msgs[i].msg_len,
+					&addresses[i], &info, &source_status);
+			if (len < 0) {
+				/* skipped, reuse the buffer */
+				continue;
+			}
+
+			/* the collector takes ownership of the buffer */
+			conf->callback(worker->buffers[i], len, info, source_status);
+			worker->buffers[i] = NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Free receiver threads
+ *
+ * Closes their sockets except the first one (plugin socket) and frees
+ * buffers and source lists. Threads must not be running. The threads are
+ * detached from the configuration first, so that input_stats() running in
+ * the statistics thread never sees them freed.
+ *
+ * \param[in,out] conf plugin_conf structure
+ */
+static void udp_workers_free(struct plugin_conf *conf)
+{
+	struct input_info_list *info_list;
+	struct udp_worker *workers;
+	int i, j, count;
+
+	pthread_mutex_lock(&workers_lock);
+	workers = conf->workers;
+	count = conf->workers_count;
+	conf->workers = NULL;
+	conf->workers_count = 0;
+	pthread_mutex_unlock(&workers_lock);
+
+	if (!workers) {
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (i > 0 && close(workers[i].socket) == -1) {
+			MSG_ERROR(msg_module, "Cannot close socket: %s", strerror(errno));
+		}
+
+		for (j = 0; j < RECV_BATCH; j++) {
+			free(workers[i].buffers[j]);
+		}
+
+		while (workers[i].info_list) {
+			info_list = workers[i].info_list->next;
+			free(workers[i].info_list);
+			workers[i].info_list = info_list;
+		}
+	}
+
+	free(workers);
+}
+
+/**
+ * \brief Start receiver threads
+ *
+ * \param[in] config plugin_conf structure
+ * \param[in] callback function passing packets to the collector
+ * \return 0 when the threads are running, 1 when get_packet() should be used
+ */
+int input_start(void *config, input_callback callback)
+{
+	struct plugin_conf *conf = (struct plugin_conf *) config;
+	sigset_t set, old_set;
+	int i, ret;
+
+	if (conf->workers_count == 0) {
+		return 1;
+	}
+
+	if (conf->running) {
+		return 0;
+	}
+
+	conf->callback = callback;
+	conf->stop = 0;
+
+	/* signals are handled by the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old_set);
+
+	for (i = 0; i < conf->workers_count; i++) {
+		if ((ret = pthread_create(&conf->workers[i].thread, NULL, udp_worker_thread, &conf->workers[i])) != 0) {
+			MSG_ERROR(msg_module, "Cannot create receiver thread: %s", strerror(ret));
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+	if (i < conf->workers_count) {
+		/* stop started threads and receive by get_packet() on the first socket */
+		__atomic_store_n(&conf->stop, 1, __ATOMIC_RELEASE);
+		while (i-- > 0) {
+			pthread_join(conf->workers[i].thread, NULL);
+		}
+
+		MSG_WARNING(msg_module, "Falling back to a single receiver thread...");
+		udp_workers_free(conf);
+		return 1;
+	}
+
+	conf->running = 1;
+	MSG_INFO(msg_module, "Started %d receiver threads", conf->workers_count);
+
+	return 0;
+}
+
+/**
+ * \brief Stop receiver threads
+ *
+ * \param[in] config plugin_conf structure
+ * \return 0 on success
+ */
+int input_stop(void *config)
+{
+	struct plugin_conf *conf = (struct plugin_conf *) config;
+	int i;
+
+	if (!conf->running) {
+		return 0;
+	}
+
+	__atomic_store_n(&conf->stop, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < conf->workers_count; i++) {
+		pthread_join(conf->workers[i].thread, NULL);
+	}
+
+	conf->running = 0;
+	return 0;
+}
+
+/**
+ * \brief Get receive statistics of the receiver threads
+ *
+ * \param[in] config plugin_conf structure
+ * \param[out] stats statistics of each socket
+ * \param[in] max size of the array
+ * \return number of filled structures
+ */
+int input_stats(void *config, struct input_socket_stats *stats, int max)
+{
+	struct plugin_conf *conf = (struct plugin_conf *) config;
+	int i;
+
+	/* receiver threads can be freed by input_start() falling back to get_packet() */
+	pthread_mutex_lock(&workers_lock);
+	for (i = 0; i < conf->workers_count && i < max; i++) {
+		stats[i].packets = __atomic_load_n(&conf->workers[i].packets, __ATOMIC_RELAXED);
+		stats[i].drops = __atomic_load_n(&conf->workers[i].drops, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&workers_lock);
+
+	return i;
+}
+
 /**
  * \brief Input plugin "destructor".
  *
@@ -487,12 +912,18 @@ int input_close(void **config)
 	struct plugin_conf *conf = (struct plugin_conf*) *config;
 	struct input_info_list *info_list;
 
+	/* stop receiver threads */
+	input_stop(conf);
+
 	/* close socket */
 	int sock = ((struct plugin_conf*) *config)->socket;
 	if ((ret = close(sock)) == -1) {
 		MSG_ERROR(msg_module, "Cannot close socket: %s", strerror(errno));
 	}
 
+	/* close sockets of the receiver threads */
+	udp_workers_free(conf);
+
 	/* free input_info list */
 	while (conf->info_list) {
 		info_list = conf->info_list->next;
@@ -141,23 +141,32 @@ uint32_t len = strlen(s);
 
 } // End of ParseCryptoPAnKey
 
-//Anonymization funtion
-uint32_t anonymize(const uint32_t orig_addr) {
-    uint8_t rin_output[16];
-    uint8_t rin_input[16];
-
-    uint32_t result = 0;
+//Pseudorandom one-time-pad of an IPv4 address
+//The bit of the pad at position pos depends only on the first pos bits of the address,
+//so the first 'from' bits are taken from 'prefix_pad', the pad of any address sharing
+//the same /from prefix. Only the remaining 32-from bits are computed.
+uint32_t anonymize_pad(const uint32_t orig_addr, const uint32_t prefix_pad, int from) {
+    uint8_t rin_output[32][16];
+    uint8_t rin_input[32][16];
+    uint32_t result;
     uint32_t first4bytes_pad, first4bytes_input;
     int pos;
 
-    memcpy(rin_input, m_pad, 16);
+    if (from >= 32) {
+	return prefix_pad;
+    } else if (from < 0) {
+	from = 0;
+    }
+    result = (from > 0) ? (prefix_pad & ~(0xffffffffU >> from)) : 0;
+
     first4bytes_pad = (((uint32_t) m_pad[0]) << 24) + (((uint32_t) m_pad[1]) << 16) +
 	(((uint32_t) m_pad[2]) << 8) + (uint32_t) m_pad[3]; 
 
-    // For each prefixes with length from 0 to 31, generate a bit using the Rijndael cipher,
+    // For each prefixes with length from 'from' to 31, generate a bit using the Rijndael cipher,
     // which is used as a pseudorandom function here. The bits generated in every rounds
     // are combineed into a pseudorandom one-time-pad.
-    for (pos = 0; pos <= 31 ; pos++) { 
+    for (pos = from; pos <= 31 ; pos++) { 
+	uint8_t *input = rin_input[pos - from];
 
 	//Padding: The most significant pos bits are taken from orig_addr. The other 128-pos 
         //bits are taken from m_pad. The variables first4bytes_pad and first4bytes_input are used
@@ -168,61 +177,90 @@ uint32_t anonymize(const uint32_t orig_addr) {
 	else {
 	  first4bytes_input = ((orig_addr >> (32-pos)) << (32-pos)) | ((first4bytes_pad<<pos) >> pos);
 	}
-	rin_input[0] = (uint8_t) (first4bytes_input >> 24);
-	rin_input[1] = (uint8_t) ((first4bytes_input << 8) >> 24);
-	rin_input[2] = (uint8_t) ((first4bytes_input << 16) >> 24);
-	rin_input[3] = (uint8_t) ((first4bytes_input << 24) >> 24);
+	memcpy(input, m_pad, 16);
+	input[0] = (uint8_t) (first4bytes_input >> 24);
+	input[1] = (uint8_t) ((first4bytes_input << 8) >> 24);
+	input[2] = (uint8_t) ((first4bytes_input << 16) >> 24);
+	input[3] = (uint8_t) ((first4bytes_input << 24) >> 24);
+    }
 
-	//Encryption: The Rijndael cipher is used as pseudorandom function. During each 
-	//round, only the first bit of rin_output is used.
-	Rijndael_blockEncrypt(rin_input, 128, rin_output);	
+    //Encryption: The Rijndael cipher is used as pseudorandom function. The blocks of all
+    //rounds are independent and are encrypted at once.
+    Rijndael_blockEncrypt(rin_input[0], (32 - from) * 128, rin_output[0]);
 
-	//Combination: the bits are combined into a pseudorandom one-time-pad
-	result |=  (rin_output[0] >> 7) << (31-pos);
+    //Combination: the bits are combined into a pseudorandom one-time-pad.
+    //During each round, only the first bit of rin_output is used.
+    for (pos = from; pos <= 31 ; pos++) { 
+	result |=  (rin_output[pos - from][0] >> 7) << (31-pos);
     }
+
+    return result;
+}
+
+//Anonymization funtion
+uint32_t anonymize(const uint32_t orig_addr) {
     //XOR the orginal address with the pseudorandom one-time-pad
-    return result ^ orig_addr;
+    return anonymize_pad(orig_addr, 0, 0) ^ orig_addr;
 }
 
-/* little endian CPU's are boring! - but give it a try
- * orig_addr is a ptr to memory, return by inet_pton for IPv6
- * anon_addr return the result in the same order
+/* Pseudorandom one-time-pad of an IPv6 address in the layout used by anonymize_v6()
+ * The first 'from' bits (multiple of 8) of the pad are taken from 'prefix_pad',
+ * the pad of any address sharing the same /from prefix.
  */
-void anonymize_v6(const uint64_t orig_addr[2], uint64_t *anon_addr) {
-    uint8_t rin_output[16], *orig_bytes, *result;
-    uint8_t rin_input[16];
-
+void anonymize_v6_pad(const uint64_t orig_addr[2], const uint64_t prefix_pad[2], int from, uint64_t *pad) {
+    uint8_t rin_output[128][16], *orig_bytes, *result;
+    uint8_t rin_input[128][16];
     int pos, i, bit_num, left_byte;
 
-	anon_addr[0] = anon_addr[1] = 0;
-	result 		 = (uint8_t *)anon_addr;
+	from &= ~0x7;
+	pad[0] = pad[1] = 0;
+	result 		 = (uint8_t *)pad;
 	orig_bytes 	 = (uint8_t *)orig_addr;
 
-    // For each prefixes with length from 0 to 127, generate a bit using the Rijndael cipher,
+	if (from > 0) {
+		memcpy(result, prefix_pad, (from < 128 ? from : 128) >> 3);
+	}
+	if (from >= 128) {
+		return;
+	}
+
+    // For each prefixes with length from 'from' to 127, generate a bit using the Rijndael cipher,
     // which is used as a pseudorandom function here. The bits generated in every rounds
     // are combineed into a pseudorandom one-time-pad.
-    for (pos = 0; pos <= 127 ; pos++) { 
+    for (pos = from; pos <= 127 ; pos++) { 
+		uint8_t *input = rin_input[pos - from];
+
 		bit_num = pos & 0x7;
 		left_byte = (pos >> 3);
-		
+
 		for ( i=0; i<left_byte; i++ ) {
-			rin_input[i] = orig_bytes[i];
+			input[i] = orig_bytes[i];
 		}
-		rin_input[left_byte] = orig_bytes[left_byte] >> (7-bit_num) << (7-bit_num) | (m_pad[left_byte]<<bit_num) >> bit_num;
+		input[left_byte] = orig_bytes[left_byte] >> (7-bit_num) << (7-bit_num) | (m_pad[left_byte]<<bit_num) >> bit_num;
 		for ( i=left_byte+1; i<16; i++ ) {
-			rin_input[i] = m_pad[i];
+			input[i] = m_pad[i];
 		}
+    }
 
-		//Encryption: The Rijndael cipher is used as pseudorandom function. During each 
-		//round, only the first bit of rin_output is used.
-		Rijndael_blockEncrypt(rin_input, 128, rin_output);	
-
-		//Combination: the bits are combined into a pseudorandom one-time-pad
-		result[left_byte] |= (rin_output[0] >> 7) << bit_num;
+	//Encryption: The Rijndael cipher is used as pseudorandom function. The blocks of all
+	//rounds are independent and are encrypted at once.
+	Rijndael_blockEncrypt(rin_input[0], (128 - from) * 128, rin_output[0]);
 
+	//Combination: the bits are combined into a pseudorandom one-time-pad.
+	//During each round, only the first bit of rin_output is used.
+    for (pos = from; pos <= 127 ; pos++) { 
+		result[pos >> 3] |= (rin_output[pos - from][0] >> 7) << (pos & 0x7);
     }
+}
+
+/* little endian CPU's are boring! - but give it a try
+ * orig_addr is a ptr to memory, return by inet_pton for IPv6
+ * anon_addr return the result in the same order
+ */
+void anonymize_v6(const uint64_t orig_addr[2], uint64_t *anon_addr) {
+	anonymize_v6_pad(orig_addr, NULL, 0, anon_addr);
+
     //XOR the orginal address with the pseudorandom one-time-pad
 	anon_addr[0] ^= orig_addr[0];
 	anon_addr[1] ^= orig_addr[1];
-
 }
@@ -92,4 +92,11 @@ uint32_t anonymize( const uint32_t orig_addr);
 
 void anonymize_v6(const uint64_t orig_addr[2], uint64_t *anon_addr);
 
+// One-time-pads XORed with the addresses by anonymize() and anonymize_v6().
+// The first 'from' bits of the pad are copied from 'prefix_pad', which has to be
+// the pad of an address with the same /from prefix (from is a multiple of 8 for IPv6).
+uint32_t anonymize_pad(const uint32_t orig_addr, const uint32_t prefix_pad, int from);
+
+void anonymize_v6_pad(const uint64_t orig_addr[2], const uint64_t prefix_pad[2], int from, uint64_t *pad);
+
 #endif //_PANONYMIZER_H_ 
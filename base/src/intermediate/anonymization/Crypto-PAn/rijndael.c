@@ -115,6 +115,12 @@
 
 #include "rijndael.h"
 
+// AES-NI instructions are used for ECB encryption when the CPU supports them
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RIJNDAEL_AESNI 1
+#include <wmmintrin.h>
+#endif
+
 static uint8_t S[256]=
 {
 	 99, 124, 119, 123, 242, 107, 111, 197,  48,   1, 103,  43, 254, 215, 171, 118, 
@@ -1039,6 +1045,7 @@ static uint8_t	m_direction;
 static uint8_t	m_initVector[MAX_IV_SIZE];
 static uint32_t	m_uRounds;
 static uint8_t	m_expandedKey[_MAX_ROUNDS+1][4][4];
+static uint8_t	m_aesni;
 
 static void keySched(uint8_t key[_MAX_KEY_COLUMNS][4]);
 
@@ -1048,6 +1055,10 @@ static void encrypt(const uint8_t a[16], uint8_t b[16]);
 
 static void decrypt(const uint8_t a[16], uint8_t b[16]);
 
+#ifdef RIJNDAEL_AESNI
+static void encryptBlocksAesni(const uint8_t *input, int numBlocks, uint8_t *outBuffer);
+#endif
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // API
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1116,6 +1127,13 @@ uint8_t keyMatrix[_MAX_KEY_COLUMNS][4];
 
 	if(m_direction == Decrypt)keyEncToDec();
 
+	// The round keys are already in the byte order expected by AES-NI
+	m_aesni = 0;
+#ifdef RIJNDAEL_AESNI
+	__builtin_cpu_init();
+	if((m_mode == ECB) && (m_direction == Encrypt) && __builtin_cpu_supports("aes"))m_aesni = 1;
+#endif
+
 	m_state = Valid;
 
 	return RIJNDAEL_SUCCESS;
@@ -1135,6 +1153,13 @@ int Rijndael_blockEncrypt(const uint8_t *input,int inputLen,uint8_t *outBuffer)
 	
 	switch(m_mode){
 		case ECB: 
+#ifdef RIJNDAEL_AESNI
+			if(m_aesni)
+			{
+				encryptBlocksAesni(input,numBlocks,outBuffer);
+				break;
+			}
+#endif
 			for(i = numBlocks;i > 0;i--)
 			{
 				encrypt(input,outBuffer);
@@ -1533,6 +1558,56 @@ void keyEncToDec()
 	}
 }	
 
+#ifdef RIJNDAEL_AESNI
+// Encrypt blocks by AES-NI instructions, four independent blocks are interleaved
+// to hide the latency of the instructions
+__attribute__((target("aes,sse2")))
+void encryptBlocksAesni(const uint8_t *input, int numBlocks, uint8_t *outBuffer)
+{
+	__m128i keys[_MAX_ROUNDS+1];
+	__m128i b0, b1, b2, b3;
+	uint32_t r;
+
+	for(r = 0;r <= m_uRounds;r++)
+	{
+		keys[r] = _mm_loadu_si128((const __m128i *) m_expandedKey[r]);
+	}
+
+	for(;numBlocks >= 4;numBlocks -= 4)
+	{
+		b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (input     )), keys[0]);
+		b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (input + 16)), keys[0]);
+		b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (input + 32)), keys[0]);
+		b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (input + 48)), keys[0]);
+		for(r = 1;r < m_uRounds;r++)
+		{
+			b0 = _mm_aesenc_si128(b0, keys[r]);
+			b1 = _mm_aesenc_si128(b1, keys[r]);
+			b2 = _mm_aesenc_si128(b2, keys[r]);
+			b3 = _mm_aesenc_si128(b3, keys[r]);
+		}
+		_mm_storeu_si128((__m128i *) (outBuffer     ), _mm_aesenclast_si128(b0, keys[m_uRounds]));
+		_mm_storeu_si128((__m128i *) (outBuffer + 16), _mm_aesenclast_si128(b1, keys[m_uRounds]));
+		_mm_storeu_si128((__m128i *) (outBuffer + 32), _mm_aesenclast_si128(b2, keys[m_uRounds]));
+		_mm_storeu_si128((__m128i *) (outBuffer + 48), _mm_aesenclast_si128(b3, keys[m_uRounds]));
+		input += 64;
+		outBuffer += 64;
+	}
+
+	for(;numBlocks > 0;numBlocks--)
+	{
+		b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) input), keys[0]);
+		for(r = 1;r < m_uRounds;r++)
+		{
+			b0 = _mm_aesenc_si128(b0, keys[r]);
+		}
+		_mm_storeu_si128((__m128i *) outBuffer, _mm_aesenclast_si128(b0, keys[m_uRounds]));
+		input += 16;
+		outBuffer += 16;
+	}
+}
+#endif
+
 void encrypt(const uint8_t a[16], uint8_t b[16])
 {
 	int r;
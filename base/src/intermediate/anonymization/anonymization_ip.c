@@ -68,6 +68,12 @@ static char *msg_module = "Anon IP";
 #define ANONYMIZATION_TYPE_TRUNCATION    1
 #define ANONYMIZATION_TYPE_CRYPTOPAN     2
 
+/* Number of cached addresses and prefixes (powers of 2) */
+#define ANON_CACHE_V4_SIZE         65536
+#define ANON_CACHE_V4_PREFIX_SIZE  16384
+#define ANON_CACHE_V6_SIZE         16384
+#define ANON_CACHE_V6_PREFIX_SIZE  4096
+
 /* interesting IPFIX entities */
 /* IPv4 */                 /* element ID, IP version, element name */
 #define sourceIPv4Address             {8, 4, "sourceIPv4Address"}
@@ -107,6 +113,37 @@ static struct ipfix_entity entities_to_anonymize[] = {
 };
 #define entities_array_length     4
 
+/** cached IPv4 address or pad of IPv4 prefix */
+struct anon_cache_v4 {
+	uint32_t key;         /* original address or prefix (host byte order) */
+	uint32_t value;       /* anonymized address or pad of prefix */
+	uint8_t valid;        /* entry is used */
+};
+
+/** cached IPv6 address or pad of IPv6 prefix */
+struct anon_cache_v6 {
+	uint64_t key[2];      /* original address or prefix (network byte order) */
+	uint64_t value[2];    /* anonymized address or pad of prefix */
+	uint8_t valid;        /* entry is used */
+};
+
+/**
+ * Crypto-PAn results of recently seen addresses
+ *
+ * Bit n of the Crypto-PAn pad depends only on the first n bits of the address.
+ * When the address itself is not cached, the pad of its longest cached prefix
+ * is reused and only the remaining bits are computed. All tables are direct
+ * mapped, a new entry replaces the old one in the same slot.
+ */
+struct anon_cache {
+	struct anon_cache_v4 v4[ANON_CACHE_V4_SIZE];          /* IPv4 addresses */
+	struct anon_cache_v4 v4_24[ANON_CACHE_V4_PREFIX_SIZE]; /* pads of /24 prefixes */
+	struct anon_cache_v4 v4_16[ANON_CACHE_V4_PREFIX_SIZE]; /* pads of /16 prefixes */
+	struct anon_cache_v6 v6[ANON_CACHE_V6_SIZE];          /* IPv6 addresses */
+	struct anon_cache_v6 v6_64[ANON_CACHE_V6_PREFIX_SIZE]; /* pads of /64 prefixes */
+	struct anon_cache_v6 v6_48[ANON_CACHE_V6_PREFIX_SIZE]; /* pads of /48 prefixes */
+};
+
 /** plugin's configuration structure */
 struct anonymization_ip_config {
 	char *params;         /* XML configuration */
@@ -115,6 +152,21 @@ struct anonymization_ip_config {
 	uint32_t ip_id;       /* Intermediate plugin source ID into template manager */
 	char *key;            /* Anonymization key */
 	struct ipfix_template_mgr *tm;
+	struct anon_cache *cache; /* Crypto-PAn cache */
+};
+
+/** field to anonymize located in template of data set */
+struct anon_field {
+	struct ipfix_entity *entity; /* anonymized entity */
+	int offset;                  /* static offset in record, -1 if it follows variable-length field */
+};
+
+/** data for anonymization of records in one data set */
+struct anon_set {
+	struct anonymization_ip_config *conf;
+	uint32_t odid;
+	int field_count;
+	struct anon_field fields[entities_array_length];
 };
 
 /**
@@ -140,6 +192,124 @@ static void truncate_IPv6Address(uint8_t *data)
 	memset(data+7, 0, 8);
 }
 
+/**
+ * \brief Mix bits of a value into index of cache slot
+ *
+ * \param[in] value hashed value
+ * \return hash
+ */
+static inline uint32_t anon_cache_hash(uint64_t value)
+{
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdULL;
+	value ^= value >> 33;
+	return (uint32_t) value;
+}
+
+/**
+ * \brief Anonymize IPv4 address using Crypto-PAn and the cache
+ *
+ * \param[in] cache Crypto-PAn cache
+ * \param[in] addr IPv4 address (host byte order)
+ * \return anonymized address (host byte order)
+ */
+static uint32_t anon_cached_IPv4Address(struct anon_cache *cache, uint32_t addr)
+{
+	struct anon_cache_v4 *entry = &cache->v4[anon_cache_hash(addr) & (ANON_CACHE_V4_SIZE - 1)];
+	if (entry->valid && entry->key == addr) {
+		return entry->value;
+	}
+
+	uint32_t prefix24 = addr & 0xffffff00;
+	uint32_t prefix16 = addr & 0xffff0000;
+	struct anon_cache_v4 *entry24 = &cache->v4_24[anon_cache_hash(prefix24) & (ANON_CACHE_V4_PREFIX_SIZE - 1)];
+	struct anon_cache_v4 *entry16 = &cache->v4_16[anon_cache_hash(prefix16) & (ANON_CACHE_V4_PREFIX_SIZE - 1)];
+	uint32_t pad;
+
+	if (entry24->valid && entry24->key == prefix24) {
+		pad = anonymize_pad(addr, entry24->value, 24);
+	} else {
+		if (entry16->valid && entry16->key == prefix16) {
+			pad = anonymize_pad(addr, entry16->value, 16);
+		} else {
+			pad = anonymize_pad(addr, 0, 0);
+			entry16->key = prefix16;
+			entry16->value = pad;
+			entry16->valid = 1;
+		}
+
+		entry24->key = prefix24;
+		entry24->value = pad;
+		entry24->valid = 1;
+	}
+
+	entry->key = addr;
+	entry->value = pad ^ addr;
+	entry->valid = 1;
+	return entry->value;
+}
+
+/**
+ * \brief Find pad of IPv6 prefix in the cache
+ *
+ * \param[in] table cache table of the prefix length
+ * \param[in] addr IPv6 address
+ * \param[in] bytes prefix length in bytes
+ * \param[out] prefix prefix of the address padded by zeroes
+ * \return cache slot of the prefix
+ */
+static struct anon_cache_v6 *anon_cache_v6_prefix(struct anon_cache_v6 *table, const uint64_t addr[2], int bytes, uint64_t *prefix)
+{
+	prefix[0] = prefix[1] = 0;
+	memcpy(prefix, addr, bytes);
+
+	return &table[anon_cache_hash(prefix[0] ^ prefix[1]) & (ANON_CACHE_V6_PREFIX_SIZE - 1)];
+}
+
+/**
+ * \brief Anonymize IPv6 address using Crypto-PAn and the cache
+ *
+ * \param[in] cache Crypto-PAn cache
+ * \param[in] addr IPv6 address
+ * \param[out] anon anonymized address
+ */
+static void anon_cached_IPv6Address(struct anon_cache *cache, const uint64_t addr[2], uint64_t anon[2])
+{
+	struct anon_cache_v6 *entry = &cache->v6[anon_cache_hash(addr[0] ^ anon_cache_hash(addr[1])) & (ANON_CACHE_V6_SIZE - 1)];
+	if (entry->valid && entry->key[0] == addr[0] && entry->key[1] == addr[1]) {
+		anon[0] = entry->value[0];
+		anon[1] = entry->value[1];
+		return;
+	}
+
+	uint64_t prefix64[2], prefix48[2], pad[2];
+	struct anon_cache_v6 *entry64 = anon_cache_v6_prefix(cache->v6_64, addr, 8, prefix64);
+	struct anon_cache_v6 *entry48 = anon_cache_v6_prefix(cache->v6_48, addr, 6, prefix48);
+
+	if (entry64->valid && entry64->key[0] == prefix64[0]) {
+		anonymize_v6_pad(addr, entry64->value, 64, pad);
+	} else {
+		if (entry48->valid && entry48->key[0] == prefix48[0]) {
+			anonymize_v6_pad(addr, entry48->value, 48, pad);
+		} else {
+			anonymize_v6_pad(addr, NULL, 0, pad);
+			memcpy(entry48->key, prefix48, 16);
+			memcpy(entry48->value, pad, 16);
+			entry48->valid = 1;
+		}
+
+		memcpy(entry64->key, prefix64, 16);
+		memcpy(entry64->value, pad, 16);
+		entry64->valid = 1;
+	}
+
+	entry->key[0] = addr[0];
+	entry->key[1] = addr[1];
+	entry->value[0] = anon[0] = pad[0] ^ addr[0];
+	entry->value[1] = anon[1] = pad[1] ^ addr[1];
+	entry->valid = 1;
+}
+
 /**
  *  \brief Initialize Intermediate Plugin
  *
@@ -256,6 +426,14 @@ int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfi
 		}
 		
 		MSG_DEBUG(msg_module, "Crypto-PAn library initialized");
+
+		conf->cache = calloc(1, sizeof(struct anon_cache));
+		if (!conf->cache) {
+			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+			retval = 1;
+			free(conf->key);
+			goto out;
+		}
 	}
 
 	conf->params = params;
@@ -281,6 +459,75 @@ out:
 	return retval;
 }
 
+/**
+ * \brief Anonymize address fields of one data record
+ *
+ * \param[in] rec data record
+ * \param[in] rec_len data record length
+ * \param[in] templ data record's template
+ * \param[in] data anonymized fields of data set
+ */
+static void anon_process_record(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	struct anon_set *set = (struct anon_set *) data;
+	struct anonymization_ip_config *conf = set->conf;
+	char ip_orig[INET6_ADDRSTRLEN];
+	char ip_anon[INET6_ADDRSTRLEN];
+	uint8_t *p;
+	int i, length;
+
+	(void) rec_len;
+
+	for (i = 0; i < set->field_count; ++i) {
+		struct ipfix_entity *entity = set->fields[i].entity;
+		int family = (entity->ip_version == 4) ? AF_INET : AF_INET6;
+
+		if (set->fields[i].offset >= 0) {
+			p = rec + set->fields[i].offset;
+		} else {
+			p = data_record_get_field(rec, templ, 0, entity->element_id, &length);
+			if (!p || length != ((entity->ip_version == 4) ? 4 : 16)) {
+				continue;
+			}
+		}
+
+		if (verbose >= ICMSG_DEBUG) {
+			inet_ntop(family, p, ip_orig, INET6_ADDRSTRLEN);
+		}
+
+		if (entity->ip_version == 4) {
+			uint32_t addr;
+
+			if (conf->type == ANONYMIZATION_TYPE_CRYPTOPAN) {
+				/* anonymization type: cryptopan */
+				memcpy(&addr, p, 4);
+				addr = htonl(anon_cached_IPv4Address(conf->cache, ntohl(addr)));
+				memcpy(p, &addr, 4);
+			} else if (conf->type == ANONYMIZATION_TYPE_TRUNCATION) {
+				/* anonymization type: truncation */
+				truncate_IPv4Address(p);
+			}
+		} else {
+			uint64_t addr[2], anon[2];
+
+			if (conf->type == ANONYMIZATION_TYPE_CRYPTOPAN) {
+				/* anonymization type: cryptopan */
+				memcpy(addr, p, 16);
+				anon_cached_IPv6Address(conf->cache, addr, anon);
+				memcpy(p, anon, 16);
+			} else if (conf->type == ANONYMIZATION_TYPE_TRUNCATION) {
+				/* anonymization type: truncation */
+				truncate_IPv6Address(p);
+			}
+		}
+
+		if (verbose >= ICMSG_DEBUG) {
+			inet_ntop(family, p, ip_anon, INET6_ADDRSTRLEN);
+			MSG_DEBUG(msg_module, "[%u] %s: %s -> %s", set->odid, entity->entity_name, ip_orig, ip_anon);
+		}
+	}
+}
+
 /**
  * \brief Anonymization Intermediate Process
  *
@@ -293,16 +540,9 @@ int intermediate_process_message(void *config, void *message)
 	struct ipfix_message *msg;
 	struct ipfix_data_set *data_set;
 	struct ipfix_template *templ;
-	int index;
-	int ret;
-	uint8_t *p;
-	uint32_t *data;
-	uint8_t **data_records;
-	uint16_t data_records_index;
-	char ip_orig[INET6_ADDRSTRLEN];
-	char ip_anon[INET6_ADDRSTRLEN];
 	struct anonymization_ip_config *conf;
-	uint32_t odid;
+	struct anon_set set;
+	int index;
 
 	conf = (struct anonymization_ip_config *) config;
 	msg = (struct ipfix_message *) message;
@@ -319,7 +559,9 @@ int intermediate_process_message(void *config, void *message)
 		return 0;
 	}
 
-	odid = ntohl(msg->pkt_header->observation_domain_id);
+	set.conf = conf;
+	set.odid = ntohl(msg->pkt_header->observation_domain_id);
+
 	index = 0;
 	while ((data_set = msg->data_couple[index].data_set) != NULL) {
 		templ = msg->data_couple[index].data_template;
@@ -329,113 +571,36 @@ int intermediate_process_message(void *config, void *message)
 			continue;
 		}
 
-		int entities_index = 0;
-		while (entities_index < entities_array_length) {
-			ret = template_contains_field(templ, entities_to_anonymize[entities_index].element_id);
-			if (ret >= 0) {
-				switch (entities_to_anonymize[entities_index].ip_version) {
-					case 4: {
-						/* iterate over data records and modify IP address fields */
-						data_records = get_data_records(data_set, templ);
-
-						data_records_index = 0;
-						while (data_records[data_records_index]) {
-							p = data_records[data_records_index];
-							message_get_data((uint8_t **) &data, p + ret, 4); /* IPv4 address is 4 octet integer */
-							inet_ntop(AF_INET, data, ip_orig, INET6_ADDRSTRLEN);
-
-							if (conf->type == ANONYMIZATION_TYPE_CRYPTOPAN) {
-								/* anonymization type: cryptopan */
-								uint32_t new_addr;
-								uint32_t old_addr = (uint32_t) *data;
-
-								old_addr = ntohl(old_addr);
-
-								/* anonymize given IPv4 address using CryptoPAn */
-								new_addr = anonymize(old_addr);
-								new_addr = htonl(new_addr);
-
-								message_set_data(p + ret, (uint8_t *) &new_addr, 4);
-								inet_ntop(AF_INET, &new_addr, ip_anon, INET6_ADDRSTRLEN);
-
-								MSG_DEBUG(msg_module, "[%u] %s %s -> %s", odid, entities_to_anonymize[entities_index].entity_name,
-										ip_orig, ip_anon);
-
-								++data_records_index;
-								free(data);
-								continue;
-							} else if (conf->type == ANONYMIZATION_TYPE_TRUNCATION) {
-								/* anonymization type: truncation */
-								truncate_IPv4Address((uint8_t *) data);
-								message_set_data(p + ret, (uint8_t *) data, 4);
-								inet_ntop(AF_INET, data, ip_anon, INET6_ADDRSTRLEN);
-
-								MSG_DEBUG(msg_module, "[%u] %s %s -> %s", odid, entities_to_anonymize[entities_index].entity_name,
-										ip_orig, ip_anon);
-
-								++data_records_index;
-								free(data);
-								continue;
-							} else {
-								/* Do nothing */
-							}
-						}
-
-						free(data_records);
-					}
-					break;
-					case 6: {
-						/* iterate over data records and modify fields with IP addresses */
-						data_records = get_data_records(data_set, templ);
-
-						data_records_index = 0;
-						while (data_records[data_records_index]) {
-							p = data_records[data_records_index];
-							message_get_data((uint8_t **) &data, p + ret, 16); /* IPv6 address is 16 octet integer */
-							inet_ntop(AF_INET6, data, ip_orig, INET6_ADDRSTRLEN);
-
-							if (conf->type == ANONYMIZATION_TYPE_CRYPTOPAN) {
-								uint64_t *old_addr = (uint64_t *) data;
-								uint64_t new_addr[2];
-								anonymize_v6(old_addr, new_addr);
-
-								message_set_data(p + ret, (uint8_t *) new_addr, 16);
-								inet_ntop(AF_INET6, new_addr, ip_anon, INET6_ADDRSTRLEN);
-
-								MSG_DEBUG(msg_module, "[%u] %s: %s -> %s", odid,
-										entities_to_anonymize[entities_index].entity_name, ip_orig, ip_anon);
-
-								++data_records_index;
-								free(data);
-								continue;
-							} else if (conf->type == ANONYMIZATION_TYPE_TRUNCATION) {
-								/* anonymization type: truncation */
-								truncate_IPv6Address((uint8_t *) data);
-								message_set_data(p + ret, (uint8_t *) data, 16);
-								inet_ntop(AF_INET6, data, ip_anon, INET6_ADDRSTRLEN);
-
-								MSG_DEBUG(msg_module, "[%u] %s: %s -> %s", odid,
-										entities_to_anonymize[entities_index].entity_name, ip_orig, ip_anon);
-
-								free(data);
-								++data_records_index;
-								continue;
-							} else {
-								/* Do nothing */
-							}
-						}
-
-						free(data_records);
-					}
-					break;
-					default:
-						MSG_ERROR(msg_module, "[%u] Invalid address family", odid);
-						break;
-				} /* switch */
-			} /* if */
-
-			++entities_index;
-		} /* while */
+		/* locate anonymized fields once per data set */
+		set.field_count = 0;
+		for (int i = 0; i < entities_array_length; ++i) {
+			struct ipfix_entity *entity = &entities_to_anonymize[i];
+			int offset;
+
+			if (templ->map) {
+				int field = template_map_find(templ->map, 0, entity->element_id);
+				if (field < 0 || templ->map->fields[field].length != ((entity->ip_version == 4) ? 4 : 16)) {
+					continue;
+				}
+
+				offset = templ->map->fields[field].offset;
+			} else {
+				if (template_contains_field(templ, entity->element_id) < 0) {
+					continue;
+				}
+
+				/* look the field up in each record */
+				offset = -1;
+			}
+
+			set.fields[set.field_count].entity = entity;
+			set.fields[set.field_count].offset = offset;
+			set.field_count++;
+		}
+
+		if (set.field_count > 0) {
+			data_set_process_records(data_set, templ, anon_process_record, &set);
+		}
 
 		++index;
 	}
@@ -459,6 +624,7 @@ int intermediate_close(void *config)
 		free(conf->key);
 	}
 
+	free(conf->cache);
 	free(conf);
 	return 0;
 }
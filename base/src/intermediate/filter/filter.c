@@ -74,13 +74,26 @@ static const char *msg_module = "filter";
 
 /**
  * \brief Structure for processing data/template records
+ *
+ * Profile is applied in two passes. The first one evaluates the filter and
+ * marks selected data records in a bitmap, the second one copies selected
+ * records into a packet of the exact size (or compacts the original packet).
  */
 struct filter_process {
-	uint8_t *ptr;		/**< pointer to new IPFIX message */
-	int *offset;		/**< offset in message */
+	struct filter_config *config;   /**< plugin configuration (bitmap) */
 	struct filter_profile *profile; /**< used filter profile */
-	int records;		/**< number of filtered records */
-	struct metadata *metadata;
+	int index;          /**< index of processed data record */
+	int records;        /**< number of selected records */
+	int length;         /**< length of selected records */
+	uint8_t *ptr;       /**< new IPFIX packet */
+	int offset;         /**< offset in new packet */
+	uint8_t *run;       /**< first record of the run of selected records */
+	int run_length;     /**< length of the run */
+	struct metadata *src_metadata; /**< metadata of original message */
+	int src_records;    /**< number of records of original message */
+	struct metadata *metadata;     /**< metadata of new message */
+	bool in_place;      /**< original packet and metadata are reused */
+	struct data_record_decoder decoder; /**< decoder of processed data record */
 };
 
 /**
@@ -375,16 +388,15 @@ cleanup_err:
  * \brief Check whether value in data record fits with node expression
  *
  * \param[in] node Filter tree node
- * \param[in] rec Data record
- * \param[in] templ Data record's template
+ * \param[in] rec Decoded data record
  * \return true if data record's field fits
  */
-bool filter_fits_value(struct filter_treenode *node, uint8_t *rec, struct ipfix_template *templ)
+bool filter_fits_value(struct filter_treenode *node, struct data_record_decoder *rec)
 {
 	int datalen;
 	
 	/* Get data from record */
-	uint8_t *recdata = data_record_get_field(rec, templ, node->field->enterprise, node->field->id, &datalen);
+	uint8_t *recdata = data_record_decoder_get_field(rec, node->field->enterprise, node->field->id, &datalen);
 	if (!recdata) {
 		/* Field not found - if op is '!=' it is success */
 		return node->op == OP_NOT_EQUAL;
@@ -432,18 +444,17 @@ bool filter_fits_value(struct filter_treenode *node, uint8_t *rec, struct ipfix_
  * \brief Check whether string in data record fits with node
  *
  * \param[in] node Filter tree node
- * \param[in] rec Data record
- * \param[in] templ Data record's template
+ * \param[in] rec Decoded data record
  * \return true if data record's field fits
  */
-bool filter_fits_string(struct filter_treenode *node, uint8_t *rec, struct ipfix_template *templ)
+bool filter_fits_string(struct filter_treenode *node, struct data_record_decoder *rec)
 {
 	int datalen = 0, vallen = node->value->length;
 	char *pos = NULL, *prevpos = NULL;
 	bool result = false;
 
 	/* Get data from record */
-	uint8_t *recdata = data_record_get_field(rec, templ, node->field->enterprise, node->field->id, &datalen);
+	uint8_t *recdata = data_record_decoder_get_field(rec, node->field->enterprise, node->field->id, &datalen);
 	if (!recdata) {
 		return node->op == OP_NOT_EQUAL;
 	}
@@ -500,18 +511,17 @@ bool filter_fits_string(struct filter_treenode *node, uint8_t *rec, struct ipfix
  * \brief Check whether string in data record fits with node's regex
  *
  * \param[in] node Filter tree node
- * \param[in] rec Data record
- * \param[in] templ Data record's template
+ * \param[in] rec Decoded data record
  * \return true if data record's field fits
  */
-bool filter_fits_regex(struct filter_treenode *node, uint8_t *rec, struct ipfix_template *templ)
+bool filter_fits_regex(struct filter_treenode *node, struct data_record_decoder *rec)
 {
 	int datalen = 0;
 	bool result = false;
 	regex_t *regex = (regex_t *) node->value->value;
 
 	/* Get data from record */
-	uint8_t *recdata = data_record_get_field(rec, templ, node->field->enterprise, node->field->id, &datalen);
+	uint8_t *recdata = data_record_decoder_get_field(rec, node->field->enterprise, node->field->id, &datalen);
 	if (!recdata) {
 		return node->op == OP_NOT_EQUAL;
 	}
@@ -537,24 +547,22 @@ bool filter_fits_regex(struct filter_treenode *node, uint8_t *rec, struct ipfix_
  * \brief Check whether data record contains given field
  *
  * \param[in] node Filter tree node
- * \param[in] rec Data record
- * \param[in] templ Data record's template
+ * \param[in] rec Decoded data record
  * \return true if data record's field fits
  */
-bool filter_fits_exists(struct filter_treenode *node, uint8_t *rec, struct ipfix_template *templ)
+bool filter_fits_exists(struct filter_treenode *node, struct data_record_decoder *rec)
 {
-	return data_record_get_field(rec, templ, node->field->enterprise, node->field->id, NULL);
+	return data_record_decoder_get_field(rec, node->field->enterprise, node->field->id, NULL);
 }
 
 /**
  * \brief Check whether node (and it's children) fits on data record
  *
  * \param[in] node Filter tree node
- * \param[in] rec Data record
- * \param[in] templ Data record's template
+ * \param[in] rec Decoded data record
  * \return true if data record's field fits
  */
-bool filter_fits_node(struct filter_treenode *node, uint8_t *rec, struct ipfix_template *templ)
+bool filter_fits_node(struct filter_treenode *node, struct data_record_decoder *rec)
 {
 	/**
 	 * return result modified by negation flag
@@ -562,51 +570,101 @@ bool filter_fits_node(struct filter_treenode *node, uint8_t *rec, struct ipfix_t
 	 */
 	switch (node->type) {
 	case NODE_AND:
-		return (node->negate) ^ (filter_fits_node(node->left, rec, templ) && filter_fits_node(node->right, rec, templ));
+		return (node->negate) ^ (filter_fits_node(node->left, rec) && filter_fits_node(node->right, rec));
 	case NODE_OR:
-		return (node->negate) ^ (filter_fits_node(node->left, rec, templ) || filter_fits_node(node->right, rec, templ));
+		return (node->negate) ^ (filter_fits_node(node->left, rec) || filter_fits_node(node->right, rec));
 	case NODE_EXISTS:
-		return (node->negate) ^ (filter_fits_exists(node, rec, templ));
+		return (node->negate) ^ (filter_fits_exists(node, rec));
 	default: /* LEAF node */
 		switch (node->value->type) {
 		case VT_STRING:
-			return (node->negate) ^ filter_fits_string(node, rec, templ);
+			return (node->negate) ^ filter_fits_string(node, rec);
 		case VT_REGEX:
-			return (node->negate) ^ filter_fits_regex(node, rec, templ);
+			return (node->negate) ^ filter_fits_regex(node, rec);
 		default:
-			return (node->negate) ^ filter_fits_value(node, rec, templ);
+			return (node->negate) ^ filter_fits_value(node, rec);
 		}
 	}
 }
 
 /**
- * \brief Copy (options) template sets from original message
+ * \brief Mark data record in selection bitmap
  *
- * \param[in] msg Original message
- * \param[in] ptr Destination
- * \param[in] offset Offset in new message
+ * \param[in] config Plugin configuration
+ * \param[in] index Index of data record
+ * \return 0 on success
  */
-void filter_add_template_sets(struct ipfix_message *msg, uint8_t *ptr, int *offset)
+static int filter_select(struct filter_config *config, int index)
 {
-	int length, i;
+	int words = index / 64 + 1;
+	uint64_t *selection;
+
+	if (words > config->selection_size) {
+		words = (words > 2 * config->selection_size) ? words : 2 * config->selection_size;
+		selection = realloc(config->selection, words * sizeof(uint64_t));
+		if (!selection) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
 
-	/* Copy template sets */
-	for (i = 0; i < MSG_MAX_TEMPL_SETS && msg->templ_set[i]; ++i) {
-		length = ntohs(msg->templ_set[i]->header.length);
-		memcpy(ptr + *offset, msg->templ_set[i], length);
-		*offset += length;
+		memset(selection + config->selection_size, 0, (words - config->selection_size) * sizeof(uint64_t));
+		config->selection = selection;
+		config->selection_size = words;
 	}
 
-	/* Copy options template sets */
-	for (i = 0; i < MSG_MAX_OTEMPL_SETS && msg->opt_templ_set[i]; ++i) {
-		length = ntohs(msg->opt_templ_set[i]->header.length);
-		memcpy(ptr + *offset, msg->opt_templ_set[i], length);
-		*offset += length;
+	config->selection[index / 64] |= (uint64_t) 1 << (index % 64);
+	return 0;
+}
+
+/**
+ * \brief Check whether data record is selected
+ */
+static inline bool filter_selected(struct filter_config *config, int index)
+{
+	return index / 64 < config->selection_size
+		&& (config->selection[index / 64] & ((uint64_t) 1 << (index % 64)));
+}
+
+/**
+ * \brief Evaluate filter on one data record and mark it when it fits
+ *
+ * \param[in] rec Data record
+ * \param[in] rec_len Data record's length
+ * \param[in] templ Data record's template
+ * \param[in] data Processing data
+ */
+void filter_select_data_record(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	struct filter_process *conf = (struct filter_process *) data;
+
+	/* Apply filter, fields are located only once per record */
+	data_record_decode(&conf->decoder, rec, templ);
+	if (filter_fits_node(conf->profile->root, &conf->decoder)
+			&& !filter_select(conf->config, conf->index)) {
+		conf->records++;
+		conf->length += rec_len;
+	}
+
+	conf->index++;
+}
+
+/**
+ * \brief Copy pending run of selected records into new packet
+ */
+static void filter_flush_run(struct filter_process *conf)
+{
+	if (conf->run_length) {
+		/* Destination never follows the source, memmove is safe in place */
+		memmove(conf->ptr + conf->offset, conf->run, conf->run_length);
+		conf->offset += conf->run_length;
+		conf->run_length = 0;
 	}
 }
 
 /**
- * \brief Process one data record
+ * \brief Copy one data record if it was selected
+ *
+ * Adjacent selected records are copied at once.
  *
  * \param[in] rec Data record
  * \param[in] rec_len Data record's length
@@ -616,20 +674,57 @@ void filter_add_template_sets(struct ipfix_message *msg, uint8_t *ptr, int *offs
 void filter_process_data_record(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
 {
 	struct filter_process *conf = (struct filter_process *) data;
+	int index = conf->index++;
+	struct metadata *mdata;
+
+	if (!filter_selected(conf->config, index)) {
+		/* Profiles of dropped record are not needed any more */
+		if (conf->in_place && index < conf->src_records && conf->src_metadata[index].channels) {
+			free(conf->src_metadata[index].channels);
+			conf->src_metadata[index].channels = NULL;
+		}
+		return;
+	}
 
-	/* Apply filter */
-	if (filter_fits_node(conf->profile->root, rec, templ)) {
-		memcpy(conf->ptr + *(conf->offset), rec, rec_len);
+	if (conf->run_length && conf->run + conf->run_length != rec) {
+		filter_flush_run(conf);
+	}
+
+	if (!conf->run_length) {
+		conf->run = rec;
+	}
 
-		if (conf->metadata) {
-			conf->metadata[conf->records].record.record = conf->ptr + *(conf->offset);
-			conf->metadata[conf->records].record.length = rec_len;
-			conf->metadata[conf->records].record.templ = templ;
+	if (conf->metadata && index < conf->src_records) {
+		mdata = &(conf->metadata[conf->records]);
+		if (conf->in_place) {
+			/* Move metadata including profiles */
+			memmove(mdata, &(conf->src_metadata[index]), sizeof(struct metadata));
+		} else {
+			memcpy(mdata, &(conf->src_metadata[index]), sizeof(struct metadata));
+			mdata->channels = NULL;
+			if (conf->src_metadata[index].channels) {
+				uint16_t channels = 0;
+				while (conf->src_metadata[index].channels[channels]) {
+					channels++;
+				}
+
+				mdata->channels = calloc(channels + 1, sizeof(void *));
+				if (mdata->channels) {
+					memcpy(mdata->channels, conf->src_metadata[index].channels, channels * sizeof(void *));
+				} else {
+					MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+				}
+			}
 		}
 
-		*(conf->offset) += rec_len;
-		conf->records++;
+		/* Record is placed after the records of pending run */
+		mdata->record.record = conf->ptr + conf->offset + conf->run_length;
+		mdata->record.length = rec_len;
+		mdata->record.templ = templ;
 	}
+
+	conf->run_length += rec_len;
+	conf->records++;
 }
 
 /**
@@ -686,26 +781,148 @@ void filter_copy_metainfo(struct ipfix_message *src, struct ipfix_message *dst)
 	dst->opt_templ_records_count = src->opt_templ_records_count;
 }
 
+/**
+ * \brief Check whether all sets of message lie in its packet
+ *
+ * Only such packet can be compacted in place.
+ */
+static bool filter_sets_in_packet(struct ipfix_message *msg)
+{
+	uint8_t *begin = (uint8_t *) msg->pkt_header;
+	uint8_t *end = begin + ntohs(msg->pkt_header->length);
+	uint8_t *set;
+	int i;
+
+	for (i = 0; i < MSG_MAX_TEMPL_SETS && msg->templ_set[i]; ++i) {
+		set = (uint8_t *) msg->templ_set[i];
+		if (set < begin + IPFIX_HEADER_LENGTH || set + ntohs(msg->templ_set[i]->header.length) > end) {
+			return false;
+		}
+	}
+
+	for (i = 0; i < MSG_MAX_OTEMPL_SETS && msg->opt_templ_set[i]; ++i) {
+		set = (uint8_t *) msg->opt_templ_set[i];
+		if (set < begin + IPFIX_HEADER_LENGTH || set + ntohs(msg->opt_templ_set[i]->header.length) > end) {
+			return false;
+		}
+	}
+
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		set = (uint8_t *) msg->data_couple[i].data_set;
+		if (set < begin + IPFIX_HEADER_LENGTH || set + ntohs(msg->data_couple[i].data_set->header.length) > end) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * \brief Copy (options) template sets and selected data records into new message
+ *
+ * Sets are written in the order of the original packet, so the destination
+ * never follows the source and the original packet can be used as the
+ * destination.
+ *
+ * \param[in] msg Original message
+ * \param[in] new_msg New message
+ * \param[in] conf Processing data
+ */
+static void filter_copy_sets(struct ipfix_message *msg, struct ipfix_message *new_msg, struct filter_process *conf)
+{
+	int t = 0, o = 0, d = 0, new_t = 0, new_o = 0, new_d = 0, length, start;
+	uint8_t *tset, *oset, *dset;
+	uint16_t flowset_id;
+	struct ipfix_set_header *header;
+	struct ipfix_template *templ;
+
+	while (true) {
+		tset = (t < MSG_MAX_TEMPL_SETS) ? (uint8_t *) msg->templ_set[t] : NULL;
+		oset = (o < MSG_MAX_OTEMPL_SETS) ? (uint8_t *) msg->opt_templ_set[o] : NULL;
+		dset = (d < MSG_MAX_DATA_COUPLES) ? (uint8_t *) msg->data_couple[d].data_set : NULL;
+
+		if (tset && (!oset || tset < oset) && (!dset || tset < dset)) {
+			/* Template set */
+			length = ntohs(msg->templ_set[t++]->header.length);
+			memmove(conf->ptr + conf->offset, tset, length);
+			new_msg->templ_set[new_t++] = (struct ipfix_template_set *) (conf->ptr + conf->offset);
+			conf->offset += length;
+		} else if (oset && (!dset || oset < dset)) {
+			/* Options template set */
+			length = ntohs(msg->opt_templ_set[o++]->header.length);
+			memmove(conf->ptr + conf->offset, oset, length);
+			new_msg->opt_templ_set[new_o++] = (struct ipfix_options_template_set *) (conf->ptr + conf->offset);
+			conf->offset += length;
+		} else if (dset) {
+			templ = msg->data_couple[d++].data_template;
+			if (!templ) {
+				/* Data set without template, skip it */
+				continue;
+			}
+
+			/* Copy records, set header is written afterwards (it may overlap the original one) */
+			flowset_id = ((struct ipfix_set_header *) dset)->flowset_id;
+			start = conf->offset;
+			conf->offset += sizeof(struct ipfix_set_header);
+
+			data_set_process_records((struct ipfix_data_set *) dset, templ, &filter_process_data_record, (void *) conf);
+			filter_flush_run(conf);
+
+			if (conf->offset == start + (int) sizeof(struct ipfix_set_header)) {
+				/* No data records were selected, rollback */
+				conf->offset = start;
+				continue;
+			}
+
+			/* Set header with new length, template is the one of the original set */
+			header = (struct ipfix_set_header *) (conf->ptr + start);
+			header->flowset_id = flowset_id;
+			header->length = htons(conf->offset - start);
+
+			new_msg->data_couple[new_d].data_set = (struct ipfix_data_set *) header;
+			new_msg->data_couple[new_d].data_template = templ;
+			tm_template_reference_inc(templ);
+			new_d++;
+		} else {
+			break;
+		}
+	}
+
+	new_msg->templ_set[new_t] = NULL;
+	new_msg->opt_templ_set[new_o] = NULL;
+	new_msg->data_couple[new_d].data_set = NULL;
+}
+
 /**
  * \brief Apply profile filter on message and change ODID if it fits
  *
+ * Selected records are first marked in a bitmap. New packet is then allocated
+ * with the exact size and filled with the header, (options) template sets and
+ * selected records, the set lists are built directly without parsing the
+ * packet again.
+ *
+ * When \p in_place is set, the original message is not used after this call:
+ * its packet and metadata are compacted in place and handed over to the new
+ * message. Caller must drop the original message then.
+ *
+ * \param[in] config Plugin configuration
  * \param[in] msg IPFIX message
  * \param[in] profile Filter profile
+ * \param[in,out] in_place Reuse the original packet; cleared if it was not reused
  * \return pointer to new ipfix message
  */
-struct ipfix_message *filter_apply_profile(struct ipfix_message *msg, struct filter_profile *profile)
+struct ipfix_message *filter_apply_profile(struct filter_config *config, struct ipfix_message *msg, struct filter_profile *profile, bool *in_place)
 {
 	struct ipfix_message *new_msg = NULL;
 	struct ipfix_header *header = NULL;
 	struct filter_process conf;
-	int i, j, offset = 0, oldoffset;
-	uint8_t *ptr = NULL;
+	int i, length;
 	
 	if (msg->source_status == SOURCE_STATUS_CLOSED) {
+		*in_place = false;
 		filter_profile_update_input_info(profile, msg->input_info, msg->data_records_count);
-		new_msg = calloc(1, sizeof(struct ipfix_message));
+		new_msg = message_create_sized(0, 0, 0);
 		if (!new_msg) {
-			MSG_ERROR(msg_module, "Not enough memory (%s:%d)", __FILE__, __LINE__);
 			return NULL;
 		}
 		
@@ -714,79 +931,96 @@ struct ipfix_message *filter_apply_profile(struct ipfix_message *msg, struct fil
 		return new_msg;
 	}
 
-	/* Allocate space */
-	ptr = calloc(1, ntohs(msg->pkt_header->length));
-	if (!ptr) {
-		MSG_ERROR(msg_module, "Not enough memory (%s:%d)", __FILE__, __LINE__);
-		return NULL;
-	}
-
-	conf.offset = &offset;
-	conf.ptr = ptr;
+	memset(&conf, 0, sizeof(conf));
+	conf.config = config;
 	conf.profile = profile;
-	conf.records = 0;
-	conf.metadata = message_copy_metadata(msg);
 
-	/* Copy header */
-	memcpy(ptr, msg->pkt_header, IPFIX_HEADER_LENGTH);
-	offset += IPFIX_HEADER_LENGTH;
-
-	/* Copy (options) template sets */
-	filter_add_template_sets(msg, ptr, &offset);
+	/* Select data records */
+	if (config->selection_size) {
+		memset(config->selection, 0, config->selection_size * sizeof(uint64_t));
+	}
 
-	/* Filter data records */
+	length = IPFIX_HEADER_LENGTH;
 	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
 		if (!msg->data_couple[i].data_template) {
-			/* Data set without template, skip it */
 			continue;
 		}
-		
-		oldoffset = offset;
-		
-		/* Copy set header */
-		memcpy(ptr + offset, &(msg->data_couple[i].data_set->header), sizeof(struct ipfix_set_header));
-		offset += sizeof(struct ipfix_set_header);
-
-		/* Process data records */
-		data_set_process_records(msg->data_couple[i].data_set, msg->data_couple[i].data_template, &filter_process_data_record, (void *) &conf);
 
-		if (offset == oldoffset + 4) {
-			/* No data records were copied, rollback */
-			offset = oldoffset;
-			continue;
+		conf.length = 0;
+		data_set_process_records(msg->data_couple[i].data_set, msg->data_couple[i].data_template, &filter_select_data_record, (void *) &conf);
+		if (conf.length) {
+			length += sizeof(struct ipfix_set_header) + conf.length;
 		}
+	}
+
+	data_record_decoder_clear(&conf.decoder);
 
-		/* Update data set length */
-		((struct ipfix_set_header *) ((uint8_t *) ptr + oldoffset))->length = htons(offset - oldoffset);
+	/* (Options) template sets are copied as a whole */
+	for (i = 0; i < MSG_MAX_TEMPL_SETS && msg->templ_set[i]; ++i) {
+		length += ntohs(msg->templ_set[i]->header.length);
 	}
 
-	if (offset == IPFIX_HEADER_LENGTH) {
+	for (i = 0; i < MSG_MAX_OTEMPL_SETS && msg->opt_templ_set[i]; ++i) {
+		length += ntohs(msg->opt_templ_set[i]->header.length);
+	}
+
+	if (length == IPFIX_HEADER_LENGTH) {
 		/* empty message */
-		free(ptr);
+		*in_place = false;
 		return NULL;
 	}
 
-	/* Modify header and create IPFIX message */
-	header = (struct ipfix_header *) ptr;
+	new_msg = message_create_sized_as(msg);
+	if (!new_msg) {
+		*in_place = false;
+		return NULL;
+	}
 
-	header->sequence_number = htonl(filter_profile_update_input_info(profile, msg->input_info, conf.records));
-	header->length = ntohs(offset);
-	header->observation_domain_id = htonl(profile->new_odid);
+	/* Compact original packet or allocate new one */
+	*in_place = *in_place && filter_sets_in_packet(msg);
+	conf.in_place = *in_place;
+	if (conf.in_place) {
+		conf.ptr = (uint8_t *) msg->pkt_header;
+	} else {
+		conf.ptr = message_packet_alloc(length);
+		if (!conf.ptr) {
+			free(new_msg);
+			return NULL;
+		}
 
-	/* Create new IPFIX message */
-	new_msg = message_create_from_mem(ptr, offset, profile->input_info, msg->source_status);
+		memcpy(conf.ptr, msg->pkt_header, IPFIX_HEADER_LENGTH);
+	}
 
-	/* Match data couples and increment template references */
-	for (i = 0; i < MSG_MAX_DATA_COUPLES && new_msg->data_couple[i].data_set; ++i) {
-		for (j = 0; j < MSG_MAX_DATA_COUPLES && msg->data_couple[j].data_set; ++j) {
-			if (new_msg->data_couple[i].data_set->header.flowset_id == msg->data_couple[j].data_set->header.flowset_id) {
-				new_msg->data_couple[i].data_template = msg->data_couple[j].data_template;
-				break;
-			}
+	/* Metadata only for selected records */
+	conf.src_metadata = msg->metadata;
+	conf.src_records = (msg->metadata) ? msg->data_records_count : 0;
+	if (msg->metadata && conf.records) {
+		conf.metadata = (conf.in_place) ? msg->metadata : message_metadata_alloc(conf.records);
+	}
+
+	conf.offset = IPFIX_HEADER_LENGTH;
+	conf.index = 0;
+	conf.records = 0;
+	filter_copy_sets(msg, new_msg, &conf);
+
+	if (conf.in_place) {
+		/* Packet (and metadata if used) belong to the new message now */
+		msg->pkt_header = NULL;
+		if (conf.metadata) {
+			msg->metadata = NULL;
 		}
-		tm_template_reference_inc(new_msg->data_couple[i].data_template);
 	}
 
+	/* Modify header */
+	header = (struct ipfix_header *) conf.ptr;
+
+	header->sequence_number = htonl(filter_profile_update_input_info(profile, msg->input_info, conf.records));
+	header->length = htons(conf.offset);
+	header->observation_domain_id = htonl(profile->new_odid);
+
+	new_msg->pkt_header = header;
+	new_msg->input_info = profile->input_info;
+
 	/* Set counters */
 	new_msg->metadata = conf.metadata;
 	new_msg->data_records_count = conf.records;
@@ -796,50 +1030,67 @@ struct ipfix_message *filter_apply_profile(struct ipfix_message *msg, struct fil
 	return new_msg;
 }
 
+/**
+ * \brief Check whether profile is used for given source
+ */
+static bool filter_profile_has_source(struct filter_profile *profile, uint32_t odid)
+{
+	struct filter_source *aux_src;
+
+	/* Go throught all sources for this profile */
+	for (aux_src = profile->sources; aux_src; aux_src = aux_src->next) {
+		if (aux_src->id == odid) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 int intermediate_process_message(void *config, void *message)
 {
 	struct ipfix_message *msg = (struct ipfix_message *) message, *new_msg;
 	struct filter_config *conf = (struct filter_config *) config;
-	struct filter_profile *aux_profile = NULL;
-	struct filter_source *aux_src = NULL;
+	struct filter_profile *aux_profile = NULL, *last_profile = NULL;
 	uint32_t orig_odid = msg->input_info->odid;
-	int profiles = 0;
+	bool in_place;
 
-	/* Go throught all profiles */
+	/* Find the last profile for this source, it can take the original packet */
 	for (aux_profile = conf->profiles; aux_profile; aux_profile = aux_profile->next) {
-		/* Go throught all sources for this profile */
-		for (aux_src = aux_profile->sources; aux_src; aux_src = aux_src->next) {
-			if (aux_src->id == orig_odid) {
-				break;
-			}
-		}
-
-		if (!aux_src) {
-			/* Profile is not for this source */
-			continue;
-		}
-
-		profiles++;
-
-		new_msg = filter_apply_profile(msg, aux_profile);
-		if (new_msg) {
-			pass_message(conf->ip_config, (void *) new_msg);
+		if (filter_profile_has_source(aux_profile, orig_odid)) {
+			last_profile = aux_profile;
 		}
 	}
 
-	/* No profile for this source */
-	if (!profiles) {
-		if (conf->default_profile) {
-			/* Use default profile */
-			new_msg = filter_apply_profile(msg, conf->default_profile);
+	if (last_profile) {
+		/* Go throught all profiles */
+		for (aux_profile = conf->profiles; aux_profile; aux_profile = aux_profile->next) {
+			if (!filter_profile_has_source(aux_profile, orig_odid)) {
+				/* Profile is not for this source */
+				continue;
+			}
+
+			in_place = conf->remove_original && aux_profile == last_profile;
+			new_msg = filter_apply_profile(conf, msg, aux_profile, &in_place);
 			if (new_msg) {
 				pass_message(conf->ip_config, (void *) new_msg);
 			}
-		} else {
-			/* No profile found for this ODID */
-			pass_message(conf->ip_config, message);
-			return 0;
+
+			if (aux_profile == last_profile) {
+				break;
+			}
 		}
+	} else if (conf->default_profile) {
+		/* No profile for this source, use default profile */
+		in_place = conf->remove_original;
+		new_msg = filter_apply_profile(conf, msg, conf->default_profile, &in_place);
+		if (new_msg) {
+			pass_message(conf->ip_config, (void *) new_msg);
+		}
+	} else {
+		/* No profile found for this ODID */
+		pass_message(conf->ip_config, message);
+		return 0;
 	}
 
 	/* Remove original message if set */
@@ -869,6 +1120,7 @@ int intermediate_close(void *config)
 		filter_free_profile(conf->default_profile);
 	}
 
+	free(conf->selection);
 	free(conf);
 	return 0;
 }
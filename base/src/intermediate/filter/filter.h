@@ -99,6 +99,8 @@ struct filter_config {
 	void *ip_config;        /**< plugin configuration for IPFIXcol */
 	struct filter_profile *profiles;        /**< list of filter profiles */
 	struct filter_profile *default_profile; /**< default profile */
+	uint64_t *selection;    /**< bitmap of data records selected by profile */
+	int selection_size;     /**< capacity of the bitmap (in words) */
 };
 
 /**
@@ -879,9 +879,8 @@ int intermediate_process_message(void *config, void *message)
 		return 1;
 	}
 
-	new_msg = calloc(1, sizeof(struct ipfix_message));
+	new_msg = message_create_sized_as(msg);
 	if (!new_msg) {
-		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
 		free(proc.msg);
 		return 1;
 	}
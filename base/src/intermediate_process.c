@@ -54,7 +54,8 @@ static char *msg_module = "intermediate_process";
 /**
  * \brief Wait for data from input queue in loop.
  *
- * This function runs in separated thread.
+ * This function runs in separated thread. Messages are read in batches,
+ * plugins without batch API get them one by one.
  *
  * \param[in] config configuration structure
  * \return NULL
@@ -62,19 +63,23 @@ static char *msg_module = "intermediate_process";
 void *ip_loop(void *config)
 {
 	struct intermediate *conf = (struct intermediate *) config;
-	struct ipfix_message *msg;
-	unsigned int index;
+	struct ipfix_message *batch[RBUFFER_BATCH_SIZE];
+	bool dropped[RBUFFER_BATCH_SIZE];
+	unsigned int index, count, start, i;
 
 	prctl(PR_SET_NAME, conf->thread_name, 0, 0, 0);
 
+	conf->batch = batch;
+	conf->dropped = dropped;
+
 	/* wait for messages and process them */
 	while (1) {
 		index = -1;
 
-		/* get message from input buffer */
-		msg = rbuffer_read(conf->in_queue, &index);
+		/* get messages from input buffer */
+		count = rbuffer_read_batch(conf->in_queue, &index, batch, RBUFFER_BATCH_SIZE);
 		
-		if (!msg) {
+		if (!batch[0]) {
 			rbuffer_remove_reference(conf->in_queue, index, 1);
 			if (conf->new_in) {
 				/* Set new input queue */
@@ -88,16 +93,33 @@ void *ip_loop(void *config)
 			MSG_DEBUG(msg_module, "NULL message; terminating intermediate process %s...", conf->thread_name);
 			break;
 		}
-		conf->index = index;
-		conf->dropped = false;
+		conf->batch_index = index;
+		conf->batch_count = count;
+		memset(dropped, 0, count * sizeof(bool));
 		
-		/* process message */
-		conf->intermediate_process_message(conf->plugin_config, msg);
+		/* process messages */
+		if (conf->intermediate_process_messages) {
+			conf->current = (unsigned int) -1;
+			conf->intermediate_process_messages(conf->plugin_config, batch, count);
+		} else {
+			for (i = 0; i < count; ++i) {
+				conf->current = i;
+				conf->intermediate_process_message(conf->plugin_config, batch[i]);
+			}
+		}
+
+		/* remove messages from input queue, but do not free memory (it must be done later in output manager) */
+		i = 0;
+		while (i < count) {
+			/* dropped messages are already removed */
+			for (; i < count && dropped[i]; ++i) {}
+			for (start = i; i < count && !dropped[i]; ++i) {}
 
-		if (!conf->dropped) {
-			/* remove message from input queue, but do not free memory (it must be done later in output manager) */
-			rbuffer_remove_reference(conf->in_queue, index, 0);
+			if (i > start) {
+				rbuffer_remove_references(conf->in_queue, (index + start) % conf->in_queue->size, i - start, 0);
+			}
 		}
+		conf->batch_count = 0;
 	}
 	
 	return NULL;
@@ -176,10 +198,29 @@ int pass_message(void *config, struct ipfix_message *msg)
 int drop_message(void *config, struct ipfix_message *msg)
 {
 	struct intermediate *conf = (struct intermediate *) config;
-	(void) msg;
+	unsigned int i = conf->current;
+
+	if (i >= conf->batch_count || conf->batch[i] != msg) {
+		/* find the message in the batch */
+		for (i = 0; i < conf->batch_count && conf->batch[i] != msg; ++i) {}
+
+		if (i == conf->batch_count) {
+			if (conf->current >= conf->batch_count) {
+				MSG_WARNING(msg_module, "Dropped message is not being processed; skipping...");
+				return -1;
+			}
+
+			/* drop the message being processed */
+			i = conf->current;
+		}
+	}
+
+	if (conf->dropped[i]) {
+		return 0;
+	}
 
-	rbuffer_remove_reference(conf->in_queue, conf->index, 1);
-	conf->dropped = true;
+	rbuffer_remove_reference(conf->in_queue, (conf->batch_index + i) % conf->in_queue->size, 1);
+	conf->dropped[i] = true;
 	
 	return 0;
 }
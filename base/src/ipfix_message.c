@@ -86,40 +86,29 @@ static struct offset_field offsets[] = {
 struct ipfix_message *message_create_from_mem(void *msg, int len, struct input_info* input_info, int source_status)
 {
 	struct ipfix_message *message;
+	struct ipfix_header *header = (struct ipfix_header *) msg;
 	uint32_t odid;
 	uint16_t pktlen;
 
-	message = (struct ipfix_message*) calloc (1, sizeof(struct ipfix_message));
-	if (!message) {
-		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-		return NULL;
-	}
-
-	message->pkt_header = (struct ipfix_header*) msg;
-	message->input_info = input_info;
-	message->source_status = source_status;
-
-	odid = ntohl(message->pkt_header->observation_domain_id);
+	odid = ntohl(header->observation_domain_id);
 	MSG_DEBUG(msg_module, "[%u] Processing data", odid);
 
 	/* check IPFIX version */
-	if (message->pkt_header->version != htons(IPFIX_VERSION)) {
+	if (header->version != htons(IPFIX_VERSION)) {
 		MSG_WARNING(msg_module, "[%u] Unexpected IPFIX version detected (%X); skipping message...", odid,
-				message->pkt_header->version);
-		free(message);
+				header->version);
 		return NULL;
 	}
 
-	pktlen = ntohs(message->pkt_header->length);
+	pktlen = ntohs(header->length);
 
 	/* check whether message is not shorter than header says */
 	if ((uint16_t) len < pktlen) {
 		MSG_WARNING(msg_module, "[%u] Malformed IPFIX message detected (bad length); skipping message...", odid);
-		free (message);
 		return NULL;
 	}
 
-	/* process IPFIX msg and fill up the ipfix_message structure */
+	/* count sets to get the size of the ipfix_message structure */
 	uint8_t *p = msg + IPFIX_HEADER_LENGTH;
 	int t_set_count = 0;
 	int ot_set_count = 0;
@@ -129,21 +118,20 @@ struct ipfix_message *message_create_from_mem(void *msg, int len, struct input_i
 		set_header = (struct ipfix_set_header*) p;
 		if ((uint8_t *) p + ntohs(set_header->length) > (uint8_t *) msg + pktlen) {
 			MSG_WARNING(msg_module, "[%u] Malformed IPFIX message detected (bad length); skipping message...", odid);
-			free(message);
 			return NULL;
 		}
 		switch (ntohs(set_header->flowset_id)) {
 			case IPFIX_TEMPLATE_FLOWSET_ID:
-				message->templ_set[t_set_count++] = (struct ipfix_template_set *) set_header;
+				t_set_count++;
 				break;
 			case IPFIX_OPTION_FLOWSET_ID:
-				 message->opt_templ_set[ot_set_count++] = (struct ipfix_options_template_set *) set_header;
+				ot_set_count++;
 				break;
 			default:
 				if (ntohs(set_header->flowset_id) < IPFIX_MIN_RECORD_FLOWSET_ID) {
 					MSG_WARNING(msg_module, "[%u] Unknown Set ID %d", odid, ntohs(set_header->flowset_id));
 				} else {
-					message->data_couple[d_set_count++].data_set = (struct ipfix_data_set*) set_header;
+					d_set_count++;
 				}
 				break;
 		}
@@ -156,6 +144,41 @@ struct ipfix_message *message_create_from_mem(void *msg, int len, struct input_i
 		p += ntohs(set_header->length);
 	}
 
+	message = message_create_sized(t_set_count, ot_set_count, d_set_count);
+	if (!message) {
+		return NULL;
+	}
+
+	message->pkt_header = header;
+	message->input_info = input_info;
+	message->source_status = source_status;
+
+	/* process IPFIX msg and fill up the ipfix_message structure */
+	p = msg + IPFIX_HEADER_LENGTH;
+	t_set_count = ot_set_count = d_set_count = 0;
+	while (p < (uint8_t *) msg + pktlen) {
+		set_header = (struct ipfix_set_header*) p;
+		switch (ntohs(set_header->flowset_id)) {
+			case IPFIX_TEMPLATE_FLOWSET_ID:
+				message->templ_set[t_set_count++] = (struct ipfix_template_set *) set_header;
+				break;
+			case IPFIX_OPTION_FLOWSET_ID:
+				message->opt_templ_set[ot_set_count++] = (struct ipfix_options_template_set *) set_header;
+				break;
+			default:
+				if (ntohs(set_header->flowset_id) >= IPFIX_MIN_RECORD_FLOWSET_ID) {
+					message->data_couple[d_set_count++].data_set = (struct ipfix_data_set*) set_header;
+				}
+				break;
+		}
+
+		if (ntohs(set_header->length) == 0) {
+			break;
+		}
+
+		p += ntohs(set_header->length);
+	}
+
 	return message;
 }
 
@@ -329,9 +352,8 @@ struct ipfix_message *message_create_empty()
 	struct ipfix_message *message;
 	struct ipfix_header *header;
 
-	message = (struct ipfix_message *) calloc(1, sizeof(*message));
+	message = message_create_sized(MSG_MAX_TEMPL_SETS, MSG_MAX_OTEMPL_SETS, MSG_MAX_DATA_COUPLES);
 	if (!message) {
-		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		return NULL;
 	}
 
@@ -495,6 +517,31 @@ int data_record_field_next_offset(uint8_t *data_record, struct ipfix_template *t
 	int count, offset = 0, index, length, prev_offset;
 	struct ipfix_template_row *row = NULL;
 
+	if (templ->map) {
+		/* Compiled template, static offsets are known up to the first variable-length field */
+		struct ipfix_template_field *field;
+		for (index = template_map_find(templ->map, enterprise, id); index >= 0; index = field->next) {
+			field = &templ->map->fields[index];
+			if (index >= templ->map->var_first) {
+				/* Offset depends on the data record */
+				break;
+			}
+
+			if (field->offset > from_offset) {
+				if (data_length) {
+					*data_length = field->length;
+				}
+
+				return field->offset;
+			}
+		}
+
+		if (index < 0) {
+			/* Field not found */
+			return -1;
+		}
+	}
+
 	if (!(templ->data_length & 0x80000000)) {
 		/* Data record with no variable length field */
 		row = template_get_field(templ, enterprise, id, &offset);
@@ -585,6 +632,12 @@ uint8_t *data_record_get_field(uint8_t *record, struct ipfix_template *templ, ui
 {
 	int offset_id = OF_COUNT;
 
+	if (templ->map) {
+		/* Compiled template, no need for the cache of common fields */
+		int offset = data_record_field_offset(record, templ, enterprise, id, data_length);
+		return (offset < 0) ? NULL : (uint8_t *) record + offset;
+	}
+
 	if (enterprise == 0) {
 		/* Check whether we have offset field for this ID */
 		for (offset_id = 0; offset_id < OF_COUNT; ++offset_id) {
@@ -630,6 +683,50 @@ void data_record_set_field(uint8_t *record, struct ipfix_template *templ, uint32
 	}
 }
 
+/**
+ * \brief Walk fields of compiled template from given field and compute
+ * data record length
+ *
+ * \param[in] data_record Data record
+ * \param[in] map Compiled template fields
+ * \param[in] first Index of the first field with static offset to walk from
+ * \param[out] positions Positions of walked fields (may be NULL)
+ * \return Data record length
+ */
+static uint16_t data_record_length_compiled(uint8_t *data_record, struct ipfix_template_map *map,
+		uint16_t first, struct ipfix_field_position *positions)
+{
+	uint16_t i, offset = 0, length;
+
+	if (first < map->field_count) {
+		offset = map->fields[first].offset;
+	}
+
+	for (i = first; i < map->field_count; ++i) {
+		length = map->fields[i].length;
+
+		if (length == VAR_IE_LENGTH) {
+			/* Variable length */
+			length = *((uint8_t *) (data_record + offset));
+			offset += 1;
+
+			if (length == 255) {
+				length = ntohs(*((uint16_t *) (data_record + offset)));
+				offset += 2;
+			}
+		}
+
+		if (positions) {
+			positions[i].offset = offset;
+			positions[i].length = length;
+		}
+
+		offset += length;
+	}
+
+	return offset;
+}
+
 /**
  * \brief Count data record length
  */
@@ -641,6 +738,11 @@ uint16_t data_record_length(uint8_t *data_record, struct ipfix_template *templat
 		return template->data_length;
 	}
 
+	if (template->map) {
+		/* Skip fields with static offsets */
+		return data_record_length_compiled(data_record, template->map, template->map->var_first, NULL);
+	}
+
 	for (count = index = 0; count < template->field_count; count++, index++) {
 		length = template->fields[index].ie.length;
 
@@ -678,6 +780,79 @@ uint16_t data_record_length(uint8_t *data_record, struct ipfix_template *templat
 	return offset;
 }
 
+/**
+ * \brief Decode positions of all fields of data record in one pass
+ */
+int data_record_decode(struct data_record_decoder *dec, uint8_t *record, struct ipfix_template *templ)
+{
+	struct ipfix_template_map *map = templ->map;
+	struct ipfix_field_position *positions;
+	uint16_t i;
+
+	dec->record = record;
+	dec->templ = templ;
+	dec->decoded = 0;
+
+	if (!map || !(templ->data_length & 0x80000000)) {
+		/* Offsets are static or the template is not compiled */
+		dec->length = data_record_length(record, templ);
+		return 0;
+	}
+
+	if (dec->capacity < map->field_count) {
+		positions = realloc(dec->positions, map->field_count * sizeof(struct ipfix_field_position));
+		if (!positions) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			dec->length = data_record_length(record, templ);
+			return -1;
+		}
+
+		dec->positions = positions;
+		dec->capacity = map->field_count;
+	}
+
+	for (i = 0; i < map->var_first; ++i) {
+		dec->positions[i].offset = map->fields[i].offset;
+		dec->positions[i].length = map->fields[i].length;
+	}
+
+	dec->length = data_record_length_compiled(record, map, map->var_first, dec->positions);
+	dec->decoded = 1;
+	return 0;
+}
+
+/**
+ * \brief Get data from decoded record
+ */
+uint8_t *data_record_decoder_get_field(struct data_record_decoder *dec, uint32_t enterprise, uint16_t id, int *data_length)
+{
+	int index;
+
+	if (!dec->decoded) {
+		return data_record_get_field(dec->record, dec->templ, enterprise, id, data_length);
+	}
+
+	index = template_map_find(dec->templ->map, enterprise, id);
+	if (index < 0) {
+		return NULL;
+	}
+
+	if (data_length) {
+		*data_length = dec->positions[index].length;
+	}
+
+	return dec->record + dec->positions[index].offset;
+}
+
+/**
+ * \brief Free memory of data record decoder
+ */
+void data_record_decoder_clear(struct data_record_decoder *dec)
+{
+	free(dec->positions);
+	memset(dec, 0, sizeof(*dec));
+}
+
 /**
  * \brief Go through all data records and call processing function for each
  */
@@ -80,7 +80,7 @@
  */
 
 /** Acceptable command-line parameters (normal) */
-#define OPTSTRING "c:dhv:Vsr:i:S:e:Mp:"
+#define OPTSTRING "c:dhv:Vsr:i:S:e:Mp:P:O:"
 
 /** Acceptable command-line parameters (long) */
 struct option long_opts[] = {
@@ -138,6 +138,8 @@ void help ()
 	printf ("  -S num    Print statistics every \"num\" seconds\n");
 	printf ("  -M        Enable single data manager (all ODIDs have common storage plugins)\n");
 	printf ("  -p file   Path to the pidfile. Without this option, no pidfile is created.\n");
+	printf ("  -P num    Number of preprocessor threads (default: 1)\n");
+	printf ("  -O num    Number of Output Manager threads (default: 1)\n");
 	printf ("\n");
 }
 
@@ -199,6 +201,8 @@ int main (int argc, char* argv[])
 	void *output_manager_config = NULL;
 	xmlXPathObjectPtr collectors = NULL;
 	int ring_buffer_size = 8192;
+	int preprocessor_threads = 1;
+	int output_manager_threads = 1;
 	bool output_odid_merge = false;
 	char *pidfile_path = NULL;
 
@@ -261,6 +265,24 @@ int main (int argc, char* argv[])
 		case 'p':
 			pidfile_path = optarg;
 			break;
+		case 'P':
+			preprocessor_threads = strtoi(optarg, 10);
+			if (preprocessor_threads == INT_MAX) {
+				MSG_ERROR(msg_module, "No valid number of preprocessor threads provided (%s)", optarg);
+				help();
+				exit(EXIT_FAILURE);
+			}
+
+			break;
+		case 'O':
+			output_manager_threads = strtoi(optarg, 10);
+			if (output_manager_threads == INT_MAX) {
+				MSG_ERROR(msg_module, "No valid number of Output Manager threads provided (%s)", optarg);
+				help();
+				exit(EXIT_FAILURE);
+			}
+
+			break;
 
 		default:
 			help();
@@ -394,7 +416,8 @@ int main (int argc, char* argv[])
 	preprocessor_set_output_queue(rbuffer_init(ring_buffer_size));
 	
 	/* Create Output Manager */
-	retval = output_manager_create(config, stat_interval, output_odid_merge, &output_manager_config);
+	retval = output_manager_create(config, stat_interval, output_odid_merge,
+			output_manager_threads, &output_manager_config);
 	if (retval != 0) {
 		MSG_ERROR(msg_module, "[%d] Unable to create Output Manager", config->proc_id);
 		goto cleanup_err;
@@ -416,39 +439,49 @@ int main (int argc, char* argv[])
 		goto cleanup;
 	}
 
+	/* Start preprocessor threads */
+	if (preprocessor_start(preprocessor_threads) != 0) {
+		MSG_WARNING(msg_module, "[%d] Unable to start preprocessor threads; parsing messages in the input thread", config->proc_id);
+	}
+
 	/* Allow signals in the main thread only */
 	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
 
 	/* main loop */
 	while (!terminating) {
-		/* get data to process */
-		if ((get_retval = config->input.get(config->input.config, &input_info, &packet, &source_status)) < 0) {
-			/* No data received, probably interrupted by a signal */
-			if (packet) {
-				free(packet);
-				packet = NULL;
-			}
+		if (config->input.start && config->input.start(config->input.config, preprocessor_parse_msg) == 0) {
+			/* Input plugin passes data from its own threads; just wait for a signal */
+			sleep(1);
+		} else {
+			/* get data to process */
+			if ((get_retval = config->input.get(config->input.config, &input_info, &packet, &source_status)) < 0) {
+				/* No data received, probably interrupted by a signal */
+				if (packet) {
+					free(packet);
+					packet = NULL;
+				}
 
-			continue;
-		} else if (get_retval == INPUT_CLOSED) {
-			/* ensure that parser gets NULL packet => closed connection */
-			if (packet != NULL) {
-				/* free the memory allocated by xml_conf (if any) right away */
-				free(packet);
-				packet = NULL;
-			}
+				continue;
+			} else if (get_retval == INPUT_CLOSED) {
+				/* ensure that parser gets NULL packet => closed connection */
+				if (packet != NULL) {
+					/* free the memory allocated by xml_conf (if any) right away */
+					free(packet);
+					packet = NULL;
+				}
 
-			/* if input plugin is file reader, end collector */
-			if (input_info->type == SOURCE_TYPE_IPFIX_FILE) {
-				terminating = 1;
+				/* if input plugin is file reader, end collector */
+				if (input_info->type == SOURCE_TYPE_IPFIX_FILE) {
+					terminating = 1;
+				}
 			}
-		}
 
-		/* distribute data to the particular Data Manager for further processing */
-		preprocessor_parse_msg(packet, get_retval, input_info, source_status);
-		source_status = SOURCE_STATUS_OPENED;
-		packet = NULL;
-		input_info = NULL;
+			/* distribute data to the particular Data Manager for further processing */
+			preprocessor_parse_msg(packet, get_retval, input_info, source_status);
+			source_status = SOURCE_STATUS_OPENED;
+			packet = NULL;
+			input_info = NULL;
+		}
 
 		/* Check whether reconfiguration is needed */
 		if (reconf) {
@@ -464,6 +497,11 @@ cleanup_err:
 	retval = EXIT_FAILURE;
 
 cleanup:
+	/* Stop receiver threads of the input plugin before the preprocessor is closed */
+	if (config && config->input.stop && config->input.config) {
+		config->input.stop(config->input.config);
+	}
+
 	/* Close preprocessor */
 	preprocessor_close();
 	
@@ -0,0 +1,372 @@
+/**
+ * \file message_pool.c
+ * \brief Per-thread pools of memory blocks used by IPFIX messages
+ *
+ * Copyright (C) 2015 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <ipfixcol/ipfix_message.h>
+#include <ipfixcol/verbose.h>
+
+/** Identifier to MSG_* macros */
+static char *msg_module = "message_pool";
+
+/** Capacity of set lists of the pooled message structures */
+#define POOL_MESSAGE_SETS 16
+
+/** Size of the pooled packet buffers (buffer size of the network inputs) */
+#define POOL_PACKET_SIZE 10000
+
+/** Number of structures in the pooled metadata arrays */
+#define POOL_METADATA_COUNT 75
+
+/** Align offset of the lists following the (packed) message structure */
+#define POOL_ALIGN(size) (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/** Size of the message structure with lists of given capacity */
+#define POOL_MESSAGE_BLOCK(t, o, d) (POOL_ALIGN(sizeof(struct ipfix_message)) \
+		+ ((t) + 1 + (o) + 1) * sizeof(void *) \
+		+ ((d) + 1) * sizeof(struct data_template_couple))
+
+/** Classes of pooled blocks */
+enum pool_class_id {
+	POOL_MESSAGE,
+	POOL_PACKET,
+	POOL_METADATA,
+	POOL_CLASSES
+};
+
+/** Minimal size of the block of each class */
+static const size_t pool_class_size[POOL_CLASSES] = {
+	POOL_MESSAGE_BLOCK(POOL_MESSAGE_SETS, POOL_MESSAGE_SETS, POOL_MESSAGE_SETS),
+	POOL_PACKET_SIZE,
+	POOL_METADATA_COUNT * sizeof(struct metadata)
+};
+
+/** Maximal number of cached blocks of each class */
+static const uint32_t pool_class_max[POOL_CLASSES] = { 4096, 2048, 1024 };
+
+/** Constant mixed into the owner tag to recognize blocks of the pool */
+#define POOL_TAG_MAGIC ((uintptr_t) 0x9e3779b97f4a7c15ULL)
+
+/**
+ * \brief Owner of the pooled block
+ *
+ * The tag follows the usable part of the block, so the block is still a plain
+ * heap block and may be freed by free() or resized by realloc(). The check
+ * word depends on the block address; a block which was moved by realloc() or
+ * allocated outside the pool is not recognized and is freed.
+ */
+struct pool_tag {
+	struct message_pool *owner; /**< Pool of the thread which allocated the block */
+	uintptr_t check;            /**< Owner and block address mixed with magic */
+};
+
+/** Unused block, the link is stored in the block itself */
+struct pool_block {
+	struct pool_block *next;
+};
+
+/**
+ * \brief Free blocks of one class
+ *
+ * Only the owner thread takes blocks from the pool. Blocks released by any
+ * thread are pushed onto the returned stack; the owner grabs the whole stack
+ * at once when its local list is empty, so there is no ABA problem.
+ */
+struct pool_class {
+	struct pool_block *local;       /**< Blocks available to the owner thread */
+	struct pool_block *returned;    /**< Blocks returned by any thread */
+	uint32_t cached;                /**< Number of blocks in both lists */
+};
+
+/** Pool of one thread */
+struct message_pool {
+	struct pool_class classes[POOL_CLASSES];
+};
+
+/**
+ * Pool of the calling thread. Pools are never destroyed, messages created by
+ * a thread may outlive it.
+ */
+static __thread struct message_pool *thread_pool = NULL;
+
+/**
+ * \brief Get pool of the calling thread
+ *
+ * \return Pool or NULL when it cannot be created
+ */
+static struct message_pool *pool_current()
+{
+	if (!thread_pool) {
+		thread_pool = calloc(1, sizeof(struct message_pool));
+		if (!thread_pool) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		}
+	}
+
+	return thread_pool;
+}
+
+/**
+ * \brief Compute check word of the owner tag
+ */
+static inline uintptr_t pool_tag_check(const void *block, const struct message_pool *owner)
+{
+	return (uintptr_t) block ^ (uintptr_t) owner ^ POOL_TAG_MAGIC;
+}
+
+/**
+ * \brief Get pool which allocated the block
+ *
+ * \param[in] cls Class of the block
+ * \param[in] ptr Block
+ * \return Owner pool or NULL when the block was not allocated by a pool
+ */
+static struct message_pool *pool_owner(int cls, void *ptr)
+{
+	struct pool_tag tag;
+
+	if (malloc_usable_size(ptr) < pool_class_size[cls] + sizeof(struct pool_tag)) {
+		return NULL;
+	}
+
+	/* Tag may be unaligned (size of the metadata class) */
+	memcpy(&tag, (uint8_t *) ptr + pool_class_size[cls], sizeof(tag));
+	if (!tag.owner || tag.check != pool_tag_check(ptr, tag.owner)) {
+		return NULL;
+	}
+
+	return tag.owner;
+}
+
+/**
+ * \brief Take block from the pool or allocate a new one
+ *
+ * \param[in] pool Pool of the calling thread
+ * \param[in] cls Class of the block
+ * \return Uninitialized block
+ */
+static void *pool_get(struct message_pool *pool, int cls)
+{
+	struct pool_class *class = &(pool->classes[cls]);
+	struct pool_block *block;
+
+	if (!class->local) {
+		class->local = __atomic_exchange_n(&(class->returned), NULL, __ATOMIC_ACQUIRE);
+	}
+
+	if (class->local) {
+		block = class->local;
+		class->local = block->next;
+		__atomic_fetch_sub(&(class->cached), 1, __ATOMIC_RELAXED);
+		return block;
+	}
+
+	/* Pool is empty; content is initialized by the caller */
+	block = malloc(pool_class_size[cls] + sizeof(struct pool_tag));
+	if (block) {
+		struct pool_tag tag = { pool, pool_tag_check(block, pool) };
+		memcpy((uint8_t *) block + pool_class_size[cls], &tag, sizeof(tag));
+	}
+
+	return block;
+}
+
+/**
+ * \brief Return block to the pool which allocated it
+ *
+ * Blocks are returned to their owner, not to the pool of the message, because
+ * packets and metadata are often allocated by another thread (e.g. inputs)
+ * than the one creating the message. Blocks allocated outside the pool or
+ * blocks exceeding the pool capacity are freed.
+ *
+ * \param[in] cls Class of the block
+ * \param[in] ptr Block
+ */
+static void pool_put(int cls, void *ptr)
+{
+	struct message_pool *pool;
+	struct pool_class *class;
+	struct pool_block *block = ptr, *head;
+
+	if (!ptr) {
+		return;
+	}
+
+	pool = pool_owner(cls, ptr);
+	if (!pool) {
+		free(ptr);
+		return;
+	}
+
+	class = &(pool->classes[cls]);
+	if (__atomic_load_n(&(class->cached), __ATOMIC_RELAXED) >= pool_class_max[cls]) {
+		free(ptr);
+		return;
+	}
+
+	head = __atomic_load_n(&(class->returned), __ATOMIC_RELAXED);
+	do {
+		block->next = head;
+	} while (!__atomic_compare_exchange_n(&(class->returned), &head, block, 0,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	__atomic_fetch_add(&(class->cached), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief Create IPFIX message structure with lists of sets of given capacity
+ */
+struct ipfix_message *message_create_sized(int templ_sets, int opt_templ_sets, int data_couples)
+{
+	struct ipfix_message *message;
+	struct message_pool *pool = pool_current();
+	size_t size = POOL_MESSAGE_BLOCK(templ_sets, opt_templ_sets, data_couples);
+	uint8_t *lists;
+
+	if (pool && size <= pool_class_size[POOL_MESSAGE]) {
+		message = pool_get(pool, POOL_MESSAGE);
+	} else {
+		/* malloc is used, block is zeroed below */
+		message = malloc(size);
+	}
+
+	if (!message) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	memset(message, 0, size);
+
+	/* Lists follow the structure */
+	lists = (uint8_t *) message + POOL_ALIGN(sizeof(struct ipfix_message));
+	message->templ_set = (struct ipfix_template_set **) lists;
+	lists += (templ_sets + 1) * sizeof(void *);
+	message->opt_templ_set = (struct ipfix_options_template_set **) lists;
+	lists += (opt_templ_sets + 1) * sizeof(void *);
+	message->data_couple = (struct data_template_couple *) lists;
+
+	message->pool = pool;
+
+	return message;
+}
+
+/**
+ * \brief Create IPFIX message structure able to hold the sets of given message
+ */
+struct ipfix_message *message_create_sized_as(const struct ipfix_message *msg)
+{
+	int t, o, d;
+
+	for (t = 0; t < MSG_MAX_TEMPL_SETS && msg->templ_set[t]; ++t) {}
+	for (o = 0; o < MSG_MAX_OTEMPL_SETS && msg->opt_templ_set[o]; ++o) {}
+	for (d = 0; d < MSG_MAX_DATA_COUPLES && msg->data_couple[d].data_set; ++d) {}
+
+	return message_create_sized(t, o, d);
+}
+
+/**
+ * \brief Allocate buffer for a packet from the message pool of calling thread
+ */
+void *message_packet_alloc(size_t size)
+{
+	struct message_pool *pool = pool_current();
+	void *packet;
+
+	/* Packet is overwritten by the input, no need to initialize it */
+	if (pool && size <= pool_class_size[POOL_PACKET]) {
+		packet = pool_get(pool, POOL_PACKET);
+	} else {
+		packet = malloc(size);
+	}
+
+	if (!packet) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+	}
+
+	return packet;
+}
+
+/**
+ * \brief Allocate zeroed array of metadata from the message pool of calling thread
+ */
+struct metadata *message_metadata_alloc(int count)
+{
+	struct message_pool *pool = pool_current();
+	struct metadata *metadata;
+
+	if (pool && count * sizeof(struct metadata) <= pool_class_size[POOL_METADATA]) {
+		metadata = pool_get(pool, POOL_METADATA);
+		if (metadata) {
+			memset(metadata, 0, count * sizeof(struct metadata));
+		}
+	} else {
+		metadata = calloc(count, sizeof(struct metadata));
+	}
+
+	if (!metadata) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+	}
+
+	return metadata;
+}
+
+/**
+ * \brief Dispose IPFIX message including its packet and metadata
+ */
+void message_recycle(struct ipfix_message *msg)
+{
+	if (!msg) {
+		return;
+	}
+
+	pool_put(POOL_PACKET, msg->pkt_header);
+
+	if (msg->metadata) {
+		for (uint16_t i = 0; i < msg->data_records_count; ++i) {
+			/* Free profiles */
+			if (msg->metadata[i].channels) {
+				free(msg->metadata[i].channels);
+			}
+		}
+
+		pool_put(POOL_METADATA, msg->metadata);
+	}
+
+	pool_put(POOL_MESSAGE, msg);
+}
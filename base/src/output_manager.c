@@ -146,19 +146,53 @@ void sig_handler(int s)
 }
 
 /**
- * \brief Search for Data manager handling specified Observation Domain ID
+ * \brief Hash Observation Domain ID
+ *
+ * Upper bits select the bucket of dispatcher's table, middle bits the dispatcher.
+ *
+ * \param[in] odid Observation Domain ID
+ * \return hash
+ */
+static inline uint32_t om_odid_hash(uint32_t odid)
+{
+	return odid * 0x9E3779B1;
+}
+
+/**
+ * \brief Get dispatcher owning Data Manager of specified Observation Domain ID
+ *
+ * \param[in] odid Observation Domain ID
+ * \return dispatcher
+ */
+static inline struct om_dispatcher *om_get_dispatcher(uint32_t odid)
+{
+	return &conf->dispatchers[(om_odid_hash(odid) >> 16) % conf->dispatchers_count];
+}
+
+/**
+ * \brief Get ODID of Data Manager for a message
  *
- * \todo: improve search e.g. by some kind of sorting data_managers
+ * \param[in] msg IPFIX message
+ * \return Observation Domain ID
+ */
+static inline uint32_t om_msg_odid(struct ipfix_message *msg)
+{
+	return (conf->perman_odid_merge || conf->manager_mode == OM_SINGLE) ? 0 : msg->input_info->odid;
+}
+
+/**
+ * \brief Search for Data manager handling specified Observation Domain ID
  *
  * \param[in] id Observation domain ID of wanted Data manager.
+ * \param[in] dispatcher Dispatcher owning the ODID
  * \return Desired Data Manager configuration structure if exists, NULL if
  * there is no Data manager for specified Observation domain ID
  */
-static struct data_manager_config *get_data_mngmt_config(uint32_t id, struct data_manager_config *data_mngmts)
+static struct data_manager_config *get_data_mngmt_config(uint32_t id, struct om_dispatcher *dispatcher)
 {
-	struct data_manager_config *aux_cfg = data_mngmts;
+	struct data_manager_config *aux_cfg;
 
-	for (aux_cfg = data_mngmts; aux_cfg; aux_cfg = aux_cfg->next) {
+	for (aux_cfg = dispatcher->table[om_odid_hash(id) >> (32 - OM_TABLE_BITS)]; aux_cfg; aux_cfg = aux_cfg->hash_next) {
 		if (aux_cfg->observation_domain_id == id) {
 			break;
 		}
@@ -171,10 +205,19 @@ static struct data_manager_config *get_data_mngmt_config(uint32_t id, struct dat
  * \brief Insert new Data manager into list
  *
  * \param[in] output_manager Output Manager structure
+ * \param[in] dispatcher Dispatcher owning the Data Manager
  * \param[in] new_manager New Data manager
  */
-void output_manager_insert(struct output_manager_config *output_manager, struct data_manager_config *new_manager)
+void output_manager_insert(struct output_manager_config *output_manager, struct om_dispatcher *dispatcher,
+		struct data_manager_config *new_manager)
 {
+	struct data_manager_config **bucket = &dispatcher->table[om_odid_hash(new_manager->observation_domain_id) >> (32 - OM_TABLE_BITS)];
+
+	pthread_mutex_lock(&output_manager->data_managers_mutex);
+
+	new_manager->hash_next = *bucket;
+	*bucket = new_manager;
+
 	new_manager->next = NULL;
 	if (output_manager->last == NULL) {
 		output_manager->data_managers = new_manager;
@@ -182,18 +225,36 @@ void output_manager_insert(struct output_manager_config *output_manager, struct
 		output_manager->last->next = new_manager;
 	}
 	output_manager->last = new_manager;
+
+	pthread_mutex_unlock(&output_manager->data_managers_mutex);
 }
 
 /**
  * \brief Remove data manager from list, close it and free templates
  *
  * \param[in] output_manager Output Manager structure
+ * \param[in] dispatcher Dispatcher owning the Data Manager
  * \param[in] old_manager Data Manager to remove and close
  */
-void output_manager_remove(struct output_manager_config *output_manager, struct data_manager_config *old_manager)
+void output_manager_remove(struct output_manager_config *output_manager, struct om_dispatcher *dispatcher,
+		struct data_manager_config *old_manager)
 {
-	struct data_manager_config *aux_conf = output_manager->data_managers;
+	struct data_manager_config **aux_ptr = &dispatcher->table[om_odid_hash(old_manager->observation_domain_id) >> (32 - OM_TABLE_BITS)];
+	struct data_manager_config *aux_conf;
+
+	pthread_mutex_lock(&output_manager->data_managers_mutex);
 
+	/* Remove it from the table */
+	while (*aux_ptr && *aux_ptr != old_manager) {
+		aux_ptr = &(*aux_ptr)->hash_next;
+	}
+
+	if (*aux_ptr) {
+		*aux_ptr = old_manager->hash_next;
+	}
+
+	/* Remove it from the list */
+	aux_conf = output_manager->data_managers;
 	if (aux_conf == old_manager) {
 		output_manager->data_managers = old_manager->next;
 	}
@@ -213,6 +274,9 @@ void output_manager_remove(struct output_manager_config *output_manager, struct
 	if (output_manager->data_managers == NULL) {
 		output_manager->last = NULL;
 	}
+
+	pthread_mutex_unlock(&output_manager->data_managers_mutex);
+
 	uint32_t odid = old_manager->observation_domain_id;
 	data_manager_close(&old_manager);
 
@@ -224,6 +288,19 @@ void output_manager_remove(struct output_manager_config *output_manager, struct
 	}
 }
 
+/**
+ * \brief Pass message to the dispatcher of its ODID
+ *
+ * Called by the thread writing into the Output Manager's input queue.
+ *
+ * \param[in] msg IPFIX message
+ * \return 0 on success
+ */
+static int output_manager_dispatch(struct ipfix_message *msg)
+{
+	return rbuffer_write(om_get_dispatcher(om_msg_odid(msg))->queue, msg, 1);
+}
+
 /**
  * \brief Get input queue
  */
@@ -241,22 +318,15 @@ void output_manager_set_in_queue(struct ring_buffer *in_queue)
 		return;
 	}
 
-	if (conf->running) {
-		/* If already running, control message must be sent */
-		pthread_mutex_lock(&conf->in_q_mutex);
-
-		conf->new_in = in_queue;
-		rbuffer_write(conf->in_queue, NULL, 1);
+	/* Writers of the new queue dispatch messages directly from now */
+	rbuffer_set_forward(in_queue, output_manager_dispatch);
 
-		/* Wait for change */
-		while (conf->in_queue != in_queue) {
-			pthread_cond_wait(&conf->in_q_cond, &conf->in_q_mutex);
-		}
-
-		pthread_mutex_unlock(&conf->in_q_mutex);
-	} else {
-		conf->in_queue = in_queue;
+	/* Old queue will be read by an intermediate plugin */
+	if (conf->in_queue) {
+		rbuffer_set_forward(conf->in_queue, NULL);
 	}
+
+	conf->in_queue = in_queue;
 }
 
 /**
@@ -271,9 +341,12 @@ int output_manager_add_plugin(struct storage *plugin)
 	for (i = 0; conf->storage_plugins[i]; ++i) {}
 	conf->storage_plugins[i] = plugin;
 
+	pthread_mutex_lock(&conf->data_managers_mutex);
+
 	if (plugin->xml_conf->observation_domain_id) {
 		/* Plugin for one specific ODID */
-		data_mgr = get_data_mngmt_config(atol(plugin->xml_conf->observation_domain_id), conf->data_managers);
+		uint32_t odid = atol(plugin->xml_conf->observation_domain_id);
+		data_mgr = get_data_mngmt_config(odid, om_get_dispatcher(odid));
 
 		if (data_mgr) {
 			/* Update existing Data Manager */
@@ -287,6 +360,8 @@ int output_manager_add_plugin(struct storage *plugin)
 		}
 	}
 
+	pthread_mutex_unlock(&conf->data_managers_mutex);
+
 	return 0;
 }
 
@@ -314,10 +389,13 @@ int output_manager_remove_plugin(int id)
 		return 0;
 	}
 
+	pthread_mutex_lock(&conf->data_managers_mutex);
+
 	/* Kill all its instances */
 	if (plugin->xml_conf->observation_domain_id) {
 		/* Has ODID - max. 1 instance */
-		data_mgr = get_data_mngmt_config(atol(plugin->xml_conf->observation_domain_id), conf->data_managers);
+		uint32_t odid = atol(plugin->xml_conf->observation_domain_id);
+		data_mgr = get_data_mngmt_config(odid, om_get_dispatcher(odid));
 
 		if (data_mgr) {
 			/* Kill plugin */
@@ -331,53 +409,60 @@ int output_manager_remove_plugin(int id)
 		}
 	}
 
+	pthread_mutex_unlock(&conf->data_managers_mutex);
+
 	return 0;
 }
 
 /**
- * \brief Output Manager thread
+ * \brief Output Manager dispatcher thread
  *
- * @param[in] config configuration structure
+ * @param[in] config dispatcher structure
  * @return NULL
  */
-static void *output_manager_plugin_thread(void* config)
+static void *output_manager_dispatcher_thread(void* config)
 {
+	struct om_dispatcher *dispatcher = (struct om_dispatcher *) config;
 	struct data_manager_config *data_config = NULL;
 	struct ipfix_message* msg = NULL;
 	unsigned int index;
 	uint32_t odid;
-
-	conf = (struct output_manager_config *) config;
-	index = conf->in_queue->read_offset;
+	char thread_name[16];
 
 	/* Set thread name to reflect the configuration */
-	prctl(PR_SET_NAME, "ipfixcol OM", 0, 0, 0);
+	if (conf->dispatchers_count > 1) {
+		snprintf(thread_name, sizeof(thread_name), "ipfixcol OM %d", dispatcher->id);
+	} else {
+		snprintf(thread_name, sizeof(thread_name), "ipfixcol OM");
+	}
+	prctl(PR_SET_NAME, thread_name, 0, 0, 0);
 
 	/* loop will break upon receiving NULL from buffer */
 	while (1) {
 		/* get next data */
 		index = -1;
-		msg = rbuffer_read(conf->in_queue, &index);
+		msg = rbuffer_read(dispatcher->queue, &index);
 
 		if (!msg) {
-			rbuffer_remove_reference(conf->in_queue, index, 1);
-			if (conf->new_in) {
-				/* Set new input queue */
-				conf->in_queue = (struct ring_buffer *) conf->new_in;
-				conf->new_in = NULL;
-				pthread_cond_signal(&conf->in_q_cond);
-				continue;
-			}
-
-			/* Stop manager */
+			/* Stop dispatcher */
+			rbuffer_remove_reference(dispatcher->queue, index, 1);
 			break;
 		}
 
-		odid = (conf->perman_odid_merge || conf->manager_mode == OM_SINGLE)
-				? 0 : msg->input_info->odid;
+		odid = om_msg_odid(msg);
+
+		if (om_get_dispatcher(odid) != dispatcher) {
+			/* Message was dispatched before the mode of the manager changed */
+			if (rbuffer_write(om_get_dispatcher(odid)->queue, msg, 1) != 0) {
+				rbuffer_remove_reference(dispatcher->queue, index, 1);
+			} else {
+				rbuffer_remove_reference(dispatcher->queue, index, 0);
+			}
+			continue;
+		}
 
 		/* Get appropriate data Manager config according to ODID */
-		data_config = get_data_mngmt_config(odid, conf->data_managers);
+		data_config = get_data_mngmt_config(odid, dispatcher);
 		if (data_config == NULL) {
 			/*
 			 * No data manager config for this observation domain ID found -
@@ -388,12 +473,12 @@ static void *output_manager_plugin_thread(void* config)
 			if (data_config == NULL) {
 				MSG_WARNING(msg_module, "[%u] Unable to create Data Manager; skipping data...",
 						odid);
-				rbuffer_remove_reference(conf->in_queue, index, 1);
+				rbuffer_remove_reference(dispatcher->queue, index, 1);
 				continue;
 			}
 
 			/* Add config to data_mngmts structure */
-			output_manager_insert(conf, data_config);
+			output_manager_insert(conf, dispatcher, data_config);
 			MSG_INFO(msg_module, "[%u] Data Manager created", odid);
 		}
 
@@ -422,23 +507,22 @@ static void *output_manager_plugin_thread(void* config)
 			if (data_config->references == 0) {
 				/* No reference for this ODID, close DM */
 				MSG_DEBUG(msg_module, "[%u] No source; releasing templates...", data_config->observation_domain_id);
-				output_manager_remove(conf, data_config);
+				output_manager_remove(conf, dispatcher, data_config);
 			}
 
-			rbuffer_remove_reference(conf->in_queue, index, 1);
+			rbuffer_remove_reference(dispatcher->queue, index, 1);
 			continue;
 		}
 
 		/* Write data into input queue of Storage Plugins */
 		if (rbuffer_write(data_config->store_queue, msg, data_config->plugins_count) != 0) {
 			MSG_WARNING(msg_module, "[%u] Unable to write into Data Manager input queue; skipping data...", data_config->observation_domain_id);
-			rbuffer_remove_reference(conf->in_queue, index, 1);
-			free(msg);
+			rbuffer_remove_reference(dispatcher->queue, index, 1);
 			continue;
 		}
 
 		/* Remove data from queue (without memory deallocation) */
-		rbuffer_remove_reference(conf->in_queue, index, 0);
+		rbuffer_remove_reference(dispatcher->queue, index, 0);
 	}
 
 	MSG_INFO(msg_module, "Closing Output Manager thread");
@@ -446,6 +530,70 @@ static void *output_manager_plugin_thread(void* config)
 	return (void *) 0;
 }
 
+/**
+ * \brief Stop dispatcher threads
+ *
+ * Messages waiting in the queues of dispatchers are processed first.
+ *
+ * @param[in] count number of running dispatchers
+ */
+static void output_manager_stop_dispatchers(int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		rbuffer_write(conf->dispatchers[i].queue, NULL, 1);
+	}
+
+	for (i = 0; i < count; ++i) {
+		pthread_join(conf->dispatchers[i].thread_id, NULL);
+	}
+}
+
+/**
+ * \brief Start dispatcher threads
+ *
+ * @return 0 on success
+ */
+static int output_manager_start_dispatchers()
+{
+	int i, retval;
+
+	for (i = 0; i < conf->dispatchers_count; ++i) {
+		retval = pthread_create(&(conf->dispatchers[i].thread_id), NULL,
+				&output_manager_dispatcher_thread, (void *) &(conf->dispatchers[i]));
+		if (retval != 0) {
+			MSG_ERROR(msg_module, "Unable to create Output Manager thread");
+			output_manager_stop_dispatchers(i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Close all Data Managers
+ */
+static void output_manager_close_data_managers()
+{
+	struct data_manager_config *aux_config = conf->data_managers, *tmp;
+	int i;
+
+	while (aux_config) {
+		tmp = aux_config;
+		aux_config = aux_config->next;
+		data_manager_close(&tmp);
+	}
+
+	conf->data_managers = NULL;
+	conf->last = NULL;
+
+	for (i = 0; i < conf->dispatchers_count; ++i) {
+		memset(conf->dispatchers[i].table, 0, sizeof(conf->dispatchers[i].table));
+	}
+}
+
 /**
  * \brief Get total cpu time
  *
@@ -607,23 +755,73 @@ void statistics_print_buffers(struct output_manager_config *conf, FILE *stat_out
 		MSG_ALWAYS(" | Queue utilization:", NULL);
 
 		struct ring_buffer *prep_buffer = get_preprocessor_output_queue();
-		MSG_ALWAYS(" |     Preprocessor output queue: %u / %u", prep_buffer->count, prep_buffer->size);
+		MSG_ALWAYS(" |     Preprocessor output queue: %u / %u", rbuffer_count(prep_buffer), prep_buffer->size);
+
+		/* Print info about dispatchers' queues */
+		int i;
+		for (i = 0; i < conf->dispatchers_count; ++i) {
+			MSG_ALWAYS(" |     Output Manager dispatcher %d queue: %u / %u", i,
+					rbuffer_count(conf->dispatchers[i].queue), conf->dispatchers[i].queue->size);
+		}
 
 		/* Print info about Output Manager queues */
+		pthread_mutex_lock(&conf->data_managers_mutex);
 		struct data_manager_config *dm = conf->data_managers;
 		if (dm) {
 			if (conf->manager_mode == OM_SINGLE) {
-				MSG_ALWAYS(" |     Output Manager output queue: %u / %u", dm->store_queue->count, dm->store_queue->size);
+				MSG_ALWAYS(" |     Output Manager output queue: %u / %u", rbuffer_count(dm->store_queue), dm->store_queue->size);
 			} else {
 				MSG_ALWAYS(" |     Output Manager output queues:", NULL);
 				MSG_ALWAYS(" |         %.4s | %.10s / %.10s", "ODID", "waiting", "total size");
 
 				while (dm) {
-					MSG_ALWAYS(" |   %10u %9u / %u", dm->observation_domain_id, dm->store_queue->count, dm->store_queue->size);
+					MSG_ALWAYS(" |   %10u %9u / %u", dm->observation_domain_id, rbuffer_count(dm->store_queue), dm->store_queue->size);
 					dm = dm->next;
 				}
 			}
 		}
+		pthread_mutex_unlock(&conf->data_managers_mutex);
+	}
+}
+
+/** Maximal number of input sockets reported in statistics */
+#define STAT_MAX_INPUT_SOCKETS 64
+
+/**
+ * \brief Print receive statistics of input plugin sockets
+ *
+ * Only input plugins exporting input_stats() provide these statistics.
+ *
+ * @param conf Output Manager config
+ * @param stat_out_file Output file for statistics
+ */
+static void statistics_print_input(struct output_manager_config *conf, FILE *stat_out_file)
+{
+	struct input *input = &(conf->plugins_config->input);
+	struct input_socket_stats stats[STAT_MAX_INPUT_SOCKETS];
+	int i, count;
+
+	if (!input->stats || !input->config) {
+		return;
+	}
+
+	count = input->stats(input->config, stats, STAT_MAX_INPUT_SOCKETS);
+	if (count <= 0) {
+		return;
+	}
+
+	if (stat_out_file) {
+		for (i = 0; i < count; ++i) {
+			fprintf(stat_out_file, "%s_%d=%" PRIu64 "\n", "INPUT_PACKETS", i, stats[i].packets);
+			fprintf(stat_out_file, "%s_%d=%" PRIu64 "\n", "INPUT_DROPS", i, stats[i].drops);
+		}
+	} else {
+		MSG_ALWAYS(" | Input sockets:", NULL);
+		MSG_ALWAYS(" | %10s %15s %15s", "socket", "packets", "kernel drops");
+		for (i = 0; i < count; ++i) {
+			MSG_ALWAYS(" | %10d %15" PRIu64 " %15" PRIu64, i, stats[i].packets, stats[i].drops);
+		}
+		MSG_ALWAYS(" |", NULL);
 	}
 }
 
@@ -839,6 +1037,9 @@ static void *statistics_thread(void* config)
 			MSG_ALWAYS(" | %10s %15lu %15lu %15lu", "Total:", packets_total, data_records_total, lost_data_records_total);
 		}
 
+		/* Print receive statistics of the input plugin */
+		statistics_print_input(conf, stat_out_file);
+
 		/* Print CPU usage by threads */
 		statistics_print_cpu(&(conf->stats), stat_out_file);
 
@@ -865,11 +1066,15 @@ static void *statistics_thread(void* config)
  * @param[in] plugins_config plugins configurator
  * @param[in] stat_interval statistics printing interval
  * @param[in] odid_merge enable single output manager permanently
+ * @param[in] dispatchers number of dispatcher threads
  * @param[out] config configuration structure
  * @return 0 on success, negative value otherwise
  */
-int output_manager_create(configurator *plugins_config, int stat_interval, bool odid_merge, void **config)
+int output_manager_create(configurator *plugins_config, int stat_interval, bool odid_merge,
+		int dispatchers, void **config)
 {
+	int i;
+
 	conf = calloc(1, sizeof(struct output_manager_config));
 	if (!conf) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
@@ -880,6 +1085,30 @@ int output_manager_create(configurator *plugins_config, int stat_interval, bool
 	conf->stat_interval = stat_interval;
 	conf->plugins_config = plugins_config;
 	conf->perman_odid_merge = odid_merge;
+	pthread_mutex_init(&conf->data_managers_mutex, NULL);
+
+	/* Create dispatchers and their queues */
+	conf->dispatchers_count = (dispatchers > 1) ? dispatchers : 1;
+	conf->dispatchers = calloc(conf->dispatchers_count, sizeof(struct om_dispatcher));
+	if (!conf->dispatchers) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(conf);
+		return -1;
+	}
+
+	for (i = 0; i < conf->dispatchers_count; ++i) {
+		conf->dispatchers[i].id = i;
+		conf->dispatchers[i].queue = rbuffer_init(ring_buffer_size);
+		if (!conf->dispatchers[i].queue) {
+			MSG_ERROR(msg_module, "Unable to initiate queue of Output Manager dispatcher");
+			while (--i >= 0) {
+				rbuffer_free(conf->dispatchers[i].queue);
+			}
+			free(conf->dispatchers);
+			free(conf);
+			return -1;
+		}
+	}
 
 	if (conf->manager_mode == OM_SINGLE) {
 		MSG_INFO(msg_module, "Configuring Output Manager in single manager mode");
@@ -902,11 +1131,8 @@ int output_manager_start()
 {
 	int retval;
 
-	/* Create Output Manager thread */
-	retval = pthread_create(&(conf->thread_id), NULL, &output_manager_plugin_thread, (void *) conf);
-	if (retval != 0) {
-		MSG_ERROR(msg_module, "Unable to create Output Manager thread");
-		free(conf);
+	/* Create Output Manager threads */
+	if (output_manager_start_dispatchers() != 0) {
 		return -1;
 	}
 
@@ -916,7 +1142,7 @@ int output_manager_start()
 		retval = pthread_create(&(conf->stat_thread), NULL, &statistics_thread, (void *) conf);
 		if (retval != 0) {
 			MSG_ERROR(msg_module, "Unable to create statistics thread");
-			free(conf);
+			conf->stat_interval = 0;
 			return -1;
 		}
 	}
@@ -930,13 +1156,12 @@ int output_manager_start()
 void output_manager_close(void *config)
 {
 	struct output_manager_config *manager = (struct output_manager_config *) config;
-	struct data_manager_config *aux_config = NULL, *tmp = NULL;
 	struct stat_thread *aux_thread = NULL, *tmp_thread = NULL;
+	int i;
 
-	/* Stop Output Manager thread and free input buffer */
+	/* Stop Output Manager threads and free input buffer */
 	if (manager->running) {
-		rbuffer_write(manager->in_queue, NULL, 1);
-		pthread_join(manager->thread_id, NULL);
+		output_manager_stop_dispatchers(conf->dispatchers_count);
 		rbuffer_free(manager->in_queue);
 
 		/* Close statistics thread */
@@ -946,14 +1171,8 @@ void output_manager_close(void *config)
 			pthread_join(manager->stat_thread, NULL);
 		}
 
-		aux_config = manager->data_managers;
-
 		/* Close all data managers */
-		while (aux_config) {
-			tmp = aux_config;
-			aux_config = aux_config->next;
-			data_manager_close(&tmp);
-		}
+		output_manager_close_data_managers();
 
 		/* Free input_info_list */
 		if (input_info_list) {
@@ -974,6 +1193,12 @@ void output_manager_close(void *config)
 		}
 	}
 
+	for (i = 0; i < manager->dispatchers_count; ++i) {
+		rbuffer_free(manager->dispatchers[i].queue);
+	}
+
+	free(manager->dispatchers);
+	pthread_mutex_destroy(&manager->data_managers_mutex);
 	free(manager);
 }
 
@@ -982,7 +1207,7 @@ void output_manager_close(void *config)
  *
  * Allow to change mode from single mode to multi mode and vice versa.
  * If new mode is different from current mode, all data managers are removed.
- * If the manager thread is running, it will be stopped and restarted later.
+ * If the dispatcher threads are running, they will be stopped and restarted later.
  *
  * \param[in] mode New mode of output manager
  * \return 0 on successs
@@ -1004,22 +1229,15 @@ int output_manager_set_mode(enum om_mode mode)
 	}
 
 	if (conf->running) {
-		MSG_DEBUG(msg_module, "Stopping Output Manager thread");
-		rbuffer_write(conf->in_queue, NULL, 1);
-		pthread_join(conf->thread_id, NULL);
+		MSG_DEBUG(msg_module, "Stopping Output Manager threads");
+		output_manager_stop_dispatchers(conf->dispatchers_count);
 	}
 
 	/* Delete data managers */
-	struct data_manager_config *aux_config = conf->data_managers;
-	while (aux_config) {
-		struct data_manager_config *tmp = aux_config;
-		aux_config = aux_config->next;
-		data_manager_close(&tmp);
-	}
-
-	conf->data_managers = NULL;
-	conf->last = NULL;
+	pthread_mutex_lock(&conf->data_managers_mutex);
+	output_manager_close_data_managers();
 	conf->manager_mode = mode;
+	pthread_mutex_unlock(&conf->data_managers_mutex);
 
 	if (mode == OM_SINGLE) {
 		MSG_INFO(msg_module, "Switching Output Manager to single manager mode");
@@ -1030,14 +1248,9 @@ int output_manager_set_mode(enum om_mode mode)
 	}
 
 	if (conf->running) {
-		/* Restart thread */
-		int retval;
-		MSG_DEBUG(msg_module, "Restarting Output Manager thread");
-		retval = pthread_create(&(conf->thread_id), NULL,
-				&output_manager_plugin_thread, (void *) conf);
-		if (retval != 0) {
-			MSG_ERROR(msg_module, "Unable to create Output Manager thread");
-			free(conf);
+		/* Restart threads */
+		MSG_DEBUG(msg_module, "Restarting Output Manager threads");
+		if (output_manager_start_dispatchers() != 0) {
 			return -1;
 		}
 	}
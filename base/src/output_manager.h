@@ -76,6 +76,24 @@ enum om_mode {
 	OM_SINGLE        /**< Single common data manager for all ODIDs */
 };
 
+/** Number of bits of the Data Manager table index */
+#define OM_TABLE_BITS 10
+/** Number of buckets of the Data Manager table of a dispatcher */
+#define OM_TABLE_SIZE (1 << OM_TABLE_BITS)
+
+/**
+ * \brief Output Manager dispatcher
+ *
+ * Dispatcher owns Data Managers of a subset of ODIDs and passes messages
+ * of these ODIDs to them.
+ */
+struct om_dispatcher {
+	int id;                                     /**< Dispatcher's index */
+	pthread_t thread_id;                        /**< Dispatcher's thread ID */
+	struct ring_buffer *queue;                  /**< Input queue */
+	struct data_manager_config *table[OM_TABLE_SIZE]; /**< Data Managers hashed by ODID */
+};
+
 /**
  * \struct output_mm_config
  *
@@ -84,19 +102,18 @@ enum om_mode {
 struct output_manager_config {
 	struct data_manager_config *data_managers;  /**< output managers */
 	struct data_manager_config *last;           /**< last Output Manager in list */
+	pthread_mutex_t data_managers_mutex;        /**< Guards the list of Data Managers */
 	struct storage *storage_plugins[32];        /**< Storage plugins */
-	struct ring_buffer *in_queue;               /**< Input queue */
-	struct ring_buffer *new_in;                 /**< New input queue */
+	struct ring_buffer *in_queue;               /**< Input queue (forwarded to dispatchers) */
+	struct om_dispatcher *dispatchers;          /**< Dispatchers */
+	int dispatchers_count;                      /**< Number of dispatchers */
 	int running;                                /**< Status of manager */
 	bool perman_odid_merge;                     /**< Enable permanently single data manager */
 	enum om_mode manager_mode;                       /**< Manager mode */
-	pthread_t thread_id;                        /**< Manager's thread ID */
 	pthread_t stat_thread;                      /**< Stat's thread ID */
 	int stat_interval;                          /**< Stat's interval */
 	struct stat_conf stats;                     /**< Statistics */
 	configurator *plugins_config;               /**< Plugins configurator */
-	pthread_mutex_t in_q_mutex;
-	pthread_cond_t  in_q_cond;
 };
 
 /**
@@ -104,10 +121,13 @@ struct output_manager_config {
  *
  * @param[in] plugins_config plugins configurator
  * @param[in] stat_interval statistics printing interval
+ * @param[in] odid_merge enable single output manager permanently
+ * @param[in] dispatchers number of dispatcher threads
  * @param[out] config configuration structure
  * @return 0 on success, negative value otherwise
  */
-int output_manager_create(configurator *plugins_config, int stat_interval, bool odid_merge, void **config);
+int output_manager_create(configurator *plugins_config, int stat_interval, bool odid_merge,
+		int dispatchers, void **config);
 
 /**
  * \brief Start data processing
@@ -141,6 +161,9 @@ void output_manager_close(void *config);
 
 /**
  * \brief Set new input queue
+ *
+ * Messages written into the input queue are passed directly to the dispatcher
+ * of their ODID, messages waiting in the queue are passed first.
  * 
  * @param in_queue input queue
  */
@@ -158,7 +181,7 @@ struct ring_buffer *output_manager_get_in_queue();
  *
  * Allow to change mode from single mode to multi mode and vice versa.
  * If new mode is different from current mode, all data managers are removed.
- * If the manager thread is running, it will be stopped and restarted later.
+ * If the dispatcher threads are running, they will be stopped and restarted later.
  *
  * \param[in] mode New mode of output manager
  * \return 0 on successs
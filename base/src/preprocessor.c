@@ -41,6 +41,7 @@
 #include <pthread.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <sys/prctl.h>
 
 #include "configurator.h"
 #include "preprocessor.h"
@@ -53,9 +54,41 @@
 /** Identifier to MSG_* macros */
 static char *msg_module = "preprocessor";
 
+/** Number of jobs that fit into the queue of one preprocessor worker */
+#define PREPROCESSOR_QUEUE_SIZE 4096
+/** Maximal number of jobs taken from the queue at once */
+#define PREPROCESSOR_BATCH 64
+
 static struct ring_buffer *preprocessor_out_queue = NULL;
 static configurator *global_config = NULL;
 
+/* Raw message waiting for a preprocessor worker */
+struct preprocessor_job {
+	void *packet;
+	int len;
+	struct input_info *input_info;
+	int source_status;
+	uint32_t crc;                  /**< CRC of exporter identification */
+};
+
+/* Preprocessor worker thread with its own input queue */
+struct preprocessor_worker {
+	pthread_t thread;
+	int id;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct preprocessor_job *jobs; /**< Circular queue of PREPROCESSOR_QUEUE_SIZE jobs */
+	unsigned int head;             /**< Index of the oldest job */
+	unsigned int count;            /**< Number of queued jobs */
+	int idle;                      /**< Worker is waiting for a job */
+	int stop;
+};
+
+/* Preprocessor workers; messages are parsed in the calling thread when there are none */
+static struct preprocessor_worker *workers = NULL;
+static int workers_count = 0;
+
 /* Sequence number counter for each flow data source */
 struct data_source_info {
 	uint32_t exporter_ip_addr, odid, sequence_number;
@@ -65,6 +98,9 @@ struct data_source_info {
 
 struct data_source_info *data_source_info = NULL;
 
+/* Serializes insertions; lookups are lock-free since items are removed only at exit */
+static pthread_mutex_t data_source_info_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * \brief Get sequence number counter for given flow data source
  *
@@ -74,13 +110,13 @@ struct data_source_info *data_source_info = NULL;
  */
 struct data_source_info *data_source_info_get(uint32_t exporter_ip_addr, uint32_t odid)
 {
-	struct data_source_info *aux_info = data_source_info;
+	struct data_source_info *aux_info = __atomic_load_n(&data_source_info, __ATOMIC_ACQUIRE);
 	while (aux_info) {
 		if (aux_info->exporter_ip_addr == exporter_ip_addr && aux_info->odid == odid) {
 			return aux_info;
 		}
 
-		aux_info = aux_info->next;
+		aux_info = __atomic_load_n(&aux_info->next, __ATOMIC_ACQUIRE);
 	}
 
 	return NULL;
@@ -89,6 +125,9 @@ struct data_source_info *data_source_info_get(uint32_t exporter_ip_addr, uint32_
 /**
  * \brief Add new flow data source info
  *
+ * Preprocessor can be called from more receiver threads at once. When other
+ * thread has added the same source in the meantime, its info is returned.
+ *
  * \param[in] exporter_ip_addr CRC32 of exporter IP address
  * \param[in] odid Observation Domain ID
  * \return Pointer to sequence number counter
@@ -97,8 +136,17 @@ struct data_source_info *data_source_info_add(uint32_t exporter_ip_addr, uint32_
 {
 	struct data_source_info *aux_info;
 
+	pthread_mutex_lock(&data_source_info_lock);
+
+	aux_info = data_source_info_get(exporter_ip_addr, odid);
+	if (aux_info) {
+		pthread_mutex_unlock(&data_source_info_lock);
+		return aux_info;
+	}
+
 	aux_info = calloc(1, sizeof(struct data_source_info));
 	if (!aux_info) {
+		pthread_mutex_unlock(&data_source_info_lock);
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		return NULL;
 	}
@@ -107,13 +155,15 @@ struct data_source_info *data_source_info_add(uint32_t exporter_ip_addr, uint32_
 	aux_info->odid = odid;
 	aux_info->free_tid = 256;
 
+	/* Publish fully initialized item to lock-free readers */
 	if (!data_source_info) {
-		data_source_info = aux_info;
+		__atomic_store_n(&data_source_info, aux_info, __ATOMIC_RELEASE);
 	} else {
 		aux_info->next = data_source_info->next;
-		data_source_info->next = aux_info;
+		__atomic_store_n(&data_source_info->next, aux_info, __ATOMIC_RELEASE);
 	}
 
+	pthread_mutex_unlock(&data_source_info_lock);
 	return aux_info;
 }
 
@@ -364,7 +414,8 @@ static int preprocessor_process_one_template(void *tmpl, int max_len, int type,
 	return template->template_length - sizeof(struct ipfix_template) + sizeof(struct ipfix_options_template_record);
 }
 
-static int mdata_max = 0;
+/* Capacity of metadata of the message being processed by the calling thread */
+static __thread int mdata_max = 0;
 
 void fill_metadata(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
 {
@@ -373,9 +424,8 @@ void fill_metadata(uint8_t *rec, int rec_len, struct ipfix_template *templ, void
 	/* Allocate space for metadata */
 	if (mdata_max == 0) {
 		mdata_max = 75;
-		msg->metadata = calloc(mdata_max, sizeof(struct metadata));
+		msg->metadata = message_metadata_alloc(mdata_max);
 		if (!msg->metadata) {
-			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 			mdata_max = 0;
 			return;
 		}
@@ -532,33 +582,18 @@ static uint32_t preprocessor_process_templates(struct ipfix_message *msg)
  * @param len Packet length
  * @param input_info Input informations about source etc.
  * @param source_status Status of source (new, opened, closed)
+ * @param exporter_ip_addr CRC of exporter identification
  */
-void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info, int source_status)
+static void preprocessor_process_msg(void* packet, int len, struct input_info* input_info,
+		int source_status, uint32_t exporter_ip_addr)
 {
 	struct ipfix_message* msg;
-	uint32_t exporter_ip_addr;
 	uint32_t *seqn;
 
-	/* Check input info */
-	if (input_info == NULL) {
-		MSG_WARNING(msg_module, "Invalid parameters in preprocessor_parse_msg");
-
-		if (packet) {
-			free(packet);
-		}
-
-		packet = NULL;
-		return;
-	}
-
-	/* CRC of exporter identification is used to differentiate sources */
-	exporter_ip_addr = preprocessor_compute_crc(input_info);
-
 	if (source_status == SOURCE_STATUS_CLOSED) {
 		/* Inform intermediate plugins and output manager about closed input */
-		msg = calloc(1, sizeof(struct ipfix_message));
+		msg = message_create_sized(0, 0, 0);
 		if (!msg) {
-			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 			return;
 		}
 
@@ -636,8 +671,244 @@ void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info
 	}
 }
 
+/**
+ * \brief Select worker for messages of given source
+ *
+ * All messages of one source (and therefore of one input_info structure) go
+ * to the same worker, which keeps their order and the template state of
+ * the source in one thread. Input info of a file is shared by all ODIDs
+ * in the file, so file sources are routed by their CRC only.
+ *
+ * @param input_info Input informations about source
+ * @param crc CRC of exporter identification
+ * @return Preprocessor worker
+ */
+static inline struct preprocessor_worker *preprocessor_route(struct input_info *input_info, uint32_t crc)
+{
+	uint32_t key = crc;
+
+	if (input_info->type != SOURCE_TYPE_IPFIX_FILE) {
+		key ^= input_info->odid * 0x9E3779B1;
+	}
+
+	/* Mix the bits so that sources with close keys are spread over workers */
+	key ^= key >> 16;
+	key *= 0x85EBCA6B;
+	key ^= key >> 13;
+
+	return &workers[key % workers_count];
+}
+
+/**
+ * \brief Append job to the queue of a worker
+ *
+ * Blocks while the queue is full, the same way as writing into a full ring buffer.
+ *
+ * @param worker Preprocessor worker
+ * @param job Job to append
+ */
+static void preprocessor_worker_push(struct preprocessor_worker *worker, struct preprocessor_job *job)
+{
+	pthread_mutex_lock(&worker->lock);
+
+	while (worker->count == PREPROCESSOR_QUEUE_SIZE) {
+		pthread_cond_wait(&worker->not_full, &worker->lock);
+	}
+
+	worker->jobs[(worker->head + worker->count) % PREPROCESSOR_QUEUE_SIZE] = *job;
+	worker->count++;
+
+	if (worker->idle) {
+		pthread_cond_signal(&worker->not_empty);
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+}
+
+/**
+ * \brief Preprocessor worker thread
+ *
+ * Takes jobs from its queue in batches and parses them. Exits when it is
+ * stopped and its queue is empty.
+ *
+ * @param arg Preprocessor worker
+ * @return NULL
+ */
+static void *preprocessor_worker_thread(void *arg)
+{
+	struct preprocessor_worker *worker = (struct preprocessor_worker *) arg;
+	struct preprocessor_job batch[PREPROCESSOR_BATCH];
+	unsigned int i, batch_count;
+	char thread_name[16];
+
+	snprintf(thread_name, sizeof(thread_name), "ipfixcol:prep%d", worker->id);
+	prctl(PR_SET_NAME, thread_name, 0, 0, 0);
+
+	while (1) {
+		pthread_mutex_lock(&worker->lock);
+
+		while (worker->count == 0 && !worker->stop) {
+			worker->idle = 1;
+			pthread_cond_wait(&worker->not_empty, &worker->lock);
+			worker->idle = 0;
+		}
+
+		if (worker->count == 0) {
+			/* Stopped and drained */
+			pthread_mutex_unlock(&worker->lock);
+			break;
+		}
+
+		batch_count = (worker->count < PREPROCESSOR_BATCH) ? worker->count : PREPROCESSOR_BATCH;
+		for (i = 0; i < batch_count; i++) {
+			batch[i] = worker->jobs[(worker->head + i) % PREPROCESSOR_QUEUE_SIZE];
+		}
+
+		if (worker->count == PREPROCESSOR_QUEUE_SIZE) {
+			pthread_cond_broadcast(&worker->not_full);
+		}
+
+		worker->head = (worker->head + batch_count) % PREPROCESSOR_QUEUE_SIZE;
+		worker->count -= batch_count;
+
+		pthread_mutex_unlock(&worker->lock);
+
+		for (i = 0; i < batch_count; i++) {
+			preprocessor_process_msg(batch[i].packet, batch[i].len, batch[i].input_info,
+					batch[i].source_status, batch[i].crc);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Stop preprocessor workers and free them
+ *
+ * Workers parse all queued messages before they exit.
+ *
+ * @param count Number of workers with running thread
+ */
+static void preprocessor_workers_stop(int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		pthread_mutex_lock(&workers[i].lock);
+		workers[i].stop = 1;
+		pthread_cond_signal(&workers[i].not_empty);
+		pthread_mutex_unlock(&workers[i].lock);
+	}
+
+	for (i = 0; i < count; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	for (i = 0; i < workers_count; i++) {
+		pthread_mutex_destroy(&workers[i].lock);
+		pthread_cond_destroy(&workers[i].not_empty);
+		pthread_cond_destroy(&workers[i].not_full);
+		free(workers[i].jobs);
+	}
+
+	free(workers);
+	workers = NULL;
+	workers_count = 0;
+}
+
+/**
+ * \brief Start preprocessor workers
+ */
+int preprocessor_start(int count)
+{
+	int i, retval;
+
+	if (count <= 1) {
+		/* Parse messages in the thread of the caller */
+		return 0;
+	}
+
+	workers = calloc(count, sizeof(struct preprocessor_worker));
+	if (!workers) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		workers[i].id = i;
+		pthread_mutex_init(&workers[i].lock, NULL);
+		pthread_cond_init(&workers[i].not_empty, NULL);
+		pthread_cond_init(&workers[i].not_full, NULL);
+		workers_count++;
+
+		workers[i].jobs = calloc(PREPROCESSOR_QUEUE_SIZE, sizeof(struct preprocessor_job));
+		if (!workers[i].jobs) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			preprocessor_workers_stop(0);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		retval = pthread_create(&workers[i].thread, NULL, preprocessor_worker_thread, &workers[i]);
+		if (retval != 0) {
+			MSG_ERROR(msg_module, "Unable to create preprocessor thread: %s", strerror(retval));
+			preprocessor_workers_stop(i);
+			return 1;
+		}
+	}
+
+	MSG_INFO(msg_module, "Started %d preprocessor threads", count);
+	return 0;
+}
+
+/**
+ * \brief Parse IPFIX message or pass it to the worker of its source
+ *
+ * @param packet Received data from input plugins
+ * @param len Packet length
+ * @param input_info Input informations about source etc.
+ * @param source_status Status of source (new, opened, closed)
+ */
+void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info, int source_status)
+{
+	struct preprocessor_job job;
+
+	/* Check input info */
+	if (input_info == NULL) {
+		MSG_WARNING(msg_module, "Invalid parameters in preprocessor_parse_msg");
+
+		if (packet) {
+			free(packet);
+		}
+
+		packet = NULL;
+		return;
+	}
+
+	/* CRC of exporter identification is used to differentiate sources */
+	job.crc = preprocessor_compute_crc(input_info);
+
+	if (workers_count == 0) {
+		preprocessor_process_msg(packet, len, input_info, source_status, job.crc);
+		return;
+	}
+
+	job.packet = packet;
+	job.len = len;
+	job.input_info = input_info;
+	job.source_status = source_status;
+
+	preprocessor_worker_push(preprocessor_route(input_info, job.crc), &job);
+}
+
 void preprocessor_close()
 {
+	/* Parse messages remaining in the queues of workers */
+	if (workers_count > 0) {
+		preprocessor_workers_stop(workers_count);
+	}
+
 	/* output queue will be closed by intermediate process or output manager */
 	data_source_info_destroy();
 	return;
@@ -97,6 +97,18 @@ void preprocessor_set_output_queue(struct ring_buffer *out_queue);
 void preprocessor_set_configurator(configurator *config);
 
 
+/**
+ * \brief Start preprocessor worker threads
+ *
+ * Messages are routed to the workers by exporter CRC and ODID, so the messages
+ * of one source are parsed in order by a single worker. With one or no worker,
+ * messages are parsed directly in the thread calling preprocessor_parse_msg.
+ *
+ * @param count Number of worker threads
+ * @return 0 on success, 1 when the workers could not be started
+ */
+int preprocessor_start(int count);
+
 /**
  * \brief Close all data managers and their storage plugins
  */
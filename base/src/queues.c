@@ -40,12 +40,141 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "queues.h"
 
 /** Identifier to MSG_* macros */
 static char *msg_module = "queue";
 
+/** Number of busy-wait iterations before the thread goes to sleep */
+#define RBUFFER_SPIN_COUNT 1024
+
+/** Number of sched_yield() calls before the thread goes to sleep */
+#define RBUFFER_YIELD_COUNT 16
+
+#define rb_load(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define rb_store(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+
+/** Side of the ring buffer a thread waits for */
+enum rbuffer_side {
+	RBUFFER_WAIT_WRITE, /**< Wait for write_offset to move */
+	RBUFFER_WAIT_READ,  /**< Wait for read_pos to move */
+};
+
+/**
+ * \brief Hint the CPU that we are in a spin loop
+ */
+static inline void rbuffer_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/**
+ * \brief Sleep on futex word while it holds value \p val
+ */
+static inline void rbuffer_futex_wait(uint32_t *addr, uint32_t val)
+{
+	/* EAGAIN (value changed) and EINTR are handled by the caller's loop */
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/**
+ * \brief Wake all threads sleeping on futex word
+ */
+static inline void rbuffer_futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * \brief Adaptive wait step - spin, then yield, then sleep on the futex
+ *
+ * Caller calls this function in a loop as long as its condition is not met.
+ * The condition is re-checked after the thread announces itself as a waiter,
+ * so that the wake up cannot be lost.
+ *
+ * @param[in] rbuffer Ring buffer
+ * @param[in] spin Number of previous unsuccessful iterations
+ * @param[in] side Side whose offset is watched by the caller
+ * @param[in] value Value of the write offset or read position the caller waits to change
+ */
+static void rbuffer_wait_step(struct ring_buffer *rbuffer, unsigned int spin,
+		enum rbuffer_side side, uint64_t value)
+{
+	uint32_t seq_val, *seq, *waiters;
+	uint64_t current;
+
+	if (spin < RBUFFER_SPIN_COUNT) {
+		rbuffer_relax();
+		return;
+	}
+
+	if (spin < RBUFFER_SPIN_COUNT + RBUFFER_YIELD_COUNT) {
+		sched_yield();
+		return;
+	}
+
+	if (side == RBUFFER_WAIT_WRITE) {
+		seq = &(rbuffer->write_seq);
+		waiters = &(rbuffer->read_waiters);
+	} else {
+		seq = &(rbuffer->read_seq);
+		waiters = &(rbuffer->write_waiters);
+	}
+
+	seq_val = rb_load(seq);
+	__atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+	current = (side == RBUFFER_WAIT_WRITE) ? rb_load(&(rbuffer->write_offset)) : rb_load(&(rbuffer->read_pos));
+	if (current == value) {
+		rbuffer_futex_wait(seq, seq_val);
+	}
+	__atomic_fetch_sub(waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * \brief Announce change of the futex word and wake sleeping threads
+ */
+static inline void rbuffer_notify(uint32_t *seq, uint32_t *waiters)
+{
+	__atomic_fetch_add(seq, 1, __ATOMIC_SEQ_CST);
+	if (rb_load(waiters) > 0) {
+		rbuffer_futex_wake(seq);
+	}
+}
+
+/**
+ * \brief Free IPFIX message released from the ring buffer
+ *
+ * @param[in] msg IPFIX message
+ */
+static void rbuffer_free_message(struct ipfix_message *msg)
+{
+	int i;
+
+	if (!msg) {
+		return;
+	}
+
+	/* Decrement reference on templates */
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple && msg->data_couple[i].data_set; ++i) {
+		if (msg->data_couple[i].data_template) {
+			tm_template_reference_dec(msg->data_couple[i].data_template);
+		}
+	}
+
+	/* Return packet, metadata and message to the pool */
+	message_recycle(msg);
+}
+
 /**
  * \brief Initiate ring buffer structure with specified size.
  *
@@ -61,17 +190,15 @@ struct ring_buffer* rbuffer_init(uint16_t size)
 		return NULL;
 	}
 
-	retval = (struct ring_buffer*) malloc(sizeof(struct ring_buffer));
-	if (retval == NULL) {
+	/* calloc cannot be used, structure must be aligned to the cache line */
+	if (posix_memalign((void **) &retval, RBUFFER_CACHE_LINE, sizeof(struct ring_buffer)) != 0) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		return NULL;
 	}
+	memset(retval, 0, sizeof(struct ring_buffer));
 
-	retval->read_offset = 0;
-	retval->write_offset = 0;
-	retval->count = 0;
 	retval->size = size;
-	retval->data = (struct ipfix_message **) malloc(size * sizeof(struct ipfix_message*));
+	retval->data = (struct ipfix_message **) calloc(size, sizeof(struct ipfix_message*));
 	if (retval->data == NULL) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		free(retval);
@@ -86,26 +213,18 @@ struct ring_buffer* rbuffer_init(uint16_t size)
 		return NULL;
 	}
 
-	if (pthread_mutex_init(&(retval->mutex), NULL) != 0) {
-		MSG_ERROR(msg_module, "Initialization of condition variable failed (%s:%d)", __FILE__, __LINE__);
-		free(retval->data_references);
-		free(retval->data);
-		free(retval);
-		return NULL;
-	}
-
-	if (pthread_cond_init(&(retval->cond), NULL) != 0) {
-		MSG_ERROR(msg_module, "Initialization of condition variable failed (%s:%d)", __FILE__, __LINE__);
-		pthread_mutex_destroy(&(retval->mutex));
+	retval->data_free = (uint8_t *) calloc(size, sizeof(uint8_t));
+	if (retval->data_free == NULL) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		free(retval->data_references);
 		free(retval->data);
 		free(retval);
 		return NULL;
 	}
 
-	if (pthread_cond_init(&(retval->cond_empty), NULL) != 0) {
-		MSG_ERROR(msg_module, "Initialization of condition variable failed (%s:%d)", __FILE__, __LINE__);
-		pthread_mutex_destroy(&(retval->mutex));
+	if (pthread_mutex_init(&(retval->write_mutex), NULL) != 0) {
+		MSG_ERROR(msg_module, "Initialization of mutex failed (%s:%d)", __FILE__, __LINE__);
+		free(retval->data_free);
 		free(retval->data_references);
 		free(retval->data);
 		free(retval);
@@ -118,6 +237,8 @@ struct ring_buffer* rbuffer_init(uint16_t size)
 /**
  * \brief Add new record into the ring buffer.
  *
+ * Writers are serialized by the write mutex, reading threads are not blocked.
+ *
  * @param[in] rbuffer Ring buffer.
  * @param[in] record IPFIX message structure to be added into the ring buffer.
  * @param[in] ref_count Initial reference count - number of reading threads.
@@ -125,51 +246,99 @@ struct ring_buffer* rbuffer_init(uint16_t size)
  */
 int rbuffer_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uint16_t ref_count)
 {
+	unsigned int spin;
+	uint16_t write_offset, next_offset;
+	uint64_t read_pos;
+
+	int (*forward)(struct ipfix_message *);
+
 	if (rbuffer == NULL || ref_count == 0) {
 		MSG_ERROR(msg_module, "Invalid ring buffer write parameters");
 		return EXIT_FAILURE;
 	}
 
-	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
+	/* records of forwarding ring buffer bypass it */
+	forward = __atomic_load_n(&(rbuffer->forward), __ATOMIC_ACQUIRE);
+	if (forward) {
+		return forward(record);
+	}
+
+	if (pthread_mutex_lock(&(rbuffer->write_mutex)) != 0) {
 		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
 		return EXIT_FAILURE;
 	}
-	/* it will be never more than ring buffer size, but just to be sure I'm checking it 
-	 * leave one position in buffer free, so that faster thread cannot read 
+
+	/* forwarding could be enabled while waiting for the mutex */
+	forward = rbuffer->forward;
+	if (forward) {
+		pthread_mutex_unlock(&(rbuffer->write_mutex));
+		return forward(record);
+	}
+
+	write_offset = rbuffer->write_offset;
+	next_offset = (write_offset + 1) % rbuffer->size;
+
+	/* leave one position in buffer free, so that faster thread cannot read
 	 * data yet not processed by slower one */
-	while (rbuffer->count + 1 >= rbuffer->size) {
-		if (pthread_cond_wait(&(rbuffer->cond), &(rbuffer->mutex)) != 0) {
-			MSG_ERROR(msg_module, "Condition wait failed (%s:%d)", __FILE__, __LINE__);
+	for (spin = 0; RBUFFER_POS_OFFSET(read_pos = rb_load(&(rbuffer->read_pos))) == next_offset; ++spin) {
+		rbuffer_wait_step(rbuffer, spin, RBUFFER_WAIT_READ, read_pos);
+	}
 
-			if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-				MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-			}
-			
-			return EXIT_FAILURE;
-		}
+	rbuffer->data[write_offset] = record;
+	rbuffer->data_free[write_offset] = 0;
+	rb_store(&(rbuffer->data_references[write_offset]), ref_count);
+
+	/* publish the record to the read threads */
+	rb_store(&(rbuffer->write_offset), next_offset);
+	rbuffer_notify(&(rbuffer->write_seq), &(rbuffer->read_waiters));
+
+	if (pthread_mutex_unlock(&(rbuffer->write_mutex)) != 0) {
+		MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
+		return EXIT_FAILURE;
 	}
 
-	rbuffer->data[rbuffer->write_offset] = record;
-	rbuffer->data_references[rbuffer->write_offset] = ref_count;
-	rbuffer->write_offset = (rbuffer->write_offset + 1) % rbuffer->size;
-	rbuffer->count++;
+	return EXIT_SUCCESS;
+}
+
+/**
+ * \brief Pass records written into the ring buffer directly to a function.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] forward Function taking over written records or NULL.
+ * @return 0 on success, nonzero on error.
+ */
+int rbuffer_set_forward(struct ring_buffer* rbuffer, int (*forward)(struct ipfix_message *))
+{
+	unsigned int index;
+	struct ipfix_message *msg;
+
+	if (pthread_mutex_lock(&(rbuffer->write_mutex)) != 0) {
+		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
+		return EXIT_FAILURE;
+	}
 
-	/* Set exit code to variable */
-	int ret = EXIT_SUCCESS;
+	if (forward) {
+		/* pass waiting records first; writers are blocked by the mutex */
+		for (index = rbuffer_read_offset(rbuffer); index != rb_load(&(rbuffer->write_offset));
+				index = (index + 1) % rbuffer->size) {
+			msg = rbuffer->data[index];
+			if (msg) {
+				forward(msg);
+			}
 
-	/* I did change of rbuffer->count so inform about it other threads (read threads) */
-	if (pthread_cond_signal(&(rbuffer->cond)) != 0) {
-		MSG_ERROR(msg_module, "Condition signal failed (%s:%d)", __FILE__, __LINE__);
-		/* Do not return yet, we need to unlock first */
-		ret = EXIT_FAILURE;
+			/* control messages are dropped, other records belong to the function now */
+			rbuffer_remove_reference(rbuffer, index, 0);
+		}
 	}
 
-	if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
+	__atomic_store_n(&(rbuffer->forward), forward, __ATOMIC_RELEASE);
+
+	if (pthread_mutex_unlock(&(rbuffer->write_mutex)) != 0) {
 		MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
 		return EXIT_FAILURE;
 	}
 
-	return ret;
+	return EXIT_SUCCESS;
 }
 
 /**
@@ -183,43 +352,134 @@ int rbuffer_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uin
  */
 struct ipfix_message* rbuffer_read(struct ring_buffer* rbuffer, unsigned int *index)
 {
+	unsigned int spin;
+
 	if (*index == (unsigned int) -1) {
 		/* if no index specified -> read from read_offset, so just 1 record in ring buffer required */
-		*index = rbuffer->read_offset;
+		*index = rbuffer_read_offset(rbuffer);
 	}
 
-	/* check if the ring buffer is full enough, if not wait (and block) for it */
-	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
-		return NULL;
+	/* wait when trying to read from write_offset - no data here yet
+	 * otherwise it's ok, reading thread cannot outrun the writing one,
+	 * unless it demands indexes nonlinearly */
+	for (spin = 0; rb_load(&(rbuffer->write_offset)) == *index; ++spin) {
+		rbuffer_wait_step(rbuffer, spin, RBUFFER_WAIT_WRITE, *index);
 	}
-	/* wait when trying to read from write_offset - no data here yer
-	 * otherwise it's ok, reading tread connot outrun the writing one,
-	 * unles it demands indexes nonlinearly */
-	while (rbuffer->write_offset == *index) {
-		if (pthread_cond_wait(&(rbuffer->cond), &(rbuffer->mutex)) != 0) {
-			MSG_ERROR(msg_module, "Condition wait failed (%s:%d)", __FILE__, __LINE__);
 
-			if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-				MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-			}
+	/* get data */
+	return rbuffer->data[*index];
+}
 
-			return NULL;
-		}
+/**
+ * \brief Get pointers to all ready data in ring buffer starting at index.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in,out] index Index of the first item, (unsigned int)-1 for the ring
+ * buffer's read offset.
+ * @param[out] msgs Array for the read data.
+ * @param[in] max Size of the array.
+ * @return Number of items stored in msgs.
+ */
+unsigned int rbuffer_read_batch(struct ring_buffer* rbuffer, unsigned int *index,
+		struct ipfix_message **msgs, unsigned int max)
+{
+	unsigned int i, avail, pos;
+
+	if (max == 0) {
+		return 0;
 	}
-	if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-		return NULL;
+
+	/* wait for the first item */
+	msgs[0] = rbuffer_read(rbuffer, index);
+	if (msgs[0] == NULL) {
+		return 1;
 	}
 
-	/* Wake up other threads waiting for read */
-	if (pthread_cond_signal(&(rbuffer->cond)) != 0) {
-		MSG_ERROR(msg_module, "Condition signal failed (%s:%d)", __FILE__, __LINE__);
-		return NULL;
+	avail = (rb_load(&(rbuffer->write_offset)) + rbuffer->size - *index) % rbuffer->size;
+	if (avail > max) {
+		avail = max;
 	}
 
-	/* get data */
-	return rbuffer->data[*index];
+	for (i = 1, pos = (*index + 1) % rbuffer->size; i < avail; ++i, pos = (pos + 1) % rbuffer->size) {
+		msgs[i] = rbuffer->data[pos];
+		if (msgs[i] == NULL) {
+			/* control message starts next batch */
+			break;
+		}
+	}
+
+	return i;
+}
+
+/**
+ * \brief Release all records at the read offset with no references left
+ *
+ * Any thread can move the read offset; the one which wins the compare and
+ * swap of the read position owns the released record and frees it if
+ * required. The position includes the number of wraps, so the swap fails
+ * when the ring buffer wrapped around since the record was loaded.
+ *
+ * @param[in] rbuffer Ring buffer.
+ */
+static void rbuffer_release(struct ring_buffer* rbuffer)
+{
+	uint64_t read_pos, next_pos;
+	uint16_t read_offset;
+	struct ipfix_message *msg;
+	uint8_t do_free;
+
+	while (1) {
+		read_pos = rb_load(&(rbuffer->read_pos));
+		read_offset = RBUFFER_POS_OFFSET(read_pos);
+		if (read_offset == rb_load(&(rbuffer->write_offset))
+				|| rb_load(&(rbuffer->data_references[read_offset])) != 0) {
+			/* empty buffer or the oldest record is still in use */
+			return;
+		}
+
+		msg = rbuffer->data[read_offset];
+		do_free = rbuffer->data_free[read_offset];
+
+		/* move offset pointer in ring buffer, count the wrap at the end */
+		next_pos = (read_offset + 1 == rbuffer->size) ? (read_pos | 0xFFFF) + 1 : read_pos + 1;
+		if (!__atomic_compare_exchange_n(&(rbuffer->read_pos), &read_pos,
+				next_pos, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			/* another thread released the record */
+			continue;
+		}
+
+		if (do_free) {
+			rbuffer_free_message(msg);
+		}
+
+		/* inform write thread (and threads waiting for empty queue) */
+		rbuffer_notify(&(rbuffer->read_seq), &(rbuffer->write_waiters));
+	}
+}
+
+/**
+ * \brief Decrease reference counter without releasing the record
+ *
+ * @return 1 if last reference was removed, 0 if not, -1 on error
+ */
+static int rbuffer_dec_reference(struct ring_buffer* rbuffer, unsigned int index, uint8_t do_free)
+{
+	unsigned int refs = rb_load(&(rbuffer->data_references[index]));
+
+	/* atomic rbuffer->data_references[index]--; and check <= 0 */
+	do {
+		if (refs == 0) {
+			return -1;
+		}
+
+		if (refs == 1) {
+			/* last reference, remember how to release the data */
+			rbuffer->data_free[index] = do_free;
+		}
+	} while (!__atomic_compare_exchange_n(&(rbuffer->data_references[index]), &refs,
+			refs - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+	return refs == 1;
 }
 
 /**
@@ -234,6 +494,9 @@ struct ipfix_message* rbuffer_read(struct ring_buffer* rbuffer, unsigned int *in
  * - do some work with read data; <br/>
  * - rbuffer_remove_reference ();
  *
+ * The do_free flag of the thread removing the last reference decides whether
+ * the data are freed.
+ *
  * @param[in] rbuffer Ring buffer.
  * @param[in] index Index of the item in the ring buffer.
  * @param[in] do_free 1 to free data with 0 references, 0 to lose data by removing
@@ -242,81 +505,49 @@ struct ipfix_message* rbuffer_read(struct ring_buffer* rbuffer, unsigned int *in
  */
 int rbuffer_remove_reference(struct ring_buffer* rbuffer, unsigned int index, uint8_t do_free)
 {
-	int i;
+	int ret = rbuffer_dec_reference(rbuffer, index, do_free);
 
-	/* atomic rbuffer->data_references[index]--; and check <= 0 */
-	if (__sync_fetch_and_sub(&(rbuffer->data_references[index]), 1) <= 0) {
+	if (ret < 0) {
 		return EXIT_FAILURE;
 	}
 
-	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
-		return EXIT_FAILURE;
+	if (ret > 0) {
+		rbuffer_release(rbuffer);
 	}
 
-	/* it will be never less than zero, but just to be sure I'm checking it */
-	if (rbuffer->data_references[rbuffer->read_offset] <= 0) {
-		while ((rbuffer->data_references[rbuffer->read_offset] == 0) && (rbuffer->count > 0)) {
-			if (do_free) {
-				/* free the data */
-				if (rbuffer->data[rbuffer->read_offset]) {
-					if (rbuffer->data[rbuffer->read_offset]->pkt_header) {
-						free(rbuffer->data[rbuffer->read_offset]->pkt_header);
-					}
-
-					/* Decrement reference on templates */
-					for (i = 0; i < MSG_MAX_DATA_COUPLES && rbuffer->data[rbuffer->read_offset]->data_couple[i].data_set; ++i) {
-						if (rbuffer->data[rbuffer->read_offset]->data_couple[i].data_template) {
-							tm_template_reference_dec(rbuffer->data[rbuffer->read_offset]->data_couple[i].data_template);
-						}
-					}
-					
-					if (rbuffer->data[rbuffer->read_offset]->metadata) {
-						message_free_metadata(rbuffer->data[rbuffer->read_offset]);
-					}
-					
-					free(rbuffer->data[rbuffer->read_offset]);
-				}
-			}
-
-			/* move offset pointer in ring buffer */
-			rbuffer->read_offset = (rbuffer->read_offset + 1) % rbuffer->size;
-			rbuffer->count--;
-
-			/* signal to write thread waiting for empty queue */
-			if (rbuffer->count == 0) {
-				if (pthread_cond_signal(&(rbuffer->cond_empty)) != 0) {
-					MSG_ERROR(msg_module, "Condition signal failed (%s:%d)", __FILE__, __LINE__);
-
-					if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-						MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-					}
+	return EXIT_SUCCESS;
+}
 
-					return EXIT_FAILURE;
-				}
-			}
-		}
-		if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-			MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-			return EXIT_FAILURE;
-		}
-	} else {
-		if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-			MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-			return EXIT_FAILURE;
+/**
+ * \brief Decrease reference counters on a contiguous range of records.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] index Index of the first item in the ring buffer.
+ * @param[in] count Number of items (wrap around the end of the buffer is allowed).
+ * @param[in] do_free 1 to free data with 0 references, 0 to lose data by removing
+ * the pointer, but do not free the data.
+ * @return 0 on success, nonzero on error - no reference on some item
+ */
+int rbuffer_remove_references(struct ring_buffer* rbuffer, unsigned int index,
+		unsigned int count, uint8_t do_free)
+{
+	unsigned int i;
+	int ret, released = 0, retval = EXIT_SUCCESS;
+
+	for (i = 0; i < count; ++i, index = (index + 1) % rbuffer->size) {
+		ret = rbuffer_dec_reference(rbuffer, index, do_free);
+		if (ret < 0) {
+			retval = EXIT_FAILURE;
+		} else if (ret > 0) {
+			released = 1;
 		}
-
-		/* only reference decrease was done, moving rbuffer->read_offset not */
-		return EXIT_SUCCESS;
 	}
 
-	/* I did change of rbuffer->count so inform about it other threads (mainly write thread) */
-	if (pthread_cond_signal(&(rbuffer->cond)) != 0) {
-		MSG_ERROR(msg_module, "Condition signal failed (%s:%d)", __FILE__, __LINE__);
-		return EXIT_FAILURE;
+	if (released) {
+		rbuffer_release(rbuffer);
 	}
 
-	return EXIT_SUCCESS;
+	return retval;
 }
 
 /**
@@ -325,26 +556,44 @@ int rbuffer_remove_reference(struct ring_buffer* rbuffer, unsigned int index, ui
  * @param[in] rbuffer Ring buffer.
  * @return 0 on success, nonzero on error
  */
-int rbuffer_wait_empty(struct ring_buffer* rbuffer) {
-	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
-		return EXIT_FAILURE;
-	}
+int rbuffer_wait_empty(struct ring_buffer* rbuffer)
+{
+	unsigned int spin;
+	uint64_t read_pos;
 
-	while (rbuffer->count > 0) {
-		if (pthread_cond_wait(&(rbuffer->cond_empty), &(rbuffer->mutex)) != 0) {
-			MSG_ERROR(msg_module, "Condition wait failed (%s:%d)", __FILE__, __LINE__);
-			return EXIT_FAILURE;
-		}
+	for (spin = 0; RBUFFER_POS_OFFSET(read_pos = rb_load(&(rbuffer->read_pos)))
+			!= rb_load(&(rbuffer->write_offset)); ++spin) {
+		rbuffer_wait_step(rbuffer, spin, RBUFFER_WAIT_READ, read_pos);
 	}
 
-	if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-		return EXIT_FAILURE;
-	}
 	return EXIT_SUCCESS;
 }
 
+/**
+ * \brief Get number of items currently held by the ring buffer
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @return Number of items
+ */
+uint16_t rbuffer_count(struct ring_buffer* rbuffer)
+{
+	uint16_t read_offset = rbuffer_read_offset(rbuffer);
+	uint16_t write_offset = rb_load(&(rbuffer->write_offset));
+
+	return (write_offset + rbuffer->size - read_offset) % rbuffer->size;
+}
+
+/**
+ * \brief Get current read offset of the ring buffer
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @return Index of the oldest item
+ */
+uint16_t rbuffer_read_offset(struct ring_buffer* rbuffer)
+{
+	return RBUFFER_POS_OFFSET(rb_load(&(rbuffer->read_pos)));
+}
+
 /**
  * \brief Destroy ring buffer structures.
  *
@@ -354,6 +603,9 @@ int rbuffer_wait_empty(struct ring_buffer* rbuffer) {
 int rbuffer_free(struct ring_buffer* rbuffer)
 {
 	if (rbuffer) {
+		if (rbuffer->data_free) {
+			free(rbuffer->data_free);
+		}
 		if (rbuffer->data_references) {
 			free(rbuffer->data_references);
 		}
@@ -361,9 +613,7 @@ int rbuffer_free(struct ring_buffer* rbuffer)
 			free(rbuffer->data);
 		}
 
-		pthread_cond_destroy(&(rbuffer->cond));
-		pthread_cond_destroy(&(rbuffer->cond_empty));
-		pthread_mutex_destroy(&(rbuffer->mutex));
+		pthread_mutex_destroy(&(rbuffer->write_mutex));
 		free(rbuffer);
 	}
 
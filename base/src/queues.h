@@ -44,6 +44,12 @@
 
 #include "ipfixcol.h"
 
+/** Size of the cache line used to separate producer and consumer fields */
+#define RBUFFER_CACHE_LINE 64
+
+/** Maximal number of items processed at once by the reading threads */
+#define RBUFFER_BATCH_SIZE 64
+
 /**
  * \brief Simple ring buffer for passing data between one write thread and one
  * or more read threads.
@@ -59,21 +65,47 @@
  * threads already read them.
  *
  * Thread calling rbuffer_read() must specify which index it wants to read and
- * the index must be incremented continuously.
- *
+ * the index must be incremented continuously. The index is the private cursor
+ * of the reading thread, so readers never touch shared state except the
+ * reference counter of the item.
+ *
+ * Reading threads are lock-free. Offsets are published with atomic operations
+ * and threads waiting for data (or for free space) spin for a while and then
+ * sleep on a futex word which is bumped by the opposite side. There is usually
+ * only one write thread, control messages (e.g. NULL for termination) can
+ * be written by other threads, so writers are serialized by write_mutex which
+ * is never touched by the readers.
  */
 struct ring_buffer {
-	uint16_t read_offset;
-	uint16_t write_offset;
-	uint16_t size;
-	uint16_t count;
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
-	pthread_cond_t cond_empty;
+	/* Fields written by the write thread */
+	uint16_t write_offset __attribute__((aligned(RBUFFER_CACHE_LINE)));
+	uint32_t write_seq;         /**< Futex word, incremented on each write */
+	uint32_t read_waiters;      /**< Number of readers sleeping on write_seq */
+	pthread_mutex_t write_mutex;
+	int (*forward)(struct ipfix_message *); /**< Written records are passed to this function instead of being stored */
+
+	/* Fields written by the reading threads */
+	uint64_t read_pos __attribute__((aligned(RBUFFER_CACHE_LINE))); /**< Read offset (lower 16 bits) and number of wraps (see RBUFFER_POS_OFFSET) */
+	uint32_t read_seq;          /**< Futex word, incremented on read offset move */
+	uint32_t write_waiters;     /**< Number of threads sleeping on read_seq */
+
+	/* Read-only after initialization */
+	uint16_t size __attribute__((aligned(RBUFFER_CACHE_LINE)));
 	struct ipfix_message** data;
 	unsigned int* data_references;
+	uint8_t* data_free;         /**< do_free flag of the last reference */
 };
 
+/**
+ * \brief Get read offset from the read position of the ring buffer
+ *
+ * The read offset is moved by compare and swap of the whole position. The
+ * number of wraps in the upper bits makes the position unique, so a thread
+ * which was preempted while the ring buffer wrapped around cannot move the
+ * offset (and release a record) again.
+ */
+#define RBUFFER_POS_OFFSET(pos) ((uint16_t) ((pos) & 0xFFFF))
+
 /**
  * \brief Initiate ring buffer structure with specified size.
  *
@@ -84,6 +116,20 @@ struct ring_buffer* rbuffer_init(uint16_t size);
 
 int rbuffer_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uint16_t ref_count);
 
+/**
+ * \brief Pass records written into the ring buffer directly to a function.
+ *
+ * Records waiting in the ring buffer are passed to the function first, so no
+ * record overtakes the older ones. Afterwards writers call the function
+ * instead of storing records, the ring buffer must have no reading thread
+ * then. NULL function restores storing of records.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] forward Function taking over written records or NULL.
+ * @return 0 on success, nonzero on error.
+ */
+int rbuffer_set_forward(struct ring_buffer* rbuffer, int (*forward)(struct ipfix_message *));
+
 /**
  * \brief Get pointer to data in ring buffer - its position is specified by
  * index or by ring buffer's current read offset.
@@ -95,6 +141,24 @@ int rbuffer_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uin
  */
 struct ipfix_message* rbuffer_read(struct ring_buffer* rbuffer, unsigned int *index);
 
+/**
+ * \brief Get pointers to all ready data in ring buffer starting at index.
+ *
+ * Waits until at least one item is available. NULL item (control message) is
+ * always returned alone, i.e. the batch ends before it. The items are stored
+ * at consecutive (modulo size) positions of the ring buffer, so the index of
+ * i-th item is (*index + i) % size.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in,out] index Index of the first item, (unsigned int)-1 for the ring
+ * buffer's read offset.
+ * @param[out] msgs Array for the read data.
+ * @param[in] max Size of the array.
+ * @return Number of items stored in msgs.
+ */
+unsigned int rbuffer_read_batch(struct ring_buffer* rbuffer, unsigned int *index,
+		struct ipfix_message **msgs, unsigned int max);
+
 /**
  * \brief Decrease reference counter on specified record in ring buffer.
  *
@@ -115,6 +179,22 @@ struct ipfix_message* rbuffer_read(struct ring_buffer* rbuffer, unsigned int *in
  */
 int rbuffer_remove_reference(struct ring_buffer* rbuffer, unsigned int index, uint8_t do_free);
 
+/**
+ * \brief Decrease reference counters on a contiguous range of records.
+ *
+ * Same as calling rbuffer_remove_reference() for each record of the range,
+ * but the read offset is moved just once.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] index Index of the first item in the ring buffer.
+ * @param[in] count Number of items (wrap around the end of the buffer is allowed).
+ * @param[in] do_free 1 to free data with 0 references, 0 to lose data by removing
+ * the pointer, but do not free the data.
+ * @return 0 on success, nonzero on error - no reference on some item
+ */
+int rbuffer_remove_references(struct ring_buffer* rbuffer, unsigned int index,
+		unsigned int count, uint8_t do_free);
+
 /**
  * \brief Wait for queue to became empty
  *
@@ -123,6 +203,24 @@ int rbuffer_remove_reference(struct ring_buffer* rbuffer, unsigned int index, ui
  */
 int rbuffer_wait_empty(struct ring_buffer* rbuffer);
 
+/**
+ * \brief Get number of items currently held by the ring buffer
+ *
+ * The value is only a snapshot, it is intended for statistics.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @return Number of items
+ */
+uint16_t rbuffer_count(struct ring_buffer* rbuffer);
+
+/**
+ * \brief Get current read offset of the ring buffer
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @return Index of the oldest item
+ */
+uint16_t rbuffer_read_offset(struct ring_buffer* rbuffer);
+
 /**
  * \brief Destroy ring buffer structures.
  *
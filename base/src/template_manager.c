@@ -40,6 +40,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <libxml/tree.h>
 
 #include <ipfixcol.h>
@@ -49,9 +50,220 @@
 /** TEMPLATE_ENT_FIELD_LEN length of template enterprise number */
 #define TEMPLATE_ENT_NUM_LEN 4
 
+/** Initial number of slots of the table of records (power of 2) */
+#define TM_TABLE_INIT_SIZE 64
+
+/** Atomic access to the data shared with lock-free readers */
+#define tm_load(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define tm_store(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+
+/**
+ * \brief Open addressing hash table of Template Manager's records
+ */
+struct ipfix_template_mgr_table {
+	uint32_t size;    /**< Number of slots (power of 2) */
+	uint32_t used;    /**< Number of occupied and removed slots */
+	uint32_t records; /**< Number of records */
+	struct ipfix_template_mgr_record *slots[]; /**< Slots with records */
+};
+
+/** Marks a slot whose record was removed (lookups have to continue) */
+static struct ipfix_template_mgr_record tm_record_removed;
+#define TM_RECORD_REMOVED (&tm_record_removed)
+
+/** Serial number of the last created template */
+static uint64_t tm_serial = 0;
+
 /** Identifier to MSG_* macros */
 static char *msg_module = "template manager";
 
+/**
+ * \brief Enter lock-free read section
+ *
+ * \param[in] tm Template Manager
+ * \return Grace period index for tm_read_unlock()
+ */
+static inline unsigned int tm_read_lock(struct ipfix_template_mgr *tm)
+{
+	unsigned int idx = tm_load(&tm->epoch) & 1;
+	__atomic_fetch_add(&tm->readers[idx], 1, __ATOMIC_SEQ_CST);
+	return idx;
+}
+
+/**
+ * \brief Leave lock-free read section
+ *
+ * \param[in] tm Template Manager
+ * \param[in] idx Grace period index from tm_read_lock()
+ */
+static inline void tm_read_unlock(struct ipfix_template_mgr *tm, unsigned int idx)
+{
+	__atomic_fetch_sub(&tm->readers[idx], 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * \brief Wait until all readers that could see unpublished data are gone
+ *
+ * Readers entering after the epoch is switched count into the other
+ * grace period and cannot see the data unpublished before this call.
+ * Caller must hold tmr_lock.
+ *
+ * \param[in] tm Template Manager
+ */
+static void tm_synchronize(struct ipfix_template_mgr *tm)
+{
+	unsigned int idx = __atomic_fetch_add(&tm->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+
+	while (tm_load(&tm->readers[idx]) != 0) {
+		sched_yield();
+	}
+}
+
+/**
+ * \brief Hash function for keys of Template Manager's records
+ */
+static inline uint32_t tm_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (uint32_t) key;
+}
+
+/**
+ * \brief Create empty table of Template Manager's records
+ *
+ * \param[in] size Number of slots (power of 2)
+ * \return New table or NULL
+ */
+static struct ipfix_template_mgr_table *tm_table_create(uint32_t size)
+{
+	struct ipfix_template_mgr_table *table;
+
+	table = calloc(1, sizeof(*table) + size * sizeof(struct ipfix_template_mgr_record *));
+	if (!table) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	table->size = size;
+	return table;
+}
+
+/**
+ * \brief Find record in the table
+ *
+ * Safe for lock-free readers, the table always has at least one empty slot.
+ *
+ * \param[in] table Table of records
+ * \param[in] key Key of record
+ * \return Record or NULL
+ */
+static struct ipfix_template_mgr_record *tm_table_find(struct ipfix_template_mgr_table *table, uint64_t key)
+{
+	struct ipfix_template_mgr_record *rec;
+	uint32_t mask = table->size - 1;
+	uint32_t i = tm_hash(key) & mask;
+
+	while ((rec = tm_load(&table->slots[i])) != NULL) {
+		if (rec != TM_RECORD_REMOVED && rec->key == key) {
+			return rec;
+		}
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Put record into the table (there must be enough free slots)
+ *
+ * \param[in] table Table of records
+ * \param[in] rec New record
+ */
+static void tm_table_put(struct ipfix_template_mgr_table *table, struct ipfix_template_mgr_record *rec)
+{
+	struct ipfix_template_mgr_record *old;
+	uint32_t mask = table->size - 1;
+	uint32_t i = tm_hash(rec->key) & mask;
+
+	while ((old = table->slots[i]) != NULL && old != TM_RECORD_REMOVED) {
+		i = (i + 1) & mask;
+	}
+
+	if (old == NULL) {
+		table->used++;
+	}
+	table->records++;
+
+	tm_store(&table->slots[i], rec);
+}
+
+/**
+ * \brief Insert record into Template Manager's table, resize it if necessary
+ *
+ * Caller must hold tmr_lock.
+ *
+ * \param[in] tm Template Manager
+ * \param[in] rec New record
+ * \return 0 on success, 1 otherwise
+ */
+static int tm_table_insert(struct ipfix_template_mgr *tm, struct ipfix_template_mgr_record *rec)
+{
+	struct ipfix_template_mgr_table *table = tm->table, *new_table;
+	uint32_t size, i;
+
+	/* Keep the load (including removed slots) under one half */
+	if ((table->used + 1) * 2 > table->size) {
+		size = TM_TABLE_INIT_SIZE;
+		while (size < (table->records + 1) * 4) {
+			size *= 2;
+		}
+
+		if ((new_table = tm_table_create(size)) == NULL) {
+			return 1;
+		}
+
+		for (i = 0; i < table->size; ++i) {
+			if (table->slots[i] != NULL && table->slots[i] != TM_RECORD_REMOVED) {
+				tm_table_put(new_table, table->slots[i]);
+			}
+		}
+
+		tm_store(&tm->table, new_table);
+		tm_synchronize(tm);
+		free(table);
+		table = new_table;
+	}
+
+	tm_table_put(table, rec);
+	return 0;
+}
+
+/**
+ * \brief Remove record from Template Manager's table
+ *
+ * The record is only unpublished, caller must call tm_synchronize()
+ * before it is destroyed. Caller must hold tmr_lock.
+ *
+ * \param[in] table Table of records
+ * \param[in] rec Record
+ */
+static void tm_table_remove(struct ipfix_template_mgr_table *table, struct ipfix_template_mgr_record *rec)
+{
+	uint32_t mask = table->size - 1;
+	uint32_t i = tm_hash(rec->key) & mask;
+
+	while (table->slots[i] != NULL) {
+		if (table->slots[i] == rec) {
+			tm_store(&table->slots[i], TM_RECORD_REMOVED);
+			table->records--;
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
 /**
  * \brief Create new Template Manager's record
  */
@@ -64,76 +276,82 @@ struct ipfix_template_mgr_record *tm_record_create()
 		return NULL;
 	}
 
-	/* Allocate space for templates */
-	tmr->counter = 0;
-	tmr->max_length = 32;
-	tmr->templates = calloc(tmr->max_length, sizeof(struct ipfix_template *));
-	if (!tmr->templates) {
-		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-		free(tmr);
-		return NULL;
-	}
-
 	return tmr;
 }
 
 /**
  * \brief Find template managers record in template manager
  *
+ * Caller must hold tmr_lock or be inside of a read section.
+ *
  * \param[in] tm Template Manager
  * \param[in] key Unique identifier of template in Template Manager
  * \return pointer to Template Manager's record
  */
 struct ipfix_template_mgr_record *tm_record_lookup(struct ipfix_template_mgr *tm, struct ipfix_template_key *key)
 {
-	struct ipfix_template_mgr_record *tmp_rec;
 	uint64_t table_key = ((uint64_t) key->odid << 32) | key->crc;
 
-	for (tmp_rec = tm->first; tmp_rec != NULL; tmp_rec = tmp_rec->next) {
-		if (tmp_rec->key == table_key) {
-			return tmp_rec;
-		}
-	}
-
-	return NULL;
+	return tm_table_find(tm_load(&tm->table), table_key);
 }
 
 /**
  * \brief Find (or insert if not found) template managers record in template manager
  *
+ * Caller must hold tmr_lock.
+ *
  * \param[in] tm Template Manager
  * \param[in] key Unique identifier of template in Template Manager
  * \return pointer to Template Manager's record
  */
 struct ipfix_template_mgr_record *tm_record_lookup_insert(struct ipfix_template_mgr *tm, struct ipfix_template_key *key)
 {
-	pthread_mutex_lock(&tm->tmr_lock);
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup(tm, key);
 
 	/* Template Manager's record not found - create a new one */
 	if (tmr == NULL) {
 		if ((tmr = tm_record_create()) == NULL) {
-			pthread_mutex_unlock(&tm->tmr_lock);
 			return NULL;
 		}
-		uint64_t table_key = ((uint64_t) key->odid << 32) | key->crc;
-		tmr->key = table_key;
-		tmr->next = NULL;
+		tmr->key = ((uint64_t) key->odid << 32) | key->crc;
 
-		/* Insert new record at the end of list */
-		if (tm->first == NULL) {
-			tm->first = tmr;
-		} else {
-			tm->last->next = tmr;
+		if (tm_table_insert(tm, tmr) != 0) {
+			free(tmr);
+			return NULL;
 		}
-
-		tm->last = tmr;
 	}
 
-	pthread_mutex_unlock(&tm->tmr_lock);
 	return tmr;
 }
 
+/**
+ * \brief Get slot of template in index of Template Manager's record
+ *
+ * \param[in] tmr Template Manager's record
+ * \param[in] id Template ID
+ * \param[in] create Allocate page of the index if it does not exist
+ * \return pointer to the slot or NULL
+ */
+static struct ipfix_template **tm_record_slot(struct ipfix_template_mgr_record *tmr, uint16_t id, int create)
+{
+	struct ipfix_template **page = tm_load(&tmr->index[id / TM_INDEX_PAGE_SIZE]);
+
+	if (page == NULL) {
+		if (!create) {
+			return NULL;
+		}
+
+		page = calloc(TM_INDEX_PAGE_SIZE, sizeof(struct ipfix_template *));
+		if (!page) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return NULL;
+		}
+		tm_store(&tmr->index[id / TM_INDEX_PAGE_SIZE], page);
+	}
+
+	return &page[id % TM_INDEX_PAGE_SIZE];
+}
+
 /**
  * \brief Copy ipfix_template fields and convert them to host byte order
  *
@@ -179,6 +397,7 @@ static int tm_fill_template(struct ipfix_template *template, void *template_reco
 	template->original_id = template->template_id;
 	template->template_length = template_length;
 	template->data_length = data_length;
+	template->serial = __atomic_add_fetch(&tm_serial, 1, __ATOMIC_RELAXED);
 
 	/* set type specific attributes */
 	if (type == TM_TEMPLATE) { /* template */
@@ -200,6 +419,7 @@ static int tm_fill_template(struct ipfix_template *template, void *template_reco
 
 	template->references = 0;
 	template->next = NULL;
+	template->map = NULL;
 	template->first_transmission = time(NULL);
 
 	int i;
@@ -295,16 +515,11 @@ int tm_source_register(struct ipfix_template_mgr *tm, uint32_t odid, uint32_t cr
 	key.crc = crc;
 	key.tid = 0; // This field is not used by lookup up function, so it is OK
 
+	pthread_mutex_lock(&tm->tmr_lock);
+
 	struct ipfix_template_mgr_record *rec;
 	if ((rec = tm_record_lookup_insert(tm, &key)) == NULL) {
 		// Failed
-		return 1;
-	}
-
-	pthread_mutex_lock(&tm->tmr_lock);
-	// We have to get it again, but right now we are locked...
-	if ((rec = tm_record_lookup(tm, &key)) == NULL) {
-		// Someone removed the record, before we managed to lock the manager
 		pthread_mutex_unlock(&tm->tmr_lock);
 		return 1;
 	}
@@ -346,6 +561,123 @@ int tm_source_unregister(struct ipfix_template_mgr *tm, uint32_t odid, uint32_t
 	return 0;
 }
 
+/**
+ * \brief Hash function for fields of compiled template
+ */
+static inline uint32_t tm_field_hash(uint32_t enterprise, uint16_t id)
+{
+	uint32_t hash = (enterprise * 31 + id) * 2654435761U;
+	return hash >> 16;
+}
+
+/**
+ * \brief Get size of compiled fields of template
+ *
+ * \param[in] field_count Number of template fields
+ * \param[out] hash_size Size of hash table
+ * \return Size of memory needed for compiled fields
+ */
+static size_t tm_map_size(uint16_t field_count, uint32_t *hash_size)
+{
+	uint32_t size = 4;
+
+	/* Keep the load of hash table under one half */
+	while (size < field_count * 2U) {
+		size *= 2;
+	}
+
+	*hash_size = size;
+	return sizeof(struct ipfix_template_map) + field_count * sizeof(struct ipfix_template_field)
+			+ size * sizeof(uint16_t);
+}
+
+/**
+ * \brief Compile template fields
+ *
+ * Fills descriptors of all fields (with static offsets up to the first
+ * variable-length field) and hash table indexed by (enterprise, ID).
+ *
+ * \param[in,out] templ Template with allocated map
+ * \param[in] hash_size Size of hash table
+ */
+static void tm_compile_template(struct ipfix_template *templ, uint32_t hash_size)
+{
+	struct ipfix_template_map *map = templ->map;
+	struct ipfix_template_field *field, *prev;
+	int32_t offset = 0;
+	uint32_t slot;
+	uint16_t i, index, j;
+
+	map->field_count = templ->field_count;
+	map->var_first = templ->field_count;
+	map->hash_mask = hash_size - 1;
+	map->hash = (uint16_t *) &map->fields[templ->field_count];
+	memset(map->hash, 0, hash_size * sizeof(uint16_t));
+
+	for (i = index = 0; i < templ->field_count; ++i, ++index) {
+		field = &map->fields[i];
+		field->id = templ->fields[index].ie.id;
+		field->length = templ->fields[index].ie.length;
+		field->enterprise = 0;
+		field->next = -1;
+
+		if (field->id >> 15) {
+			/* Enterprise Number */
+			field->id &= 0x7FFF;
+			field->enterprise = templ->fields[++index].enterprise_number;
+		}
+
+		/* Offsets are static only up to the first variable-length field */
+		field->offset = offset;
+		if (offset >= 0) {
+			if (field->length == VAR_IE_LENGTH) {
+				map->var_first = i;
+				offset = -1;
+			} else {
+				offset += field->length;
+			}
+		}
+
+		/* Insert into hash table or chain after the last field with the same ID */
+		slot = tm_field_hash(field->enterprise, field->id) & map->hash_mask;
+		while ((j = map->hash[slot]) != 0) {
+			prev = &map->fields[j - 1];
+			if (prev->id == field->id && prev->enterprise == field->enterprise) {
+				while (prev->next >= 0) {
+					prev = &map->fields[prev->next];
+				}
+				prev->next = i;
+				break;
+			}
+			slot = (slot + 1) & map->hash_mask;
+		}
+
+		if (j == 0) {
+			map->hash[slot] = i + 1;
+		}
+	}
+}
+
+/**
+ * \brief Find field in compiled template
+ */
+int template_map_find(const struct ipfix_template_map *map, uint32_t enterprise, uint16_t id)
+{
+	const struct ipfix_template_field *field;
+	uint32_t slot = tm_field_hash(enterprise, id) & map->hash_mask;
+	uint16_t j;
+
+	while ((j = map->hash[slot]) != 0) {
+		field = &map->fields[j - 1];
+		if (field->id == id && field->enterprise == enterprise) {
+			return j - 1;
+		}
+		slot = (slot + 1) & map->hash_mask;
+	}
+
+	return -1;
+}
+
 /**
  * \brief Create new IPFIX template
  *
@@ -359,7 +691,8 @@ struct ipfix_template *tm_create_template(void *template, int max_len, int type,
 {
 	struct ipfix_template *new_tmpl = NULL;
 	uint32_t data_length = 0;
-	uint32_t tmpl_length;
+	uint32_t tmpl_length, map_offset, hash_size;
+	size_t map_size;
 
 	tmpl_length = tm_template_length(template, max_len, type, &data_length);
 	if (tmpl_length == 0) {
@@ -369,8 +702,10 @@ struct ipfix_template *tm_create_template(void *template, int max_len, int type,
 		return NULL;
 	}
 
-	/* allocate memory for new template */
-	if ((new_tmpl = malloc(tmpl_length)) == NULL) {
+	/* allocate memory for new template and its compiled fields */
+	map_offset = (tmpl_length + 7) & ~7U;
+	map_size = tm_map_size(ntohs(((struct ipfix_template_record *) template)->count), &hash_size);
+	if ((new_tmpl = malloc(map_offset + map_size)) == NULL) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		return NULL;
 	}
@@ -380,50 +715,126 @@ struct ipfix_template *tm_create_template(void *template, int max_len, int type,
 		return NULL;
 	}
 
+	new_tmpl->map = (struct ipfix_template_map *) ((uint8_t *) new_tmpl + map_offset);
+	tm_compile_template(new_tmpl, hash_size);
+
+	return new_tmpl;
+}
+
+/**
+ * \brief Free template and all its older versions
+ *
+ * \param[in] templ IPFIX Template
+ */
+static void tm_free_template_chain(struct ipfix_template *templ)
+{
+	struct ipfix_template *next;
+
+	while (templ != NULL) {
+		next = templ->next;
+		free(templ);
+		templ = next;
+	}
+}
+
+int tm_compare_templates(struct ipfix_template *first, struct ipfix_template *second)
+{
+	if (first->data_length != second->data_length || first->field_count != second->field_count) {
+		return 1;
+	}
+
+	uint16_t count = first->field_count;
+
+	for (uint16_t i = 0; i < count; ++i) {
+		if (first->fields[i].ie.id != second->fields[i].ie.id
+				|| first->fields[i].ie.length != second->fields[i].ie.length) {
+			return 1;
+		}
+
+		if (first->fields[i].ie.id >> 15) {
+			i++;
+			count++;
+
+			if (first->fields[i].enterprise_number != second->fields[i].enterprise_number) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Replace template in the slot of Template Manager's record
+ *
+ * Old template without references is removed, otherwise it is kept
+ * (marked as 'old') behind the new one.
+ *
+ * \param[in] tm Template Manager
+ * \param[in] slot Slot of the template
+ * \param[in] new_tmpl New template
+ * \param[in] odid Observation Domain ID
+ * \return pointer to new template
+ */
+static struct ipfix_template *tm_slot_replace_template(struct ipfix_template_mgr *tm, struct ipfix_template **slot,
+		struct ipfix_template *new_tmpl, uint32_t odid)
+{
+	struct ipfix_template *old = *slot;
+
+	if (old->references == 0) {
+		/* Remove the old template, keep previous template(s) if any */
+		MSG_DEBUG(msg_module, "[%u] Replacing template %d", odid, new_tmpl->original_id);
+		new_tmpl->next = old->next;
+		tm_store(slot, new_tmpl);
+		tm_synchronize(tm);
+		free(old);
+	} else {
+		MSG_DEBUG(msg_module, "[%u] Template %d cannot be removed (%u reference(s)), but it will be marked as 'old'", odid, new_tmpl->original_id, old->references);
+		new_tmpl->next = old;
+		tm_store(slot, new_tmpl);
+	}
+
 	return new_tmpl;
 }
 
 /**
  * \brief Insert existing template into Template Manager's record
  *
+ * If the record already contains template with the same ID and the
+ * templates are equal, the existing one is kept and the new one is freed.
+ *
+ * \param[in] tm Template Manager
  * \param[in] tmr Template Manager's record
  * \param[in] new_tmpl IPFIX Template
  * \return pointer to inserted template
  */
-struct ipfix_template *tm_record_insert_template(struct ipfix_template_mgr_record *tmr, struct ipfix_template *new_tmpl)
+struct ipfix_template *tm_record_insert_template(struct ipfix_template_mgr *tm, struct ipfix_template_mgr_record *tmr, struct ipfix_template *new_tmpl)
 {
-	struct ipfix_template **new_templates = NULL;
-	int i;
+	struct ipfix_template **slot = tm_record_slot(tmr, new_tmpl->original_id, 1);
 
-	/* check whether allocated memory is big enough */
-	if (tmr->counter == tmr->max_length) {
-		new_templates = realloc(tmr->templates, tmr->max_length*2*sizeof(void *));
-		if (new_templates == NULL) {
-			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-			free(new_tmpl);
-			return NULL;
-		}
-		tmr->templates = new_templates;
-		memset(tmr->templates + tmr->max_length, 0, tmr->max_length * sizeof(void*));
-		tmr->max_length *= 2;
+	if (slot == NULL) {
+		free(new_tmpl);
+		return NULL;
 	}
 
-	/* add template to managers record (first position available) */
-	for (i = 0; i < tmr->max_length; i++) {
-		if (tmr->templates[i] == NULL) {
-			tmr->templates[i] = new_tmpl;
-			/* increase the counter */
-			tmr->counter++;
-			break;
-		}
+	if (*slot == NULL) {
+		new_tmpl->next = NULL;
+		tm_store(slot, new_tmpl);
+		return new_tmpl;
 	}
 
-	return new_tmpl;
+	if (tm_compare_templates(new_tmpl, *slot) == 0) {
+		free(new_tmpl);
+		return *slot;
+	}
+
+	return tm_slot_replace_template(tm, slot, new_tmpl, (uint32_t) (tmr->key >> 32));
 }
 
 /**
  * \brief Add new template into Template Manager's record
  *
+ * \param[in] tm Template Manager
  * \param[in] tmr Template Manager's record
  * \param[in] template ipfix template which will be inserted into tmr
  * \param[in] max_len maximum size of template
@@ -431,7 +842,7 @@ struct ipfix_template *tm_record_insert_template(struct ipfix_template_mgr_recor
  * \param[in] odid Observation Domain ID
  * \return pointer to added template
  */
-struct ipfix_template *tm_record_add_template(struct ipfix_template_mgr_record *tmr, void *template, int max_len, int type, uint32_t odid)
+struct ipfix_template *tm_record_add_template(struct ipfix_template_mgr *tm, struct ipfix_template_mgr_record *tmr, void *template, int max_len, int type, uint32_t odid)
 {
 	struct ipfix_template *new_tmpl = NULL;
 
@@ -439,90 +850,37 @@ struct ipfix_template *tm_record_add_template(struct ipfix_template_mgr_record *
 		return NULL;
 	}
 
-	return tm_record_insert_template(tmr, new_tmpl);
+	return tm_record_insert_template(tm, tmr, new_tmpl);
 }
 
 /**
  * \brief Remove template from Template Manager's record
  *
+ * \param[in] tm Template Manager
  * \param[in] tmr Template Manager's record
  * \param[in] template_id Identification number of template
  * \return 0 if template was found, 1 otherwise
  */
-int tm_record_remove_template(struct ipfix_template_mgr_record *tmr, uint16_t template_id)
+int tm_record_remove_template(struct ipfix_template_mgr *tm, struct ipfix_template_mgr_record *tmr, uint16_t template_id)
 {
-	int i;
-	for (i=0; i < tmr->max_length; i++) {
-		if (tmr->templates[i] != NULL && tmr->templates[i]->original_id == template_id) {
-			struct ipfix_template *next = tmr->templates[i];
-			while (next->next != NULL) {
-				tmr->templates[i] = next->next;
-				free(next);
-				next = tmr->templates[i];
-			}
-			free(tmr->templates[i]);
-			tmr->templates[i] = NULL;
-			tmr->counter--;
-			return 0;
-		}
-	}
-	/* template not found */
-	return 1;
-}
+	struct ipfix_template **slot = tm_record_slot(tmr, template_id, 0);
+	struct ipfix_template *templ;
 
-/**
- * \brief Get template index in template manager's record
- *
- * \param tmr Template manager's record
- * \param id Template ID
- * \return Template index or -1 if not found
- */
-int tm_record_template_index(struct ipfix_template_mgr_record *tmr, uint16_t id)
-{
-	int i, count = 0;
-	/* the array may have holes, thus the counter */
-	for (i = 0; i < tmr->max_length && count < tmr->counter; i++) {
-		if (tmr->templates[i] != NULL) {
-			if (tmr->templates[i]->original_id == id) {
-				return i;
-			}
-			count++;
-		}
-	}
-
-	return -1;
-}
-
-int tm_compare_templates(struct ipfix_template *first, struct ipfix_template *second)
-{
-	if (first->data_length != second->data_length || first->field_count != second->field_count) {
+	if (slot == NULL || (templ = *slot) == NULL) {
+		/* template not found */
 		return 1;
 	}
 
-	uint16_t count = first->field_count;
-
-	for (uint16_t i = 0; i < count; ++i) {
-		if (first->fields[i].ie.id != second->fields[i].ie.id
-				|| first->fields[i].ie.length != second->fields[i].ie.length) {
-			return 1;
-		}
-
-		if (first->fields[i].ie.id >> 15) {
-			i++;
-			count++;
-
-			if (first->fields[i].enterprise_number != second->fields[i].enterprise_number) {
-				return 1;
-			}
-		}
-	}
-
+	tm_store(slot, NULL);
+	tm_synchronize(tm);
+	tm_free_template_chain(templ);
 	return 0;
 }
 
 /**
  * \brief Update template in template managers record
  *
+ * \param[in] tm Template Manager
  * \param[in] tmr Template Manager's record
  * \param[in] template ipfix template record
  * \param[in] max_len maximum size of template
@@ -530,69 +888,33 @@ int tm_compare_templates(struct ipfix_template *first, struct ipfix_template *se
  * \param[in] odid Observation Domain ID
  * \return pointer to updated template
  */
-struct ipfix_template *tm_record_update_template(struct ipfix_template_mgr_record *tmr, void *template, int max_len, int type, uint32_t odid)
+struct ipfix_template *tm_record_update_template(struct ipfix_template_mgr *tm, struct ipfix_template_mgr_record *tmr, void *template, int max_len, int type, uint32_t odid)
 {
 	uint16_t id = ntohs(((struct ipfix_template_record *) template)->template_id);
 	struct ipfix_template *new_tmpl = NULL;
+	struct ipfix_template **slot = tm_record_slot(tmr, id, 0);
 
-	/* Get template index */
-	int i = tm_record_template_index(tmr, id);
-
-	if (i < 0) {
+	if (slot == NULL || *slot == NULL) {
 		MSG_WARNING(msg_module, "[%u] Template %u cannot be updated (not found); creating new one...", odid, id);
-		return tm_record_add_template(tmr, template, max_len, type, odid);
+		return tm_record_add_template(tm, tmr, template, max_len, type, odid);
 	}
 
-	/* Save IDs */
-	uint16_t templ_id = tmr->templates[i]->template_id;
-
 	/* Create new template */
 	if ((new_tmpl = tm_create_template(template, max_len, type, odid)) == NULL) {
 		return NULL;
 	}
 
-	if (tm_compare_templates(new_tmpl, tmr->templates[i]) == 0) {
+	if (tm_compare_templates(new_tmpl, *slot) == 0) {
 		/* Templates are the same, no need to update */
 		free(new_tmpl);
 		MSG_DEBUG(msg_module, "[%u] Received the same template as last time; not replacing", odid);
-		return tmr->templates[i];
-	}
-
-	new_tmpl->template_id = templ_id;
-
-	if (tmr->templates[i]->references == 0) {
-		if (tmr->templates[i]->next == NULL) {
-			/* No previous template */
-			/* Remove the old template */
-			if (tm_record_remove_template(tmr, id) != 0) {
-				MSG_WARNING(msg_module, "[%u] Cannot remove template %i", odid, id);
-			}
-
-			/* Create a new one */
-			MSG_DEBUG(msg_module, "Creating new template... %d", id);
-			new_tmpl = tm_record_insert_template(tmr, new_tmpl);
-			if (new_tmpl) {
-				new_tmpl->template_id = templ_id;
-			}
-			return new_tmpl;
-		} else {
-			/* Has some previous template(s) */
-			MSG_DEBUG(msg_module, "[%u] No references, but previous template found (ID %d)", odid, id);
-			struct ipfix_template *new = tmr->templates[i]->next;
-			free(tmr->templates[i]);
-			tmr->templates[i] = new;
-		}
-	} else {
-		MSG_DEBUG(msg_module, "[%u] Template %d cannot be removed (%u reference(s)), but it will be marked as 'old'", odid, id, tmr->templates[i]->references);
+		return *slot;
 	}
 
-	/* Insert new template */
-	new_tmpl->next = tmr->templates[i];
-	tmr->templates[i] = new_tmpl;
-
-	MSG_DEBUG(msg_module,"[%u] Template %d added to list", odid, id, i);
+	/* Keep ID given by collector */
+	new_tmpl->template_id = (*slot)->template_id;
 
-	return tmr->templates[i];
+	return tm_slot_replace_template(tm, slot, new_tmpl, odid);
 }
 
 /**
@@ -604,24 +926,21 @@ struct ipfix_template *tm_record_update_template(struct ipfix_template_mgr_recor
  */
 struct ipfix_template *tm_record_get_template(struct ipfix_template_mgr_record *tmr, uint16_t template_id)
 {
-	int i, count=0;
-	/* the array may have holes, thus the counter */
-	for (i=0; i < tmr->max_length && count < tmr->counter; i++) {
-		if (tmr->templates[i] != NULL) {
-			if (tmr->templates[i]->original_id == template_id) {
-				return tmr->templates[i];
-			}
-			count++;
-		}
+	struct ipfix_template **page = tm_load(&tmr->index[template_id / TM_INDEX_PAGE_SIZE]);
+
+	if (page == NULL) {
+		/* template not found */
+		return NULL;
 	}
 
-	/* template not found */
-	return NULL;
+	return tm_load(&page[template_id % TM_INDEX_PAGE_SIZE]);
 }
 
 /**
  * \brief Remove all templates from Template Manager's record
  *
+ * The record must not be reachable by lock-free readers.
+ *
  * \param[in] tm Template Manager
  * \param[in] tmr Template Manager's record
  * \param[in] type Type of templates to remove
@@ -630,18 +949,18 @@ void tm_record_remove_all_templates(struct ipfix_template_mgr *tm, struct ipfix_
 {
 	(void) tm;
 	MSG_DEBUG(msg_module, "Removing all %stemplates", (type == TM_TEMPLATE) ? "" : "option ");
-	int i;
-	for (i=0; i < tmr->max_length; i++) {
-		if ((tmr->templates[i] != NULL) && (tmr->templates[i]->template_type == type)) {
-			struct ipfix_template *next = tmr->templates[i];
-			while (next->next != NULL) {
-				tmr->templates[i] = next->next;
-				free(next);
-				next = tmr->templates[i];
-			}
+	int i, j;
+	for (i = 0; i < TM_INDEX_PAGES; i++) {
+		struct ipfix_template **page = tmr->index[i];
+		if (page == NULL) {
+			continue;
+		}
 
-			free(tmr->templates[i]);
-			tmr->templates[i] = NULL;
+		for (j = 0; j < TM_INDEX_PAGE_SIZE; j++) {
+			if ((page[j] != NULL) && (page[j]->template_type == type)) {
+				tm_free_template_chain(page[j]);
+				page[j] = NULL;
+			}
 		}
 	}
 }
@@ -649,14 +968,20 @@ void tm_record_remove_all_templates(struct ipfix_template_mgr *tm, struct ipfix_
 /**
  * \brief Destroy Template Manager's record
  *
+ * The record must not be reachable by lock-free readers.
+ *
  * \param[in] tm Template Manager
  * \param[in] tmr Template Manager's record
  */
 void tm_record_destroy(struct ipfix_template_mgr *tm, struct ipfix_template_mgr_record *tmr)
 {
+	int i;
+
 	tm_record_remove_all_templates(tm, tmr, TM_TEMPLATE);  /* Templates */
 	tm_record_remove_all_templates(tm, tmr, TM_OPTIONS_TEMPLATE);  /* Options Templates */
-	free(tmr->templates);
+	for (i = 0; i < TM_INDEX_PAGES; i++) {
+		free(tmr->index[i]);
+	}
 	free(tmr);
 	return;
 }
@@ -669,18 +994,21 @@ void tm_record_destroy(struct ipfix_template_mgr *tm, struct ipfix_template_mgr_
 struct ipfix_template_mgr *tm_create() {
 	struct ipfix_template_mgr *tm;
 
-	if ((tm = malloc(sizeof(struct ipfix_template_mgr))) == NULL) {
+	if ((tm = calloc(1, sizeof(struct ipfix_template_mgr))) == NULL) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		return NULL;
 	}
 
 	/* Allocate space for Template Manager's records */
-	tm->first = NULL;
-	tm->last = NULL;
+	if ((tm->table = tm_table_create(TM_TABLE_INIT_SIZE)) == NULL) {
+		free(tm);
+		return NULL;
+	}
 
 	/* Initialize mutex */
 	if (pthread_mutex_init(&tm->tmr_lock, NULL) != 0) {
 		MSG_ERROR(msg_module, "Failed to initialize a mutex.");
+		free(tm->table);
 		free(tm);
 		return NULL;
 	}
@@ -698,14 +1026,17 @@ void tm_destroy(struct ipfix_template_mgr *tm)
 	if (tm == NULL) {
 		return;
 	}
-	struct ipfix_template_mgr_record *tmp_rec = tm->first;
 
-	while (tmp_rec) {
-		tmp_rec = tmp_rec->next;
-		tm_record_destroy(tm, tm->first);
-		tm->first = tmp_rec;
+	uint32_t i;
+	struct ipfix_template_mgr_table *table = tm->table;
+
+	for (i = 0; i < table->size; ++i) {
+		if (table->slots[i] != NULL && table->slots[i] != TM_RECORD_REMOVED) {
+			tm_record_destroy(tm, table->slots[i]);
+		}
 	}
 
+	free(table);
 	pthread_mutex_destroy(&tm->tmr_lock);
 
 	free(tm);
@@ -717,14 +1048,18 @@ void tm_destroy(struct ipfix_template_mgr *tm)
  */
 struct ipfix_template *tm_add_template(struct ipfix_template_mgr *tm, void *template, int max_len, int type, struct ipfix_template_key *key)
 {
+	struct ipfix_template *templ = NULL;
+
+	pthread_mutex_lock(&tm->tmr_lock);
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup_insert(tm, key);
 
-	if (tmr == NULL) {
-		return NULL;
+	if (tmr != NULL) {
+		/* Add template to Template Manager */
+		templ = tm_record_add_template(tm, tmr, template, max_len, type, key->odid);
 	}
 
-	/* Add template to Template Manager */
-	return tm_record_add_template(tmr, template, max_len, type, key->odid);
+	pthread_mutex_unlock(&tm->tmr_lock);
+	return templ;
 }
 
 /**
@@ -732,12 +1067,17 @@ struct ipfix_template *tm_add_template(struct ipfix_template_mgr *tm, void *temp
  */
 struct ipfix_template *tm_insert_template(struct ipfix_template_mgr *tm, struct ipfix_template *tmpl, struct ipfix_template_key *key)
 {
+	struct ipfix_template *templ = NULL;
+
+	pthread_mutex_lock(&tm->tmr_lock);
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup_insert(tm, key);
 
-	if (tmr == NULL) {
-			return NULL;
+	if (tmr != NULL) {
+		templ = tm_record_insert_template(tm, tmr, tmpl);
 	}
-	return tm_record_insert_template(tmr, tmpl);
+
+	pthread_mutex_unlock(&tm->tmr_lock);
+	return templ;
 }
 
 /**
@@ -745,16 +1085,17 @@ struct ipfix_template *tm_insert_template(struct ipfix_template_mgr *tm, struct
  */
 struct ipfix_template *tm_update_template(struct ipfix_template_mgr *tm, void *template, int max_len, int type, struct ipfix_template_key *key)
 {
+	struct ipfix_template *templ = NULL;
+
+	pthread_mutex_lock(&tm->tmr_lock);
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup_insert(tm, key);
 
-	if (tmr == NULL) {
-		return NULL;
+	if (tmr != NULL) {
+		templ = tm_record_update_template(tm, tmr, template, max_len, type, key->odid);
 	}
 
-	struct ipfix_template *templ = tm_record_update_template(tmr, template, max_len, type, key->odid);
-
+	pthread_mutex_unlock(&tm->tmr_lock);
 	return templ;
-
 }
 
 /**
@@ -762,54 +1103,80 @@ struct ipfix_template *tm_update_template(struct ipfix_template_mgr *tm, void *t
  */
 int tm_remove_template(struct ipfix_template_mgr *tm, struct ipfix_template_key *key)
 {
+	int ret = 1;
+
+	pthread_mutex_lock(&tm->tmr_lock);
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup(tm, key);
 
-	if (tmr == NULL) {
-		return 1;
+	if (tmr != NULL) {
+		ret = tm_record_remove_template(tm, tmr, key->tid);
 	}
 
-	return tm_record_remove_template(tmr, key->tid);
+	pthread_mutex_unlock(&tm->tmr_lock);
+	return ret;
 }
 
-void tm_remove_all_templates(struct ipfix_template_mgr *tm)
+/**
+ * \brief Remove records of sources without registration
+ *
+ * Caller must hold tmr_lock.
+ *
+ * \param[in] tm Template Manager
+ * \param[in] odid Observation Domain ID
+ * \param[in] all Remove records of all ODIDs
+ */
+static void tm_remove_records(struct ipfix_template_mgr *tm, uint32_t odid, int all)
 {
-	// Lock the list of sources
-	pthread_mutex_lock(&tm->tmr_lock);
+	struct ipfix_template_mgr_table *table = tm->table;
+	struct ipfix_template_mgr_record *aux_rec, *removed = NULL;
+	uint32_t i;
 
-	struct ipfix_template_mgr_record *prev_rec = tm->first;
-	struct ipfix_template_mgr_record *aux_rec = tm->first;
-	MSG_INFO(msg_module, "Removing all templates in the collector!");
+	for (i = 0; i < table->size; ++i) {
+		aux_rec = table->slots[i];
+		if (aux_rec == NULL || aux_rec == TM_RECORD_REMOVED) {
+			continue;
+		}
+
+		if (!all && aux_rec->key >> 32 != odid) {
+			// Different ODID source
+			continue;
+		}
 
-	while (aux_rec) {
 		// Only template records without registration can be removed
 		if (aux_rec->registrations != 0) {
-			prev_rec = aux_rec;
-			aux_rec = aux_rec->next;
-			MSG_INFO(msg_module, "Unable to remove templates of one of "
-				"sources. The source is probably already reconnected.");
+			MSG_INFO(msg_module, "[%u] Unable to remove templates of one of "
+				"sources. The source is probably already reconnected.",
+				(uint32_t) (aux_rec->key >> 32));
 			continue;
 		}
 
-		// Remove the record
-		if (aux_rec == tm->first) {
-			if (aux_rec == tm->last) {
-				tm->last = NULL;
-			}
-			tm->first = aux_rec->next;
-			tm_record_destroy(tm, aux_rec);
-			prev_rec = tm->first;
-			aux_rec = tm->first;
-		} else {
-			if (aux_rec == tm->last) {
-				tm->last = prev_rec;
-			}
-			prev_rec->next = aux_rec->next;
-			tm_record_destroy(tm, aux_rec);
-			aux_rec = prev_rec->next;
-		}
+		tm_table_remove(table, aux_rec);
+		aux_rec->next = removed;
+		removed = aux_rec;
+	}
+
+	if (removed == NULL) {
+		return;
+	}
+
+	// Destroy the records when no reader can see them
+	tm_synchronize(tm);
+	while (removed) {
+		aux_rec = removed;
+		removed = removed->next;
+		tm_record_destroy(tm, aux_rec);
 	}
+}
+
+void tm_remove_all_templates(struct ipfix_template_mgr *tm)
+{
+	// Lock the table of sources
+	pthread_mutex_lock(&tm->tmr_lock);
 
-	// Unlock list of sources
+	MSG_INFO(msg_module, "Removing all templates in the collector!");
+	tm_remove_records(tm, 0, 1);
+
+	// Unlock table of sources
 	pthread_mutex_unlock(&tm->tmr_lock);
 }
 
@@ -818,63 +1185,33 @@ void tm_remove_all_templates(struct ipfix_template_mgr *tm)
  */
 void tm_remove_all_odid_templates(struct ipfix_template_mgr *tm, uint32_t odid)
 {
-	// Lock the list of sources
+	// Lock the table of sources
 	pthread_mutex_lock(&tm->tmr_lock);
 
-	struct ipfix_template_mgr_record *prev_rec = tm->first;
-	struct ipfix_template_mgr_record *aux_rec = tm->first;
 	MSG_INFO(msg_module, "[%u] Removing all templates", odid);
+	tm_remove_records(tm, odid, 0);
 
-	while (aux_rec) {
-		if (aux_rec->key >> 32 != odid) {
-			// Different ODID source
-			prev_rec = aux_rec;
-			aux_rec = aux_rec->next;
-			continue;
-		}
-
-		// Only template records without registration can be removed
-		if (aux_rec->registrations != 0) {
-			prev_rec = aux_rec;
-			aux_rec = aux_rec->next;
-			MSG_INFO(msg_module, "[%u] Unable to remove templates of one of "
-				"sources. The source is probably already reconnected.", odid);
-			continue;
-		}
-
-		// Remove the record
-		if (aux_rec == tm->first) {
-			if (aux_rec == tm->last) {
-				tm->last = NULL;
-			}
-			tm->first = aux_rec->next;
-			tm_record_destroy(tm, aux_rec);
-			prev_rec = tm->first;
-			aux_rec = tm->first;
-		} else {
-			if (aux_rec == tm->last) {
-				tm->last = prev_rec;
-			}
-			prev_rec->next = aux_rec->next;
-			tm_record_destroy(tm, aux_rec);
-			aux_rec = prev_rec->next;
-		}
-	}
-
-	// Unlock list of sources
+	// Unlock table of sources
 	pthread_mutex_unlock(&tm->tmr_lock);
 }
 
 /**
  * \brief Get pointer to template in template manager
+ *
+ * The lookup is lock-free, it never waits for modifications of the manager.
  */
 struct ipfix_template *tm_get_template(struct ipfix_template_mgr *tm, struct ipfix_template_key *key)
 {
+	struct ipfix_template *templ = NULL;
+	unsigned int idx = tm_read_lock(tm);
+
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup(tm, key);
-	if (tmr == NULL) {
-		return NULL;
+	if (tmr != NULL) {
+		templ = tm_record_get_template(tmr, key->tid);
 	}
-	return tm_record_get_template(tmr, key->tid);
+
+	tm_read_unlock(tm, idx);
+	return templ;
 }
 
 /**
@@ -67,6 +67,8 @@ static time_t last_change = 0;
 static struct elem_groups *collections[ELEM_COLL_MAX] = {NULL};
 /** Index of active collection */
 static int collection_id = ELEM_COLL_EMPTY;
+/** Number of loaded collections */
+static unsigned int collection_revision = 0;
 
 /**
  * \brief Load new collection
@@ -154,6 +156,7 @@ int elem_coll_reload(const char *path)
 	}
 	
 	*desc_ptr = new_desc;
+	collection_revision++;
 	return 1;
 }
 
@@ -190,4 +193,11 @@ const struct elem_groups *elem_coll_get()
 	return collections[collection_id];
 }
 
-
+/**
+ * \brief Get a revision of the current collection
+ * \return Number of collections loaded so far.
+ */
+unsigned int elem_coll_revision()
+{
+	return collection_revision;
+}
@@ -51,4 +51,7 @@ void elem_coll_destroy();
 // Get a pointer to the current collection
 const struct elem_groups *elem_coll_get();
 
+// Get a revision of the current collection
+unsigned int elem_coll_revision();
+
 #endif
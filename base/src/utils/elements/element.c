@@ -381,6 +381,68 @@ static int elem_make_name_indexes(struct elem_groups *groups)
 }
 
 
+/**
+ * \brief Make indexes of elements' IDs
+ *
+ * Groups are inserted into an open addressing hash table by Enterprise ID and
+ * elements of each group into pages indexed by Element ID, so an element can
+ * be found without searching. Only pages with at least one element are
+ * allocated.
+ * \warning Duplicity of elements must be checked first.
+ * \param[in,out] groups Structure with groups of IPFIX elements.
+ * \return 0 on success. Otherwise returns non-zero value.
+ */
+static int elem_make_id_indexes(struct elem_groups *groups)
+{
+	// Keep the hash table of groups at most half full
+	unsigned int size = 8;
+	while (size < 2 * groups->elem_used) {
+		size *= 2;
+	}
+
+	groups->en_hash = calloc(size, sizeof(struct elem_en_group *));
+	if (!groups->en_hash) {
+		MSG_ERROR(msg_module, "CALLOC FAILED! (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+	groups->en_hash_mask = size - 1;
+
+	for (unsigned int i = 0; i < groups->elem_used; ++i) {
+		struct elem_en_group *aux_grp = groups->groups[i];
+
+		unsigned int pos = ELEM_EN_HASH(aux_grp->en_id) & groups->en_hash_mask;
+		while (groups->en_hash[pos] != NULL) {
+			pos = (pos + 1) & groups->en_hash_mask;
+		}
+		groups->en_hash[pos] = aux_grp;
+
+		aux_grp->id_pages = calloc(ELEM_ID_PAGES, sizeof(ipfix_element_t **));
+		if (!aux_grp->id_pages) {
+			MSG_ERROR(msg_module, "CALLOC FAILED! (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
+
+		for (unsigned int y = 0; y < aux_grp->elem_used; ++y) {
+			ipfix_element_t *elem = aux_grp->elements[y];
+			ipfix_element_t ***page = &aux_grp->id_pages[elem->id / ELEM_ID_PAGE_SIZE];
+
+			if (*page == NULL) {
+				*page = calloc(ELEM_ID_PAGE_SIZE, sizeof(ipfix_element_t *));
+				if (*page == NULL) {
+					MSG_ERROR(msg_module, "CALLOC FAILED! (%s:%d)", __FILE__,
+						__LINE__);
+					return 1;
+				}
+			}
+
+			(*page)[elem->id % ELEM_ID_PAGE_SIZE] = elem;
+		}
+	}
+
+	return 0;
+}
+
+
 /**
  * \brief Initialize the iterator of IPFIX elements over a XML document
  *
@@ -554,6 +616,10 @@ int elements_load(int file_descriptor, struct elem_groups *ipfix_groups)
 		// Duplication found
 		return 1;
 	}
+
+	if (elem_make_id_indexes(ipfix_groups)) {
+		return 1;
+	}
 	
 	// All elements successfully loaded
 	MSG_INFO(msg_module, "Description of %u IPFIX elements loaded.", count);
@@ -580,13 +646,21 @@ void elements_destroy(struct elem_groups *ipfix_groups)
 			free(aux_elem);
 		}
 		
+		if (aux_grp->id_pages) {
+			for (unsigned int y = 0; y < ELEM_ID_PAGES; ++y) {
+				free(aux_grp->id_pages[y]);
+			}
+		}
+
 		free(aux_grp->elements);
 		free(aux_grp->name_index);
+		free(aux_grp->id_pages);
 		free(aux_grp);
 	}
 	
 	free(ipfix_groups->groups);
 	free(ipfix_groups->name_index);
+	free(ipfix_groups->en_hash);
 	free(ipfix_groups);
 }
 
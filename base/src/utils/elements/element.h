@@ -55,6 +55,7 @@ struct elem_en_group {
 	unsigned int elem_max;         /**< Max. number of elements               */
 	
 	ipfix_element_t **name_index;  /**< Same as "elements" but sorted by name */
+	ipfix_element_t ***id_pages;   /**< Pages of elements indexed by ID       */
 };
 
 /**
@@ -68,8 +69,20 @@ struct elem_groups {
 	// Do not free content of the array below!
 	ipfix_element_t **name_index;  /**< Array of all elements sorted by name  */
 	unsigned int name_count;       /**< Size of the array sorted by name      */
+
+	struct elem_en_group **en_hash;/**< Groups hashed by Enterprise ID        */
+	unsigned int en_hash_mask;     /**< Size of the hash table - 1            */
 };
 
+/** Number of elements in one page of the index by ID */
+#define ELEM_ID_PAGE_SIZE (256)
+
+/** Number of pages of the index by ID (covers all 16b Element IDs) */
+#define ELEM_ID_PAGES (65536 / ELEM_ID_PAGE_SIZE)
+
+/** Hash of the Enterprise ID */
+#define ELEM_EN_HASH(en) ((uint32_t) (en) * 0x9E3779B1U)
+
 // Create structures for elements
 struct elem_groups *elements_init();
 
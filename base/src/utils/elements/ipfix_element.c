@@ -37,7 +37,7 @@
  *
  */
 
-#include <stdlib.h> // bsearch
+#include <stdlib.h> // bsearch, strtoul
 #include <string.h> // strchr
 
 #include <ipfixcol.h>
@@ -63,21 +63,19 @@ static const struct elem_en_group *get_en_group_by_id(uint32_t en)
 	}
 	
 	// Find the group with same Enterprise ID
-	struct elem_en_group grp_key;
-	struct elem_en_group *grp_key_p;
-	struct elem_en_group **grp_pp;
-	
-	grp_key.en_id = en;
-	grp_key_p = &grp_key;
-	
-	grp_pp = bsearch(&grp_key_p, groups->groups, groups->elem_used,
-		sizeof(struct elem_en_group *), cmp_groups);
-	if (!grp_pp) {
-		// Group not found
-		return NULL;
+	unsigned int pos = ELEM_EN_HASH(en) & groups->en_hash_mask;
+	const struct elem_en_group *group;
+
+	while ((group = groups->en_hash[pos]) != NULL) {
+		if (group->en_id == en) {
+			return group;
+		}
+
+		pos = (pos + 1) & groups->en_hash_mask;
 	}
-	
-	return *grp_pp;
+
+	// Group not found
+	return NULL;
 }
 
 /**
@@ -99,22 +97,23 @@ const ipfix_element_t *get_element_by_id(uint16_t id, uint32_t en)
 	}
 	
 	// Find the element
-	ipfix_element_t el_key;
-	const ipfix_element_t *el_key_p;
-	const ipfix_element_t **elem_pp;
-	
-	el_key.id = id;
-	el_key_p = &el_key;
-	
-	elem_pp = bsearch(&el_key_p, group->elements, group->elem_used,
-		sizeof(ipfix_element_t *), cmp_elem_by_id);
-	if (!elem_pp) {
+	ipfix_element_t **page = group->id_pages[id / ELEM_ID_PAGE_SIZE];
+	if (!page) {
 		// Element not found in the group
 		return NULL;
 	}
-	
-	// Suceess
-	return *elem_pp;
+
+	return page[id % ELEM_ID_PAGE_SIZE];
+}
+
+/**
+ * \brief Get a revision of the description of IPFIX elements
+ *
+ * \return Revision number, changed every time the description is reloaded.
+ */
+unsigned int get_elements_revision()
+{
+	return elem_coll_revision();
 }
 
 /**
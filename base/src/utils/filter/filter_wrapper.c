@@ -110,6 +110,34 @@ struct ipx_filter {
     void* buffer;	//buffer
 };
 
+/** Maximal number of fields resolved per template in batch evaluation */
+#define NFF_BATCH_FIELDS 32
+
+/**
+ * \brief Field of a template resolved in batch evaluation
+ */
+typedef struct nff_batch_field_s {
+    uint64_t index;     /**< External ID of the field (as used by ffilter) */
+    int field;          /**< Index of the field in compiled template, -1 if missing */
+} nff_batch_field_t;
+
+/**
+ * \brief State of batch evaluation
+ *
+ * Fields used by the filter are resolved only once for each template, so
+ * every record of the template reads its values directly by the index of
+ * the field. Positions of fields behind variable-length fields are decoded
+ * at most once per record.
+ */
+typedef struct nff_batch_s {
+    struct ipfix_template *templ;      /**< Template of resolved fields (NULL if none) */
+    bool enabled;                      /**< Template is compiled, fields can be resolved */
+    bool decoded;                      /**< Decoder holds positions for the current record */
+    int count;                         /**< Number of resolved fields */
+    nff_batch_field_t fields[NFF_BATCH_FIELDS]; /**< Resolved fields */
+    struct data_record_decoder decoder; /**< Positions of fields of the current record */
+} nff_batch_t;
+
 /**
  * \brief Structure of ipfix message and record pointers
  *
@@ -119,6 +147,7 @@ struct ipx_filter {
 typedef struct nff_msg_rec_s {
     struct ipfix_message* msg;
     struct ipfix_record* rec;
+    nff_batch_t *batch;     /**< Batch evaluation state (NULL for single record) */
 } nff_msg_rec_t;
 
 /**
@@ -798,6 +827,75 @@ ff_error_t ipf_lookup_func(ff_t *filter, const char *fieldstr, ff_lvalue_t *lval
     return FF_OK;
 }
 
+/**
+ * \brief Get a field of the record in batch evaluation
+ *
+ * \param[in,out] batch Batch evaluation state
+ * \param[in]     rec   Data record (its template must be the batch template)
+ * \param[in]     index External ID of the field
+ * \param[in]     gen   Flags of the external ID
+ * \param[in]     en    Enterprise number
+ * \param[in]     ie_id Element ID
+ * \param[out]    data  Pointer to the field
+ * \param[out]    size  Size of the field
+ * \return 0 when found, 1 when the template has no such field and -1 when
+ *   the field has to be found in the usual way
+ */
+static int
+batch_get_field(nff_batch_t *batch, struct ipfix_record *rec, uint64_t index,
+    uint16_t gen, uint32_t en, uint16_t ie_id, char **data, size_t *size)
+{
+    struct ipfix_template_map *map = rec->templ->map;
+    nff_batch_field_t *item = NULL;
+    int i;
+
+    if (!batch->enabled) {
+        return -1;
+    }
+
+    for (i = 0; i < batch->count; ++i) {
+        if (batch->fields[i].index == index) {
+            item = &batch->fields[i];
+            break;
+        }
+    }
+
+    if (!item) {
+        if (batch->count == NFF_BATCH_FIELDS) {
+            return -1;
+        }
+
+        item = &batch->fields[batch->count++];
+        item->index = index;
+        item->field = template_map_find(map, en, ie_id);
+        if (item->field < 0 && (gen & CTL_V4V6IP) && specify_ipv(&ie_id)) {
+            item->field = template_map_find(map, en, ie_id);
+        }
+    }
+
+    if (item->field < 0) {
+        return 1;
+    }
+
+    if (item->field < map->var_first) {
+        *data = (char *) rec->record + map->fields[item->field].offset;
+        *size = map->fields[item->field].length;
+        return 0;
+    }
+
+    if (!batch->decoded) {
+        if (data_record_decode(&batch->decoder, rec->record, rec->templ) != 0
+                || !batch->decoder.decoded) {
+            return -1;
+        }
+        batch->decoded = true;
+    }
+
+    *data = (char *) rec->record + batch->decoder.positions[item->field].offset;
+    *size = batch->decoder.positions[item->field].length;
+    return 0;
+}
+
 /* getting data callback */
 ff_error_t ipf_data_func(ff_t *filter, void *rec, ff_extern_id_t id, char **data, size_t *size)
 {
@@ -989,6 +1087,18 @@ ff_error_t ipf_data_func(ff_t *filter, void *rec, ff_extern_id_t id, char **data
 
     } */else {
 
+        if (msg_pair->batch) {
+            switch (batch_get_field(msg_pair->batch, msg_pair->rec, id.index,
+                generic_set, en, ie_id, data, size)) {
+            case 0:
+                return FF_OK;
+            case 1:
+                return FF_ERR_OTHER;
+            default:
+                break;
+            }
+        }
+
         ipf_field = data_record_get_field((msg_pair->rec)->record, (msg_pair->rec)->templ, en, ie_id, &len);
         if (generic_set & CTL_V4V6IP && ipf_field == NULL) {
             if (specify_ipv(&ie_id)) {
@@ -1136,10 +1246,42 @@ int ipx_filter_eval(ipx_filter_t *filter, struct ipfix_message *msg, struct ipfi
     struct nff_msg_rec_s pack;
     pack.msg = msg;
     pack.rec = record;
+    pack.batch = NULL;
     /* Necesarry to pass both msg and record to ff_eval, passed structure that contains both */
     return ff_eval(filter->filter, &pack);
 }
 
+/* Evaluate expression tree over a sequence of records */
+int ipx_filter_eval_batch(ipx_filter_t *filter, struct ipfix_message *msg,
+    struct metadata *mdata, uint16_t count, uint8_t *result)
+{
+    struct nff_msg_rec_s pack;
+    nff_batch_t batch;
+    int matches = 0;
+
+    memset(&batch, 0, sizeof(batch));
+    pack.msg = msg;
+    pack.batch = &batch;
+
+    for (uint16_t i = 0; i < count; ++i) {
+        pack.rec = &(mdata[i].record);
+
+        if (pack.rec->templ != batch.templ) {
+            /* Resolve fields of the new template */
+            batch.templ = pack.rec->templ;
+            batch.enabled = (batch.templ != NULL && batch.templ->map != NULL);
+            batch.count = 0;
+        }
+
+        batch.decoded = false;
+        result[i] = (ff_eval(filter->filter, &pack) > 0);
+        matches += result[i];
+    }
+
+    data_record_decoder_clear(&batch.decoder);
+    return matches;
+}
+
 char *ipx_filter_get_error(ipx_filter_t *filter)
 {
     ff_error(filter->filter, (char *) filter->buffer, FF_MAX_STRING);
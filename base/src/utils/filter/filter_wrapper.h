@@ -85,6 +85,24 @@ int ipx_filter_parse(ipx_filter_t *filter, char* filter_str);
  */
 int ipx_filter_eval(ipx_filter_t *filter, struct ipfix_message *msg, struct ipfix_record *record);
 
+/**
+ * \brief Match filter with a sequence of IPFIX records
+ *
+ * Records are usually records of a message in the order of data sets, so
+ * that consecutive records share a template. Fields used by the filter are
+ * located only once per template instead of once per record and field.
+ *
+ * \param[in]  filter filter object
+ * \param[in]  msg    IPFIX message (filter may contain field from message header)
+ * \param[in]  mdata  Metadata of data records
+ * \param[in]  count  Number of data records
+ * \param[out] result Selection mask, 1 when the record fits, 0 otherwise
+ *   (\p count items)
+ * \return Number of records that fit
+ */
+int ipx_filter_eval_batch(ipx_filter_t *filter, struct ipfix_message *msg,
+    struct metadata *mdata, uint16_t count, uint8_t *result);
+
 /**
  * \brief Copy last ff_filter error to ipx_filter internal buffer
  *
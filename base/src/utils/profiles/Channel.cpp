@@ -196,9 +196,10 @@ void Channel::setProfile(Profile* profile)
 /**
  * Set channel filter
  */
-void Channel::setFilter(ipx_filter_t* filter)
+void Channel::setFilter(ipx_filter_t* filter, const std::string& expr)
 {
 	m_filter = filter;
+	m_filterExpr = expr;
 }
 
 /**
@@ -230,39 +231,3 @@ void Channel::match(ipfix_message* msg, metadata* mdata, std::vector<Channel *>&
 		child->match(msg, mdata, channels);
 	}
 }
-
-/**
- * Match channel filter to data record
- */
-void Channel::match(struct match_data *data)
-{
-	if (m_filter && 0 >= ipx_filter_eval(m_filter, data->msg, &(data->mdata->record))) {
-		return;
-	}
-
-	if (data->channelsMax == 0) {
-		data->channelsMax = 5;
-		data->channels = (void**) calloc(data->channelsMax, sizeof(void*));
-		if (data->channels == NULL) {
-			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
-			return;
-		}
-	} else if (data->channelsCounter == data->channelsMax) {
-		data->channels = (void**) realloc(data->channels, sizeof(void*) * data->channelsMax * 2);
-		if (data->channels == NULL) {
-			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
-			return;
-		}
-
-		memset(&(data->channels[data->channelsMax]), 0, sizeof(void*) * data->channelsMax);
-
-		data->channelsMax *= 2;
-	}
-
-	data->channels[data->channelsCounter++] = (void*) this;
-
-
-	for (auto& child: m_listeners) {
-		child->match(data);
-	}
-}
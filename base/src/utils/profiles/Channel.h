@@ -79,8 +79,23 @@ public:
 	 * \brief Set channel's filter
 	 * 
      * \param[in] filter filter
+     * \param[in] expr filter expression
      */
-	void setFilter(ipx_filter_t *filter);
+	void setFilter(ipx_filter_t *filter, const std::string& expr);
+
+	/**
+	 * \brief Get channel's filter
+	 *
+	 * \return filter or NULL
+	 */
+	ipx_filter_t *getFilter() { return m_filter; }
+
+	/**
+	 * \brief Get channel's filter expression
+	 *
+	 * \return filter expression
+	 */
+	const std::string& getFilterExpr() const { return m_filterExpr; }
 
 	/**
 	 * \brief Get channel's ID
@@ -159,8 +174,6 @@ public:
 	 * \param[out] channels	list of matching channels
      */
 	void match(struct ipfix_message *msg, struct metadata *mdata, std::vector<Channel *>& channels);
-
-	void match(struct match_data *data);
 private:
 
 	channel_id_t m_id;			/**< Channel ID */
@@ -168,6 +181,7 @@ private:
 	std::string m_pathName;		/**< path name */
 
 	ipx_filter_t *m_filter{};	/**< Filter */
+	std::string m_filterExpr{};	/**< Filter expression */
 	Profile *m_profile{};		/**< Profile */
 
 	channelsSet m_listeners{};	/**< Listening channels */
@@ -0,0 +1,164 @@
+/**
+ * \file Classifier.cpp
+ * \brief Profile tree compiled for matching of data records
+ *
+ * Copyright (C) 2015 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include "Classifier.h"
+
+/**
+ * Constructor
+ */
+Classifier::Classifier(Profile *root)
+{
+	std::map<Channel *, size_t> index;
+	std::map<std::string, int> filters;
+
+	addProfile(root, index, filters);
+}
+
+/**
+ * Add channels of the profile and its subprofiles
+ */
+void Classifier::addProfile(Profile *profile, std::map<Channel *, size_t>& index, std::map<std::string, int>& filters)
+{
+	for (auto& ch: profile->getChannels()) {
+		node n;
+		n.channel = ch;
+		n.filter = -1;
+
+		if (ch->getFilter()) {
+			auto it = filters.find(ch->getFilterExpr());
+			if (it != filters.end()) {
+				n.filter = it->second;
+			} else {
+				n.filter = m_filters.size();
+				m_filters.push_back(ch->getFilter());
+				filters[ch->getFilterExpr()] = n.filter;
+			}
+		}
+
+		/* Sources are in the parent profile, which is already added */
+		if (profile->getParent()) {
+			for (auto& src: ch->getSources()) {
+				n.sources.push_back(index.at(src));
+			}
+		}
+
+		index[ch] = m_nodes.size();
+		m_nodes.push_back(n);
+	}
+
+	for (auto& child: profile->getChildren()) {
+		addProfile(child, index, filters);
+	}
+}
+
+/**
+ * Evaluate filter on given range of records
+ */
+void Classifier::evalFilter(struct ipfix_message *msg, struct metadata *mdata, int filter, uint16_t first, uint16_t last, batch &result) const
+{
+	std::pair<uint16_t, uint16_t> &range = result.ranges[filter];
+	uint8_t *values = &(result.filters[filter * result.count]);
+
+	if (range.first == range.second) {
+		/* Nothing evaluated yet */
+		ipx_filter_eval_batch(m_filters[filter], msg, mdata + first, last - first, values + first);
+		range = std::make_pair(first, last);
+		return;
+	}
+
+	/* Extend evaluated range */
+	if (first < range.first) {
+		ipx_filter_eval_batch(m_filters[filter], msg, mdata + first, range.first - first, values + first);
+		range.first = first;
+	}
+
+	if (last > range.second) {
+		ipx_filter_eval_batch(m_filters[filter], msg, mdata + range.second, last - range.second, values + range.second);
+		range.second = last;
+	}
+}
+
+/**
+ * Match sequence of data records with all channels
+ */
+void Classifier::match(struct ipfix_message *msg, struct metadata *mdata, uint16_t count, batch &result) const
+{
+	result.count = count;
+	result.channels.assign(m_nodes.size() * count, 0);
+	result.filters.resize(m_filters.size() * count);
+	result.ranges.assign(m_filters.size(), std::make_pair(0, 0));
+
+	for (size_t i = 0; i < m_nodes.size(); ++i) {
+		const node &n = m_nodes[i];
+		uint8_t *channel = &(result.channels[i * count]);
+		uint16_t first = count, last = 0;
+
+		/* Records of at least one source */
+		if (n.sources.empty()) {
+			memset(channel, 1, count);
+			first = 0;
+			last = count;
+		} else {
+			for (size_t src: n.sources) {
+				const uint8_t *source = &(result.channels[src * count]);
+				for (uint16_t r = 0; r < count; ++r) {
+					channel[r] |= source[r];
+				}
+			}
+
+			for (uint16_t r = 0; r < count; ++r) {
+				if (channel[r]) {
+					first = (r < first) ? r : first;
+					last = r + 1;
+				}
+			}
+		}
+
+		if (n.filter < 0 || first >= last) {
+			continue;
+		}
+
+		/* Filter only records which may reach the channel */
+		evalFilter(msg, mdata, n.filter, first, last, result);
+
+		const uint8_t *values = &(result.filters[n.filter * count]);
+		for (uint16_t r = first; r < last; ++r) {
+			channel[r] &= values[r];
+		}
+	}
+}
@@ -0,0 +1,162 @@
+/**
+ * \file Classifier.h
+ * \brief Profile tree compiled for matching of data records
+ *
+ * Copyright (C) 2015 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef CLASSIFIER_H
+#define	CLASSIFIER_H
+
+#include "profiles_internal.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Profile;
+class Channel;
+
+/**
+ * \brief Profile tree compiled into a flat list of channels
+ *
+ * Channels are stored in the order of the profile tree (parent profiles
+ * first), so sources of each channel always precede the channel itself and
+ * all channels can be matched in one pass. Each index in the list is also
+ * the index of the channel in the results of match().
+ *
+ * Channels with the same filter expression share one filter, which is
+ * evaluated at most once per data record.
+ */
+class Classifier {
+public:
+	/**
+	 * \brief Constructor
+	 *
+	 * \param[in] root Root profile of the tree
+	 */
+	Classifier(Profile *root);
+
+	/**
+	 * \brief Get number of channels
+	 *
+	 * \return number of channels in the tree
+	 */
+	size_t getChannelCount() const { return m_nodes.size(); }
+
+	/**
+	 * \brief Get number of unique filters
+	 *
+	 * \return number of filters shared by channels
+	 */
+	size_t getFilterCount() const { return m_filters.size(); }
+
+	/**
+	 * \brief Get channel
+	 *
+	 * \param[in] idx Index of the channel (see matched())
+	 * \return channel
+	 */
+	Channel *getChannel(size_t idx) const { return m_nodes[idx].channel; }
+
+	/** Buffers for matching of a sequence of data records */
+	struct batch {
+		uint16_t count = 0;                /**< Number of matched records */
+		std::vector<uint8_t> channels{};   /**< Results of channels (channel x record) */
+		std::vector<uint8_t> filters{};    /**< Results of filters (filter x record) */
+		std::vector<std::pair<uint16_t, uint16_t>> ranges{}; /**< Records evaluated by each filter */
+	};
+
+	/**
+	 * \brief Match sequence of data records with all channels of the tree
+	 *
+	 * Channels are matched one by one over all records. Each filter is
+	 * evaluated by ipx_filter_eval_batch() over the range of records which
+	 * may reach it, so fields are located once per template, not per record.
+	 *
+	 * \param[in] msg IPFIX message
+	 * \param[in] mdata Metadata of data records (usually all records of the message)
+	 * \param[in] count Number of data records
+	 * \param[out] result Results of the channels, see matched()
+	 */
+	void match(struct ipfix_message *msg, struct metadata *mdata, uint16_t count, batch &result) const;
+
+	/**
+	 * \brief Check whether data record matched the channel
+	 *
+	 * \param[in] result Results of match() over a sequence of records
+	 * \param[in] idx Index of the channel
+	 * \param[in] record Index of the data record
+	 * \return true when the record belongs to the channel
+	 */
+	static bool matched(const batch &result, size_t idx, uint16_t record)
+	{
+		return result.channels[idx * result.count + record];
+	}
+
+private:
+	/** Compiled channel */
+	struct node {
+		Channel *channel;             /**< Channel */
+		int filter;                   /**< Index of the filter or -1 */
+		std::vector<size_t> sources;  /**< Indexes of source channels (empty for top channels) */
+	};
+
+	/**
+	 * \brief Add channels of the profile and its subprofiles
+	 *
+	 * \param[in] profile Profile
+	 * \param[in,out] index Indexes of added channels
+	 * \param[in,out] filters Indexes of filters by expression
+	 */
+	void addProfile(Profile *profile, std::map<Channel *, size_t>& index, std::map<std::string, int>& filters);
+
+	/**
+	 * \brief Evaluate filter on given range of records unless it is already known
+	 *
+	 * \param[in] msg IPFIX message
+	 * \param[in] mdata Metadata of data records
+	 * \param[in] filter Index of the filter
+	 * \param[in] first First record of the range
+	 * \param[in] last Record after the range
+	 * \param[in,out] result Results of the batch
+	 */
+	void evalFilter(struct ipfix_message *msg, struct metadata *mdata, int filter, uint16_t first, uint16_t last, batch &result) const;
+
+	std::vector<node> m_nodes{};             /**< Channels in order of the tree */
+	std::vector<ipx_filter_t *> m_filters{}; /**< Unique filters (owned by channels) */
+};
+
+#endif	/* CLASSIFIER_H */
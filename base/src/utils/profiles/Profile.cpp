@@ -41,6 +41,7 @@
 
 #include "Profile.h"
 #include "Channel.h"
+#include "Classifier.h"
 
 /* Numer of profiles (ID for new profiles) */
 profile_id_t Profile::profiles_cnt = 1;
@@ -67,6 +68,8 @@ Profile::~Profile()
 	for (auto& p: m_children) {
 		delete p;
 	}
+
+	delete m_classifier;
 }
 
 /**
@@ -156,9 +159,12 @@ void Profile::match(ipfix_message* msg, metadata* mdata, std::vector<Channel *>&
 	}
 }
 
-void Profile::match(struct match_data *data)
+/**
+ * Compile profile tree
+ */
+void Profile::compile()
 {
-	for (auto& channel: m_channels) {
-		channel->match(data);
-	}
+	delete m_classifier;
+	m_classifier = nullptr;
+	m_classifier = new Classifier(this);
 }
@@ -47,6 +47,7 @@
 #include "profiles_internal.h"
 
 class Channel;
+class Classifier;
 
 /**
  * \brief Class representing profile
@@ -182,7 +183,19 @@ public:
 	 */
 	void match(struct ipfix_message *msg, struct metadata *mdata, std::vector<Channel *>& channels);
 
-	void match(struct match_data *data);
+	/**
+	 * \brief Compile the profile tree for matching of data records
+	 *
+	 * Must be called on the root profile once the tree is complete.
+	 */
+	void compile();
+
+	/**
+	 * \brief Get compiled profile tree
+	 *
+	 * \return classifier or NULL if the tree is not compiled
+	 */
+	Classifier *getClassifier() { return m_classifier; }
 private:
 
 	Profile *m_parent{NULL};	/**< Parent profile */
@@ -196,6 +209,7 @@ private:
 
 	profilesVec m_children{};	/**< Children */
 	channelsVec m_channels{};	/**< Channels */
+	Classifier *m_classifier{};	/**< Compiled tree (root profile only) */
 	
 	static profile_id_t profiles_cnt;	/**< Total number of profiles */
 };
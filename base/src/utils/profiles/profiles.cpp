@@ -51,6 +51,7 @@ extern "C" {
 
 #include "Profile.h"
 #include "Channel.h"
+#include "Classifier.h"
 
 
 #include "profiles_internal.h"
@@ -100,10 +101,10 @@ int xml_find_uniq_element(xmlNodePtr root, const char *name, xmlNodePtr *result)
 /**
  * \brief Find and parse flow filter in the channel specification
  * \param[in] root Channel element
- * \param[in,out] pdata Filter parse aux. structure
+ * \param[out] expr Filter expression
  * \return Pointer to new filter or NULL
  */
-static ipx_filter_t *channel_parse_filter(xmlNodePtr root)
+static ipx_filter_t *channel_parse_filter(xmlNodePtr root, std::string& expr)
 {
 	ipx_filter_t *pdata = NULL;
 	xmlNodePtr filter_node = NULL;
@@ -152,6 +153,7 @@ static ipx_filter_t *channel_parse_filter(xmlNodePtr root)
 		xmlFree(aux_char);
 		throw_empty;
 	}
+	expr = (const char *) aux_char;
 	xmlFree(aux_char);
 	return pdata;
 }
@@ -239,8 +241,9 @@ Channel *process_channel(Profile *profile, xmlNode *root)
 	/*Create filter*/
 	try {
 		/* Find and parse filter */
-		ipx_filter_t *filter = channel_parse_filter(root);
-		channel->setFilter(filter);
+		std::string expr;
+		ipx_filter_t *filter = channel_parse_filter(root, expr);
+		channel->setFilter(filter, expr);
 
 		/* Find and process the list of source channels */
 		std::string list = channel_parse_source_list(root);
@@ -567,6 +570,15 @@ Profile *process_profile_xml(const char *filename)
 	}
 
 	rootProfile->updatePathName();
+
+	try {
+		rootProfile->compile();
+	} catch (std::exception &e) {
+		MSG_ERROR(msg_module, "Unable to compile profile tree (%s)", e.what());
+		delete rootProfile;
+		return NULL;
+	}
+
 	return rootProfile;
 }
 
@@ -656,39 +668,84 @@ void *profile_get_channel(void *profile, uint16_t index)
 	return p->getChannels().size() > index ? p->getChannels()[index] : NULL;
 }
 
+/**
+ * \brief Get channels matched by a data record
+ *
+ * \param[in] classifier Compiled profile tree
+ * \param[in] result Results of Classifier::match()
+ * \param[in] record Index of the data record
+ * \return Null-terminated array of matching channels or NULL
+ */
+static void **matched_channels(const Classifier *classifier, const Classifier::batch &result, uint16_t record)
+{
+	const size_t channels = classifier->getChannelCount();
+	size_t count = 0;
+	for (size_t i = 0; i < channels; ++i) {
+		count += Classifier::matched(result, i, record);
+	}
+
+	if (count == 0) {
+		return NULL;
+	}
+
+	/* Null-terminated array of matching channels */
+	void **channel_list = (void **) malloc(sizeof(void *) * (count + 1));
+	if (channel_list == NULL) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	size_t index = 0;
+	for (size_t i = 0; i < channels; ++i) {
+		if (Classifier::matched(result, i, record)) {
+			channel_list[index++] = classifier->getChannel(i);
+		}
+	}
+
+	channel_list[index] = NULL;
+	return channel_list;
+}
+
 /**
  * Match profile with data record
  */
 void **profile_match_data(void *profile, struct ipfix_message *msg, struct metadata *mdata)
 {
-	Profile *p = (Profile *) profile;
+	static thread_local Classifier::batch buffers;
+	Classifier *classifier = ((Profile *) profile)->getClassifier();
 
-	/* Fill data structure */
-	struct match_data data;
-	data.msg = msg;
-	data.mdata = mdata;
-	data.channels = NULL;
-	data.channelsCounter = 0;
-	data.channelsMax = 0;
-
-	/* Find matching channels */
-	p->match(&data);
-	if (data.channels == NULL || data.channelsCounter == 0) {
+	if (!classifier) {
 		return NULL;
 	}
 
-	/* Add terminating NULL pointer */
-	if (data.channelsCounter == data.channelsMax) {
-		data.channels = (void**) realloc(data.channels, sizeof(void*) * (data.channelsCounter + 1));
-		if (data.channels == NULL) {
-			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
-			return NULL;
-		}
+	/* Sequence of one data record */
+	classifier->match(msg, mdata, 1, buffers);
+	return matched_channels(classifier, buffers, 0);
+}
+
+/**
+ * Match profile with all data records of the message
+ */
+void profile_match_message(void *profile, struct ipfix_message *msg)
+{
+	static thread_local Classifier::batch buffers;
+	Classifier *classifier = ((Profile *) profile)->getClassifier();
+	const uint16_t records = msg->data_records_count;
+
+	for (uint16_t r = 0; r < records; ++r) {
+		msg->metadata[r].channels = NULL;
+	}
+
+	if (!classifier || records == 0) {
+		return;
 	}
 
-	data.channels[data.channelsCounter] = NULL;
+	/* Find matching channels of all records */
+	classifier->match(msg, msg->metadata, records, buffers);
 
-	return data.channels;
+	for (uint16_t r = 0; r < records; ++r) {
+		msg->metadata[r].channels = matched_channels(classifier, buffers, r);
+	}
 }
 
 /**
@@ -0,0 +1,115 @@
+/**
+ * \file rbuffer_bench.c
+ * \brief Throughput benchmark of ipfixcol's ring buffer queue
+ *
+ * Copyright (C) 2015 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+
+#include "../../src/queues.h" // We expect that ring buffer API does not change
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#define MAX_THREADS 8 // Maximal number of reading threads
+#define BUFFER_SIZE 8192 // Size of the ring buffer (default of the collector)
+#define WRITE_COUNT 2000000 // How many items should be written in each run
+#define POOL_SIZE BUFFER_SIZE // Number of preallocated messages
+
+struct ring_buffer *rb;
+struct ipfix_message pool[POOL_SIZE];
+
+void *reader_thread(void *arg)
+{
+	unsigned int index = -1;
+	uint64_t *sum = (uint64_t *) arg;
+	struct ipfix_message *msg;
+
+	for (int i = 0; i < WRITE_COUNT; i++) {
+		msg = rbuffer_read(rb, &index);
+
+		/* touch the data like a real consumer */
+		*sum += msg->data_records_count;
+
+		/* messages are owned by the pool, do not free them */
+		rbuffer_remove_reference(rb, index, 0);
+
+		index = (index + 1) % BUFFER_SIZE;
+	}
+
+	return NULL;
+}
+
+int main()
+{
+	pthread_t threads[MAX_THREADS];
+	uint64_t sums[MAX_THREADS];
+	struct timespec start, end;
+
+	for (int i = 0; i < POOL_SIZE; i++) {
+		pool[i].data_records_count = 1;
+	}
+
+	printf("%10s %15s\n", "consumers", "messages/s");
+
+	for (int consumers = 1; consumers <= MAX_THREADS; consumers++) {
+		rb = rbuffer_init(BUFFER_SIZE);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		for (int i = 0; i < consumers; i++) {
+			sums[i] = 0;
+			pthread_create(&threads[i], NULL, reader_thread, &sums[i]);
+		}
+
+		for (int i = 0; i < WRITE_COUNT; i++) {
+			rbuffer_write(rb, &pool[i % POOL_SIZE], consumers);
+		}
+
+		for (int i = 0; i < consumers; i++) {
+			pthread_join(threads[i], NULL);
+			if (sums[i] != WRITE_COUNT) {
+				printf("Error: thread %i read %lu messages\n", i, (unsigned long) sums[i]);
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		rbuffer_free(rb);
+
+		double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("%10i %15.0f\n", consumers, WRITE_COUNT / secs);
+	}
+
+	return 0;
+}
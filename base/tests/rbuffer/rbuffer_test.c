@@ -37,18 +37,26 @@
  *
  */
 
-#include "../../../src/queues.h" // We expect that ring buffer API does not change
+#include "../../src/queues.h" // We expect that ring buffer API does not change
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sched.h>
 
 #define THREAD_NUM 2 // Number of threads to use
 #define BUFFER_SIZE 128 // Size of the ring buffer
 #define WRITE_COUNT 100000 // How many items should be written
 #define READ_COUNT WRITE_COUNT // How many items should each thread dread
 
+#define WRAP_THREAD_NUM 16 // Number of threads releasing records of a small buffer
+#define WRAP_BUFFER_SIZE 4 // Size of the small ring buffer, wraps around all the time
+#define WRAP_WRITE_COUNT 100000 // How many items should be written into the small buffer
+
+extern unsigned long recycled; // Number of released messages (stubs.c)
+
 struct ring_buffer *rb;
+pthread_mutex_t print_mutex = PTHREAD_MUTEX_INITIALIZER;
 int delays[THREAD_NUM] = {50, 50}; // Delays for each thread
 
 void *reader_thread(void *arg)
@@ -65,8 +73,8 @@ void *reader_thread(void *arg)
 		/* give the data a chance to disappear */
 		usleep(delays[num]);
 
-		/* lock the rbuffer so that the error output is consistent */
-		if (pthread_mutex_lock (&(rb->mutex)) != 0) {
+		/* lock the output so that the error output is consistent */
+		if (pthread_mutex_lock (&print_mutex) != 0) {
 			printf("Mutex lock failed (%s:%d)", __FILE__, __LINE__);
 			return (NULL);
 		}
@@ -75,10 +83,10 @@ void *reader_thread(void *arg)
             printf("Error: ODID does not match\n");
 			printf("Thread num: %i iteration: %i read from index: %i\n", num, i, index);
 			printf("buffer size: %i buffer count: %i read offset: %i write offset: %i\n\n",
-                rb->size, rb->count, rb->read_offset, rb->write_offset);
+                rb->size, rbuffer_count(rb), rbuffer_read_offset(rb), rb->write_offset);
 		}
 
-		if (pthread_mutex_unlock(&(rb->mutex)) != 0) {
+		if (pthread_mutex_unlock(&print_mutex) != 0) {
 			printf("Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
 			return (NULL);
 		}
@@ -91,6 +99,84 @@ void *reader_thread(void *arg)
 	return NULL;
 }
 
+int wrap_written = 0; // Number of records written into the small buffer
+int wrap_ticket = 0; // Next record to be taken by a reader of the small buffer
+
+/*
+ * Reader of the small ring buffer. Each record has one reference and is taken
+ * by one of the readers, so the buffer keeps wrapping around while a reader
+ * releasing a record is preempted. Each record must be released exactly once.
+ */
+void *wrap_reader_thread(void *arg)
+{
+	int num = *((int*) arg);
+	struct ipfix_message *msg;
+	unsigned int index;
+	int i;
+
+	while ((i = __atomic_fetch_add(&wrap_ticket, 1, __ATOMIC_SEQ_CST)) < WRAP_WRITE_COUNT) {
+		/* the record cannot be overwritten before this thread releases it */
+		while (__atomic_load_n(&wrap_written, __ATOMIC_SEQ_CST) <= i) {
+			sched_yield();
+		}
+
+		index = i % WRAP_BUFFER_SIZE;
+		msg = rbuffer_read(rb, &index);
+
+		if (msg->pkt_header->observation_domain_id != i) {
+			printf("Error: ODID does not match in wrap test (thread %i, record %i)\n", num, i);
+		}
+
+		if (i % 64 == num) {
+			sched_yield();
+		}
+
+		rbuffer_remove_reference(rb, index, 1);
+	}
+
+	return NULL;
+}
+
+int wrap_test()
+{
+	pthread_t threads[WRAP_THREAD_NUM];
+	int idarray[WRAP_THREAD_NUM];
+	unsigned long released;
+
+	rb = rbuffer_init(WRAP_BUFFER_SIZE);
+	recycled = 0;
+	wrap_written = 0;
+	wrap_ticket = 0;
+
+	for (int i = 0; i < WRAP_THREAD_NUM; i++) {
+		idarray[i] = i;
+		pthread_create(&threads[i], NULL, wrap_reader_thread, &idarray[i]);
+	}
+
+	for (int i=0; i<WRAP_WRITE_COUNT; i++) {
+		struct ipfix_message *record = calloc(1, sizeof(struct ipfix_message));
+		record->pkt_header = malloc(sizeof(struct ipfix_header));
+		record->pkt_header->observation_domain_id = i;
+		rbuffer_write(rb, record, 1);
+		__atomic_store_n(&wrap_written, i + 1, __ATOMIC_SEQ_CST);
+	}
+
+	for (int i = 0; i < WRAP_THREAD_NUM; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	rbuffer_free(rb);
+
+	released = __atomic_load_n(&recycled, __ATOMIC_SEQ_CST);
+	if (released != WRAP_WRITE_COUNT) {
+		printf("Error: %lu of %i records released in wrap test\n", released, WRAP_WRITE_COUNT);
+		return 1;
+	}
+
+	printf("Wrap test: %i records released exactly once by %i threads\n", WRAP_WRITE_COUNT, WRAP_THREAD_NUM);
+	return 0;
+}
+
 int main()
 {
 	rb = rbuffer_init(BUFFER_SIZE);
@@ -105,7 +191,7 @@ int main()
 
 	for (int i=0; i<WRITE_COUNT; i++) {
 
-		struct ipfix_message *record = malloc(sizeof(struct ipfix_message));
+		struct ipfix_message *record = calloc(1, sizeof(struct ipfix_message));
 		record->pkt_header = malloc(sizeof(struct ipfix_header));
 		record->pkt_header->observation_domain_id = i;
 		rbuffer_write(rb, record, THREAD_NUM);
@@ -117,5 +203,5 @@ int main()
 
 	rbuffer_free(rb);
 
-	return 0;
+	return wrap_test();
 }
@@ -85,6 +85,15 @@ struct extensions {
 	struct extension *map;
 };
 
+/**
+ * \brief List of templates created for extension maps
+ */
+struct template_list {
+	struct ipfix_template **templates; /**< array of pointers to templates */
+	uint16_t max_length;               /**< maximum length of array */
+	uint16_t counter;                  /**< number of templates in array */
+};
+
 /**
  * \brief List of input info structures
  */
@@ -105,7 +114,7 @@ struct nfinput_config {
 	struct input_info_file_list	*in_info_list;
 	struct input_info_file *in_info; /**< info structure about current input file */
 	struct extensions ext;           /**< extensions map */
-	struct ipfix_template_mgr_record template_mgr; /**< template manager */
+	struct template_list template_mgr; /**< template manager */
 	struct file_header_s header;     /**< header of readed file */
 	struct stat_record_s stats;      /**< stats record */
 	int basic_added;                 /**< flag indicating if basic templates was added */
@@ -377,7 +386,7 @@ void add_template(struct ipfix_message *ipfix_msg, struct ipfix_template * templ
  * 
  * \param manager Template manager
  */
-void clean_tmp_manager(struct ipfix_template_mgr_record *manager){
+void clean_tmp_manager(struct template_list *manager){
 	int i;
 	for(i = 0; i <= manager->counter; i++ ) {
 		if (manager->templates[i] != NULL){
@@ -400,7 +409,7 @@ void clean_tmp_manager(struct ipfix_template_mgr_record *manager){
  * \return 0 on success
  */
 int process_ext_record(struct record_header_s *record, struct extensions *ext,
-	struct ipfix_template_mgr_record *template_mgr, struct ipfix_message *msg)
+	struct template_list *template_mgr, struct ipfix_message *msg)
 {
 	int data_offset = 0;
 	int id,eid;
@@ -485,7 +494,7 @@ int process_ext_record(struct record_header_s *record, struct extensions *ext,
  * \return 0 on success
  */
 int process_ext_map(struct record_header_s *record, struct extensions *ext,
-		struct ipfix_template_mgr_record *template_mgr, struct ipfix_message *msg)
+		struct template_list *template_mgr, struct ipfix_message *msg)
 {	
 	struct extension_map_s *extension_map = (struct extension_map_s*) record;
 
@@ -821,9 +830,8 @@ int get_packet(void *config, struct input_info **info, char **packet, int *sourc
 	struct nfinput_config *conf = (struct nfinput_config *) config;
 
 	// Prepare and init new message
-	struct ipfix_message *ipfix_msg = calloc(1, sizeof(struct ipfix_message));
+	struct ipfix_message *ipfix_msg = message_create_sized(MSG_MAX_TEMPL_SETS, 0, MSG_MAX_DATA_COUPLES);
 	if (!ipfix_msg) {
-		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
 		return INPUT_ERROR;
 	}
 
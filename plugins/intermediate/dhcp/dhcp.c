@@ -44,9 +44,17 @@
 
 #include <sqlite3.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #define IP_MAC_PAIRS_MAX 16
 
+/* Default interval between database checks (seconds) */
+#define DHCP_REFRESH_DEFAULT 1
+
+/* Minimal number of slots in the IP-MAC table */
+#define DHCP_TABLE_MIN 64
+
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
@@ -69,18 +77,87 @@ typedef struct {
 	dhcp_ipfix_element_t mac;
 } dhcp_ip_mac_t;
 
+/**
+ * \brief Slot of the IP-MAC table
+ */
+struct dhcp_entry {
+	uint32_t ip;		/**< IPv4 address (network byte order) */
+	uint8_t mac[6];		/**< MAC address */
+	uint8_t used;		/**< Slot is occupied */
+};
+
+/**
+ * \brief IP-MAC table
+ *
+ * The table is built by the refresh thread and never modified once it is
+ * published, so the processing thread reads it without any locking.
+ */
+struct dhcp_table {
+	uint32_t mask;		/**< Number of slots - 1 */
+	uint32_t count;		/**< Number of stored addresses */
+	struct dhcp_entry entries[]; /**< Open addressing slots */
+};
+
+/**
+ * \brief Table replaced by a newer one, freed once no reader can use it
+ */
+struct dhcp_retired {
+	struct dhcp_table *table;	/**< Replaced table */
+	uint64_t epoch;				/**< Reader epoch at the time of replacement */
+	struct dhcp_retired *next;	/**< Next retired table */
+};
+
 /**
  * \brief Plugin's configuration structure
  */
 struct plugin_conf {
-	char mac[18];		/**< MAC field from DB */
 	sqlite3 *db;		/**< DB config */
 	char *db_path;		/**< Path to database file */
 	void *ip_config;	/**< Intermediate process config */
 	dhcp_ip_mac_t ip_mac_pairs[IP_MAC_PAIRS_MAX]; /**< IP-MAC pairs */
 	uint8_t ip_mac_pairs_count; /**< IP-MAC pairs count*/
+	int refresh;		/**< Interval between database checks (seconds) */
+
+	struct dhcp_table *table;	/**< Current IP-MAC table */
+	struct dhcp_retired *retired; /**< Replaced tables */
+	int64_t data_version;	/**< Database version of the current table */
+	uint64_t epoch;		/**< Number of processed messages */
+	int active;			/**< Processing thread is reading the table */
+
+	pthread_t thread;	/**< Refresh thread */
+	int thread_running;	/**< Refresh thread has been started */
+	pthread_mutex_t lock;	/**< Lock for stop condition */
+	pthread_cond_t cond;	/**< Wakes up the refresh thread on close */
+	int stop;			/**< Refresh thread should terminate */
 };
 
+/**
+ * \brief Free all retired tables that cannot be used by the processing thread
+ *
+ * The processing thread marks reading of the table by the \e active flag and
+ * increments \e epoch after each message. A table retired in epoch E may be
+ * freed when the reader is idle or has finished the message of epoch E.
+ *
+ * \param[in] conf plugin's configuration
+ * \param[in] force free all tables regardless of the reader
+ */
+static void dhcp_reclaim(struct plugin_conf *conf, int force)
+{
+	int active = __atomic_load_n(&conf->active, __ATOMIC_SEQ_CST);
+	uint64_t epoch = __atomic_load_n(&conf->epoch, __ATOMIC_SEQ_CST);
+	struct dhcp_retired **prev = &conf->retired, *item;
+
+	while ((item = *prev) != NULL) {
+		if (force || !active || item->epoch < epoch) {
+			*prev = item->next;
+			free(item->table);
+			free(item);
+		} else {
+			prev = &item->next;
+		}
+	}
+}
+
 /**
  * \brief Free configuration structure
  * 
@@ -98,6 +175,10 @@ void dhcp_free_config(struct plugin_conf *conf)
 		if (conf->db) {
 			sqlite3_close(conf->db);
 		}
+
+		/* Free tables */
+		dhcp_reclaim(conf, 1);
+		free(conf->table);
 		
 		free(conf);
 	}
@@ -135,6 +216,17 @@ int process_startup_xml(struct plugin_conf *conf, char *params)
 		/* Path to database file */
 		if (!xmlStrcasecmp(node->name, (const xmlChar *) "path")) {
 			conf->db_path = (char *) xmlNodeListGetString(doc, node->children, 1);
+		} else if (!xmlStrcasecmp(node->name, (const xmlChar *) "refresh")) { /* Refresh interval */
+			char *refresh = (char *) xmlNodeListGetString(doc, node->children, 1);
+			if (refresh) {
+				conf->refresh = atoi(refresh);
+				xmlFree(refresh);
+			}
+
+			if (conf->refresh <= 0) {
+				MSG_WARNING(msg_module, "Invalid refresh interval, using %d s", DHCP_REFRESH_DEFAULT);
+				conf->refresh = DHCP_REFRESH_DEFAULT;
+			}
 		} else if (!xmlStrcasecmp(node->name, (const xmlChar *) "pair")) { /* IP-MAC pairs */
 
 			if (conf->ip_mac_pairs_count >= IP_MAC_PAIRS_MAX) {
@@ -175,6 +267,258 @@ int process_startup_xml(struct plugin_conf *conf, char *params)
 	return 0;
 }
 
+/**
+ * \brief Compute slot index of IPv4 address
+ *
+ * \param[in] ip IPv4 address
+ * \return hash value
+ */
+static inline uint32_t dhcp_hash(uint32_t ip)
+{
+	/* Mix all bits into the low ones used as the index */
+	ip ^= ip >> 16;
+	ip *= 0x85ebca6bU;
+	ip ^= ip >> 13;
+	ip *= 0xc2b2ae35U;
+	ip ^= ip >> 16;
+	return ip;
+}
+
+/**
+ * \brief Find MAC address of IPv4 address in the table
+ *
+ * \param[in] table IP-MAC table
+ * \param[in] ip IPv4 address (network byte order)
+ * \return pointer to MAC address or NULL when not found
+ */
+static const uint8_t *dhcp_table_find(const struct dhcp_table *table, uint32_t ip)
+{
+	uint32_t idx = dhcp_hash(ip) & table->mask;
+
+	while (table->entries[idx].used) {
+		if (table->entries[idx].ip == ip) {
+			return table->entries[idx].mac;
+		}
+		idx = (idx + 1) & table->mask;
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Insert or replace IP-MAC pair in the table
+ *
+ * \param[in] table IP-MAC table with at least one free slot
+ * \param[in] ip IPv4 address (network byte order)
+ * \param[in] mac MAC address
+ */
+static void dhcp_table_insert(struct dhcp_table *table, uint32_t ip, const uint8_t *mac)
+{
+	uint32_t idx = dhcp_hash(ip) & table->mask;
+
+	while (table->entries[idx].used && table->entries[idx].ip != ip) {
+		idx = (idx + 1) & table->mask;
+	}
+
+	if (!table->entries[idx].used) {
+		table->entries[idx].used = 1;
+		table->entries[idx].ip = ip;
+		table->count++;
+	}
+
+	memcpy(table->entries[idx].mac, mac, 6);
+}
+
+/**
+ * \brief Read current database version
+ *
+ * The version changes whenever another connection commits a change
+ * to the database.
+ *
+ * \param[in] conf plugin's configuration
+ * \param[out] version database version
+ * \return 0 on success
+ */
+static int dhcp_data_version(struct plugin_conf *conf, int64_t *version)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(conf->db, "PRAGMA data_version", -1, &stmt, NULL) != SQLITE_OK) {
+		MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(conf->db));
+		return 1;
+	}
+
+	int rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW) {
+		*version = sqlite3_column_int64(stmt, 0);
+	}
+
+	sqlite3_finalize(stmt);
+	return (rc == SQLITE_ROW) ? 0 : 1;
+}
+
+/**
+ * \brief Load IP-MAC pairs from the database into a new table
+ *
+ * \param[in] conf plugin's configuration
+ * \return new table or NULL on error
+ */
+static struct dhcp_table *dhcp_load_table(struct plugin_conf *conf)
+{
+	sqlite3_stmt *stmt;
+	struct dhcp_table *table = NULL;
+	int64_t rows;
+
+	/* Both statements see the same snapshot of the database */
+	if (sqlite3_exec(conf->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+		MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(conf->db));
+		return NULL;
+	}
+
+	/* Size the table to be at most half full */
+	if (sqlite3_prepare_v2(conf->db, "SELECT count(*) FROM dhcp", -1, &stmt, NULL) != SQLITE_OK) {
+		goto sql_error;
+	}
+
+	if (sqlite3_step(stmt) != SQLITE_ROW) {
+		sqlite3_finalize(stmt);
+		goto sql_error;
+	}
+
+	rows = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	uint32_t size = DHCP_TABLE_MIN;
+	while (size < 2 * rows) {
+		size <<= 1;
+	}
+
+	table = calloc(1, sizeof(struct dhcp_table) + size * sizeof(struct dhcp_entry));
+	if (!table) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		sqlite3_exec(conf->db, "COMMIT", NULL, NULL, NULL);
+		return NULL;
+	}
+	table->mask = size - 1;
+
+	/* Later rows replace earlier ones */
+	if (sqlite3_prepare_v2(conf->db, "SELECT ip, mac FROM dhcp", -1, &stmt, NULL) != SQLITE_OK) {
+		goto sql_error;
+	}
+
+	int rc;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const char *ip_str = (const char *) sqlite3_column_text(stmt, 0);
+		const char *mac_str = (const char *) sqlite3_column_text(stmt, 1);
+		uint32_t ip;
+		uint8_t mac[6] = {0};
+
+		if (!ip_str || !mac_str || inet_pton(AF_INET, ip_str, &ip) != 1) {
+			continue;
+		}
+
+		if (table->count == table->mask) {
+			/* Database changed since the count, do not overfill the table */
+			break;
+		}
+
+		sscanf(mac_str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
+		dhcp_table_insert(table, ip, mac);
+	}
+
+	sqlite3_finalize(stmt);
+	if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+		goto sql_error;
+	}
+
+	sqlite3_exec(conf->db, "COMMIT", NULL, NULL, NULL);
+	return table;
+
+sql_error:
+	MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(conf->db));
+	sqlite3_exec(conf->db, "ROLLBACK", NULL, NULL, NULL);
+	free(table);
+	return NULL;
+}
+
+/**
+ * \brief Reload the IP-MAC table when the database has changed
+ *
+ * \param[in] conf plugin's configuration
+ */
+static void dhcp_refresh(struct plugin_conf *conf)
+{
+	int64_t version;
+
+	/* Free tables replaced by previous refreshes */
+	dhcp_reclaim(conf, 0);
+
+	if (dhcp_data_version(conf, &version) != 0) {
+		return;
+	}
+
+	if (conf->table && version == conf->data_version) {
+		/* Nothing has changed */
+		return;
+	}
+
+	struct dhcp_table *table = dhcp_load_table(conf);
+	if (!table) {
+		/* Keep the current table and try again later */
+		return;
+	}
+
+	struct dhcp_retired *retired = malloc(sizeof(struct dhcp_retired));
+	if (!retired) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		free(table);
+		return;
+	}
+
+	/* Publish the new table, the old one may still be read by the processing thread */
+	retired->table = __atomic_exchange_n(&conf->table, table, __ATOMIC_SEQ_CST);
+	retired->epoch = __atomic_load_n(&conf->epoch, __ATOMIC_SEQ_CST);
+	conf->data_version = version;
+
+	if (retired->table) {
+		retired->next = conf->retired;
+		conf->retired = retired;
+	} else {
+		free(retired);
+	}
+
+	MSG_DEBUG(msg_module, "Loaded %u IP-MAC pairs", table->count);
+}
+
+/**
+ * \brief Refresh thread, periodically checks the database for changes
+ *
+ * \param[in] arg plugin's configuration
+ * \return NULL
+ */
+static void *dhcp_refresh_thread(void *arg)
+{
+	struct plugin_conf *conf = (struct plugin_conf *) arg;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&conf->lock);
+	while (!conf->stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += conf->refresh;
+		pthread_cond_timedwait(&conf->cond, &conf->lock, &deadline);
+		if (conf->stop) {
+			break;
+		}
+
+		pthread_mutex_unlock(&conf->lock);
+		dhcp_refresh(conf);
+		pthread_mutex_lock(&conf->lock);
+	}
+	pthread_mutex_unlock(&conf->lock);
+
+	return NULL;
+}
+
 /**
  * \brief Plugin initialization
  * 
@@ -201,6 +545,7 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
 		return 1;
 	}
+	conf->refresh = DHCP_REFRESH_DEFAULT;
 	
 	/* Process configuration */
 	if (process_startup_xml(conf, params) != 0) {
@@ -217,6 +562,21 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 
 	/* Set a 10ms busy timeout */
 	sqlite3_busy_timeout(conf->db, 10);
+
+	/* Load the table before the first message arrives */
+	dhcp_refresh(conf);
+
+	/* Start refresh thread */
+	pthread_mutex_init(&conf->lock, NULL);
+	pthread_cond_init(&conf->cond, NULL);
+	if (pthread_create(&conf->thread, NULL, dhcp_refresh_thread, conf) != 0) {
+		MSG_ERROR(msg_module, "Unable to create refresh thread");
+		pthread_cond_destroy(&conf->cond);
+		pthread_mutex_destroy(&conf->lock);
+		dhcp_free_config(conf);
+		return 1;
+	}
+	conf->thread_running = 1;
 	
 	/* Save configuration */
 	conf->ip_config = ip_config;
@@ -226,35 +586,17 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 	return 0;
 }
 
-/**
- * \brief Callback for each select
- * 
- * \param[in] data Plugin configuration
- * \param[in] argc
- * \param[in] argv DB fields
- * \param[in] azColName
- * \return 0 on success
- */
-static int dhcp_callback(void *data, int argc, char **argv, char **azColName){
-	struct plugin_conf *conf = (struct plugin_conf *) data;
-
-	strncpy(conf->mac, argv[0], 17);
-
-	return 0;
-}
-
 /**
  * \brief Replace existing MAC address with MAC from database
  * 
- * \param[in] conf plugin's configuration
+ * \param[in] table IP-MAC table
  * \param[in] mdata data record's metadata
  * \param[in] ip_mac_pair IP-MAC pair
  * \return void
  */
-void dhcp_replace_mac(struct plugin_conf *conf, struct metadata *mdata, dhcp_ip_mac_t *ip_mac_pair)
+void dhcp_replace_mac(const struct dhcp_table *table, struct metadata *mdata, dhcp_ip_mac_t *ip_mac_pair)
 {
 	void *ip_data = NULL, *mac_data = NULL;
-	conf->mac[0] = '\0';
 	
 	/* Get IP address */
 	ip_data = data_record_get_field(mdata->record.record, mdata->record.templ, ip_mac_pair->ip.en, ip_mac_pair->ip.id, NULL);
@@ -268,38 +610,18 @@ void dhcp_replace_mac(struct plugin_conf *conf, struct metadata *mdata, dhcp_ip_
 		return;
 	}
 
-	/** Get the MAC from database **/
+	/* Get the MAC from the table */
+	uint32_t ip;
+	memcpy(&ip, ip_data, sizeof(ip));
 
-	char ipStr[INET_ADDRSTRLEN];
-	
-	/* Get IPv4 string */
-	inet_ntop(AF_INET, ip_data, ipStr, INET_ADDRSTRLEN);
-	
-	char sqlQuery[150];
-	snprintf(sqlQuery, 150, "SELECT mac FROM dhcp WHERE ip == '%s'", ipStr);
-
-	/* Execute query */
-	char *err = NULL;
-	int rc = sqlite3_exec(conf->db, sqlQuery, dhcp_callback, (void *) conf, &err);
-	
-	if (rc != SQLITE_OK) {
-		MSG_ERROR(msg_module, "SQL error: %s", err);
-		sqlite3_free(err);
-		return;
-	}
-
-	/* Check that we got a result */
-	if (conf->mac[0] == '\0') {
+	const uint8_t *mac = dhcp_table_find(table, ip);
+	if (!mac) {
 		/* Write zeroes */
 		uint64_t zero = 0;
 		memcpy(mac_data, &zero, 6);
 		return;
 	}
 
-	/* Convert MAC to number */
-	unsigned char mac[6];
-	sscanf(conf->mac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
-
 	/* Fill the result back to the record */
 	memcpy(mac_data, mac, 6);
 
@@ -318,16 +640,23 @@ int intermediate_process_message(void* config, void* message)
 	struct plugin_conf *conf = (struct plugin_conf *) config;
 	struct ipfix_message *msg = (struct ipfix_message *) message;
 	struct metadata *mdata;
-	
+
+	/* Keep the refresh thread from freeing the table while it is used */
+	__atomic_store_n(&conf->active, 1, __ATOMIC_SEQ_CST);
+	const struct dhcp_table *table = __atomic_load_n(&conf->table, __ATOMIC_SEQ_CST);
+
 	/* Process each data record */
-	for (int i = 0; i < msg->data_records_count; ++i) {
+	for (int i = 0; table && i < msg->data_records_count; ++i) {
 		mdata = &(msg->metadata[i]);
 
 		/* Replace MACs from database */
 		for (int j=0; j < conf->ip_mac_pairs_count; j++) {
-			dhcp_replace_mac(conf, mdata, &conf->ip_mac_pairs[j]);
+			dhcp_replace_mac(table, mdata, &conf->ip_mac_pairs[j]);
 		}
 	}
+
+	__atomic_fetch_add(&conf->epoch, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&conf->active, 0, __ATOMIC_SEQ_CST);
 	
 	/* Pass message to the next plugin/Output Manager */
 	pass_message(conf->ip_config, msg);
@@ -344,6 +673,18 @@ int intermediate_close(void *config)
 {
 	MSG_DEBUG(msg_module, "Closing");
 	struct plugin_conf *conf = (struct plugin_conf *) config;
+
+	/* Stop refresh thread */
+	if (conf->thread_running) {
+		pthread_mutex_lock(&conf->lock);
+		conf->stop = 1;
+		pthread_cond_signal(&conf->cond);
+		pthread_mutex_unlock(&conf->lock);
+
+		pthread_join(conf->thread, NULL);
+		pthread_cond_destroy(&conf->cond);
+		pthread_mutex_destroy(&conf->lock);
+	}
 	
 	/* Release configuration */
 	dhcp_free_config(conf);
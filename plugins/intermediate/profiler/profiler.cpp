@@ -310,10 +310,8 @@ int intermediate_process_message(void* config, void* message)
 		return 0;
 	}
 
-	/* Match channels for each data record */
-	for (uint16_t i = 0; i < msg->data_records_count; ++i) {
-		msg->metadata[i].channels = profile_match_data(msg->live_profile, msg, &(msg->metadata[i]));
-	}
+	/* Match channels of all data records at once */
+	profile_match_message(msg->live_profile, msg);
 
 	pass_message(conf->ip_config, msg);
 	return 0;
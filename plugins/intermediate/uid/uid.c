@@ -44,6 +44,9 @@
 
 #include <sqlite3.h>
 #include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
 
 #define IPv4 4
 #define IPv6 6
@@ -57,22 +60,161 @@
 #define FLOW_START_SECONDS 150
 #define FLOW_START_MILLISECONDS 152
 
+/* Default interval between database checks (seconds) */
+#define UID_REFRESH_DEFAULT 1
+
+/* Minimal number of slots in the address table */
+#define UID_TABLE_MIN 64
+
+/* Initial number of events per address */
+#define UID_EVENTS_MIN 4
+
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
 /* Identifier for verbose macros */
 static const char *msg_module = "uid";
 
+/**
+ * \brief Login or logout of a user
+ */
+struct uid_event {
+	uint32_t time;		/**< Time of the event */
+	uint8_t login;		/**< 1 for login, 0 for logout */
+	char name[32];		/**< User name */
+};
+
+/**
+ * \brief Events of one address sorted by time
+ *
+ * Events arriving in time order are appended in place and become visible by
+ * the update of \e count. Other changes create a new copy of the array.
+ */
+struct uid_events {
+	uint32_t count;		/**< Number of valid events */
+	uint32_t size;		/**< Allocated number of events */
+	struct uid_event items[]; /**< Events */
+};
+
+/**
+ * \brief Slot of the address table
+ */
+struct uid_entry {
+	uint8_t addr[16];	/**< IPv4 or IPv6 address, IPv4 padded by zeroes */
+	uint8_t ipv;		/**< IP version, 0 for free slot */
+	struct uid_events *events; /**< Events of the address */
+};
+
+/**
+ * \brief Address table
+ *
+ * Slots are only added. Once a slot is published, its address never changes.
+ */
+struct uid_table {
+	uint32_t mask;		/**< Number of slots - 1 */
+	uint32_t count;		/**< Number of used slots */
+	struct uid_entry entries[]; /**< Open addressing slots */
+};
+
+/**
+ * \brief Memory replaced by the refresh thread, freed once no reader can use it
+ */
+struct uid_retired {
+	void *ptr;			/**< Replaced table or events */
+	uint64_t epoch;		/**< Reader epoch at the time of replacement */
+	struct uid_retired *next; /**< Next retired item */
+};
+
 /**
  * \brief Plugin's configuration structure
  */
 struct plugin_conf {
-	char name[32];		/**< Name field from DB */
 	sqlite3 *db;		/**< DB config */
 	char *db_path;		/**< Path to database file */
 	void *ip_config;	/**< intermediate process config */
+	int refresh;		/**< Interval between database checks (seconds) */
+
+	struct uid_table *table;	/**< Current address table */
+	struct uid_retired *retired; /**< Replaced tables and events */
+	int64_t data_version;	/**< Database version of the loaded rows */
+	int64_t last_rowid;	/**< Last loaded row */
+	int64_t rows;		/**< Number of loaded rows */
+	uint64_t epoch;		/**< Number of processed messages */
+	int active;			/**< Processing thread is reading the table */
+
+	pthread_t thread;	/**< Refresh thread */
+	int thread_running;	/**< Refresh thread has been started */
+	pthread_mutex_t lock;	/**< Lock for stop condition */
+	pthread_cond_t cond;	/**< Wakes up the refresh thread on close */
+	int stop;			/**< Refresh thread should terminate */
 };
 
+/**
+ * \brief Retire memory that may still be read by the processing thread
+ *
+ * \param[in] conf plugin's configuration
+ * \param[in] ptr memory already unreachable from the current table
+ */
+static void uid_retire(struct plugin_conf *conf, void *ptr)
+{
+	struct uid_retired *retired = malloc(sizeof(struct uid_retired));
+	if (!retired) {
+		/* The memory is leaked rather than freed under the reader */
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		return;
+	}
+
+	retired->ptr = ptr;
+	retired->epoch = __atomic_load_n(&conf->epoch, __ATOMIC_SEQ_CST);
+	retired->next = conf->retired;
+	conf->retired = retired;
+}
+
+/**
+ * \brief Free all retired memory that cannot be used by the processing thread
+ *
+ * The processing thread marks reading of the table by the \e active flag and
+ * increments \e epoch after each message. Memory retired in epoch E may be
+ * freed when the reader is idle or has finished the message of epoch E.
+ *
+ * \param[in] conf plugin's configuration
+ * \param[in] force free everything regardless of the reader
+ */
+static void uid_reclaim(struct plugin_conf *conf, int force)
+{
+	int active = __atomic_load_n(&conf->active, __ATOMIC_SEQ_CST);
+	uint64_t epoch = __atomic_load_n(&conf->epoch, __ATOMIC_SEQ_CST);
+	struct uid_retired **prev = &conf->retired, *item;
+
+	while ((item = *prev) != NULL) {
+		if (force || !active || item->epoch < epoch) {
+			*prev = item->next;
+			free(item->ptr);
+			free(item);
+		} else {
+			prev = &item->next;
+		}
+	}
+}
+
+/**
+ * \brief Free address table including all its events
+ *
+ * \param[in] table address table
+ */
+static void uid_table_free(struct uid_table *table)
+{
+	if (!table) {
+		return;
+	}
+
+	for (uint32_t i = 0; i <= table->mask; ++i) {
+		free(table->entries[i].events);
+	}
+
+	free(table);
+}
+
 /**
  * \brief Free configuration structure
  * 
@@ -90,6 +232,10 @@ void uid_free_config(struct plugin_conf *conf)
 		if (conf->db) {
 			sqlite3_close(conf->db);
 		}
+
+		/* Free tables */
+		uid_reclaim(conf, 1);
+		uid_table_free(conf->table);
 		
 		free(conf);
 	}
@@ -127,6 +273,17 @@ int process_startup_xml(struct plugin_conf *conf, char *params)
 		/* Path to database file */
 		if (!xmlStrcasecmp(node->name, (const xmlChar *) "path")) {
 			conf->db_path = (char *) xmlNodeListGetString(doc, node->children, 1);
+		} else if (!xmlStrcasecmp(node->name, (const xmlChar *) "refresh")) { /* Refresh interval */
+			char *refresh = (char *) xmlNodeListGetString(doc, node->children, 1);
+			if (refresh) {
+				conf->refresh = atoi(refresh);
+				xmlFree(refresh);
+			}
+
+			if (conf->refresh <= 0) {
+				MSG_WARNING(msg_module, "Invalid refresh interval, using %d s", UID_REFRESH_DEFAULT);
+				conf->refresh = UID_REFRESH_DEFAULT;
+			}
 		}
 	}
 	
@@ -140,6 +297,396 @@ int process_startup_xml(struct plugin_conf *conf, char *params)
 	return 0;
 }
 
+/**
+ * \brief Compute slot index of an address
+ *
+ * \param[in] addr IPv4 or IPv6 address padded to 16 bytes
+ * \return hash value
+ */
+static inline uint32_t uid_hash(const uint8_t *addr)
+{
+	uint32_t hash = 2166136261U;
+
+	for (int i = 0; i < 16; ++i) {
+		hash = (hash ^ addr[i]) * 16777619U;
+	}
+
+	return hash;
+}
+
+/**
+ * \brief Find the last event of an address not newer than given time
+ *
+ * \param[in] table address table
+ * \param[in] addr IPv4 or IPv6 address padded to 16 bytes
+ * \param[in] ipv IP version
+ * \param[in] time time of the flow
+ * \return event or NULL when not found
+ */
+static const struct uid_event *uid_table_find(const struct uid_table *table, const uint8_t *addr,
+		uint8_t ipv, uint32_t time)
+{
+	uint32_t idx = uid_hash(addr) & table->mask;
+	const struct uid_entry *entry;
+	uint8_t entry_ipv;
+
+	for (entry = &table->entries[idx]; (entry_ipv = __atomic_load_n(&entry->ipv, __ATOMIC_ACQUIRE)) != 0;
+			entry = &table->entries[idx]) {
+		if (entry_ipv == ipv && memcmp(entry->addr, addr, 16) == 0) {
+			break;
+		}
+		idx = (idx + 1) & table->mask;
+	}
+
+	if (!entry_ipv) {
+		return NULL;
+	}
+
+	const struct uid_events *events = __atomic_load_n(&entry->events, __ATOMIC_ACQUIRE);
+	uint32_t low = 0, high = __atomic_load_n(&events->count, __ATOMIC_ACQUIRE);
+
+	/* Find the first event newer than the flow */
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		if (events->items[mid].time <= time) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return (low > 0) ? &events->items[low - 1] : NULL;
+}
+
+/**
+ * \brief Get slot of an address, add it when it is not in the table
+ *
+ * The table is replaced by a bigger one when it gets half full.
+ *
+ * \param[in] conf plugin's configuration
+ * \param[in,out] table_ptr address table
+ * \param[in] addr IPv4 or IPv6 address padded to 16 bytes
+ * \param[in] ipv IP version
+ * \return slot or NULL on error
+ */
+static struct uid_entry *uid_table_get(struct plugin_conf *conf, struct uid_table **table_ptr,
+		const uint8_t *addr, uint8_t ipv)
+{
+	struct uid_table *table = *table_ptr;
+	uint32_t idx = uid_hash(addr) & table->mask;
+
+	while (table->entries[idx].ipv) {
+		if (table->entries[idx].ipv == ipv && memcmp(table->entries[idx].addr, addr, 16) == 0) {
+			return &table->entries[idx];
+		}
+		idx = (idx + 1) & table->mask;
+	}
+
+	if (2 * (table->count + 1) > table->mask + 1) {
+		/* Move slots to a bigger table, events are shared with the old one */
+		uint32_t size = 2 * (table->mask + 1);
+		struct uid_table *bigger = calloc(1, sizeof(struct uid_table) + size * sizeof(struct uid_entry));
+		if (!bigger) {
+			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+			return NULL;
+		}
+		bigger->mask = size - 1;
+		bigger->count = table->count;
+
+		for (uint32_t i = 0; i <= table->mask; ++i) {
+			if (!table->entries[i].ipv) {
+				continue;
+			}
+
+			uint32_t pos = uid_hash(table->entries[i].addr) & bigger->mask;
+			while (bigger->entries[pos].ipv) {
+				pos = (pos + 1) & bigger->mask;
+			}
+			bigger->entries[pos] = table->entries[i];
+		}
+
+		__atomic_store_n(table_ptr, bigger, __ATOMIC_SEQ_CST);
+		uid_retire(conf, table);
+		table = bigger;
+
+		idx = uid_hash(addr) & table->mask;
+		while (table->entries[idx].ipv) {
+			idx = (idx + 1) & table->mask;
+		}
+	}
+
+	struct uid_events *events = malloc(sizeof(struct uid_events) + UID_EVENTS_MIN * sizeof(struct uid_event));
+	if (!events) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+	events->count = 0;
+	events->size = UID_EVENTS_MIN;
+
+	/* Publish the address after the slot is complete */
+	struct uid_entry *entry = &table->entries[idx];
+	memcpy(entry->addr, addr, 16);
+	entry->events = events;
+	__atomic_store_n(&entry->ipv, ipv, __ATOMIC_RELEASE);
+	table->count++;
+
+	return entry;
+}
+
+/**
+ * \brief Add login or logout event of an address
+ *
+ * \param[in] conf plugin's configuration
+ * \param[in,out] table_ptr address table
+ * \param[in] addr IPv4 or IPv6 address padded to 16 bytes
+ * \param[in] ipv IP version
+ * \param[in] event new event
+ * \return 0 on success
+ */
+static int uid_table_add(struct plugin_conf *conf, struct uid_table **table_ptr, const uint8_t *addr,
+		uint8_t ipv, const struct uid_event *event)
+{
+	struct uid_entry *entry = uid_table_get(conf, table_ptr, addr, ipv);
+	if (!entry) {
+		return 1;
+	}
+
+	struct uid_events *events = entry->events;
+	uint32_t count = events->count;
+
+	/* Append in place, readers see the event after the count is updated */
+	if (count < events->size && (count == 0 || events->items[count - 1].time <= event->time)) {
+		events->items[count] = *event;
+		__atomic_store_n(&events->count, count + 1, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	/* Events with the same time keep order of the database rows */
+	uint32_t pos = count;
+	while (pos > 0 && events->items[pos - 1].time > event->time) {
+		pos--;
+	}
+
+	uint32_t size = (count < events->size) ? events->size : 2 * events->size;
+	struct uid_events *copy = malloc(sizeof(struct uid_events) + size * sizeof(struct uid_event));
+	if (!copy) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	copy->count = count + 1;
+	copy->size = size;
+	memcpy(copy->items, events->items, pos * sizeof(struct uid_event));
+	copy->items[pos] = *event;
+	memcpy(copy->items + pos + 1, events->items + pos, (count - pos) * sizeof(struct uid_event));
+
+	__atomic_store_n(&entry->events, copy, __ATOMIC_SEQ_CST);
+	uid_retire(conf, events);
+	return 0;
+}
+
+/**
+ * \brief Execute statement returning one integer
+ *
+ * \param[in] conf plugin's configuration
+ * \param[in] sql SQL statement
+ * \param[in] param value of the first parameter
+ * \param[out] result value of the first column
+ * \return 0 on success
+ */
+static int uid_query_int(struct plugin_conf *conf, const char *sql, int64_t param, int64_t *result)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(conf->db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(conf->db));
+		return 1;
+	}
+
+	if (sqlite3_bind_parameter_count(stmt) > 0) {
+		sqlite3_bind_int64(stmt, 1, param);
+	}
+
+	int rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW) {
+		*result = sqlite3_column_int64(stmt, 0);
+	} else {
+		MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(conf->db));
+	}
+
+	sqlite3_finalize(stmt);
+	return (rc == SQLITE_ROW) ? 0 : 1;
+}
+
+/**
+ * \brief Load rows added to the database since the last refresh
+ *
+ * Rows are expected to be only appended. When any loaded row disappears,
+ * the whole table is loaded again.
+ *
+ * \param[in] conf plugin's configuration
+ */
+static void uid_refresh(struct plugin_conf *conf)
+{
+	struct uid_table *table;
+	sqlite3_stmt *stmt;
+	int64_t version, rows;
+
+	/* Free memory replaced by previous refreshes */
+	uid_reclaim(conf, 0);
+
+	if (uid_query_int(conf, "PRAGMA data_version", 0, &version) != 0) {
+		return;
+	}
+
+	if (conf->table && version == conf->data_version) {
+		/* Nothing has changed */
+		return;
+	}
+
+	/* All statements see the same snapshot of the database */
+	if (sqlite3_exec(conf->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+		MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(conf->db));
+		return;
+	}
+
+	if (uid_query_int(conf, "SELECT count(*) FROM logs WHERE rowid <= ?", conf->last_rowid, &rows) != 0) {
+		sqlite3_exec(conf->db, "ROLLBACK", NULL, NULL, NULL);
+		return;
+	}
+
+	int reload = (!conf->table || rows != conf->rows);
+	int64_t last_rowid = reload ? 0 : conf->last_rowid;
+	int64_t loaded = reload ? 0 : conf->rows;
+
+	if (reload) {
+		/* Build a new table, nobody can see it until it is complete */
+		table = calloc(1, sizeof(struct uid_table) + UID_TABLE_MIN * sizeof(struct uid_entry));
+		if (!table) {
+			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+			sqlite3_exec(conf->db, "ROLLBACK", NULL, NULL, NULL);
+			return;
+		}
+		table->mask = UID_TABLE_MIN - 1;
+	} else {
+		table = conf->table;
+	}
+
+	struct uid_table **table_ptr = reload ? &table : &conf->table;
+
+	if (sqlite3_prepare_v2(conf->db, "SELECT rowid, name, ip, action, time FROM logs WHERE rowid > ? ORDER BY rowid",
+			-1, &stmt, NULL) != SQLITE_OK) {
+		MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(conf->db));
+		sqlite3_exec(conf->db, "ROLLBACK", NULL, NULL, NULL);
+		if (reload) {
+			uid_table_free(table);
+		}
+		return;
+	}
+	sqlite3_bind_int64(stmt, 1, last_rowid);
+
+	int rc;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const char *name = (const char *) sqlite3_column_text(stmt, 1);
+		const char *ip = (const char *) sqlite3_column_text(stmt, 2);
+		const char *action = (const char *) sqlite3_column_text(stmt, 3);
+		struct uid_event event;
+		uint8_t addr[16] = {0};
+		uint8_t ipv = 0;
+
+		if (!ip) {
+			/* Skip row */
+		} else if (inet_pton(AF_INET, ip, addr) == 1) {
+			ipv = IPv4;
+		} else if (inet_pton(AF_INET6, ip, addr) == 1) {
+			ipv = IPv6;
+		}
+
+		if (ipv) {
+			memset(&event, 0, sizeof(event));
+			event.time = (uint32_t) sqlite3_column_int64(stmt, 4);
+			event.login = (action && strcmp(action, "1") == 0);
+			if (name) {
+				strncpy(event.name, name, 31);
+			}
+
+			if (uid_table_add(conf, table_ptr, addr, ipv, &event) != 0) {
+				break;
+			}
+		}
+
+		last_rowid = sqlite3_column_int64(stmt, 0);
+		loaded++;
+	}
+
+	sqlite3_finalize(stmt);
+	sqlite3_exec(conf->db, "COMMIT", NULL, NULL, NULL);
+
+	if (rc != SQLITE_DONE) {
+		if (rc != SQLITE_ROW) {
+			MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(conf->db));
+		}
+
+		/* Start over next time */
+		if (reload) {
+			uid_table_free(table);
+		} else {
+			conf->data_version = -1;
+			conf->last_rowid = last_rowid;
+			conf->rows = loaded;
+		}
+		return;
+	}
+
+	if (reload) {
+		/* Publish the new table, the old one may still be read by the processing thread */
+		struct uid_table *old = __atomic_exchange_n(&conf->table, table, __ATOMIC_SEQ_CST);
+		if (old) {
+			for (uint32_t i = 0; i <= old->mask; ++i) {
+				if (old->entries[i].events) {
+					uid_retire(conf, old->entries[i].events);
+				}
+			}
+			uid_retire(conf, old);
+		}
+
+		MSG_DEBUG(msg_module, "Loaded %" PRId64 " log rows", loaded);
+	}
+
+	conf->data_version = version;
+	conf->last_rowid = last_rowid;
+	conf->rows = loaded;
+}
+
+/**
+ * \brief Refresh thread, periodically loads new rows from the database
+ *
+ * \param[in] arg plugin's configuration
+ * \return NULL
+ */
+static void *uid_refresh_thread(void *arg)
+{
+	struct plugin_conf *conf = (struct plugin_conf *) arg;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&conf->lock);
+	while (!conf->stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += conf->refresh;
+		pthread_cond_timedwait(&conf->cond, &conf->lock, &deadline);
+		if (conf->stop) {
+			break;
+		}
+
+		pthread_mutex_unlock(&conf->lock);
+		uid_refresh(conf);
+		pthread_mutex_lock(&conf->lock);
+	}
+	pthread_mutex_unlock(&conf->lock);
+
+	return NULL;
+}
+
 /**
  * \brief Plugin initialization
  * 
@@ -166,6 +713,7 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
 		return 1;
 	}
+	conf->refresh = UID_REFRESH_DEFAULT;
 	
 	/* Process configuration */
 	if (process_startup_xml(conf, params) != 0) {
@@ -179,6 +727,24 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 		uid_free_config(conf);
 		return 1;
 	}
+
+	/* Set a 10ms busy timeout */
+	sqlite3_busy_timeout(conf->db, 10);
+
+	/* Load the table before the first message arrives */
+	uid_refresh(conf);
+
+	/* Start refresh thread */
+	pthread_mutex_init(&conf->lock, NULL);
+	pthread_cond_init(&conf->cond, NULL);
+	if (pthread_create(&conf->thread, NULL, uid_refresh_thread, conf) != 0) {
+		MSG_ERROR(msg_module, "Unable to create refresh thread");
+		pthread_cond_destroy(&conf->cond);
+		pthread_mutex_destroy(&conf->lock);
+		uid_free_config(conf);
+		return 1;
+	}
+	conf->thread_running = 1;
 	
 	/* Save configuration */
 	conf->ip_config = ip_config;
@@ -188,68 +754,20 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 	return 0;
 }
 
-/**
- * \brief Callback for each select
- * 
- * \param[in] data Plugin configuration
- * \param[in] argc
- * \param[in] argv DB fields
- * \param[in] azColName
- * \return 0 on success
- */
-static int uid_callback(void *data, int argc, char **argv, char **azColName){
-	/*
-		item                argv[x]:
-		id = 1                  0
-		name = Paul             1
-		ip = 192.168.1.1        2
-		action = 1              3
-		time = 1415204353       4
-	*/
-
-	struct plugin_conf *conf = (struct plugin_conf *) data;
-
-	if (strcmp(argv[3], "1") == 0) {
-		strncpy(conf->name, argv[1], 31);
-	} else {
-		strncpy(conf->name, "", 31);
-	}
-
-	return 0;
-}
-
-/**
- * \brief Convert IPv6 address to expanded form
- * 
- * \param[out] str Expanded address
- * \param[in] addr ipv6 address
- */
-void convertToExpandedIPv6(char *str, const struct in6_addr *addr) {
-	sprintf(str, "%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x",
-			(int)addr->s6_addr[0], (int)addr->s6_addr[1],
-			(int)addr->s6_addr[2], (int)addr->s6_addr[3],
-			(int)addr->s6_addr[4], (int)addr->s6_addr[5],
-			(int)addr->s6_addr[6], (int)addr->s6_addr[7],
-			(int)addr->s6_addr[8], (int)addr->s6_addr[9],
-			(int)addr->s6_addr[10], (int)addr->s6_addr[11],
-			(int)addr->s6_addr[12], (int)addr->s6_addr[13],
-			(int)addr->s6_addr[14], (int)addr->s6_addr[15]);
-}
-
 /**
  * \brief Get user informations for given data record and given address (source or destination)
  * 
- * \param[in] conf plugin's configuration
+ * \param[in] table address table
  * \param[in] mdata data record's metadata
  * \param[in] ipv4_field IPv4 field
  * \param[in] ipv6_field IPv6 alternative
  * \param[in] flow_start Flow start time
- * \return country code
+ * \return name of logged user or empty string
  */
-uint16_t uid_get_user_info(struct plugin_conf *conf, struct metadata *mdata, int ipv4_field, int ipv6_field, uint32_t flow_start)
+const char *uid_get_user_info(const struct uid_table *table, struct metadata *mdata, int ipv4_field, int ipv6_field, uint32_t flow_start)
 {
 	void *data = NULL;
-	conf->name[0] = '\0';
+	uint8_t addr[16] = {0};
 	
 	/* Get address */
 	int ipv = IPv4;
@@ -260,33 +778,18 @@ uint16_t uid_get_user_info(struct plugin_conf *conf, struct metadata *mdata, int
 	}
 	
 	if (!data) {
-		return 0;
-	}
-	
-	char ipStr[INET6_ADDRSTRLEN];
-	
-	/* Get country ID */
-	if (ipv == IPv4) {
-		inet_ntop(AF_INET, data, ipStr, INET_ADDRSTRLEN);
-	} else {
-		convertToExpandedIPv6(ipStr, data);
+		return "";
 	}
-	
-	char sqlQuery[150];
-	snprintf(sqlQuery, 150, "SELECT * from logs WHERE ip == '%s' and time <= %u ORDER BY time DESC LIMIT 1", ipStr, flow_start);
 
-	/* Execute query */
-	char *err = NULL;
-	int rc = sqlite3_exec(conf->db, sqlQuery, uid_callback, (void *) conf, &err);
-	
-	if (rc != SQLITE_OK) {
-		MSG_ERROR(msg_module, "SQL error: %s", err);
-		sqlite3_free(err);
+	memcpy(addr, data, (ipv == IPv4) ? 4 : 16);
+
+	/* Last event before the flow decides */
+	const struct uid_event *event = uid_table_find(table, addr, ipv, flow_start);
+	if (!event || !event->login) {
+		return "";
 	}
-	
-	conf->name[31] = '\0';
-	
-	return 0;
+
+	return event->name;
 }
 
 /**
@@ -300,7 +803,7 @@ uint32_t get_flow_start(struct ipfix_record *record)
 	/* Get time in milliseconds */
 	void *data = data_record_get_field(record->record, record->templ, 0, FLOW_START_MILLISECONDS, NULL);
 	if (data) {
-		return (uint32_t) be64toh(*((uint64_t*) data)) / 1000;
+		return (uint32_t) (be64toh(*((uint64_t*) data)) / 1000);
 	}
 
 	/* Time in milliseconds not found, try seconds */
@@ -326,20 +829,24 @@ int intermediate_process_message(void* config, void* message)
 	struct ipfix_message *msg = (struct ipfix_message *) message;
 	
 	struct metadata *mdata;
+
+	/* Keep the refresh thread from freeing the table while it is used */
+	__atomic_store_n(&conf->active, 1, __ATOMIC_SEQ_CST);
+	const struct uid_table *table = __atomic_load_n(&conf->table, __ATOMIC_SEQ_CST);
 	
 	/* Process each data record */
-	for (int i = 0; i < msg->data_records_count; ++i) {
+	for (int i = 0; table && i < msg->data_records_count; ++i) {
 		mdata = &(msg->metadata[i]);
 
-		uint32_t flowStart = get_flow_start(&(msg->metadata->record));
+		uint32_t flowStart = get_flow_start(&(mdata->record));
 
 		/* Fill user names */
-		uid_get_user_info(conf, mdata, FIELD_IPV4_SRC, FIELD_IPV6_SRC, flowStart);
-		strncpy(mdata->srcName, conf->name, 31);
-		
-		uid_get_user_info(conf, mdata, FIELD_IPV4_DST, FIELD_IPV6_DST, flowStart);
-		strncpy(mdata->dstName, conf->name, 31);
+		strncpy(mdata->srcName, uid_get_user_info(table, mdata, FIELD_IPV4_SRC, FIELD_IPV6_SRC, flowStart), 31);
+		strncpy(mdata->dstName, uid_get_user_info(table, mdata, FIELD_IPV4_DST, FIELD_IPV6_DST, flowStart), 31);
 	}
+
+	__atomic_fetch_add(&conf->epoch, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&conf->active, 0, __ATOMIC_SEQ_CST);
 	
 	/* Pass message to the next plugin/Output Manager */
 	pass_message(conf->ip_config, msg);
@@ -356,6 +863,18 @@ int intermediate_close(void *config)
 {
 	MSG_DEBUG(msg_module, "Closing");
 	struct plugin_conf *conf = (struct plugin_conf *) config;
+
+	/* Stop refresh thread */
+	if (conf->thread_running) {
+		pthread_mutex_lock(&conf->lock);
+		conf->stop = 1;
+		pthread_cond_signal(&conf->cond);
+		pthread_mutex_unlock(&conf->lock);
+
+		pthread_join(conf->thread, NULL);
+		pthread_cond_destroy(&conf->cond);
+		pthread_mutex_destroy(&conf->lock);
+	}
 	
 	/* Release configuration */
 	uid_free_config(conf);
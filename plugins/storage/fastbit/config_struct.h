@@ -50,6 +50,9 @@ extern "C" {
 
 #include "fastbit.h"
 
+class fastbit_writer;
+class fastbit_indexer;
+
 struct fastbit_config {
 	/* Stores information on templates per flow data source (identified by
 	 * exporter IP address and ODID).
@@ -61,9 +64,6 @@ struct fastbit_config {
 	/* Stores elements that should be indexed */
 	std::vector<std::string> *index_en_id;
 
-	/* Directories for index & reorder thread */
-	std::vector<std::string> *dirs;
-
 	/* Specifies time interval for storage directory rotation
 	 * (0 = no time based rotation)
 	 */
@@ -110,12 +110,17 @@ struct fastbit_config {
 	/* size of buffer (number of values)*/
 	int buff_size;
 
-	/* Handler for the index thread */
-	pthread_t index_thread;
+	/* Number of threads writing data to disk */
+	int writer_threads;
+
+	/* Writer of column blocks */
+	fastbit_writer *writer;
+
+	/* Number of threads reordering data and building indexes */
+	int index_threads;
 
-	/* Mutex for index building thread */
-	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-	pthread_cond_t mutex_cond = PTHREAD_COND_INITIALIZER;
+	/* Reorders data and builds indexes of finished windows */
+	fastbit_indexer *indexer;
 };
 
 #endif /* CONFIG_STRUCT_H_ */
@@ -64,10 +64,10 @@ extern "C" {
 #include "fastbit.h"
 #include "fastbit_table.h"
 #include "fastbit_element.h"
+#include "fastbit_writer.h"
+#include "fastbit_indexer.h"
 #include "config_struct.h"
 
-volatile bool terminate = false;
-
 void ipv6_addr_non_canonical(char *str, const struct in6_addr *addr)
 {
 	sprintf(str, "%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
@@ -131,71 +131,6 @@ int get_len_from_type(ELEMENT_TYPE type)
     return len;
 }
 
-void *reorder_index(void *config)
-{
-	struct fastbit_config *conf = static_cast<struct fastbit_config*>(config);
-	ibis::table *index_table;
-	std::string dir;
-	ibis::part *reorder_part;
-	ibis::table::stringArray ibis_columns;
-	bool no_dirs = true;
-
-	while (!terminate || !no_dirs) {
-
-		/* Sleep until there is a work to do */
-		pthread_mutex_lock(&conf->mutex);
-		while(!terminate && (*conf->dirs).empty()) {
-			pthread_cond_wait(&conf->mutex_cond, &conf->mutex);
-		}
-
-		/* Nothing to do, start again and check termination flag */
-		if ((*conf->dirs).empty()) {
-			pthread_mutex_unlock(&conf->mutex);
-			no_dirs = true;
-			continue;
-		}
-
-		/* Get the dir to process */
-		no_dirs = false;
-		dir = (*conf->dirs).back();
-		(*conf->dirs).pop_back();
-
-		pthread_mutex_unlock(&conf->mutex);
-
-		/* Reorder partitions */
-		if (conf->reorder) {
-			MSG_DEBUG(msg_module, "Reordering: %s", dir.c_str());
-			reorder_part = new ibis::part(dir.c_str(), NULL, false);
-			reorder_part->reorder(); /* TODO return value */
-			delete reorder_part;
-		}
-
-		/* Build indexes */
-		if (conf->indexes == 1) { /* Build all indexes */
-			MSG_DEBUG(msg_module, "Creating indexes: %s", dir.c_str());
-			index_table = ibis::table::create(dir.c_str());
-			index_table->buildIndexes(NULL);
-			delete index_table;
-		} else if (conf->indexes == 2) { /* Build selected indexes */
-			index_table = ibis::table::create(dir.c_str());
-			ibis_columns = index_table->columnNames();
-			for (unsigned int i = 0; i < conf->index_en_id->size(); i++) {
-				for (unsigned int j = 0; j < ibis_columns.size(); j++) {
-					if ((*conf->index_en_id)[i] == std::string(ibis_columns[j])) {
-						MSG_DEBUG(msg_module, "Creating indexes: %s%s", dir.c_str(), (*conf->index_en_id)[i].c_str());
-						index_table->buildIndex(ibis_columns[j]);
-					}
-				}
-			}
-			delete index_table;
-		}
-
-		ibis::fileManager::instance().flushDir(dir.c_str());
-	}
-
-	return NULL;
-}
-
 std::string generate_path(struct fastbit_config *config, std::string exporter_ip_addr, uint32_t odid)
 {
 	struct tm *timeinfo = localtime(&(config->last_flush));
@@ -260,7 +195,6 @@ void flush_data(struct fastbit_config *conf, std::string exporter_ip_addr, uint3
 
 	std::map<std::string, std::map<uint32_t, od_info>*>::iterator exporter_it;
 	std::map<uint32_t, od_info>::iterator odid_it;
-	std::string flushed_path;
 
 	/* Check whether exporter is listed in data structure */
 	if ((exporter_it = conf->od_infos->find(exporter_ip_addr)) == conf->od_infos->end()) {
@@ -276,28 +210,22 @@ void flush_data(struct fastbit_config *conf, std::string exporter_ip_addr, uint3
 
 	std::string path = odid_it->second.path;
 
-	pthread_mutex_lock(&conf->mutex);;
-	{
-		MSG_DEBUG(msg_module, "Flushing data to disk (exporter: %s, ODID: %u)",
-				odid_it->second.exporter_ip_addr.c_str(), odid);
-		MSG_DEBUG(msg_module, "    > Exported: %u", odid_it->second.flow_watch.exported_flows());
-		MSG_DEBUG(msg_module, "    > Received: %u", odid_it->second.flow_watch.received_flows());
+	MSG_DEBUG(msg_module, "Flushing data to disk (exporter: %s, ODID: %u)",
+			odid_it->second.exporter_ip_addr.c_str(), odid);
+	MSG_DEBUG(msg_module, "    > Exported: %u", odid_it->second.flow_watch.exported_flows());
+	MSG_DEBUG(msg_module, "    > Received: %u", odid_it->second.flow_watch.received_flows());
 
-		for (table = templates->begin(); table != templates->end(); table++) {
-			if ((*table).second->flush(path, flushed_path) == 0) {
-				conf->dirs->push_back(flushed_path);
-			}
-			(*table).second->reset_rows();
-		}
-
-		if (odid_it->second.flow_watch.write(path) == -1) {
-			MSG_ERROR(msg_module, "Unable to write flow statistics: %s", path.c_str());
-		}
+	/* Directories are passed to the index threads by the writer once written */
+	for (table = templates->begin(); table != templates->end(); table++) {
+		(*table).second->flush(path);
+		(*table).second->reset_rows();
+	}
 
-		odid_it->second.flow_watch.reset_state();
+	if (odid_it->second.flow_watch.write(path) == -1) {
+		MSG_ERROR(msg_module, "Unable to write flow statistics: %s", path.c_str());
 	}
-	pthread_mutex_unlock(&conf->mutex);
-	pthread_cond_signal(&conf->mutex_cond);
+
+	odid_it->second.flow_watch.reset_state();
 }
 
 /**
@@ -352,6 +280,16 @@ int process_startup_xml(char *params, struct fastbit_config *c)
 		c->use_template_field_lengths =
 				(!ie.node().child("useTemplateFieldLengths") || template_field_lengths == "yes");
 
+		c->writer_threads = atoi(ie.node().child_value("writerThreads"));
+		if (c->writer_threads <= 0) {
+			c->writer_threads = 1;
+		}
+
+		c->index_threads = atoi(ie.node().child_value("indexThreads"));
+		if (c->index_threads <= 0) {
+			c->index_threads = 1;
+		}
+
 		pugi::xpath_node_set index_e = doc.select_nodes("fileWriter/indexes/element");
 		for (pugi::xpath_node_set::const_iterator it = index_e.begin(); it != index_e.end(); ++it) {
 			pugi::xpath_node node = *it;
@@ -464,12 +402,6 @@ int storage_init(char *params, void **config)
 		return 1;
 	}
 
-	c->dirs = new std::vector<std::string>;
-	if (c->dirs == NULL) {
-		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-		return 1;
-	}
-
 	/* Parse configuration xml and updated configure structure according to it */
 	if (process_startup_xml(params, c)) {
 		MSG_ERROR(msg_module, "Unable to parse plugin configuration");
@@ -479,9 +411,16 @@ int storage_init(char *params, void **config)
 	/* On startup we expect to write to new directory */
 	c->new_dir = true;
 
-	/* Create index thread */
-	if (pthread_create(&c->index_thread, NULL, reorder_index, c) != 0) {
-		MSG_ERROR(msg_module, "pthread_create");
+	/* Create writer threads */
+	c->writer = new fastbit_writer(c);
+	if (c->writer->start(c->writer_threads) != 0) {
+		MSG_WARNING(msg_module, "Data will be written by the storage thread");
+	}
+
+	/* Create index threads */
+	c->indexer = new fastbit_indexer(c);
+	if ((c->reorder || c->indexes) && c->indexer->start(c->index_threads) != 0) {
+		MSG_ERROR(msg_module, "Stored data will not be reordered and indexed");
 	}
 
 	return 0;
@@ -617,6 +556,8 @@ int store_packet(void *config, const struct ipfix_message *ipfix_msg,
 		if (flush_records || flush_time) {
 			/* Flush data for all exporters and ODIDs */
 			flush_all_data(conf);
+			conf->writer->report();
+			conf->indexer->report();
 
 			/* Time management differs between flush policies (records vs. time) */
 			if (flush_records) {
@@ -692,20 +633,19 @@ int storage_close(void **config)
 		delete (*exporter_it).second;
 	}
 
-	/* Tell index thread to terminate */
-	terminate = true;
-	pthread_cond_signal(&conf->mutex_cond);
+	/* Write remaining data */
+	conf->writer->stop();
+	delete conf->writer;
 
-	MSG_INFO(msg_module, "Waiting for the index thread to finish");
-	if (pthread_join(conf->index_thread, NULL) != 0) {
-		MSG_ERROR(msg_module, "pthread_join");
-	}
-	MSG_INFO(msg_module, "Index thread finished");
+	/* Let index threads finish queued directories */
+	MSG_INFO(msg_module, "Waiting for the index threads to finish");
+	conf->indexer->stop();
+	delete conf->indexer;
+	MSG_INFO(msg_module, "Index threads finished");
 
 	/* Free config structure */
 	delete od_infos;
 	delete conf->index_en_id;
-	delete conf->dirs;
 	delete conf;
 	return 0;
 }
@@ -42,10 +42,68 @@ extern "C" {
 }
 
 #include <endian.h>
+#include <algorithm>
 
 #include "fastbit_element.h"
 #include "fastbit_table.h"
 
+/**
+ * \brief Decode big-endian unsigned values of one column
+ *
+ * Values are read from fixed-length records and stored to \p dst, which
+ * may be narrower or wider than the values in records.
+ *
+ * @param dst destination buffer
+ * @param src pointer to the value in the first record
+ * @param stride length of the records
+ * @param count number of records
+ * @param src_size size of the value in records (1 - 8)
+ */
+template <typename T>
+static void decode_column(T *dst, const uint8_t *src, uint16_t stride, uint32_t count, int src_size)
+{
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+	uint32_t i;
+
+	switch (src_size) {
+	case 1:
+		for (i = 0; i < count; i++, src += stride) {
+			dst[i] = src[0];
+		}
+		break;
+	case 2:
+		for (i = 0; i < count; i++, src += stride) {
+			memcpy(&v16, src, sizeof(v16));
+			dst[i] = (T) ntohs(v16);
+		}
+		break;
+	case 4:
+		for (i = 0; i < count; i++, src += stride) {
+			memcpy(&v32, src, sizeof(v32));
+			dst[i] = (T) ntohl(v32);
+		}
+		break;
+	case 8:
+		for (i = 0; i < count; i++, src += stride) {
+			memcpy(&v64, src, sizeof(v64));
+			dst[i] = (T) be64toh(v64);
+		}
+		break;
+	default:
+		/* Sizes 3, 5, 6 and 7 */
+		for (i = 0; i < count; i++, src += stride) {
+			v64 = 0;
+			for (int j = 0; j < src_size; j++) {
+				v64 = (v64 << 8) | src[j];
+			}
+			dst[i] = (T) v64;
+		}
+		break;
+	}
+}
+
 void element::byte_reorder(uint8_t *dst, uint8_t *src, int srcSize, int dstSize)
 {
 	(void) dstSize;
@@ -93,35 +151,32 @@ int element::append(void *data)
 	return 0;
 }
 
-int element::flush(std::string path)
+void element::fill_column(uint8_t *data, uint16_t stride, uint32_t count)
 {
-	FILE *f;
-	size_t check;
-	if (_filled > 0) {
-		f = fopen((path + "/" + _name).c_str(), "a+");
-		if (f == NULL) {
-			MSG_ERROR(msg_module, "Error while writing data (fopen)");
-			return 1;
-		}
+	for (uint32_t i = 0; i < count; i++) {
+		fill(data);
+		data += stride;
+	}
+}
 
-		if (_buffer == NULL) {
-			MSG_ERROR(msg_module, "Error while writing data (buffer)");
-			fclose(f);
-			return 1;
-		}
+void element::swap_block(column_block *block)
+{
+	char *buffer = block->buffer;
+	uint32_t buf_max = block->buf_max;
 
-		check = fwrite(_buffer, size(), _filled, f);
-		if (check != (size_t) _filled) {
-			MSG_ERROR(msg_module, "Error while writing data (fwrite)");
-			fclose(f);
-			return 1;
-		}
+	/* Hand the filled buffer over to the writer */
+	block->buffer = _buffer;
+	block->buf_max = _buf_max;
+	block->size = (size_t) size() * _filled;
 
-		_filled = 0;
-		fclose(f);
+	/* Continue with the buffer written by the previous flush */
+	_filled = 0;
+	_buffer = buffer;
+	if (_buffer == NULL) {
+		allocate_buffer(_buf_max);
+	} else {
+		_buf_max = buf_max;
 	}
-
-	return 0;
 }
 
 std::string element::get_part_info()
@@ -210,6 +265,26 @@ uint16_t el_float::fill(uint8_t *data)
 	return _size;
 }
 
+void el_float::fill_column(uint8_t *data, uint16_t stride, uint32_t count)
+{
+	count = std::min(count, _buf_max - _filled);
+
+	/* Floats are decoded as integers of the same size */
+	switch (_size) {
+	case 4:
+		decode_column((uint32_t *) _buffer + _filled, data, stride, count, _size);
+		break;
+	case 8:
+		decode_column((uint64_t *) _buffer + _filled, data, stride, count, _size);
+		break;
+	default:
+		element::fill_column(data, stride, count);
+		return;
+	}
+
+	_filled += count;
+}
+
 int el_float::set_type()
 {
 	switch (_size) {
@@ -325,54 +400,37 @@ uint16_t el_text::fill(uint8_t *data)
 	return _true_size + _offset;
 }
 
-int el_text::flush(std::string path)
+void el_text::swap_block(column_block *block)
 {
-	FILE *f;
-	size_t check;
-
-	/* Flush sp buffer */
-	if (_config->create_sp_files && _filled > 0 && _sp_buffer != NULL) {
-		f = fopen((path + "/" + _name + ".sp").c_str(), "a+");
-		if (f == NULL) {
-			MSG_ERROR(msg_module, "Error while writing data (fopen)");
-			return 1;
-		}
+	char *sp_buffer = block->sp_buffer;
+	uint32_t sp_size = block->sp_size;
 
-		/* Get file offset */
-		struct stat stat_buf;
-		int rc = stat((path + "/" + _name).c_str(), &stat_buf);
-
-		/* Adjust the _sp_buffer values */
-		if (rc == 0 && stat_buf.st_size != 0) {
-			uint64_t file_offset = stat_buf.st_size;
+	/* Hand over the sp buffer only together with some data */
+	if (_filled > 0 && _sp_buffer != NULL) {
+		block->sp_buffer = _sp_buffer;
+		block->sp_size = _sp_buffer_size;
+		block->sp_offset = _sp_buffer_offset;
 
-			/* We will ignore the first zero offset. The .sp file aready contains offset
-			 * pointing just after the file */
-			for (uint32_t i = 8; i < _sp_buffer_offset; i+=8) {
-				*(uint64_t *) (_sp_buffer + i-8) = (*(uint64_t *) (_sp_buffer + i)) + file_offset;
+		_sp_buffer = sp_buffer;
+		if (_sp_buffer == NULL) {
+			_sp_buffer = (char *) malloc(_sp_buffer_size);
+			if (_sp_buffer == NULL) {
+				MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+				exit(-1);
 			}
-			_sp_buffer_offset -= 8;
-		}
-
-		check = fwrite(_sp_buffer, 1 , _sp_buffer_offset, f);
-		if (check != (size_t) _sp_buffer_offset) {
-			MSG_ERROR(msg_module, "Error while writing data (fwrite)");
-			fclose(f);
-			return 1;
+		} else {
+			_sp_buffer_size = sp_size;
 		}
 
-		/* Close the file */
-		fclose(f);
-
 		/* Reset buffer */
 		_sp_buffer_offset = 8;
 		*(uint64_t *) _sp_buffer = 0;
+	} else {
+		block->sp_offset = 0;
 	}
 
-	/* Call parent function to write the data buffer */
-	element::flush(path);
-
-	return 0;
+	/* Call parent function to hand over the data buffer */
+	element::swap_block(block);
 }
 
 el_text::~el_text()
@@ -408,6 +466,13 @@ uint16_t el_ipv6::fill(uint8_t *data)
 	return _size;
 }
 
+void el_ipv6::fill_column(uint8_t *data, uint16_t stride, uint32_t count)
+{
+	count = std::min(count, _buf_max - _filled);
+	decode_column((uint64_t *) _buffer + _filled, data, stride, count, _size);
+	_filled += count;
+}
+
 int el_ipv6::set_type()
 {
 	/* ulong */
@@ -503,53 +568,37 @@ uint16_t el_blob::fill(uint8_t *data)
 	return _true_size  + _offset;
 }
 
-int el_blob::flush(std::string path)
+void el_blob::swap_block(column_block *block)
 {
-	FILE *f;
-	size_t check;
-	
-	if (_filled > 0 && _sp_buffer != NULL) {
-		f = fopen((path + "/" + _name + ".sp").c_str(), "a+");
-		if (f == NULL) {
-			MSG_ERROR(msg_module, "Error while writing data (fopen)");
-			return 1;
-		}
+	char *sp_buffer = block->sp_buffer;
+	uint32_t sp_size = block->sp_size;
 
-		/* Get file offset */
-		struct stat stat_buf;
-		int rc = stat((path + "/" + _name).c_str(), &stat_buf);
-
-		/* Adjust the _sp_buffer values */
-		if (rc == 0 && stat_buf.st_size != 0) {
-			uint64_t file_offset = stat_buf.st_size;
+	/* Hand over the sp buffer only together with some data */
+	if (_filled > 0 && _sp_buffer != NULL) {
+		block->sp_buffer = _sp_buffer;
+		block->sp_size = _sp_buffer_size;
+		block->sp_offset = _sp_buffer_offset;
 
-			/* We will ignore the first zero offset. The .sp file aready contains offset
-			 * pointing just after the file */
-			for (uint32_t i = 8; i < _sp_buffer_offset; i+=8) {
-				*(uint64_t *) (_sp_buffer + i-8) = (*(uint64_t *) (_sp_buffer + i)) + file_offset;
+		_sp_buffer = sp_buffer;
+		if (_sp_buffer == NULL) {
+			_sp_buffer = (char *) malloc(_sp_buffer_size);
+			if (_sp_buffer == NULL) {
+				MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+				exit(-1);
 			}
-			_sp_buffer_offset -= 8;
-		}
-
-		check = fwrite(_sp_buffer, 1 , _sp_buffer_offset, f);
-		if (check != (size_t) _sp_buffer_offset) {
-			MSG_ERROR(msg_module, "Error while writing data (fwrite)");
-			fclose(f);
-			return 1;
+		} else {
+			_sp_buffer_size = sp_size;
 		}
 
-		/* Close the file */
-		fclose(f);
-
 		/* Reset buffer */
 		_sp_buffer_offset = 8;
 		*(uint64_t *) _sp_buffer = 0;
+	} else {
+		block->sp_offset = 0;
 	}
 
-	/* Call parent function to write the data buffer */
-	element::flush(path);
-
-	return 0;
+	/* Call parent function to hand over the data buffer */
+	element::swap_block(block);
 }
 
 el_blob::~el_blob()
@@ -620,6 +669,37 @@ uint16_t el_uint::fill(uint8_t *data) {
 	return _real_size;
 }
 
+void el_uint::fill_column(uint8_t *data, uint16_t stride, uint32_t count)
+{
+	if (_real_size < 1 || _real_size > 8) {
+		element::fill_column(data, stride, count);
+		return;
+	}
+
+	count = std::min(count, _buf_max - _filled);
+
+	/* Storage size may differ from the size in template */
+	switch (_size) {
+	case 1:
+		decode_column((uint8_t *) _buffer + _filled, data, stride, count, _real_size);
+		break;
+	case 2:
+		decode_column((uint16_t *) _buffer + _filled, data, stride, count, _real_size);
+		break;
+	case 4:
+		decode_column((uint32_t *) _buffer + _filled, data, stride, count, _real_size);
+		break;
+	case 8:
+		decode_column((uint64_t *) _buffer + _filled, data, stride, count, _real_size);
+		break;
+	default:
+		element::fill_column(data, stride, count);
+		return;
+	}
+
+	_filled += count;
+}
+
 int el_uint::set_type()
 {
 	int target_size;
@@ -743,10 +823,9 @@ int el_unknown::append(void *data)
 	return 0;
 }
 
-int el_unknown::flush(std::string path)
+void el_unknown::swap_block(column_block *block)
 {
-	(void) path;
-	return 0;
+	block->size = 0;
 }
 
 uint16_t el_unknown::fill(uint8_t *data)
@@ -55,6 +55,7 @@ extern "C" {
 #include <fastbit/ibis.h>
 
 #include "fastbit.h"
+#include "fastbit_writer.h"
 #include "config_struct.h"
 
 #define NFv9_CONVERSION_ENTERPRISE_NUMBER (~((uint32_t) 0))
@@ -151,12 +152,26 @@ public:
 	virtual uint16_t fill(uint8_t *data) = 0;
 
 	/**
-	 * \brief Flush buffer content to file
+	 * \brief Fill values of one column of fixed-length data records
 	 *
-	 * @param path of the file to write to
-	 * @return 0 on success, 1 otherwise
+	 * Decodes the element from \p count records at once. Default implementation
+	 * calls fill() for each record.
+	 *
+	 * @param data pointer to the element in the first record
+	 * @param stride length of the data records
+	 * @param count number of records
+	 */
+	virtual void fill_column(uint8_t *data, uint16_t stride, uint32_t count);
+
+	/**
+	 * \brief Hand buffer content over to the writer
+	 *
+	 * The filled buffer is swapped with the buffer of the block, which
+	 * was written by the previous flush. The element continues with an empty buffer.
+	 *
+	 * @param block Column block of the element; must not be in use by the writer
 	 */
-	virtual int flush(std::string path);
+	virtual void swap_block(column_block *block);
 
 	/**
 	 * \brief Return string with par information for -part.txt FastBit file
@@ -222,6 +237,7 @@ public:
 	 * @return 1 on failure
 	 */
 	virtual uint16_t fill(uint8_t *data);
+	virtual void fill_column(uint8_t *data, uint16_t stride, uint32_t count);
 
 protected:
 	int set_type();
@@ -245,13 +261,12 @@ public:
 	virtual ~el_text();
 
 	/**
-	 * \brief Overloaded flush function to write the sp buffer.
-	 * Calls parent funtion flush
+	 * \brief Overloaded swap_block function to hand over the sp buffer.
+	 * Calls parent function swap_block
 	 *
-	 * @param path to write the file to
-	 * @return 0 on success, 1 otherwise
+	 * @param block Column block of the element
 	 */
-	virtual int flush(std::string path);
+	virtual void swap_block(column_block *block);
 
 protected:
 	int set_type() {
@@ -287,6 +302,7 @@ public:
 	 * @return 1 on failure
 	 */
 	virtual uint16_t fill(uint8_t *data);
+	virtual void fill_column(uint8_t *data, uint16_t stride, uint32_t count);
 
 protected:
 	int set_type();
@@ -302,14 +318,13 @@ public:
 	virtual ~el_blob();
 
 	/**
-	 * \brief Overloaded flush function to write the sp buffer
+	 * \brief Overloaded swap_block function to hand over the sp buffer
 	 *
-	 * Calls parent funtion flush
+	 * Calls parent function swap_block
 	 *
-	 * @param path to write the file to
-	 * @return 0 on success, 1 otherwise
+	 * @param block Column block of the element
 	 */
-	virtual int flush(std::string path);
+	virtual void swap_block(column_block *block);
 
 protected:
 	bool _var_size;
@@ -352,6 +367,7 @@ public:
 	 * @return 1 on failure
 	 */
 	virtual uint16_t fill(uint8_t *data);
+	virtual void fill_column(uint8_t *data, uint16_t stride, uint32_t count);
 
 protected:
 	uint_u uint_value;
@@ -399,12 +415,11 @@ public:
 	virtual uint16_t fill(uint8_t *data);
 
 	/**
-	 * \brief Flush buffer content to file
+	 * \brief Unknown elements store no data; the block stays empty
 	 *
-	 * @param path of the file to write to
-	 * @return 0 on success, 1 otherwise
+	 * @param block Column block of the element
 	 */
-	virtual int flush(std::string path);
+	virtual void swap_block(column_block *block);
 
 	/**
 	 * \brief Return string with par information for -part.txt FastBit file
@@ -0,0 +1,293 @@
+/**
+ * \file fastbit_indexer.cpp
+ * \brief Pool of threads reordering stored data and building indexes
+ *
+ * Copyright (C) 2015 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+extern "C" {
+#include <ipfixcol/verbose.h>
+#include <inttypes.h>
+}
+
+#include <algorithm>
+
+#include <fastbit/ibis.h>
+
+#include "fastbit.h"
+#include "fastbit_indexer.h"
+#include "config_struct.h"
+
+/**
+ * \brief Seconds elapsed since the given time
+ */
+static double elapsed(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+fastbit_indexer::fastbit_indexer(struct fastbit_config *config): _config(config), _terminate(false),
+	_done(0), _columns(0), _delay(0), _max_delay(0)
+{
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_cond, NULL);
+}
+
+fastbit_indexer::~fastbit_indexer()
+{
+	for (index_dir *dir : _dirs) {
+		delete dir->table;
+		delete dir;
+	}
+
+	pthread_mutex_destroy(&_mutex);
+	pthread_cond_destroy(&_cond);
+}
+
+int fastbit_indexer::start(int count)
+{
+	pthread_t thread;
+
+	for (int i = 0; i < count; i++) {
+		if (pthread_create(&thread, NULL, thread_main, this) != 0) {
+			MSG_ERROR(msg_module, "Unable to create index thread");
+			return _threads.empty() ? 1 : 0;
+		}
+
+		_threads.push_back(thread);
+	}
+
+	return 0;
+}
+
+void fastbit_indexer::stop()
+{
+	pthread_mutex_lock(&_mutex);
+	_terminate = true;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_mutex);
+
+	for (pthread_t thread : _threads) {
+		pthread_join(thread, NULL);
+	}
+
+	_threads.clear();
+}
+
+void fastbit_indexer::add(const std::string &path)
+{
+	index_dir *dir;
+
+	pthread_mutex_lock(&_mutex);
+	if (_threads.empty()) {
+		/* Nothing to do with stored data */
+		pthread_mutex_unlock(&_mutex);
+		return;
+	}
+
+	/* Process directories of the most recent window first */
+	dir = new index_dir(path);
+	clock_gettime(CLOCK_MONOTONIC, &dir->queued);
+	_dirs.push_front(dir);
+
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_mutex);
+}
+
+ibis::table *fastbit_indexer::prepare(const std::string &path, std::vector<std::string> &columns)
+{
+	ibis::table *index_table;
+	ibis::table::stringArray ibis_columns;
+
+	/* Reorder partitions */
+	if (_config->reorder) {
+		MSG_DEBUG(msg_module, "Reordering: %s", path.c_str());
+		ibis::part *reorder_part = new ibis::part(path.c_str(), NULL, false);
+		reorder_part->reorder(); /* TODO return value */
+		delete reorder_part;
+	}
+
+	if (!_config->indexes) {
+		return NULL;
+	}
+
+	index_table = ibis::table::create(path.c_str());
+	if (index_table == NULL) {
+		MSG_ERROR(msg_module, "Unable to open '%s' for building indexes", path.c_str());
+		return NULL;
+	}
+
+	/* Select columns to index; all of them or only marked elements */
+	ibis_columns = index_table->columnNames();
+	for (unsigned int i = 0; i < ibis_columns.size(); i++) {
+		if (_config->indexes == 1 || std::find(_config->index_en_id->begin(), _config->index_en_id->end(),
+				std::string(ibis_columns[i])) != _config->index_en_id->end()) {
+			columns.push_back(ibis_columns[i]);
+		}
+	}
+
+	if (columns.empty()) {
+		delete index_table;
+		return NULL;
+	}
+
+	return index_table;
+}
+
+void fastbit_indexer::finish(index_dir *dir)
+{
+	double delay = elapsed(&dir->queued);
+
+	_dirs.remove(dir);
+	_done++;
+	_delay += delay;
+	_max_delay = std::max(_max_delay, delay);
+	pthread_mutex_unlock(&_mutex);
+
+	delete dir->table;
+	ibis::fileManager::instance().flushDir(dir->path.c_str());
+	delete dir;
+
+	pthread_mutex_lock(&_mutex);
+
+	/* Threads waiting for termination need to recheck the queue */
+	pthread_cond_broadcast(&_cond);
+}
+
+void *fastbit_indexer::thread_main(void *arg)
+{
+	fastbit_indexer *indexer = static_cast<fastbit_indexer *>(arg);
+	index_dir *dir;
+	ibis::table *table;
+	std::vector<std::string> columns;
+	std::string column;
+
+	pthread_mutex_lock(&indexer->_mutex);
+	while (true) {
+		/* Find the newest directory with work that is not taken yet */
+		dir = NULL;
+		for (index_dir *d : indexer->_dirs) {
+			if ((d->table == NULL && !d->preparing) || !d->columns.empty()) {
+				dir = d;
+				break;
+			}
+		}
+
+		if (dir == NULL) {
+			if (indexer->_terminate && indexer->_dirs.empty()) {
+				break;
+			}
+
+			pthread_cond_wait(&indexer->_cond, &indexer->_mutex);
+			continue;
+		}
+
+		if (dir->table == NULL) {
+			/* Reorder the directory and find columns to index */
+			dir->preparing = true;
+			pthread_mutex_unlock(&indexer->_mutex);
+
+			columns.clear();
+			table = indexer->prepare(dir->path, columns);
+
+			pthread_mutex_lock(&indexer->_mutex);
+			dir->preparing = false;
+			if (table == NULL) {
+				indexer->finish(dir);
+				continue;
+			}
+
+			dir->table = table;
+			dir->columns.swap(columns);
+
+			/* Columns can be indexed by other threads as well */
+			pthread_cond_broadcast(&indexer->_cond);
+			continue;
+		}
+
+		/* Build index of one column */
+		column = dir->columns.back();
+		dir->columns.pop_back();
+		dir->running++;
+		pthread_mutex_unlock(&indexer->_mutex);
+
+		MSG_DEBUG(msg_module, "Creating indexes: %s%s", dir->path.c_str(), column.c_str());
+		dir->table->buildIndex(column.c_str());
+
+		pthread_mutex_lock(&indexer->_mutex);
+		indexer->_columns++;
+		dir->running--;
+		if (dir->columns.empty() && dir->running == 0) {
+			indexer->finish(dir);
+		}
+	}
+	pthread_mutex_unlock(&indexer->_mutex);
+
+	return NULL;
+}
+
+void fastbit_indexer::report()
+{
+	size_t columns = 0;
+	double oldest = 0;
+
+	pthread_mutex_lock(&_mutex);
+	if (_threads.empty()) {
+		pthread_mutex_unlock(&_mutex);
+		return;
+	}
+
+	for (index_dir *dir : _dirs) {
+		columns += dir->columns.size() + dir->running;
+	}
+
+	if (!_dirs.empty()) {
+		oldest = elapsed(&_dirs.back()->queued);
+	}
+
+	MSG_INFO(msg_module, "Processed %" PRIu64 " directories (%" PRIu64 " indexes) in last window, "
+			"delay avg %.1f s, max %.1f s; %zu directories (%zu indexes) waiting, oldest for %.1f s",
+			_done, _columns, _done ? _delay / _done : 0.0, _max_delay, _dirs.size(), columns, oldest);
+
+	if (_config->time_window > 0 && oldest > _config->time_window) {
+		MSG_WARNING(msg_module, "Indexing is %.0f s behind; consider increasing indexThreads", oldest);
+	}
+
+	_done = _columns = 0;
+	_delay = _max_delay = 0;
+	pthread_mutex_unlock(&_mutex);
+}
@@ -0,0 +1,151 @@
+/**
+ * \file fastbit_indexer.h
+ * \brief Pool of threads reordering stored data and building indexes
+ *
+ * Copyright (C) 2015 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef FASTBIT_INDEXER_H_
+#define FASTBIT_INDEXER_H_
+
+extern "C" {
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+}
+
+#include <list>
+#include <string>
+#include <vector>
+
+namespace ibis {
+	class table;
+}
+
+struct fastbit_config;
+
+/**
+ * \brief Directory (FastBit partition) waiting for reorder and indexes
+ */
+struct index_dir {
+	std::string path;
+	ibis::table *table;               /* Opened table; NULL until prepared */
+	std::vector<std::string> columns; /* Columns still to be indexed */
+	bool preparing;                   /* Reorder and table opening in progress */
+	int running;                      /* Number of columns being indexed */
+	struct timespec queued;           /* Time when the directory was queued */
+
+	index_dir(const std::string &dir): path(dir), table(NULL), preparing(false), running(0) {}
+};
+
+/**
+ * \brief Pool of threads processing directories of finished windows
+ *
+ * Each directory is first reordered (if enabled) and opened by one thread.
+ * Then its columns are indexed in parallel. Directories of the most recent
+ * window are processed first.
+ */
+class fastbit_indexer
+{
+private:
+	struct fastbit_config *_config;
+	std::vector<pthread_t> _threads;
+	std::list<index_dir *> _dirs; /* Newest first */
+	bool _terminate;
+
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond;
+
+	/* Statistics since the last report */
+	uint64_t _done;      /* Processed directories */
+	uint64_t _columns;   /* Indexed columns */
+	double _delay;       /* Sum of times from queueing to finishing directories */
+	double _max_delay;   /* Maximum of times from queueing to finishing directories */
+
+	static void *thread_main(void *indexer);
+
+	/**
+	 * \brief Reorder directory and open it as a table
+	 *
+	 * @param path Directory to prepare
+	 * @param columns Columns to be indexed
+	 * @return opened table or NULL when there is nothing to index
+	 */
+	ibis::table *prepare(const std::string &path, std::vector<std::string> &columns);
+
+	/**
+	 * \brief Remove finished directory from the queue
+	 *
+	 * Must be called with the mutex locked. The mutex is released while
+	 * the table is closed.
+	 *
+	 * @param dir Directory without pending work
+	 */
+	void finish(index_dir *dir);
+
+public:
+	fastbit_indexer(struct fastbit_config *config);
+	~fastbit_indexer();
+
+	/**
+	 * \brief Start index threads
+	 *
+	 * @param count Number of threads
+	 * @return 0 on success, 1 otherwise
+	 */
+	int start(int count);
+
+	/**
+	 * \brief Queue directory of a finished window
+	 *
+	 * @param dir Directory path
+	 */
+	void add(const std::string &dir);
+
+	/**
+	 * \brief Print statistics of the index queue and reset them
+	 *
+	 * Warns when directories wait longer than the time window.
+	 */
+	void report();
+
+	/**
+	 * \brief Process all queued directories and stop index threads
+	 *
+	 * Must be called before the indexer is destroyed.
+	 */
+	void stop();
+};
+
+#endif /* FASTBIT_INDEXER_H_ */
@@ -42,6 +42,7 @@ extern "C" {
 }
 
 #include <vector>
+#include <algorithm>
 
 #include "fastbit_table.h"
 
@@ -77,6 +78,7 @@ template_table::template_table(uint16_t template_id, uint32_t buff_size): _rows_
 	_index = 0;
 	_rows_in_window = 0;
 	_min_record_size = 0;
+	_record_size = 0;
 	_new_dir = true;
 
 	if (buff_size == 0) {
@@ -85,56 +87,25 @@ template_table::template_table(uint16_t template_id, uint32_t buff_size): _rows_
 
 	_buff_size = buff_size;
 	_first_transmission = 0;
+	_writer = NULL;
 }
 
 template_table::~template_table()
 {
-	for (el_it = elements.begin(); el_it != elements.end(); ++el_it) {
-		delete (*el_it);
-	}
-}
-
-int template_table::update_part(std::string path)
-{
-	FILE *f;
-	std::stringstream ss;
-	std::string part;
-	int columns = 0;
-	uint64_t rows_in_part;
-	rows_in_part = get_rows_from_part((path + "/-part.txt").c_str());
-
-	f = fopen((path + "/-part.txt").c_str(), "w");
-	if (f == NULL) {
-		MSG_ERROR(msg_module, "Cannot open file '-part.txt'");
-		return 1;
+	/* Wait until the writer is done with the blocks */
+	if (_writer != NULL) {
+		_writer->wait(&_job);
+		_writer->close_files(&_job);
 	}
 
-	/* Count only real elements, not unknown
-	 * Unknown elements have empty name */
-	for (element *el : elements) {
-		if (strlen(el->getName()) != 0) {
-			columns++;
-		}
+	for (column_block &block : _job.blocks) {
+		free(block.buffer);
+		free(block.sp_buffer);
 	}
 
-	/* Insert header */
-	ss << "BEGIN HEADER\n";
-	ss << "Name=" << std::string(this->_name) << "\n";
-	ss << "Description=Generated by FastBit plugin for IPFIXcol\n";
-	ss << "Number_of_rows=" << _rows_in_window + rows_in_part << "\n";
-	ss << "Number_of_columns=" << columns << "\n";
-	ss << "Timestamp=" << time(NULL) << "\n";
-	ss << "END HEADER\n";
-
-	/* Insert row info */
 	for (el_it = elements.begin(); el_it != elements.end(); ++el_it) {
-		ss << (*el_it)->get_part_info();
+		delete (*el_it);
 	}
-
-	part = ss.str();
-	fputs(part.c_str(), f);
-	fclose(f);
-	return 0;
 }
 
 int template_table::dir_check(std::string path, bool new_dir)
@@ -228,6 +199,16 @@ int template_table::store(ipfix_data_set *data_set, std::string path, bool new_d
 	/* Count how many records data_set contains */
 	uint16_t data_size = (ntohs(data_set->header.length) - (sizeof(struct ipfix_set_header)));
 	uint16_t read_data = 0;
+
+	/* Fixed-length records are decoded column by column */
+	if (_record_size > 0) {
+		record_cnt = data_size / _record_size;
+		if (this->store_columns(data, record_cnt, path) != 0) {
+			return -1;
+		}
+
+		return record_cnt;
+	}
 	while (read_data < data_size) {
 		if ((data_size - read_data) < _min_record_size) {
 			break;
@@ -243,50 +224,89 @@ int template_table::store(ipfix_data_set *data_set, std::string path, bool new_d
 
 		_rows_count++;
 		if (_rows_count >= _buff_size) {
-			_rows_in_window += _rows_count;
-
-			if (this->dir_check(path + _name, this->_new_dir) != 0) {
+			if (this->flush_block(path, false) != 0) {
 				return -1;
 			}
-
-			for (el_it = elements.begin(); el_it != elements.end(); ++el_it) {
-				(*el_it)->flush(path + _name);
-			}
-
-			/* Update -part.txt so that the data is ready for processing */
-			this->update_part(path + _name);
-			_rows_count = 0;
-			_rows_in_window = 0;
 		}
 	}
 
 	return record_cnt;
 }
 
-int template_table::flush(std::string path, std::string &flushed_path)
+int template_table::store_columns(uint8_t *data, uint32_t record_cnt, std::string path)
 {
-	/* Check whether there is something to flush */
-	if (_rows_count <= 0) {
-		return -1;
+	uint32_t count;
+
+	while (record_cnt > 0) {
+		/* Fill the buffers at most up to their size */
+		count = std::min<uint64_t>(record_cnt, _buff_size - _rows_count);
+
+		for (size_t i = 0; i < elements.size(); i++) {
+			elements[i]->fill_column(data + _offsets[i], _record_size, count);
+		}
+
+		data += count * _record_size;
+		record_cnt -= count;
+
+		_rows_count += count;
+		if (_rows_count >= _buff_size) {
+			if (this->flush_block(path, false) != 0) {
+				return -1;
+			}
+		}
 	}
 
+	return 0;
+}
+
+int template_table::flush_block(std::string path, bool close)
+{
 	/* Check directory */
 	_rows_in_window += _rows_count;
 	if (this->dir_check(path + _name, this->_new_dir) != 0) {
-		return -2;
+		return -1;
 	}
 
-	/* Flush data */
-	for (el_it = elements.begin(); el_it != elements.end(); ++el_it) {
-		(*el_it)->flush(path + _name);
+	/* Buffers of the previous block are reused, wait until it is written */
+	_writer->wait(&_job);
+
+	for (size_t i = 0; i < elements.size(); i++) {
+		elements[i]->swap_block(&_job.blocks[i]);
 	}
 
-	/* Create/update -part.txt file */
-	this->update_part(path + _name);
+	_job.dir = path + _name;
+	_job.name = _name;
+	_job.rows = _rows_count;
+	_job.close = close;
+	_writer->submit(&_job);
+
 	_rows_count = 0;
 	_rows_in_window = 0;
 
-	flushed_path = path + _name;
+	return 0;
+}
+
+int template_table::flush(std::string path)
+{
+	/* Check whether there is something to flush */
+	if (_rows_count <= 0) {
+		_writer->wait(&_job);
+		if (_job.open_dir.empty()) {
+			return -1;
+		}
+
+		/* Only close files of the window */
+		_job.dir = _job.open_dir;
+		_job.rows = 0;
+		_job.close = true;
+		_writer->submit(&_job);
+		return 0;
+	}
+
+	/* Flush data */
+	if (this->flush_block(path, true) != 0) {
+		return -2;
+	}
 
 	/* Data on disk is consistent; try to go back to original name */
 	if (this->_orig_name[0] != '\0') {
@@ -305,6 +325,8 @@ int template_table::parse_template(struct ipfix_template *tmp, struct fastbit_co
 	int en_offset = 0;
 	template_ie *field;
 	element *new_element;
+	uint32_t offset = 0; /* Offset of the element in fixed-length data records */
+	bool var_length = false;
 
 	/* Is there anything to parse? */
 	if (tmp == NULL) {
@@ -328,6 +350,7 @@ int template_table::parse_template(struct ipfix_template *tmp, struct fastbit_co
 		field = &(tmp->fields[i]);
 		if (field->ie.length == VAR_IE_LENGTH) {
 			_min_record_size += 1;
+			var_length = true;
 		} else {
 			_min_record_size += field->ie.length;
 		}
@@ -379,6 +402,8 @@ int template_table::parse_template(struct ipfix_template *tmp, struct fastbit_co
 
 				new_element = new el_ipv6(config, sizeof(uint64_t), en, id, 0, _buff_size);
 				elements.push_back(new_element);
+				_offsets.push_back(offset);
+				offset += sizeof(uint64_t);
 
 				new_element = new el_ipv6(config, sizeof(uint64_t), en, id, 1, _buff_size);
 				break;
@@ -428,6 +453,33 @@ int template_table::parse_template(struct ipfix_template *tmp, struct fastbit_co
 		}
 
 		elements.push_back(new_element);
+		_offsets.push_back(offset);
+
+		/* The second part of IPv6 address has been already counted */
+		if (field_type == ET_IPV6_ADDRESS && field->ie.length == 16) {
+			offset += sizeof(uint64_t);
+		} else {
+			offset += field->ie.length;
+		}
+	}
+
+	/* Records of templates without variable-length fields can be decoded by columns */
+	if (!var_length && offset > 0 && offset <= UINT16_MAX) {
+		_record_size = offset;
+	}
+
+	/* Prepare blocks for the writer */
+	_writer = config->writer;
+	_job.blocks.resize(elements.size());
+	for (size_t j = 0; j < elements.size(); j++) {
+		_job.blocks[j].name = elements[j]->getName();
+		_job.part_info += elements[j]->get_part_info();
+
+		/* Count only real elements, not unknown
+		 * Unknown elements have empty name */
+		if (strlen(elements[j]->getName()) != 0) {
+			_job.columns++;
+		}
 	}
 
 	return 0;
@@ -57,6 +57,7 @@ extern "C" {
 #include <fastbit/ibis.h>
 
 #include "fastbit_element.h"
+#include "fastbit_writer.h"
 
 class element; /* Needed because of circular dependency */
 
@@ -73,11 +74,37 @@ private:
 	uint64_t _rows_count;
 	uint16_t _template_id;
 	uint16_t _min_record_size;
+	uint16_t _record_size; /* Length of data records; 0 when template has variable-length fields */
+	std::vector<uint16_t> _offsets; /* Offsets of elements in fixed-length data records */
 	char _name[10];
 	char _orig_name[10]; /* Saves the _name when renamed due to template collision */
 	bool _new_dir; /* Remember that the directory is supposed to be new */
 	char _index;
 	time_t _first_transmission; /* First transmission of the template. Used to detect changes. */
+	fastbit_writer *_writer; /* Writer of column blocks */
+	flush_job _job; /* Blocks handed over to the writer */
+
+	/**
+	 * \brief Store fixed-length data records column by column
+	 *
+	 * @param data first data record
+	 * @param record_cnt number of data records
+	 * @param path path to direcotry where should be data flushed
+	 * @return 0 on success, negative value otherwise
+	 */
+	int store_columns(uint8_t *data, uint32_t record_cnt, std::string path);
+
+	/**
+	 * \brief Hand buffered rows over to the writer
+	 *
+	 * Waits until the previous block of the table is written, swaps column
+	 * buffers with the job and queues it for writing.
+	 *
+	 * @param path path to directory where should be data flushed
+	 * @param close close the files after writing (end of window)
+	 * @return 0 on success, negative value otherwise
+	 */
+	int flush_block(std::string path, bool close);
 
 public:
 	/* Vector of elements stored in data record (based on template)
@@ -103,8 +130,6 @@ public:
 	 */
 	int store(ipfix_data_set *data_set, std::string path, bool new_dir);
 
-	int update_part(std::string path);
-
 	/**
 	 * \brief Checks whether specified directory exists and creates it if not
 	 *
@@ -126,13 +151,15 @@ public:
 	}
 
 	/**
-	 * \brief Flush data to disk and clean memory
+	 * \brief Flush data to disk at the end of a window
+	 *
+	 * Data is written by the writer in background. Once written, files of the
+	 * window are closed and the directory is passed to the index threads.
 	 *
 	 * @param path path to directory where should be data flushed
-	 * @param flushed_path path to directory where data was actually written
 	 * @return 0 on success, negative value otherwise
 	 */
-	int flush(std::string path, std::string &flushed_path);
+	int flush(std::string path);
 
 	time_t get_first_transmission() {
 		return _first_transmission;
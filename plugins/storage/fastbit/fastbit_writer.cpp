@@ -0,0 +1,513 @@
+/**
+ * \file fastbit_writer.cpp
+ * \brief Background threads writing column blocks to disk
+ *
+ * Copyright (C) 2015 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+extern "C" {
+#include <ipfixcol/verbose.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+}
+
+#include <sstream>
+
+#include "fastbit.h"
+#include "fastbit_writer.h"
+#include "fastbit_indexer.h"
+#include "config_struct.h"
+
+/**
+ * \brief Write whole buffer to file descriptor
+ *
+ * @return 0 on success, 1 otherwise
+ */
+static int write_all(int fd, const char *data, size_t size)
+{
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = write(fd, data, size);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return 1;
+		}
+
+		data += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Open column file for appending
+ *
+ * @param path File path
+ * @param size Current size of the file
+ * @return file descriptor or -1 on error
+ */
+static int open_column(const std::string &path, uint64_t *size)
+{
+	off_t end;
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+	if (fd < 0) {
+		MSG_ERROR(msg_module, "Error while writing data (open '%s': %s)", path.c_str(), strerror(errno));
+		return -1;
+	}
+
+	end = lseek(fd, 0, SEEK_END);
+	*size = (end > 0) ? end : 0;
+
+	return fd;
+}
+
+/**
+ * \brief Check whether the block has offsets for .sp file
+ */
+static inline bool block_has_sp(const column_block &block)
+{
+	return block.sp_buffer != NULL && block.sp_offset > 0;
+}
+
+fastbit_writer::fastbit_writer(struct fastbit_config *config): _config(config), _terminate(false),
+	_open_files(0), _max_open_files(0),
+	_blocks(0), _bytes(0), _waits(0), _blocked_ns(0),
+	_total_blocks(0), _total_bytes(0), _total_waits(0), _total_blocked_ns(0)
+{
+	struct rlimit limit;
+
+	/* Keep at most half of the descriptors open, the rest is left to the collector */
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+		_max_open_files = limit.rlim_cur / 2;
+	} else {
+		_max_open_files = 4096;
+	}
+
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_work_cond, NULL);
+	pthread_cond_init(&_done_cond, NULL);
+}
+
+fastbit_writer::~fastbit_writer()
+{
+	pthread_mutex_destroy(&_mutex);
+	pthread_cond_destroy(&_work_cond);
+	pthread_cond_destroy(&_done_cond);
+}
+
+int fastbit_writer::start(int count)
+{
+	pthread_t thread;
+
+	for (int i = 0; i < count; i++) {
+		if (pthread_create(&thread, NULL, thread_main, this) != 0) {
+			MSG_ERROR(msg_module, "Unable to create writer thread");
+			return _threads.empty() ? 1 : 0;
+		}
+
+		_threads.push_back(thread);
+	}
+
+	return 0;
+}
+
+void fastbit_writer::stop()
+{
+	pthread_mutex_lock(&_mutex);
+	_terminate = true;
+	pthread_cond_broadcast(&_work_cond);
+	pthread_mutex_unlock(&_mutex);
+
+	for (pthread_t thread : _threads) {
+		pthread_join(thread, NULL);
+	}
+
+	_threads.clear();
+
+	/* Write whatever is left without threads */
+	while (!_queue.empty()) {
+		flush_job *job = _queue.front();
+		_queue.pop_front();
+		write_job(job);
+		job->busy = false;
+	}
+
+	MSG_INFO(msg_module, "Written %" PRIu64 " blocks (%" PRIu64 " B) in total; "
+			"storage thread blocked on I/O %" PRIu64 " times for %.3f s",
+			_total_blocks + _blocks, _total_bytes + _bytes, _total_waits + _waits,
+			(_total_blocked_ns + _blocked_ns) / 1e9);
+}
+
+void fastbit_writer::submit(flush_job *job)
+{
+	job->busy = true;
+
+	pthread_mutex_lock(&_mutex);
+	if (_threads.empty()) {
+		/* No writer thread is available; write in the storage thread */
+		pthread_mutex_unlock(&_mutex);
+		write_job(job);
+		job->busy = false;
+		return;
+	}
+
+	_queue.push_back(job);
+	pthread_cond_signal(&_work_cond);
+	pthread_mutex_unlock(&_mutex);
+}
+
+void fastbit_writer::wait(flush_job *job)
+{
+	struct timespec start, end;
+
+	pthread_mutex_lock(&_mutex);
+	if (job->busy) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		while (job->busy) {
+			pthread_cond_wait(&_done_cond, &_mutex);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		_waits++;
+		_blocked_ns += (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+void *fastbit_writer::thread_main(void *arg)
+{
+	fastbit_writer *writer = static_cast<fastbit_writer *>(arg);
+	flush_job *job;
+
+	pthread_mutex_lock(&writer->_mutex);
+	while (true) {
+		while (!writer->_terminate && writer->_queue.empty()) {
+			pthread_cond_wait(&writer->_work_cond, &writer->_mutex);
+		}
+
+		if (writer->_queue.empty()) {
+			break;
+		}
+
+		job = writer->_queue.front();
+		writer->_queue.pop_front();
+		pthread_mutex_unlock(&writer->_mutex);
+
+		writer->write_job(job);
+
+		pthread_mutex_lock(&writer->_mutex);
+		job->busy = false;
+		pthread_cond_broadcast(&writer->_done_cond);
+	}
+	pthread_mutex_unlock(&writer->_mutex);
+
+	return NULL;
+}
+
+void fastbit_writer::release_files(int count)
+{
+	pthread_mutex_lock(&_mutex);
+	_open_files -= count;
+	pthread_mutex_unlock(&_mutex);
+}
+
+void fastbit_writer::close_files(flush_job *job)
+{
+	for (column_block &block : job->blocks) {
+		if (block.fd >= 0) {
+			close(block.fd);
+			block.fd = -1;
+		}
+
+		if (block.sp_fd >= 0) {
+			close(block.sp_fd);
+			block.sp_fd = -1;
+		}
+
+		block.file_size = 0;
+		block.sp_file_size = 0;
+	}
+
+	release_files(job->open_files);
+	job->open_files = 0;
+
+	job->open_dir.clear();
+	job->part_rows = 0;
+}
+
+/**
+ * \brief Open files of all blocks with data
+ *
+ * Files are kept open within the window while the number of open files is
+ * below the limit. Otherwise they are open only for this flush and listed in
+ * \p transient so that the caller closes them.
+ *
+ * @param job Job to write
+ * @param transient Descriptors to close after the flush
+ * @return 0 on success, 1 when some file cannot be opened
+ */
+int fastbit_writer::open_files(flush_job *job, std::vector<int *> &transient)
+{
+	int needed = 0, opened = 0, ret = 0;
+	bool keep;
+
+	for (column_block &block : job->blocks) {
+		if (block.size == 0 || block.name.empty()) {
+			continue;
+		}
+
+		needed += (block.fd < 0) + (block_has_sp(block) && block.sp_fd < 0);
+	}
+
+	if (needed == 0) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&_mutex);
+	keep = (_open_files + needed <= _max_open_files);
+	if (keep) {
+		_open_files += needed;
+	}
+	pthread_mutex_unlock(&_mutex);
+
+	if (keep) {
+		job->open_files += needed;
+	}
+
+	for (column_block &block : job->blocks) {
+		if (ret != 0 || block.size == 0 || block.name.empty()) {
+			continue;
+		}
+
+		if (block.fd < 0) {
+			block.fd = open_column(job->dir + "/" + block.name, &block.file_size);
+			if (block.fd < 0) {
+				ret = 1;
+				continue;
+			}
+
+			opened++;
+			if (!keep) {
+				transient.push_back(&block.fd);
+			}
+		}
+
+		if (block_has_sp(block) && block.sp_fd < 0) {
+			block.sp_fd = open_column(job->dir + "/" + block.name + ".sp", &block.sp_file_size);
+			if (block.sp_fd < 0) {
+				ret = 1;
+				continue;
+			}
+
+			opened++;
+			if (!keep) {
+				transient.push_back(&block.sp_fd);
+			}
+		}
+	}
+
+	/* Files which were not opened are not counted */
+	if (keep && opened < needed) {
+		job->open_files -= needed - opened;
+		release_files(needed - opened);
+	}
+
+	return ret;
+}
+
+void fastbit_writer::write_job(flush_job *job)
+{
+	std::vector<int *> transient;
+	uint64_t bytes = 0;
+	bool failed = false;
+
+	/* Files of the previous directory are not needed anymore */
+	if (!job->open_dir.empty() && job->open_dir != job->dir) {
+		close_files(job);
+	}
+
+	if (job->open_dir.empty() && job->rows > 0) {
+		job->open_dir = job->dir;
+		job->part_rows = get_rows_from_part((job->dir + "/-part.txt").c_str());
+	}
+
+	/* All columns must be written, otherwise the partition would be corrupted */
+	if (open_files(job, transient) != 0) {
+		failed = true;
+	}
+
+	for (column_block &block : job->blocks) {
+		if (failed || block.size == 0 || block.name.empty()) {
+			continue;
+		}
+
+		/* Write .sp file with offsets of items in the column file */
+		if (block_has_sp(block)) {
+			/* The .sp file already contains offset pointing just after the file;
+			 * skip the first zero offset and shift the others */
+			if (block.file_size != 0) {
+				for (uint32_t i = 8; i < block.sp_offset; i += 8) {
+					*(uint64_t *) (block.sp_buffer + i - 8) =
+							(*(uint64_t *) (block.sp_buffer + i)) + block.file_size;
+				}
+				block.sp_offset -= 8;
+			}
+
+			if (write_all(block.sp_fd, block.sp_buffer, block.sp_offset) != 0) {
+				MSG_ERROR(msg_module, "Error while writing data (write): %s", strerror(errno));
+				failed = true;
+				continue;
+			}
+		}
+
+		if (write_all(block.fd, block.buffer, block.size) != 0) {
+			MSG_ERROR(msg_module, "Error while writing data (write): %s", strerror(errno));
+			failed = true;
+		}
+	}
+
+	for (column_block &block : job->blocks) {
+		if (block.size == 0 || block.name.empty()) {
+			continue;
+		}
+
+		if (failed) {
+			/* Remove data of this flush from all columns */
+			if (block.fd >= 0 && ftruncate(block.fd, block.file_size) != 0) {
+				MSG_ERROR(msg_module, "Cannot truncate column '%s': %s", block.name.c_str(), strerror(errno));
+			}
+
+			if (block.sp_fd >= 0 && block_has_sp(block) && ftruncate(block.sp_fd, block.sp_file_size) != 0) {
+				MSG_ERROR(msg_module, "Cannot truncate column '%s.sp': %s", block.name.c_str(), strerror(errno));
+			}
+		} else {
+			block.file_size += block.size;
+			bytes += block.size;
+			if (block_has_sp(block)) {
+				block.sp_file_size += block.sp_offset;
+				bytes += block.sp_offset;
+			}
+		}
+
+		/* Block is done; keep only the buffers */
+		block.size = 0;
+		block.sp_offset = 0;
+	}
+
+	/* Files over the limit are not kept open */
+	for (int *fd : transient) {
+		if (*fd >= 0) {
+			close(*fd);
+			*fd = -1;
+		}
+	}
+
+	if (failed) {
+		MSG_ERROR(msg_module, "Cannot write block of table '%s' to '%s', %" PRIu64 " records dropped",
+				job->name.c_str(), job->dir.c_str(), job->rows);
+	} else if (job->rows > 0) {
+		/* Update -part.txt so that the data is ready for processing */
+		job->part_rows += job->rows;
+		write_part(job);
+	}
+
+	pthread_mutex_lock(&_mutex);
+	_blocks++;
+	_bytes += bytes;
+	pthread_mutex_unlock(&_mutex);
+
+	if (!job->close || job->open_dir.empty()) {
+		return;
+	}
+
+	/* Window is finished; pass the directory to the index threads */
+	std::string dir = job->open_dir;
+	close_files(job);
+
+	_config->indexer->add(dir);
+}
+
+void fastbit_writer::write_part(flush_job *job)
+{
+	FILE *f;
+	std::stringstream ss;
+	std::string part;
+
+	f = fopen((job->dir + "/-part.txt").c_str(), "w");
+	if (f == NULL) {
+		MSG_ERROR(msg_module, "Cannot open file '-part.txt'");
+		return;
+	}
+
+	/* Insert header */
+	ss << "BEGIN HEADER\n";
+	ss << "Name=" << job->name << "\n";
+	ss << "Description=Generated by FastBit plugin for IPFIXcol\n";
+	ss << "Number_of_rows=" << job->part_rows << "\n";
+	ss << "Number_of_columns=" << job->columns << "\n";
+	ss << "Timestamp=" << time(NULL) << "\n";
+	ss << "END HEADER\n";
+
+	/* Insert row info */
+	ss << job->part_info;
+
+	part = ss.str();
+	fputs(part.c_str(), f);
+	fclose(f);
+}
+
+void fastbit_writer::report()
+{
+	pthread_mutex_lock(&_mutex);
+	MSG_INFO(msg_module, "Written %" PRIu64 " blocks (%" PRIu64 " B) in last window; "
+			"storage thread blocked on I/O %" PRIu64 " times for %.3f s",
+			_blocks, _bytes, _waits, _blocked_ns / 1e9);
+
+	_total_blocks += _blocks;
+	_total_bytes += _bytes;
+	_total_waits += _waits;
+	_total_blocked_ns += _blocked_ns;
+	_blocks = _bytes = _waits = _blocked_ns = 0;
+	pthread_mutex_unlock(&_mutex);
+}
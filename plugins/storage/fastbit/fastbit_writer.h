@@ -0,0 +1,187 @@
+/**
+ * \file fastbit_writer.h
+ * \brief Background threads writing column blocks to disk
+ *
+ * Copyright (C) 2015 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef FASTBIT_WRITER_H_
+#define FASTBIT_WRITER_H_
+
+extern "C" {
+#include <pthread.h>
+#include <stdint.h>
+}
+
+#include <deque>
+#include <string>
+#include <vector>
+
+struct fastbit_config;
+
+/**
+ * \brief Column data handed over from an element to the writer
+ *
+ * Buffers are swapped between the element and the block, so that the element
+ * keeps filling one buffer while the other one is being written.
+ */
+struct column_block {
+	std::string name;    /* Column file name (empty for unknown elements) */
+	char *buffer;        /* Column data */
+	uint32_t buf_max;    /* Capacity of the buffer in items of the element */
+	size_t size;         /* Number of bytes to write */
+	char *sp_buffer;     /* Offsets for .sp file (text and blob columns) */
+	uint32_t sp_size;    /* Capacity of sp_buffer in bytes */
+	uint32_t sp_offset;  /* Number of bytes used in sp_buffer */
+	int fd;              /* Column file, kept open within a window */
+	int sp_fd;           /* .sp file, kept open within a window */
+	uint64_t file_size;  /* Size of the column file */
+	uint64_t sp_file_size; /* Size of the .sp file */
+
+	column_block(): buffer(NULL), buf_max(0), size(0), sp_buffer(NULL), sp_size(0),
+		sp_offset(0), fd(-1), sp_fd(-1), file_size(0), sp_file_size(0) {}
+};
+
+/**
+ * \brief Rows of one template table to be written to its directory
+ *
+ * Each table owns one job. The job is either idle (owned by the storage
+ * thread) or busy (queued or being written by a writer thread).
+ */
+struct flush_job {
+	std::string dir;       /* Table directory */
+	std::string name;      /* Table name written to -part.txt */
+	std::string part_info; /* Column descriptions for -part.txt */
+	int columns;           /* Number of columns in -part.txt */
+	uint64_t rows;         /* Number of rows in the blocks */
+	bool close;            /* Last block of the window */
+	bool busy;
+
+	/* One block for each element of the table */
+	std::vector<column_block> blocks;
+
+	/* Directory with open files and number of rows stored there */
+	std::string open_dir;
+	uint64_t part_rows;
+
+	/* Number of files kept open (counted in the limit of the writer) */
+	int open_files;
+
+	flush_job(): columns(0), rows(0), close(false), busy(false), part_rows(0), open_files(0) {}
+};
+
+/**
+ * \brief Pool of threads writing blocks of template tables to disk
+ *
+ * Column files stay open until the last block of a window is written. Then
+ * the files are closed and the directory is passed to the index threads.
+ */
+class fastbit_writer
+{
+private:
+	struct fastbit_config *_config;
+	std::vector<pthread_t> _threads;
+	std::deque<flush_job *> _queue;
+	bool _terminate;
+
+	pthread_mutex_t _mutex;
+	pthread_cond_t _work_cond;
+	pthread_cond_t _done_cond;
+
+	/* Files kept open by all jobs and their limit */
+	int _open_files, _max_open_files;
+
+	/* Statistics of the current window and totals */
+	uint64_t _blocks, _bytes, _waits, _blocked_ns;
+	uint64_t _total_blocks, _total_bytes, _total_waits, _total_blocked_ns;
+
+	static void *thread_main(void *writer);
+	void write_job(flush_job *job);
+	void write_part(flush_job *job);
+	int open_files(flush_job *job, std::vector<int *> &transient);
+	void release_files(int count);
+
+public:
+	fastbit_writer(struct fastbit_config *config);
+	~fastbit_writer();
+
+	/**
+	 * \brief Start writer threads
+	 *
+	 * @param count Number of threads
+	 * @return 0 on success, 1 otherwise
+	 */
+	int start(int count);
+
+	/**
+	 * \brief Queue job for writing
+	 *
+	 * The job must not be busy (see wait()).
+	 *
+	 * @param job Job to write
+	 */
+	void submit(flush_job *job);
+
+	/**
+	 * \brief Wait until the job is written
+	 *
+	 * Time spent waiting is accounted as time blocked on I/O.
+	 *
+	 * @param job Job to wait for
+	 */
+	void wait(flush_job *job);
+
+	/**
+	 * \brief Close files kept open by the job
+	 *
+	 * The job must not be busy.
+	 *
+	 * @param job Job with open files
+	 */
+	void close_files(flush_job *job);
+
+	/**
+	 * \brief Print I/O statistics of the last window and reset them
+	 */
+	void report();
+
+	/**
+	 * \brief Write all queued jobs and stop writer threads
+	 *
+	 * Must be called before the writer is destroyed.
+	 */
+	void stop();
+};
+
+#endif /* FASTBIT_WRITER_H_ */
@@ -41,10 +41,12 @@
 #include <stdexcept>
 #include <string>
 #include <vector>
+#include <algorithm>
 
 #include <cstring>
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -123,10 +125,17 @@ File::File(const pugi::xpath_node &config)
 		}
 	}
 
+	// Prepare a buffer for writing records
+	if (posix_memalign((void **) &_buffer, _BUFFER_ALIGN, _BUFFER_SIZE) != 0) {
+		throw std::runtime_error("Failed to allocate a write buffer.");
+	}
+	_buffer_used = 0;
+
 	// Prepare a configuration of the thread for changing time windows
 	_thread = new thread_ctx_t;
 	_thread->new_file = NULL;
 	_thread->new_file_ready = false;
+	_thread->output = this;
 	_thread->stop = false;
 
 	_thread->storage_path = path;
@@ -145,6 +154,7 @@ File::File(const pugi::xpath_node &config)
 		_thread->window_time);
 	if (!new_file) {
 		delete _thread;
+		free(_buffer);
 		throw std::runtime_error("Failed to create a time window file.");
 	}
 
@@ -153,6 +163,7 @@ File::File(const pugi::xpath_node &config)
 	if (pthread_mutex_init(&_thread->mutex, NULL) != 0) {
 		fclose(_file);
 		delete _thread;
+		free(_buffer);
 		throw std::runtime_error("Mutex initialization failed");
 	}
 
@@ -161,6 +172,7 @@ File::File(const pugi::xpath_node &config)
 		fclose(_file);
 		pthread_mutex_destroy(&_thread->mutex);
 		delete _thread;
+		free(_buffer);
 		throw std::runtime_error("Failed to start a thread for changing time "
 			"windows.");
 	}
@@ -173,10 +185,7 @@ File::File(const pugi::xpath_node &config)
  */
 File::~File()
 {
-	if (_file) {
-		fclose(_file);
-	}
-
+	// Stop the thread first, it flushes the write buffer too
 	if (_thread) {
 		_thread->stop = true;
 		pthread_join(_thread->thread, NULL);
@@ -188,6 +197,13 @@ File::~File()
 
 		delete _thread;
 	}
+
+	if (_file) {
+		buffer_flush();
+		fclose(_file);
+	}
+
+	free(_buffer);
 }
 
 /**
@@ -198,6 +214,7 @@ File::~File()
 void *File::thread_window(void *context)
 {
 	thread_ctx_t *ctx = (thread_ctx_t *) context;
+	unsigned int ticks = 0;
 	MSG_DEBUG(msg_module, "Thread started...");
 
 	while(!ctx->stop) {
@@ -207,6 +224,16 @@ void *File::thread_window(void *context)
 		tim.tv_nsec = 100000000L; // 0.1 sec
 		nanosleep(&tim, NULL);
 
+		// Buffered records should not wait for more than a second
+		if (++ticks % 10 == 0) {
+			File *output = ctx->output;
+			pthread_mutex_lock(&ctx->mutex);
+			if (output->_file) {
+				output->buffer_flush();
+			}
+			pthread_mutex_unlock(&ctx->mutex);
+		}
+
 		// Get current time
 		time_t now;
 		time(&now);
@@ -240,32 +267,68 @@ void *File::thread_window(void *context)
 }
 
 /**
- * \brief Store a record to a file
- * \param[in] record JSON record
+ * \brief Write the content of the buffer to the file
+ */
+void File::buffer_flush()
+{
+	if (_buffer_used == 0) {
+		return;
+	}
+
+	if (fwrite(_buffer, _buffer_used, 1, _file) != 1) {
+		MSG_ERROR(msg_module, "Failed to write records to the file (%s).",
+			strerror(errno));
+	}
+
+	_buffer_used = 0;
+}
+
+/**
+ * \brief Store records to a file
+ *
+ * Records are collected in the buffer and written in large blocks. The window
+ * thread flushes the rest of the buffer every second.
+ * \param[in] batch JSON records
  */
-void File::ProcessDataRecord(const std::string &record)
+void File::ProcessDataBatch(const RecordBatch &batch)
 {
+	pthread_mutex_lock(&_thread->mutex);
+
 	// Should we change a time window
 	if (_thread->new_file_ready) {
 		// Close old time window
 		if (_file) {
+			buffer_flush();
 			fclose(_file);
 		}
 
 		// Get new time window
-		pthread_mutex_lock(&_thread->mutex);
 		_file = _thread->new_file;
 		_thread->new_file = NULL;
 		_thread->new_file_ready = false;
-		pthread_mutex_unlock(&_thread->mutex);
 	}
 
 	if (!_file) {
+		pthread_mutex_unlock(&_thread->mutex);
 		return;
 	}
 
-	// Store the record
-	fwrite(record.c_str(), record.size(), 1, _file);
+	// Store the records
+	const char *data = batch.data;
+	size_t todo = batch.size;
+	while (todo > 0) {
+		size_t len = std::min(todo, _BUFFER_SIZE - _buffer_used);
+		memcpy(_buffer + _buffer_used, data, len);
+		_buffer_used += len;
+		data += len;
+		todo -= len;
+
+		if (_buffer_used == _BUFFER_SIZE) {
+			buffer_flush();
+		}
+	}
+
+	pthread_mutex_unlock(&_thread->mutex);
 }
 
 /**
@@ -413,5 +476,8 @@ FILE *File::file_create(const std::string &tmplt, const std::string &prefix,
 		return NULL;
 	}
 
+	// Records are buffered by the output itself
+	setvbuf(file, NULL, _IONBF, 0);
+
 	return file;
 }
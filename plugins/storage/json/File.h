@@ -43,6 +43,7 @@
 #include "json.h"
 
 #include <string>
+#include <atomic>
 #include <ctime>
 #include <cstdio>
 
@@ -57,8 +58,8 @@ public:
 	File(const pugi::xpath_node &config);
 	~File();
 
-	// Store a record to the file
-	void ProcessDataRecord(const std::string &record);
+	// Store records to the file
+	void ProcessDataBatch(const RecordBatch &batch);
 
 	// Get a directory path for a time window
 	static int dir_name(const time_t &tm, const std::string &tmplt,
@@ -71,12 +72,17 @@ public:
 private:
 	/** Minimal window size */
 	const unsigned int _WINDOW_MIN_SIZE = 60; // seconds
+	/** Size of the write buffer */
+	static const size_t _BUFFER_SIZE = 1024 * 1024;
+	/** Alignment of the write buffer */
+	static const size_t _BUFFER_ALIGN = 4096;
 
 	/** Configuration of a thread */
 	typedef struct thread_ctx_s {
 		pthread_t thread;            /**< Thread                     */
-		pthread_mutex_t mutex;       /**< Data mutex                 */
-		bool stop;                   /**< Stop flag for temination   */
+		pthread_mutex_t mutex;       /**< Data & write buffer mutex  */
+		File *output;                /**< Output with write buffer   */
+		std::atomic<bool> stop;      /**< Stop flag for temination   */
 
 		unsigned int window_size;    /**< Size of a time window      */
 		time_t window_time;          /**< Current time window        */
@@ -89,11 +95,17 @@ private:
 
 	/** File descritor */
 	FILE *_file;
+	/** Write buffer (records are written in blocks of _BUFFER_SIZE) */
+	char *_buffer;
+	/** Number of bytes in the write buffer */
+	size_t _buffer_used;
 	/** Thread for changing time windows */
 	thread_ctx_t *_thread;
 
 	// Window changer
 	static void *thread_window(void *context);
+	// Write the content of the buffer to the file
+	void buffer_flush();
 };
 
 #endif // FILE_H
@@ -3,6 +3,7 @@
 #include <stdexcept>
 #include <sys/time.h>
 #include <unistd.h>
+#include <cstring>
 
 static const char *msg_module = "json kafka";
 
@@ -90,14 +91,66 @@ Kafka::~Kafka()
     MSG_INFO(msg_module, "Kafka plugin finished");
 }
 
-void Kafka::ProcessDataRecord(const std::string &record)
+void Kafka::ProcessDataBatch(const RecordBatch &batch)
 {
-    while (rd_kafka_produce(_rkt, _current_partition++ % _partitions,
-        RD_KAFKA_MSG_F_COPY, (void *) record.c_str(), record.length(),
-        NULL, 0, NULL) != 0) {
+    int flags = RD_KAFKA_MSG_F_COPY;
+    int32_t partition;
+#ifdef RD_KAFKA_MSG_F_PARTITION
+    // each message carries its own partition
+    flags |= RD_KAFKA_MSG_F_PARTITION;
+    partition = RD_KAFKA_PARTITION_UA;
+#else
+    partition = _current_partition++ % _partitions;
+#endif
+
+    _messages.resize(batch.count);
+    size_t start = 0;
+    for (size_t i = 0; i < batch.count; ++i) {
+        rd_kafka_message_t &msg = _messages[i];
+        memset(&msg, 0, sizeof(msg));
+        msg.payload = (void *) (batch.data + start);
+        msg.len = batch.ends[i] - start;
+#ifdef RD_KAFKA_MSG_F_PARTITION
+        msg.partition = _current_partition++ % _partitions;
+#endif
+        start = batch.ends[i];
+    }
+
+    rd_kafka_message_t *todo = _messages.data();
+    int todo_cnt = batch.count;
+    while (todo_cnt > 0) {
+        int done = rd_kafka_produce_batch(_rkt, partition, flags, todo, todo_cnt);
+        if (done == todo_cnt) {
+            break;
+        }
+
+        // keep messages rejected because of the full queue, report the rest
+        int retry_cnt = 0;
+        for (int i = 0; i < todo_cnt; ++i) {
+            switch (todo[i].err) {
+            case RD_KAFKA_RESP_ERR_NO_ERROR:
+                break;
+            case RD_KAFKA_RESP_ERR__QUEUE_FULL:
+                todo[retry_cnt] = todo[i];
+                todo[retry_cnt++].err = RD_KAFKA_RESP_ERR_NO_ERROR;
+                break;
+            case RD_KAFKA_RESP_ERR_MSG_SIZE_TOO_LARGE:
+                MSG_ERROR(msg_module, "Message is larged than configured max size:"
+                    " 'messages.max.bytes'");
+                break;
+            case RD_KAFKA_RESP_ERR__UNKNOWN_PARTITION:
+                throw std::runtime_error("Requested 'partition' is unknown in the "
+                    "Kafka cluster.");
+            case RD_KAFKA_RESP_ERR__UNKNOWN_TOPIC:
+                throw std::runtime_error("Topic is unknown in the Kafka cluster.");
+            default:
+                MSG_ERROR(msg_module, "Unknown error while producing a message to "
+                    "Kafka");
+                break;
+            }
+        }
 
-        switch (errno) {
-        case ENOBUFS:
+        if (retry_cnt > 0) {
             MSG_WARNING(msg_module, "maximum number of outstanding messages"
                 " (%u) has been reached: 'queue.buffering.max.messages'",
                 rd_kafka_outq_len(_rk));
@@ -105,23 +158,9 @@ void Kafka::ProcessDataRecord(const std::string &record)
             // wait a while for the queue to be processed
             usleep(200000);
             rd_kafka_poll(_rk, 0);
-            break;
-        case EMSGSIZE:
-            MSG_ERROR(msg_module, "Message is larged than configured max size:"
-                " 'messages.max.bytes'");
-            return;
-        case ESRCH: 
-            throw std::runtime_error("Requested 'partition' is unknown in the "
-                "Kafka cluster.");
-            break;
-        case ENOENT:
-            throw std::runtime_error("Topic is unknown in the Kafka cluster.");
-            break;
-        default:
-            MSG_ERROR(msg_module, "Unknown error while producing a message to "
-                "Kafka");
-            break;
         }
+
+        todo_cnt = retry_cnt;
     }
 
     rd_kafka_poll(_rk, 0);
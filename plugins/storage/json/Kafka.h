@@ -3,6 +3,7 @@
 
 #include "json.h"
 #include <librdkafka/rdkafka.h>
+#include <vector>
 
 class Kafka : public Output
 {
@@ -10,7 +11,7 @@ public:
     Kafka(const pugi::xpath_node &config);
 
     ~Kafka();
-    void ProcessDataRecord(const std::string& record);
+    void ProcessDataBatch(const RecordBatch &batch);
 
 private:
     std::string _topic;
@@ -18,6 +19,7 @@ private:
     int _current_partition = 0;
     rd_kafka_t *_rk; /* Producer instance handle */
     rd_kafka_topic_t *_rkt; /* Topic object */
+    std::vector<rd_kafka_message_t> _messages; /* Messages of a batch */
 };
 
 #endif // KAFKA_H
@@ -8,7 +8,7 @@ Printer::Printer(const pugi::xpath_node &config)
 	(void) config;
 }
 
-void Printer::ProcessDataRecord(const std::string &record)
+void Printer::ProcessDataBatch(const RecordBatch &batch)
 {
-	std::cout << record;
+	std::cout.write(batch.data, batch.size);
 }
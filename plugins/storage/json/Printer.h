@@ -8,7 +8,7 @@ class Printer : public Output
 public:
 	Printer(const pugi::xpath_node& config);
 
-	void ProcessDataRecord(const std::string& record);
+	void ProcessDataBatch(const RecordBatch &batch);
 };
 
 #endif // PRINTER_H
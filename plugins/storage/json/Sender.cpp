@@ -1,6 +1,7 @@
 #include "Sender.h"
 
 #include <stdexcept>
+#include <strings.h>
 #include <sys/time.h>
 
 static const char *msg_module = "json sender";
@@ -46,6 +47,7 @@ Sender::Sender(const pugi::xpath_node &config)
 		throw std::runtime_error(error);
 	}
 
+	datagram = (strcasecmp(proto.c_str(), "UDP") == 0);
 	gettimeofday(&connection_time, NULL);
 }
 
@@ -54,7 +56,7 @@ Sender::~Sender()
 	siso_destroy(sender);
 }
 
-void Sender::ProcessDataRecord(const std::string &record)
+void Sender::ProcessDataBatch(const RecordBatch &batch)
 {
 	if (siso_is_connected(sender) == 0) {
 		// Not connected -> try to reconnect
@@ -75,8 +77,22 @@ void Sender::ProcessDataRecord(const std::string &record)
 		}
 	}
 
-	if (siso_send(sender, record.c_str(), record.length()) != SISO_OK) {
-		MSG_ERROR(msg_module, "Failed to send JSON data (%s). Connection closed.",
-			siso_get_last_err(sender));
+	if (!datagram) {
+		// Stream protocols -> the whole batch at once
+		if (siso_send(sender, batch.data, batch.size) != SISO_OK) {
+			MSG_ERROR(msg_module, "Failed to send JSON data (%s). Connection closed.",
+				siso_get_last_err(sender));
+		}
+		return;
+	}
+
+	size_t start = 0;
+	for (size_t i = 0; i < batch.count; ++i) {
+		if (siso_send(sender, batch.data + start, batch.ends[i] - start) != SISO_OK) {
+			MSG_ERROR(msg_module, "Failed to send JSON data (%s). Connection closed.",
+				siso_get_last_err(sender));
+			return;
+		}
+		start = batch.ends[i];
 	}
 }
@@ -13,10 +13,11 @@ public:
 	Sender(const pugi::xpath_node &config);
 
 	~Sender();
-	void ProcessDataRecord(const std::string& record);
+	void ProcessDataBatch(const RecordBatch &batch);
 
 private:
 	sisoconf *sender{NULL};
+	bool datagram{false};	/**< Each record is sent in its own datagram */
 	struct timeval connection_time;
 };
 
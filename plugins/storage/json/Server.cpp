@@ -44,6 +44,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/time.h>
 #include <netdb.h>
 #include <arpa/inet.h>
@@ -255,35 +256,41 @@ void *Server::thread_accept(void *context)
 }
 
 /**
- * \brief Send a message to a client
+ * \brief Send data to the client
  *
- * Sends the message to the client using prepared socket. When non-blocking mode
- * is enabled and only part of the message was sent, the rest of the message is
- * stored in the client's profile.
- * \param[in] data The message
- * \param[in] len The length of the message
- * \param[in,out] client Client
- * \return Transmission status
+ * In the non-blocking mode, the transmission stops when the socket is full.
+ * \param[in,out] iov Data to send (modified)
+ * \param[in] iovcnt Number of items in \p iov
+ * \param[in] client Client
+ * \param[out] sent Number of sent bytes
+ * \return #SEND_OK when all data were sent, #SEND_WOULDBLOCK when only
+ *   \p sent bytes were sent, #SEND_FAILED when the client disconnected.
  */
-enum Server::Send_status Server::msg_send(const char *data, ssize_t len,
-	client_t &client)
+enum Server::Send_status Server::msg_send(struct iovec *iov, int iovcnt,
+	client_t &client, size_t &sent)
 {
-	ssize_t now;
-	ssize_t todo = len;
-	const char *ptr = data;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
 
 	int flags = MSG_NOSIGNAL;
 	if (_non_blocking) {
 		flags |= MSG_DONTWAIT;
 	}
 
-	while (todo > 0) {
-		now = send(client.socket, ptr, todo, flags);
+	sent = 0;
+	while (msg.msg_iovlen > 0) {
+		ssize_t now = sendmsg(client.socket, &msg, flags);
 
 		if (now == -1) {
 			if (_non_blocking && (errno == EAGAIN || errno == EWOULDBLOCK)) {
 				// Non-blocking mode
-				break;
+				return SEND_WOULDBLOCK;
+			}
+
+			if (errno == EINTR) {
+				continue;
 			}
 
 			// Connection failed
@@ -292,40 +299,33 @@ enum Server::Send_status Server::msg_send(const char *data, ssize_t len,
 			return SEND_FAILED;
 		}
 
-		ptr  += now;
-		todo -= now;
-	}
+		sent += now;
 
-	if (todo <= 0) {
-		return SEND_OK;
-	}
+		// Skip sent data
+		while (msg.msg_iovlen > 0 && (size_t) now >= msg.msg_iov->iov_len) {
+			now -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
 
-	// Non-blocking mode - (partly) failed to sent the message
-	if (todo == len) {
-		// No part of the message was sent
-		return SEND_WOULDBLOCK;
+		if (msg.msg_iovlen > 0) {
+			msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + now;
+			msg.msg_iov->iov_len -= now;
+		}
 	}
 
-	/*
-	 * Partly sent. Store the rest of the message for the next transmission to
-	 * avoid invalid JSON format. Temporary string should be here, because it is
-	 * possible to "data == rest.c_str()".
-	 */
-	std::string tmp(ptr, todo);
-	client.msg_rest.assign(tmp);
-	return SEND_WOULDBLOCK;
+	return SEND_OK;
 }
 
 /**
- * \brief Send record to all connected clients
+ * \brief Send records to all connected clients
  *
- * \param[in] record Record
+ * Each client gets the rest of the previous batch (if any) and the new batch
+ * in one system call.
+ * \param[in] batch Records
  */
-void Server::ProcessDataRecord(const std::string &record)
+void Server::ProcessDataBatch(const RecordBatch &batch)
 {
-	const char *data = record.c_str();
-	ssize_t length = record.size();
-
 	// Are there new clients?
 	if (_acceptor->new_clients_ready) {
 		pthread_mutex_lock(&_acceptor->mutex);
@@ -338,40 +338,43 @@ void Server::ProcessDataRecord(const std::string &record)
 		pthread_mutex_unlock(&_acceptor->mutex);
 	}
 
-	// Send the message to all clients
+	// Send the batch to all clients
 	std::vector<client_t>::iterator iter = _clients.begin();
 	while (iter != _clients.end()) {
 		client_t &client = *iter;
-		enum Send_status ret_val;
-
-		// Send the rest part of the last partly sent message
-		if (_non_blocking && !client.msg_rest.empty()) {
-			std::string &rest = client.msg_rest;
-
-			ret_val = msg_send(rest.c_str(), rest.size(), client);
-			switch (ret_val) {
-			case SEND_OK:
-				// The rest of the message successfully sent
-				rest.clear();
-				break;
-			case SEND_WOULDBLOCK:
-				// Skip, next client...
-				++iter;
-				continue;
-			case SEND_FAILED:
-				// Close socket and remove client
-				close(client.socket);
-				iter = _clients.erase(iter); // The iterator has new location...
-				continue;
-			}
+		std::string &rest = client.msg_rest;
+		size_t rest_len = rest.size();
+		size_t sent;
+
+		struct iovec iov[2];
+		int iovcnt = 0;
+		if (rest_len > 0) {
+			iov[iovcnt].iov_base = (void *) rest.data();
+			iov[iovcnt++].iov_len = rest_len;
 		}
+		iov[iovcnt].iov_base = (void *) batch.data;
+		iov[iovcnt++].iov_len = batch.size;
 
-		// Send new message
-		ret_val = msg_send(data, length, client);
-		switch (ret_val) {
+		switch (msg_send(iov, iovcnt, client, sent)) {
 		case SEND_OK:
+			rest.clear();
+			++iter;
+			break;
 		case SEND_WOULDBLOCK:
-			// Next client
+			if (sent < rest_len) {
+				// The rest of the last batch is still not sent, skip this one
+				rest.erase(0, sent);
+			} else if (sent > rest_len) {
+				/*
+				 * Partly sent. Store the rest of the batch for the next
+				 * transmission to avoid invalid JSON format.
+				 */
+				size_t done = sent - rest_len;
+				rest.assign(batch.data + done, batch.size - done);
+			} else {
+				// No part of the batch was sent
+				rest.clear();
+			}
 			++iter;
 			break;
 		case SEND_FAILED:
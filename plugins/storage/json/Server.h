@@ -56,8 +56,8 @@ public:
 	Server(const pugi::xpath_node &config);
 	~Server();
 
-	// Send a record to connected clients
-	void ProcessDataRecord(const std::string& record);
+	// Send records to connected clients
+	void ProcessDataBatch(const RecordBatch &batch);
 
 private:
 	/** Transmission status */
@@ -95,7 +95,8 @@ private:
 	// Brief description of a client
 	static std::string get_client_desc(const struct sockaddr_storage &client);
 	// Send data to the client
-	enum Send_status msg_send(const char *data, ssize_t len, client_t &client);
+	enum Send_status msg_send(struct iovec *iov, int iovcnt, client_t &client,
+		size_t &sent);
 
 	// Acceptor's thread function
 	static void *thread_accept(void *context);
@@ -50,24 +50,21 @@ extern "C" {
 }
 
 #include <string.h>
+#include <math.h>
 
 #include "Storage.h"
 #include <stdexcept>
-#include <sstream>
 #include <iostream>
 #include <iomanip>
 #include "branchlut2.h"
 
 static const char *msg_module = "json_storage";
 
-#define READ_BYTE_ARR(_dst_, _src_, _len_) \
-do {\
-	for (int i = 0; i < (_len_); ++i) { \
-		(_dst_)[i] = read8((_src_) + i); \
-	} \
-} while(0)
-
 #define STR_APPEND(_string_, _addition_) _string_.append(_addition_, sizeof(_addition_) - 1)
+#define ARENA_APPEND(_pos_, _addition_) arenaAppend((_pos_), (_addition_), sizeof(_addition_) - 1)
+
+/** Beginning of each record */
+#define RECORD_BEGIN "{\"@type\": \"ipfix.entry\", "
 
 /**
  * \brief Constructor
@@ -75,8 +72,8 @@ do {\
 Storage::Storage()
 {
 	/* Allocate space for buffers */
-	record.reserve(4096);
-	buffer.reserve(4096);
+	arena.resize(BATCH_MAX_SIZE + 4096);
+	ends.reserve(1024);
 }
 
 Storage::~Storage()
@@ -87,13 +84,21 @@ Storage::~Storage()
 }
 
 /**
- * \brief Send data record
+ * \brief Send batch of records
  */
-void Storage::sendData() const
+void Storage::sendData()
 {
+	if (ends.empty()) {
+		return;
+	}
+
+	RecordBatch batch = {arena.data(), arena_used, ends.data(), ends.size()};
 	for (Output *output: outputs) {
-		output->ProcessDataRecord(record);
+		output->ProcessDataBatch(batch);
 	}
+
+	arena_used = 0;
+	ends.clear();
 }
 
 /**
@@ -101,75 +106,306 @@ void Storage::sendData() const
  */
 void Storage::storeDataSets(const ipfix_message* ipfix_msg, struct json_conf * config)
 {
+	const struct ipfix_template *last_templ = NULL;
+	const TemplateInfo *info = NULL;
+
 	/* Iterate through all data records */
 	for (int i = 0; i < ipfix_msg->data_records_count; ++i) {
-		storeDataRecord(&(ipfix_msg->metadata[i]), ipfix_msg, config);
+		struct metadata *mdata = &(ipfix_msg->metadata[i]);
+
+		/* Records usually share few templates, look up each once per message */
+		if (mdata->record.templ != last_templ) {
+			last_templ = mdata->record.templ;
+			info = &templateInfo(last_templ, config);
+		}
+
+		storeDataRecord(mdata, ipfix_msg, *info, config);
+		if (arena_used >= BATCH_MAX_SIZE) {
+			sendData();
+		}
 	}
+
+	/* Records of the message are sent together */
+	sendData();
 }
 
 /**
- * \brief Get real field length
+ * \brief Select encoder of raw data
  */
-uint16_t Storage::realLength(uint16_t length, uint8_t *data_record, uint16_t &offset) const
+static FieldEncoder rawEncoder(uint16_t length)
 {
-	/* Static length */
-	if (length != VAR_IE_LENGTH) {
-		return length;
+	switch (length) {
+	case BYTE1:
+	case BYTE2:
+	case BYTE4:
+	case BYTE8:
+		return FieldEncoder::RAW_NUMBER;
+	default:
+		return FieldEncoder::RAW_HEX;
 	}
+}
 
-	/* Variable length */
-	length = static_cast<int>(read8(data_record + offset));
-	offset++;
+/**
+ * \brief Select encoder of a field
+ */
+FieldEncoder Storage::fieldEncoder(const ipfix_element_t *element, uint16_t length,
+	struct json_conf *config) const
+{
+	if (element == NULL) {
+		return rawEncoder(length);
+	}
 
-	if (length == 255) {
-		length = ntohs(read16(data_record + offset));
-		offset += 2;
+	if (length == VAR_IE_LENGTH && element->type != ET_STRING) {
+		return FieldEncoder::RAW_HEX;
 	}
 
-	return length;
+	bool tcp_flags = (element->en == 0 && element->id == 6 && config->tcpFlags);
+	bool protocol = (element->en == 0 && element->id == 4 && !config->protocol);
+
+	switch (element->type) {
+	case ET_UNSIGNED_8:
+	case ET_UNSIGNED_16:
+	case ET_UNSIGNED_32:
+	case ET_UNSIGNED_64:
+		switch (length) {
+		case BYTE1:
+			return tcp_flags ? FieldEncoder::FLAGS8 : (protocol
+				? FieldEncoder::PROTOCOL : FieldEncoder::UNSIGNED8);
+		case BYTE2:
+			return tcp_flags ? FieldEncoder::FLAGS16 : FieldEncoder::UNSIGNED16;
+		case BYTE4:
+			return FieldEncoder::UNSIGNED32;
+		case BYTE8:
+			return FieldEncoder::UNSIGNED64;
+		default:
+			return FieldEncoder::UNKNOWN;
+		}
+	case ET_SIGNED_8:
+	case ET_SIGNED_16:
+	case ET_SIGNED_32:
+	case ET_SIGNED_64:
+		switch (length) {
+		case BYTE1:
+			return FieldEncoder::SIGNED8;
+		case BYTE2:
+			return FieldEncoder::SIGNED16;
+		case BYTE4:
+			return FieldEncoder::SIGNED32;
+		case BYTE8:
+			return FieldEncoder::SIGNED64;
+		default:
+			return FieldEncoder::UNKNOWN;
+		}
+	case ET_FLOAT_32:
+	case ET_FLOAT_64:
+		switch (length) {
+		case BYTE4:
+			return FieldEncoder::FLOAT32;
+		case BYTE8:
+			return FieldEncoder::FLOAT64;
+		default:
+			return FieldEncoder::UNKNOWN;
+		}
+	case ET_IPV4_ADDRESS:
+		return (length == BYTE4) ? FieldEncoder::IPV4 : rawEncoder(length);
+	case ET_IPV6_ADDRESS:
+		return (length == IPV6_LEN) ? FieldEncoder::IPV6 : rawEncoder(length);
+	case ET_MAC_ADDRESS:
+		return (length == MAC_LEN) ? FieldEncoder::MAC : rawEncoder(length);
+	case ET_DATE_TIME_SECONDS:
+		if (length != BYTE4) {
+			return rawEncoder(length);
+		}
+		return config->timestamp ? FieldEncoder::TIME_SEC : FieldEncoder::UNSIGNED32;
+	case ET_DATE_TIME_MILLISECONDS:
+	case ET_DATE_TIME_MICROSECONDS:
+	case ET_DATE_TIME_NANOSECONDS:
+		if (length != BYTE8) {
+			return rawEncoder(length);
+		}
+
+		if (!config->timestamp) {
+			return FieldEncoder::UNSIGNED64;
+		}
+
+		if (element->type == ET_DATE_TIME_MILLISECONDS) {
+			return FieldEncoder::TIME_MSEC;
+		}
+		return (element->type == ET_DATE_TIME_MICROSECONDS)
+			? FieldEncoder::TIME_USEC : FieldEncoder::TIME_NSEC;
+	case ET_STRING:
+		return FieldEncoder::STRING;
+	case ET_BOOLEAN:
+	case ET_UNASSIGNED:
+	default:
+		return rawEncoder(length);
+	}
 }
 
 /**
- * \brief Read raw data from record
+ * \brief Get max. size of a fixed-length value
  */
-void Storage::readRawData(uint16_t &length, uint8_t* data_record, uint16_t &offset)
+size_t Storage::encoderMaxLength(FieldEncoder encoder, uint16_t length) const
 {
-	/* Read raw value */
-	switch (length) {
-	case 1:
-		sprintf(buffer.data(), "%" PRIu16, static_cast<int>(read8(data_record + offset)));
-		break;
-	case 2:
-		sprintf(buffer.data(), "%" PRIu16, ntohs(read16(data_record + offset)));
-		break;
-	case 4:
-		sprintf(buffer.data(), "%" PRIu32, ntohl(read32(data_record + offset)));
-		break;
-	case 8:
-		sprintf(buffer.data(), "%" PRIu64, be64toh(read64(data_record + offset)));
-		break;
+	switch (encoder) {
+	case FieldEncoder::SKIP:
+		return 0;
+	case FieldEncoder::UNSIGNED8:
+	case FieldEncoder::UNSIGNED16:
+	case FieldEncoder::UNSIGNED32:
+	case FieldEncoder::UNSIGNED64:
+	case FieldEncoder::SIGNED8:
+	case FieldEncoder::SIGNED16:
+	case FieldEncoder::SIGNED32:
+	case FieldEncoder::SIGNED64:
+		return INT_MAX_LEN;
+	case FieldEncoder::FLOAT32:
+	case FieldEncoder::FLOAT64:
+		return FLOAT_MAX_LEN;
+	case FieldEncoder::FLAGS8:
+	case FieldEncoder::FLAGS16:
+		return sizeof("\"UAPRSF\"");
+	case FieldEncoder::PROTOCOL:
+		return translator.protocolMaxLength();
+	case FieldEncoder::IPV4:
+		return sizeof("\"255.255.255.255\"");
+	case FieldEncoder::IPV6:
+		return IPV6_MAX_LEN;
+	case FieldEncoder::MAC:
+		return sizeof("\"ff:ff:ff:ff:ff:ff\"");
+	case FieldEncoder::TIME_SEC:
+	case FieldEncoder::TIME_MSEC:
+	case FieldEncoder::TIME_USEC:
+	case FieldEncoder::TIME_NSEC:
+		return TIMESTAMP_MAX_LEN;
+	case FieldEncoder::STRING:
+		/* Variable-length fields are counted by storeDataRecord */
+		return (length == VAR_IE_LENGTH) ? 0 : 6 * length + 2;
+	case FieldEncoder::RAW_NUMBER:
+		return INT_MAX_LEN + 2;
+	case FieldEncoder::RAW_HEX:
+		return (length == VAR_IE_LENGTH) ? 0 : 2 * length + 4;
+	case FieldEncoder::UNKNOWN:
 	default:
-		length = this->realLength(length, data_record, offset);
+		return sizeof("\"unknown\"");
+	}
+}
+
+/**
+ * \brief Get template with compiled fields
+ */
+const TemplateInfo &Storage::templateInfo(const struct ipfix_template *templ, struct json_conf *config)
+{
+	unsigned int revision = get_elements_revision();
+
+	auto it = templates.find(templ->serial);
+	if (it != templates.end()) {
+		TemplateInfo &info = it->second;
+		if (info.revision == revision) {
+			return info;
+		}
+	} else if (templates.size() >= TEMPLATE_CACHE_MAX) {
+		templates.clear();
+	}
+
+	TemplateInfo &info = templates[templ->serial];
+	info.revision = revision;
+	info.fields.clear();
+	info.fields.reserve(templ->field_count);
+	info.max_length = 0;
+	info.var_fields = 0;
+
+	bool first = true;
+	for (uint16_t count = 0, index = 0; count < templ->field_count; ++count, ++index) {
+		TemplateField field;
+		const char *element_name = NULL;
 
-		if (length == 0) {
-			STR_APPEND(record, "null");
-			return;
+		/* Get Enterprise number and ID */
+		uint16_t field_id = templ->fields[index].ie.id;
+		uint32_t field_en = 0;
+		field.length = templ->fields[index].ie.length;
+
+		if (field_id & 0x8000) {
+			field_id &= 0x7fff;
+			field_en = templ->fields[++index].enterprise_number;
 		}
 
-		if (length * 2 > buffer.capacity()) {
-			buffer.reserve(length * 2 + 1);
+		/* Get element informations */
+		const ipfix_element_t *element = get_element_by_id(field_id, field_en);
+		if (element != NULL) {
+			element_name = element->name;
+			field.encoder = fieldEncoder(element, field.length, config);
+		} else if (config->ignoreUnknown) {
+			field.encoder = FieldEncoder::SKIP;
+		} else {
+			// Element not found
+			element_name = rawName(field_en, field_id);
+			field.encoder = fieldEncoder(NULL, field.length, config);
+			MSG_DEBUG(msg_module, "Unknown element (%s)", element_name);
 		}
 
-		/* Start the string with 0x and print the rest in hexa */
-		strncpy(buffer.data(), "0x", 3);
-		for (int i = 0; i < length; i++) {
-			sprintf(buffer.data() + i * 2 + 2, "%02x", (data_record + offset)[i]);
+		if (field.encoder != FieldEncoder::SKIP) {
+			field.key = first ? "\"" : ", \"";
+			field.key += config->prefix;
+			field.key += element_name;
+			STR_APPEND(field.key, "\": ");
+			first = false;
+
+			info.max_length += field.key.size() + encoderMaxLength(field.encoder, field.length);
+			if (field.length == VAR_IE_LENGTH) {
+				info.var_fields++;
+			}
 		}
+
+		info.fields.push_back(std::move(field));
+	}
+
+	return info;
+}
+
+/**
+ * \brief Make sure there is space in the arena
+ */
+char *Storage::arenaReserve(char *pos, size_t needed)
+{
+	size_t used = pos - arena.data();
+	if (used + needed > arena.size()) {
+		arena.resize(std::max(2 * arena.size(), used + needed));
 	}
 
-	record += '"';
-	record += buffer.data();
-	record += '"';
+	return arena.data() + used;
+}
+
+/**
+ * \brief Append string to the arena
+ */
+char *Storage::arenaAppend(char *pos, const char *str, size_t len)
+{
+	pos = arenaReserve(pos, len);
+	memcpy(pos, str, len);
+	return pos + len;
+}
+
+/**
+ * \brief Get real field length
+ */
+uint16_t Storage::realLength(uint16_t length, const uint8_t *data_record, uint16_t &offset) const
+{
+	/* Static length */
+	if (length != VAR_IE_LENGTH) {
+		return length;
+	}
+
+	/* Variable length */
+	length = static_cast<int>(read8(data_record + offset));
+	offset++;
+
+	if (length == 255) {
+		length = ntohs(read16(data_record + offset));
+		offset += 2;
+	}
+
+	return length;
 }
 
 /**
@@ -186,198 +422,209 @@ const char* Storage::rawName(uint32_t en, uint16_t id) const
 /**
  * \brief Store data record
  */
-void Storage::storeDataRecord(struct metadata *mdata, const struct ipfix_message *ipfix_msg, struct json_conf *config)
+void Storage::storeDataRecord(struct metadata *mdata, const struct ipfix_message *ipfix_msg,
+	const TemplateInfo &info, struct json_conf *config)
 {
-	const char *element_name = NULL;
-	ELEMENT_TYPE element_type;
+	const uint8_t *data_record = (const uint8_t *) mdata->record.record;
+	uint16_t offset = 0;
 
-	offset = 0;
-	uint16_t trans_len = 0;
-	const char *trans_str = NULL;
-	record.clear();
-	STR_APPEND(record, "{\"@type\": \"ipfix.entry\", ");
+	/* Reserve space for the worst case, so fields are written without checks */
+	char *pos = arenaReserve(arena.data() + arena_used, sizeof(RECORD_BEGIN) + info.max_length
+		+ info.var_fields * VAR_FIELD_MAX_LEN + 6 * mdata->record.length);
 
-	struct ipfix_template *templ = mdata->record.templ;
-	uint8_t *data_record = (uint8_t*) mdata->record.record;
+	memcpy(pos, RECORD_BEGIN, sizeof(RECORD_BEGIN) - 1);
+	pos += sizeof(RECORD_BEGIN) - 1;
 
 	/* get all fields */
-	uint16_t added = 0;
-	for (uint16_t count = 0, index = 0; count < templ->field_count; ++count, ++index) {
-		/* Get Enterprise number and ID */
-		id = templ->fields[index].ie.id;
-		length = templ->fields[index].ie.length;
-		enterprise = 0;
+	for (const TemplateField &field: info.fields) {
+		uint16_t length = realLength(field.length, data_record, offset);
+		const uint8_t *data = data_record + offset;
+		offset += length;
 
-		if (id & 0x8000) {
-			id &= 0x7fff;
-			enterprise = templ->fields[++index].enterprise_number;
+		if (field.encoder == FieldEncoder::SKIP) {
+			continue;
 		}
 
-		/* Get element informations */
-		const ipfix_element_t * element = get_element_by_id(id, enterprise);
-		if (element != NULL) {
-			element_name = element->name;
-			element_type = element->type;
-		} else {
-			// Element not found
-			if (config->ignoreUnknown) {
-				offset += realLength(length, data_record, offset);
-				continue;
-			}
-
-			element_name = rawName(enterprise, id);
-			element_type = ET_UNASSIGNED;
-			MSG_DEBUG(msg_module, "Unknown element (%s)", element_name);
-	}
+		memcpy(pos, field.key.data(), field.key.size());
+		pos += field.key.size();
 
-		if (added > 0) {
-			STR_APPEND(record, ", ");
+		switch (field.encoder) {
+		case FieldEncoder::UNSIGNED8:
+			pos = u32toa_branchlut2(read8(data), pos);
+			break;
+		case FieldEncoder::UNSIGNED16:
+			pos = u32toa_branchlut2(ntohs(read16(data)), pos);
+			break;
+		case FieldEncoder::UNSIGNED32:
+			pos = u32toa_branchlut2(ntohl(read32(data)), pos);
+			break;
+		case FieldEncoder::UNSIGNED64:
+			pos = u64toa_branchlut2(be64toh(read64(data)), pos);
+			break;
+		case FieldEncoder::SIGNED8:
+			pos = i32toa_branchlut2((int8_t) read8(data), pos);
+			break;
+		case FieldEncoder::SIGNED16:
+			pos = i32toa_branchlut2((int16_t) ntohs(read16(data)), pos);
+			break;
+		case FieldEncoder::SIGNED32:
+			pos = i32toa_branchlut2((int32_t) ntohl(read32(data)), pos);
+			break;
+		case FieldEncoder::SIGNED64:
+			pos = i64toa_branchlut2((int64_t) be64toh(read64(data)), pos);
+			break;
+		case FieldEncoder::FLOAT32: {
+			uint32_t bits = ntohl(read32(data));
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			pos = translator.writeFloat(pos, value);
+			break;
 		}
-
-		STR_APPEND(record, "\"");
-		record += config->prefix;
-		record += element_name;
-		STR_APPEND(record, "\": ");
-
-		switch (element_type) {
-		case ET_UNSIGNED_8:
-		case ET_UNSIGNED_16:
-		case ET_UNSIGNED_32:
-		case ET_UNSIGNED_64:{
-			trans_str = translator.toUnsigned(length, &trans_len, data_record, offset,
-				element, config);
-			record.append(trans_str, trans_len);
+		case FieldEncoder::FLOAT64: {
+			uint64_t bits = be64toh(read64(data));
+			double value;
+			memcpy(&value, &bits, sizeof(value));
+			pos = translator.writeFloat(pos, value);
+			break;
 		}
+		case FieldEncoder::FLAGS8:
+			pos = translator.writeFlags(pos, read8(data));
 			break;
-		case ET_SIGNED_8:
-		case ET_SIGNED_16:
-		case ET_SIGNED_32:
-		case ET_SIGNED_64:
-			trans_str = translator.toSigned(length, &trans_len, data_record, offset);
-			record.append(trans_str, trans_len);
+		case FieldEncoder::FLAGS16:
+			pos = translator.writeFlags(pos, (uint8_t) ntohs(read16(data)));
 			break;
-		case ET_FLOAT_32:
-		case ET_FLOAT_64:
-			trans_str = translator.toFloat(length, &trans_len, data_record, offset);
-			record.append(trans_str, trans_len);
+		case FieldEncoder::PROTOCOL:
+			pos = translator.writeProtocol(pos, read8(data));
 			break;
-		case ET_IPV4_ADDRESS:
-			record += '"';
-			trans_str = translator.formatIPv4(read32(data_record + offset), &trans_len);
-			record.append(trans_str, trans_len);
-			record += '"';
+		case FieldEncoder::IPV4:
+			*pos++ = '"';
+			pos = translator.writeIPv4(pos, data);
+			*pos++ = '"';
 			break;
-		case ET_IPV6_ADDRESS:
-			READ_BYTE_ARR(addr6, data_record + offset, IPV6_LEN);
-			record += '"';
-			record += translator.formatIPv6(addr6);
-			record += '"';
+		case FieldEncoder::IPV6:
+			*pos++ = '"';
+			pos = translator.writeIPv6(pos, data);
+			*pos++ = '"';
 			break;
-		case ET_MAC_ADDRESS:
-			READ_BYTE_ARR(addrMac, data_record + offset, MAC_LEN);
-			record += '"';
-			record += translator.formatMac(addrMac);
-			record += '"';
+		case FieldEncoder::MAC:
+			*pos++ = '"';
+			pos = translator.writeMac(pos, data);
+			*pos++ = '"';
 			break;
-		case ET_DATE_TIME_SECONDS:
-			record += translator.formatTimestamp(read32(data_record + offset),
-				t_units::SEC, config);
+		case FieldEncoder::TIME_SEC:
+			pos = translator.writeTimestamp(pos, ntohl(read32(data)) * 1000ULL);
 			break;
-		case ET_DATE_TIME_MILLISECONDS:
-			record += translator.formatTimestamp(read64(data_record + offset),
-				t_units::MILLISEC, config);
+		case FieldEncoder::TIME_MSEC:
+			pos = translator.writeTimestamp(pos, be64toh(read64(data)));
 			break;
-		case ET_DATE_TIME_MICROSECONDS:
-			record += translator.formatTimestamp(read64(data_record + offset),
-				t_units::MICROSEC, config);
+		case FieldEncoder::TIME_USEC:
+			pos = translator.writeTimestamp(pos, be64toh(read64(data)) / 1000);
 			break;
-		case ET_DATE_TIME_NANOSECONDS:
-			record += translator.formatTimestamp(read64(data_record + offset),
-				t_units::NANOSEC, config);
+		case FieldEncoder::TIME_NSEC:
+			pos = translator.writeTimestamp(pos, be64toh(read64(data)) / 1000000);
 			break;
-		case ET_STRING:
-			length = realLength(length, data_record, offset);
-			record += translator.escapeString(length, data_record + offset,
-				config);
+		case FieldEncoder::STRING:
+			pos = translator.writeString(pos, data, length, config);
+			break;
+		case FieldEncoder::RAW_NUMBER:
+			*pos++ = '"';
+			switch (length) {
+			case BYTE1:
+				pos = u32toa_branchlut2(read8(data), pos);
+				break;
+			case BYTE2:
+				pos = u32toa_branchlut2(ntohs(read16(data)), pos);
+				break;
+			case BYTE4:
+				pos = u32toa_branchlut2(ntohl(read32(data)), pos);
+				break;
+			default:
+				pos = u64toa_branchlut2(be64toh(read64(data)), pos);
+				break;
+			}
+			*pos++ = '"';
 			break;
-		case ET_BOOLEAN:
-		case ET_UNASSIGNED:
+		case FieldEncoder::RAW_HEX:
+			pos = translator.writeHex(pos, data, length);
+			break;
+		case FieldEncoder::UNKNOWN:
 		default:
-			readRawData(length, data_record, offset);
+			memcpy(pos, "\"unknown\"", 9);
+			pos += 9;
 			break;
 		}
-
-		offset += length;
-		added++;
 	}
 
 	/* Store metadata */
 	if (processMetadata) {
-		STR_APPEND(record, ", \"");
-		record += config->prefix;
-		STR_APPEND(record, "metadata\": {");
-		storeMetadata(mdata);
-		STR_APPEND(record, "}");
+		pos = ARENA_APPEND(pos, ", \"");
+		pos = arenaAppend(pos, config->prefix.data(), config->prefix.size());
+		pos = ARENA_APPEND(pos, "metadata\": {");
+		pos = storeMetadata(pos, mdata);
+		pos = ARENA_APPEND(pos, "}");
 	}
 
 	/* Store ODID */
 	if (config->odid) {
-		/* Temporary buffer for the ODID, must be as big as UINT_MAX converted to string */
-		char odid_buf[sizeof("4294967295")];
-
-		STR_APPEND(record, ", \"");
-		record += config->prefix;
-		STR_APPEND(record, "odid\": ");
-		/* Convert ODID efficiently */
-		char *odid_buf_pos = u32toa_branchlut2(ipfix_msg->input_info->odid, odid_buf);
-		record.append(odid_buf, odid_buf_pos - odid_buf);
+		pos = ARENA_APPEND(pos, ", \"");
+		pos = arenaAppend(pos, config->prefix.data(), config->prefix.size());
+		pos = ARENA_APPEND(pos, "odid\": ");
+		pos = arenaReserve(pos, INT_MAX_LEN);
+		pos = u32toa_branchlut2(ipfix_msg->input_info->odid, pos);
 	}
 
 	/* Store Detailed Information */
 	if (config->detailedInfo) {
-		char conv_buf[sizeof("4294967295")], *conv_buf_pos = NULL;
-
-		STR_APPEND(record, ", \"ipfixcol.packet_length\": ");
-		conv_buf_pos = u32toa_branchlut2(ntohs(ipfix_msg->pkt_header->length), conv_buf);
-		record.append(conv_buf, conv_buf_pos - conv_buf);
+		pos = ARENA_APPEND(pos, ", \"ipfixcol.packet_length\": ");
+		pos = arenaReserve(pos, INT_MAX_LEN);
+		pos = u32toa_branchlut2(ntohs(ipfix_msg->pkt_header->length), pos);
 
-		STR_APPEND(record, ", \"ipfixcol.export_time\": ");
-		conv_buf_pos = u32toa_branchlut2(ntohl(ipfix_msg->pkt_header->export_time), conv_buf);
-		record.append(conv_buf, conv_buf_pos - conv_buf);
+		pos = ARENA_APPEND(pos, ", \"ipfixcol.export_time\": ");
+		pos = arenaReserve(pos, INT_MAX_LEN);
+		pos = u32toa_branchlut2(ntohl(ipfix_msg->pkt_header->export_time), pos);
 
-		STR_APPEND(record, ", \"ipfixcol.sequence_number\": ");
-		conv_buf_pos = u32toa_branchlut2(ntohl(ipfix_msg->pkt_header->sequence_number), conv_buf);
-		record.append(conv_buf, conv_buf_pos - conv_buf);
+		pos = ARENA_APPEND(pos, ", \"ipfixcol.sequence_number\": ");
+		pos = arenaReserve(pos, INT_MAX_LEN);
+		pos = u32toa_branchlut2(ntohl(ipfix_msg->pkt_header->sequence_number), pos);
 
-		STR_APPEND(record, ", \"ipfixcol.template_id\": ");
-		conv_buf_pos = u32toa_branchlut2(templ->original_id, conv_buf);
-		record.append(conv_buf, conv_buf_pos - conv_buf);
+		pos = ARENA_APPEND(pos, ", \"ipfixcol.template_id\": ");
+		pos = arenaReserve(pos, INT_MAX_LEN);
+		pos = u32toa_branchlut2(mdata->record.templ->original_id, pos);
 	}
 
-	STR_APPEND(record, "}\n");
-	sendData();
+	pos = ARENA_APPEND(pos, "}\n");
+
+	/* The record is sent later with the rest of the batch */
+	arena_used = pos - arena.data();
+	ends.push_back(arena_used);
 }
 
 /**
  * \brief Store metadata information
  */
-void Storage::storeMetadata(metadata* mdata)
+char *Storage::storeMetadata(char *pos, metadata* mdata)
 {
-	std::stringstream ss;
-
 	/* Geolocation info */
-	ss << "\"srcAS\": \"" << mdata->srcAS << "\", ";
-	ss << "\"dstAS\": \"" << mdata->dstAS << "\", ";
-	ss << "\"srcCountry\": \"" << mdata->srcCountry << "\", ";
-	ss << "\"dstCountry\": \"" << mdata->dstCountry << "\", ";
-	ss << "\"srcName\": \"" << mdata->srcName << "\", ";
-	ss << "\"dstName\": \"" << mdata->dstName << "\", ";
-
-	record += ss.str();
-
+	pos = ARENA_APPEND(pos, "\"srcAS\": \"");
+	pos = arenaReserve(pos, INT_MAX_LEN);
+	pos = u32toa_branchlut2(mdata->srcAS, pos);
+	pos = ARENA_APPEND(pos, "\", \"dstAS\": \"");
+	pos = arenaReserve(pos, INT_MAX_LEN);
+	pos = u32toa_branchlut2(mdata->dstAS, pos);
+	pos = ARENA_APPEND(pos, "\", \"srcCountry\": \"");
+	pos = arenaReserve(pos, INT_MAX_LEN);
+	pos = u32toa_branchlut2(mdata->srcCountry, pos);
+	pos = ARENA_APPEND(pos, "\", \"dstCountry\": \"");
+	pos = arenaReserve(pos, INT_MAX_LEN);
+	pos = u32toa_branchlut2(mdata->dstCountry, pos);
+	pos = ARENA_APPEND(pos, "\", \"srcName\": \"");
+	pos = arenaAppend(pos, mdata->srcName, strnlen(mdata->srcName, sizeof(mdata->srcName)));
+	pos = ARENA_APPEND(pos, "\", \"dstName\": \"");
+	pos = arenaAppend(pos, mdata->dstName, strnlen(mdata->dstName, sizeof(mdata->dstName)));
+	pos = ARENA_APPEND(pos, "\", ");
 
 	/* Profiles */
-	STR_APPEND(record, "\"profiles\": [");
+	pos = ARENA_APPEND(pos, "\"profiles\": [");
 	if (mdata->channels) {
 		// Get name of root profile
 		void *profile_ptr = NULL;
@@ -393,20 +640,23 @@ void Storage::storeMetadata(metadata* mdata)
 
 		// Process all channels
 		for (int i = 0; mdata->channels[i] != 0; ++i) {
+			const char *path = profile_get_path(channel_get_profile(mdata->channels[i]));
+			const char *channel = channel_get_name(mdata->channels[i]);
+
 			if (i > 0) {
-				STR_APPEND(record, ", ");
+				pos = ARENA_APPEND(pos, ", ");
 			}
 
-			STR_APPEND(record, "{\"profile\": \"");
-			record += root_profile_name;
-			STR_APPEND(record, "/");
-			record += profile_get_path(channel_get_profile(mdata->channels[i]));
+			pos = ARENA_APPEND(pos, "{\"profile\": \"");
+			pos = arenaAppend(pos, root_profile_name, strlen(root_profile_name));
+			pos = ARENA_APPEND(pos, "/");
+			pos = arenaAppend(pos, path, strlen(path));
 
-			STR_APPEND(record, "\", \"channel\": \"");
-			record += channel_get_name(mdata->channels[i]);
-			STR_APPEND(record, "\"}");
+			pos = ARENA_APPEND(pos, "\", \"channel\": \"");
+			pos = arenaAppend(pos, channel, strlen(channel));
+			pos = ARENA_APPEND(pos, "\"}");
 		}
 	}
-	record += ']';
-}
 
+	return ARENA_APPEND(pos, "]");
+}
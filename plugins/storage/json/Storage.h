@@ -43,6 +43,7 @@
 #define __STDC_FORMAT_MACROS
 #include <ipfixcol/storage.h>
 #include <siso.h>
+#include <unordered_map>
 
 #include "json.h"
 #include "pugixml/pugixml.hpp"
@@ -57,6 +58,65 @@
 #define IPV6_LEN 16
 #define MAC_LEN  6
 
+/** Size of serialized records after which the batch is sent to outputs */
+#define BATCH_MAX_SIZE (256 * 1024)
+
+/** Max. number of cached templates, the cache is flushed when exceeded */
+#define TEMPLATE_CACHE_MAX 4096
+
+/** Max. size of variable-length field overhead (quotes, "0x", ...) */
+#define VAR_FIELD_MAX_LEN 8
+
+/**
+ * \brief Encoder of template field, selected by type, length and configuration
+ */
+enum class FieldEncoder : uint8_t {
+	SKIP,          /**< Unknown element that is not printed */
+	UNSIGNED8,
+	UNSIGNED16,
+	UNSIGNED32,
+	UNSIGNED64,
+	SIGNED8,
+	SIGNED16,
+	SIGNED32,
+	SIGNED64,
+	FLOAT32,
+	FLOAT64,
+	FLAGS8,        /**< Formatted TCP flags */
+	FLAGS16,       /**< Formatted TCP flags */
+	PROTOCOL,      /**< Formatted protocol */
+	IPV4,
+	IPV6,
+	MAC,
+	TIME_SEC,      /**< Formatted timestamp */
+	TIME_MSEC,     /**< Formatted timestamp */
+	TIME_USEC,     /**< Formatted timestamp */
+	TIME_NSEC,     /**< Formatted timestamp */
+	STRING,
+	RAW_NUMBER,    /**< Raw data of 1, 2, 4 or 8 bytes as a quoted number */
+	RAW_HEX,       /**< Raw data as a quoted hexadecimal string */
+	UNKNOWN        /**< Number of unsupported size */
+};
+
+/**
+ * \brief Template field compiled to its encoder
+ */
+struct TemplateField {
+	FieldEncoder encoder{FieldEncoder::SKIP}; /**< Encoder of the value */
+	uint16_t length{0};                       /**< Length from template */
+	std::string key;                          /**< [, ]"<prefix><name>": */
+};
+
+/**
+ * \brief Template with all fields compiled
+ */
+struct TemplateInfo {
+	unsigned int revision{0};          /**< Revision of element descriptions */
+	std::vector<TemplateField> fields; /**< Compiled fields */
+	size_t max_length{0};              /**< Max. size of keys and fixed-length values */
+	unsigned int var_fields{0};        /**< Number of variable-length fields */
+};
+
 class Storage {
 public:
     /**
@@ -106,61 +166,98 @@ private:
      * @param offset field offset
      * @return real length;
      */
-    uint16_t realLength(uint16_t length, uint8_t *data, uint16_t &offset) const;
+    uint16_t realLength(uint16_t length, const uint8_t *data, uint16_t &offset) const;
 
     /**
-     * \brief Read string field
+     * \brief Select encoder of a field
      *
-     * @param length length from template
-     * @param data data record
-     * @param offset field offset
+     * @param element Element description (NULL if unknown)
+     * @param length Length from template
+     * @param config Plugin configuration
+     * @return Encoder
      */
-	void readString(uint16_t &length, uint8_t *data, uint16_t &offset);
+	FieldEncoder fieldEncoder(const ipfix_element_t *element, uint16_t length,
+		struct json_conf *config) const;
 
     /**
-     * \brief Read raw data from record on given offset
+     * \brief Get max. size of a fixed-length value
      *
-     * @param field_len length from template
-     * @param data data record
-     * @param offset field offset (will be changed)
+     * @param encoder Encoder
+     * @param length Length from template
+     * @return Max. size including terminating '\0'
+     */
+	size_t encoderMaxLength(FieldEncoder encoder, uint16_t length) const;
+
+    /**
+     * \brief Make sure there is space in the arena
+     *
+     * @param pos Current position in the arena
+     * @param needed Number of bytes to be written
+     * @return Current position (the arena may be moved)
+     */
+	char *arenaReserve(char *pos, size_t needed);
+
+    /**
+     * \brief Append string to the arena
+     *
+     * @param pos Current position in the arena
+     * @param str String
+     * @param len Length of the string
+     * @return Position after the string
      */
-	void readRawData(uint16_t &length, uint8_t *data, uint16_t &offset);
+	char *arenaAppend(char *pos, const char *str, size_t len);
 
     /**
      * \brief Store data record
      *
      * @param mdata Data record's metadata
+     * @param ipfix_msg IPFIX message
+     * @param info Compiled template of the record
+     * @param config Plugin configuration
      */
-	void storeDataRecord(struct metadata *mdata, const struct ipfix_message *ipfix_msg, struct json_conf *config);
+	void storeDataRecord(struct metadata *mdata, const struct ipfix_message *ipfix_msg,
+		const TemplateInfo &info, struct json_conf *config);
 
     /**
 	 * \brief Store metadata
 	 *
+     * @param pos Current position in the arena
      * @param mdata Data record's metadata
+     * @return Position after the metadata
      */
-	void storeMetadata(struct metadata *mdata);
+	char *storeMetadata(char *pos, struct metadata *mdata);
 
     /**
      * \brief Create raw name for unknown elements
      */
     const char* rawName(uint32_t en, uint16_t id) const;
 
+    /**
+     * \brief Get template with compiled fields
+     *
+     * Fields are compiled only when the template is seen for the first time
+     * or when the template or the description of elements changed.
+     *
+     * @param templ Template
+     * @param config Plugin configuration
+     * @return Compiled template
+     */
+	const TemplateInfo &templateInfo(const struct ipfix_template *templ, struct json_conf *config);
+
 
 	/**
-	 * \brief Send JSON data to output processors
+	 * \brief Send batch of JSON records to output processors
      */
-	void sendData() const;
+	void sendData();
 
 	bool processMetadata{false};	/**< Metadata processing enabled */
 	bool printOnly{false};
-	uint8_t addr6[IPV6_LEN];
-	uint8_t addrMac[MAC_LEN];
-	uint16_t offset{0}, id{0}, length{0};
-	uint32_t enterprise{0};
 
 	std::vector<Output*> outputs{};
-	std::vector<char> buffer;
-	std::string record;
+	std::unordered_map<uint64_t, TemplateInfo> templates; /**< Compiled templates by serial number */
+	std::vector<char> arena;	/**< Output buffer reused by all records */
+	size_t arena_used{0};		/**< Size of records in the arena */
+	std::vector<size_t> ends;	/**< End offsets of records in the arena */
 };
 
 #endif	/* STORAGE_H */
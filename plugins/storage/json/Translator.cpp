@@ -41,272 +41,257 @@
 #include "protocols.h"
 
 #include <arpa/inet.h>
+#include <math.h>
 #include <vector>
 
 #include "Storage.h"
 // #include "itostr.h"
 #include "branchlut2.h"
 
-/**
- * \brief Format flags 16bits
- */
-const char *Translator::formatFlags16(uint16_t flags)
-{
-	flags = ntohs(flags);
-	return formatFlags8((uint8_t) flags);
-}
-
-/**
- * \brief Format flags 8bits
- */
-const char *Translator::formatFlags8(uint8_t flags)
-{
-	buffer[0] = '"';
-	buffer[1] = flags & 0x20 ? 'U' : '.';
-	buffer[2] = flags & 0x10 ? 'A' : '.';
-	buffer[3] = flags & 0x08 ? 'P' : '.';
-	buffer[4] = flags & 0x04 ? 'R' : '.';
-	buffer[5] = flags & 0x02 ? 'S' : '.';
-	buffer[6] = flags & 0x01 ? 'F' : '.';
-	buffer[7] = '"';
-	buffer[8] = '\0';
-
-	return buffer;
-}
-
 /**
  * \brief Constructor
  */
 Translator::Translator()
 {
-	buffer = new char[Translator::BUFF_SIZE];
+	for (int i = 0; i < 256; ++i) {
+		proto_len[i] = strlen(protocols[i]);
+		if (proto_len[i] + 2U > proto_max) {
+			proto_max = proto_len[i] + 2U;
+		}
+	}
 }
 
-Translator::~Translator()
+/**
+ * \brief Format flags
+ */
+char *Translator::writeFlags(char *out, uint8_t flags)
 {
-	delete[] buffer;
+	out[0] = '"';
+	out[1] = flags & 0x20 ? 'U' : '.';
+	out[2] = flags & 0x10 ? 'A' : '.';
+	out[3] = flags & 0x08 ? 'P' : '.';
+	out[4] = flags & 0x04 ? 'R' : '.';
+	out[5] = flags & 0x02 ? 'S' : '.';
+	out[6] = flags & 0x01 ? 'F' : '.';
+	out[7] = '"';
+
+	return out + 8;
 }
 
 /**
  * \brief Format IPv4
  */
-const char *Translator::formatIPv4(uint32_t addr, uint16_t *ret_len)
-{	
-	char *ret = NULL;
-
-	ret = u32toa_branchlut2(((uint8_t *) &addr)[0], buffer);
-	ret++[0] = '.';
-	ret = u32toa_branchlut2(((uint8_t *) &addr)[1], ret);
-	ret++[0] = '.';
-	ret = u32toa_branchlut2(((uint8_t *) &addr)[2], ret);
-	ret++[0] = '.';
-	ret = u32toa_branchlut2(((uint8_t *) &addr)[3], ret);
-
-	*ret_len = ret - buffer;
-	return buffer;
+char *Translator::writeIPv4(char *out, const uint8_t *addr)
+{
+	out = u32toa_branchlut2(addr[0], out);
+	*out++ = '.';
+	out = u32toa_branchlut2(addr[1], out);
+	*out++ = '.';
+	out = u32toa_branchlut2(addr[2], out);
+	*out++ = '.';
+	return u32toa_branchlut2(addr[3], out);
 }
 
 /**
  * \brief Format IPv6
  */
-const char *Translator::formatIPv6(uint8_t* addr)
-{	
-	inet_ntop(AF_INET6, (struct in6_addr *) addr, buffer, INET6_ADDRSTRLEN);
-	return buffer;
+char *Translator::writeIPv6(char *out, const uint8_t *addr)
+{
+	uint16_t words[8];
+	for (int i = 0; i < 8; ++i) {
+		words[i] = (addr[2 * i] << 8) | addr[2 * i + 1];
+	}
+
+	if ((words[0] | words[1] | words[2] | words[3] | words[4]) == 0) {
+		/* Addresses with embedded IPv4 address are left to the library */
+		inet_ntop(AF_INET6, addr, out, INET6_ADDRSTRLEN);
+		return out + strlen(out);
+	}
+
+	/* Find the first longest run of zero words */
+	int best_base = -1, best_len = 0;
+	for (int i = 0; i < 8; ++i) {
+		if (words[i] != 0) {
+			continue;
+		}
+
+		int len = 1;
+		while (i + len < 8 && words[i + len] == 0) {
+			len++;
+		}
+
+		if (len > best_len) {
+			best_base = i;
+			best_len = len;
+		}
+		i += len;
+	}
+
+	if (best_len < 2) {
+		best_base = -1;
+	}
+
+	for (int i = 0; i < 8; ++i) {
+		if (i == best_base) {
+			*out++ = ':';
+			i += best_len - 1;
+			if (i == 7) {
+				*out++ = ':';
+			}
+			continue;
+		}
+
+		if (i > 0) {
+			*out++ = ':';
+		}
+		out = u16tohex_branchlut2(words[i], out);
+	}
+
+	return out;
 }
 
 /**
- * \brief Format timestamp
+ * \brief Format MAC
  */
-const char *Translator::formatMac(uint8_t* addr)
-{	
-	snprintf(buffer, BUFF_SIZE, "%02x:%02x:%02x:%02x:%02x:%02x",
-		addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
-	return buffer;
+char *Translator::writeMac(char *out, const uint8_t *addr)
+{
+	out = u8tohex_branchlut2(addr[0], out);
+	for (int i = 1; i < MAC_LEN; ++i) {
+		*out++ = ':';
+		out = u8tohex_branchlut2(addr[i], out);
+	}
+
+	return out;
 }
 
 /**
  * \brief Format protocol
  */
-const char *Translator::formatProtocol(uint8_t proto)
+char *Translator::writeProtocol(char *out, uint8_t proto)
 {
-	snprintf(buffer, BUFF_SIZE, "\"%s\"", protocols[proto]);
-	return buffer;
+	*out++ = '"';
+	memcpy(out, protocols[proto], proto_len[proto]);
+	out += proto_len[proto];
+	*out++ = '"';
+	return out;
 }
 
 /**
  * \brief Format timestamp
  */
-const char *Translator::formatTimestamp(uint64_t tstamp, t_units units, struct json_conf * config)
+char *Translator::writeTimestamp(char *out, uint64_t msec)
 {
-	/* Convert to host byte order. Seconds are stored in uint32_t */
-	if (units == t_units::SEC) {
-		tstamp = ntohl(tstamp);
-	} else {
-		tstamp = be64toh(tstamp);
+	time_t timesec = msec / 1000;
+
+	if (!cached_valid || timesec != cached_sec) {
+		struct tm tm;
+		if (localtime_r(&timesec, &tm) == NULL || tm.tm_year < -1900
+				|| tm.tm_year > 9999 - 1900) {
+			/* Not representable, use the number of milliseconds */
+			return u64toa_branchlut2(msec, out);
+		}
+
+		/* "YYYY-MM-DDTHH:MM:SS */
+		char *pos = cached_time;
+		unsigned int year = tm.tm_year + 1900;
+		*pos++ = '"';
+		pos = u2toa_branchlut2(year / 100, pos);
+		pos = u2toa_branchlut2(year % 100, pos);
+		*pos++ = '-';
+		pos = u2toa_branchlut2(tm.tm_mon + 1, pos);
+		*pos++ = '-';
+		pos = u2toa_branchlut2(tm.tm_mday, pos);
+		*pos++ = 'T';
+		pos = u2toa_branchlut2(tm.tm_hour, pos);
+		*pos++ = ':';
+		pos = u2toa_branchlut2(tm.tm_min, pos);
+		*pos++ = ':';
+		pos = u2toa_branchlut2(tm.tm_sec, pos);
+
+		cached_sec = timesec;
+		cached_valid = true;
 	}
 
-	if(config->timestamp) {
-	
-		/* Convert to milliseconds */
-		switch (units) {
-		case t_units::SEC:
-			tstamp *= 1000;
-			break;
-		case t_units::MICROSEC:
-			tstamp /= 1000;
-			break;
-		case t_units::NANOSEC:
-			tstamp /= 1000000;
-			break;
-		default: /* MILLI is default */
-			break;
-		}
-	
-		timesec = tstamp / 1000;
-		msec	= tstamp % 1000;
-		tm		= localtime(&timesec);
-	
-		strftime(buffer, 21, "\"%FT%T", tm);
-		/* append miliseconds */
-		sprintf(&(buffer[20]), ".%03u\"", (const unsigned int) msec);
-	} else {
-		sprintf(buffer, "%" PRIu64 , tstamp);
-	}	
-
-	return buffer;
+	memcpy(out, cached_time, sizeof(cached_time));
+	out += sizeof(cached_time);
+
+	/* Append milliseconds */
+	unsigned int ms = msec % 1000;
+	*out++ = '.';
+	*out++ = '0' + ms / 100;
+	out = u2toa_branchlut2(ms % 100, out);
+	*out++ = '"';
+	return out;
 }
 
 /**
- * \brief Conversion of unsigned int
+ * \brief Format floating point number
  */
-const char *Translator::toUnsigned(uint16_t length, uint16_t *ret_len, uint8_t *data_record,
-	uint16_t offset, const ipfix_element_t * element, struct json_conf * config)
+char *Translator::writeFloat(char *out, double value)
 {
-	// Calculate the length of returned string here to avoid unnecessary strlen later
-	const char *ret = NULL;
-	*ret_len = 0;
-
-	if(length == BYTE1) {
-		// 1 byte
-		if(element->en == 0 && element->id == 6 && config->tcpFlags) {
-			// Formated TCP flags
-			ret = formatFlags8(read8(data_record + offset));
-			*ret_len = 8;
-			return ret;
-		} else if (element->en == 0 && element->id == 4 && !config->protocol) {
-			// Formated protocol identification (TCP, UDP, ICMP,...)
-			ret =  (formatProtocol(read8(data_record + offset)));
-			*ret_len = strlen(ret);
-			return ret;
-		} else {
-			// Other elements
-			ret = u32toa_branchlut2(read8(data_record + offset), buffer);
-		}
-	} else if(length == BYTE2) {
-		// 2 bytes
-		if (element->en == 0 && element->id == 6 && config->tcpFlags) {
-			// Formated TCP flags
-			ret = formatFlags16(read16(data_record + offset));
-			*ret_len = 8;
-			return ret;
-		} else {
-			// Other elements
-			ret = u32toa_branchlut2(ntohs(read16(data_record + offset)), buffer);
-		}
-	} else if(length == BYTE4) {
-		// 4 bytes
-		ret = u32toa_branchlut2(ntohl(read32(data_record + offset)), buffer);
-	} else if(length == BYTE8) {
-		// 8 bytes
- 		ret = u64toa_branchlut2(be64toh(read64(data_record + offset)), buffer);
-	} else {
-		// Other sizes
-		*ret_len = snprintf(buffer, BUFF_SIZE, "%s", "\"unknown\"");
-		return buffer;
+	if (!isfinite(value)) {
+		memcpy(out, "null", 4);
+		return out + 4;
 	}
 
-	*ret_len = ret - buffer;
-	return buffer;
+	return out + snprintf(out, FLOAT_MAX_LEN, "%f", value);
 }
 
 /**
- * \brief Conversion of signed int
+ * \brief Format raw data
  */
-const char *Translator::toSigned(uint16_t length, uint16_t *ret_len, uint8_t *data_record, uint16_t offset)
+char *Translator::writeHex(char *out, const uint8_t *field, uint16_t length)
 {
-	// Calculate the length of returned string here to avoid unnecessary strlen later
-	const char *ret = NULL;
-	*ret_len = 0;
-
-	if(length == BYTE1) {
-		// 1 byte
-		ret = i32toa_branchlut2(read8(data_record + offset), buffer);
-	} else if(length == BYTE2) {
-		// 2 bytes
-		ret = i32toa_branchlut2(ntohs(read16(data_record + offset)), buffer);
-	} else if(length == BYTE4) {
-		// 4 bytes
-		ret = i32toa_branchlut2(ntohl(read32(data_record + offset)), buffer);
-	} else if(length == BYTE8) {
-		// 8 bytes
-		ret = i64toa_branchlut2(be64toh(read64(data_record + offset)), buffer);
-	} else {
-		*ret_len = snprintf(buffer, BUFF_SIZE, "\"unknown\"");
-		return buffer;
+	if (length == 0) {
+		memcpy(out, "null", 4);
+		return out + 4;
 	}
 
-	*ret_len = ret - buffer;
-	return buffer;
-}
+	/* Start the string with 0x and print the rest in hexa */
+	memcpy(out, "\"0x", 3);
+	out += 3;
+	for (uint16_t i = 0; i < length; ++i) {
+		out = u8tohex_branchlut2(field[i], out);
+	}
 
-/**
- * \brief Conversion of float
- */
-const char *Translator::toFloat(uint16_t length, uint16_t *ret_len, uint8_t *data_record, uint16_t offset)
-{
-	if(length == BYTE4)
-		*ret_len = snprintf(buffer, BUFF_SIZE, "%f", (float) ntohl(read32(data_record + offset)));
-	else if(length == BYTE8)
-		*ret_len = snprintf(buffer, BUFF_SIZE, "%lf", (double) be64toh(read64(data_record + offset)));
-	else
-		*ret_len = snprintf(buffer, BUFF_SIZE, "\"unknown\"");
-
-	return buffer;
+	*out++ = '"';
+	return out;
 }
 
 /**
  * \brief Convert string to JSON format
  */
-const char *Translator::escapeString(uint16_t length, const uint8_t *field,
+char *Translator::writeString(char *out, const uint8_t *field, uint16_t length,
 	const json_conf *config)
 {
-	uint32_t idx_output = 0;
-
 	#define ESCAPE_CHAR(ch) { \
-		buffer[idx_output++] = '\\'; \
-		buffer[idx_output++] = ch; \
+		*out++ = '\\'; \
+		*out++ = ch; \
+	}
+
+	#define ESCAPE_HEX(ch) { \
+		memcpy(out, "\\u00", 4); \
+		out = u8tohex_branchlut2(ch, out + 4); \
 	}
 
 	// Beginning of the string
-	buffer[idx_output++] = '"';
+	*out++ = '"';
 
 	for (uint32_t i = 0; i < length; ++i) {
-		// All characters from the extended part of ASCII must be escaped
-		if (field[i] > 0x7F) {
-			snprintf(&buffer[idx_output], 7, "\\u00%02x", field[i]);
-			idx_output += 6;
-			continue;
-		}
-
 		/*
 		 * Based on RFC 4627 (Section: 2.5. Strings):
 		 * Control characters (i.e. 0x00 - 0x1F), '"' and  '\' must be escaped
 		 * using "\"", "\\" or "\uXXXX" where "XXXX" is a hexa value.
 		 */
-		if (field[i] > 0x1F && field[i] != '"' && field[i] != '\\') {
+		if (field[i] > 0x1F && field[i] <= 0x7F && field[i] != '"' && field[i] != '\\') {
 			// Copy to the output buffer
-			buffer[idx_output++] = field[i];
+			*out++ = field[i];
+			continue;
+		}
+
+		// All characters from the extended part of ASCII must be escaped
+		if (field[i] > 0x7F) {
+			ESCAPE_HEX(field[i]);
 			continue;
 		}
 
@@ -344,16 +329,14 @@ const char *Translator::escapeString(uint16_t length, const uint8_t *field,
 			ESCAPE_CHAR('r');
 			break;
 		default: // "\uXXXX"
-			snprintf(&buffer[idx_output], 7, "\\u00%02x", field[i]);
-			idx_output += 6;
+			ESCAPE_HEX(field[i]);
 			break;
 		}
 	}
+	#undef ESCAPE_HEX
 	#undef ESCAPE_CHAR
 
 	// End of the string
-	buffer[idx_output++] = '"';
-	buffer[idx_output] = '\0';
-	return buffer;
+	*out++ = '"';
+	return out;
 }
-
@@ -48,6 +48,7 @@ extern "C" {
 #include <ipfixcol.h>
 #include <ipfixcol/profiles.h>
 #include <string.h>
+#include <time.h>
 //#include <ipfix_element.h>
 }
 
@@ -57,147 +58,134 @@ extern "C" {
 #define BYTE4 4
 #define BYTE8 8
 
-class Storage;
+/** Max. size of formatted unsigned/signed integer (including '\0') */
+#define INT_MAX_LEN 24
+/** Max. size of formatted floating point number (including '\0') */
+#define FLOAT_MAX_LEN 330
+/** Max. size of formatted timestamp (including quotes and '\0') */
+#define TIMESTAMP_MAX_LEN 32
+/** Max. size of formatted IPv6 address (including quotes and '\0') */
+#define IPV6_MAX_LEN 48
 
-enum class t_units {
-    SEC,
-    MILLISEC,
-    MICROSEC,
-    NANOSEC
-};
+class Storage;
 
+/**
+ * All functions write formatted values to the position given by the caller
+ * and return the position after the last written character. The caller is
+ * responsible for the space in the buffer.
+ */
 class Translator {
 public:
 	/** Constructor */
 	Translator();
 
-	/** Destructor */
-	~Translator();
-
-    /**
-     * \brief Format IPv4 address into dotted format
-     * 
-     * @param addr address
-     * @param ret_len pointer to return length of generated string
-     * @return formatted address
-     */
-	const char *formatIPv4(uint32_t addr, uint16_t *ret_len);
-
-    /**
-     * \brief Format IPv6 address
-     * 
-     * @param addr address
-     * @return formatted address
-     */
-	const char *formatIPv6(uint8_t *addr);
-    
-    /**
-     * \brief Format MAC address
-     * 
-     * @param addr address
-     * @return formatted address
-     */
-	const char *formatMac(uint8_t *addr);
-    
-    /**
-     * \brief Format timestamp
-     * 
-     * @param tstamp timestamp
-     * @param units time units
-     * @return  formatted timestamp
-     */
-	const char *formatTimestamp(uint64_t tstamp, t_units units, struct json_conf * config);
-    
-    /**
-     * \brief Format protocol
-     * 
-     * @param proto protocol
-     * @return formatted protocol
-     */
-	const char *formatProtocol(uint8_t proto); 
-    
-    /**
-     * \brief Format TCP flags 16bits
-     * 
-     * @param flags
-     * @return formatted flags
-     */
-	const char *formatFlags16(uint16_t flags);
-
-    /**
-     * \brief Format TCP flags 8bits
-     *
-     * @param flags
-     * @return formatted flags
-     */
-	const char *formatFlags8(uint8_t flags);
-
-    /**
-     * \brief Checks, if real length of record is the same as its data type. If not, converts to real length.
-     *
-     * @param length length of record
-     * @param ret_len pointer to return length of generated string
-     * @param data_record pointer to head of data record
-     * @param offset offset since head of data record
-     * @param element pointer to actuall element in record
-     * @param config pointer to configuration structure
-     * @return value of Unsigned int
-     */
-	const char *toUnsigned(uint16_t length, uint16_t *ret_len, uint8_t *data_record, uint16_t offset, const ipfix_element_t * element, struct json_conf * config);
-
-    /**
-     * \brief Checks, if real length of record is the same as its data type. If not, converts to real length.
-     *
-     * @param length length of record
-     * @param ret_len pointer to return length of generated string
-     * @param data_record pointer to head of data record
-     * @param offset offset since head of data record
-     * @return value of Signed int
-     */
-	const char *toSigned(uint16_t length, uint16_t *ret_len, uint8_t *data_record, uint16_t offset);
-
-    /**
-     * \brief Checks, if real length of record is the same as its data type. If not, converts to real length.
-     *
-     * @param length length of record
-     * @param ret_len pointer to return length of generated string
-     * @param data_record pointer to head of data record
-     * @param offset offset since head of data record
-     * @return value of Float
-     */
-	const char *toFloat(uint16_t length, uint16_t *ret_len, uint8_t *data_record, uint16_t offset);
+	/**
+	 * \brief Format IPv4 address into dotted format
+	 *
+	 * @param out output position
+	 * @param addr address (network byte order)
+	 * @return end of the output
+	 */
+	char *writeIPv4(char *out, const uint8_t *addr);
+
+	/**
+	 * \brief Format IPv6 address (RFC 5952)
+	 *
+	 * @param out output position
+	 * @param addr address (network byte order)
+	 * @return end of the output
+	 */
+	char *writeIPv6(char *out, const uint8_t *addr);
+
+	/**
+	 * \brief Format MAC address
+	 *
+	 * @param out output position
+	 * @param addr address
+	 * @return end of the output
+	 */
+	char *writeMac(char *out, const uint8_t *addr);
+
+	/**
+	 * \brief Format timestamp in local time as a quoted string
+	 *
+	 * Broken-down time of the last second is cached, so records from the
+	 * same second need only the milliseconds to be formatted.
+	 * @param out output position
+	 * @param msec milliseconds since the epoch
+	 * @return end of the output
+	 */
+	char *writeTimestamp(char *out, uint64_t msec);
+
+	/**
+	 * \brief Format protocol as a quoted name
+	 *
+	 * @param out output position
+	 * @param proto protocol
+	 * @return end of the output
+	 */
+	char *writeProtocol(char *out, uint8_t proto);
+
+	/**
+	 * \brief Format TCP flags as a quoted string
+	 *
+	 * @param out output position
+	 * @param flags flags
+	 * @return end of the output
+	 */
+	char *writeFlags(char *out, uint8_t flags);
+
+	/**
+	 * \brief Format floating point number
+	 *
+	 * Values that cannot be represented in JSON are written as null.
+	 * @param out output position
+	 * @param value number
+	 * @return end of the output
+	 */
+	char *writeFloat(char *out, double value);
+
+	/**
+	 * \brief Format raw data as a quoted hexadecimal string
+	 *
+	 * Empty field is written as null.
+	 * @param out output position (at most 2 * length + 4 characters)
+	 * @param field pointer to the field
+	 * @param length length of the field
+	 * @return end of the output
+	 */
+	char *writeHex(char *out, const uint8_t *field, uint16_t length);
 
 	/**
 	 * \brief Convert string to JSON format
 	 *
 	 * Escape non-printable characters and replace them.
-	 * @param length Length of the field
-	 * @param field Pointer to the field
-	 * @param config Plugin configuration
-	 * @return
+	 * @param out output position (at most 6 * length + 2 characters)
+	 * @param field pointer to the field
+	 * @param length length of the field
+	 * @param config plugin configuration
+	 * @return end of the output
 	 */
-	const char *escapeString(uint16_t length, const uint8_t *field,
+	char *writeString(char *out, const uint8_t *field, uint16_t length,
 		const struct json_conf *config);
 
-private:
 	/**
-	 * \brief Size of internal buffer for data conversion
-	 *
-	 * This buffer is used by all conversion functions for storing string
-	 * outputs. At worst Translator::escapeString() have to convert an
-	 * IPFIX record (max size of IPFIX message: 65536) of a string record that
-	 * contains only non-printable characters that will be replaced with
-	 * string "\uXXXX" (6) each.
+	 * \brief Get max. size of formatted protocol (including quotes)
 	 */
-	static const int BUFF_SIZE = (65536 * 6);
-
-	/** Buffer for JSON conversion */
-	char *buffer;
+	size_t protocolMaxLength() const { return proto_max; }
 
-	struct tm *tm{};
-	time_t timesec{};
-	uint64_t msec{};
+private:
+	/** Lengths of protocol names */
+	uint8_t proto_len[256];
+	/** Max. length of protocol name */
+	size_t proto_max{0};
+
+	/** Second of the cached timestamp */
+	time_t cached_sec{0};
+	/** Quote and formatted date and time of the cached second */
+	char cached_time[20];
+	/** The cached second is valid */
+	bool cached_valid{false};
 };
 
 #endif	/* TRANSLATOR_H */
-
@@ -101,4 +101,45 @@ i64toa_branchlut2(int64_t x, char* p)
     return u64toa_branchlut2(t, p);
 }
 
+static inline char *
+u2toa_branchlut2(uint32_t x, char* p)
+{
+    /* Exactly two digits, x must be less than 100 */
+    MIDDLE2(x);
+    return p;
+}
+
+/**
+ * Hexadecimal counterparts of the functions above
+ */
+
+const char gHexLut[513] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+static inline char *
+u8tohex_branchlut2(uint8_t x, char* p)
+{
+    p[0] = gHexLut[2 * x];
+    p[1] = gHexLut[2 * x + 1];
+    return p + 2;
+}
+
+static inline char *
+u16tohex_branchlut2(uint16_t x, char* p)
+{
+    /* No leading zeros */
+    if(x >= 0x1000) *p++ = gHexLut[2 * (x >> 12) + 1];
+    if(x >= 0x100) *p++ = gHexLut[2 * ((x >> 8) & 0xf) + 1];
+    if(x >= 0x10) *p++ = gHexLut[2 * ((x >> 4) & 0xf) + 1];
+    *p++ = gHexLut[2 * (x & 0xf) + 1];
+    return p;
+}
+
 #endif /* BRANCHLUT_H */
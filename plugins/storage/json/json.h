@@ -67,6 +67,19 @@ struct json_conf {
 	std::string prefix;  /**< Prefix for IPFIX elements */
 };
 
+/**
+ * \brief Serialized records passed to outputs at once
+ *
+ * Records are stored one after another in a single buffer and each of them
+ * ends with a new line character.
+ */
+struct RecordBatch {
+	const char *data;    /**< Records */
+	size_t size;         /**< Size of all records */
+	const size_t *ends;  /**< End offset of each record */
+	size_t count;        /**< Number of records */
+};
+
 class Output
 {
 public:
@@ -74,7 +87,7 @@ public:
 	Output(const pugi::xpath_node& config);
 	virtual ~Output() {}
 
-	virtual void ProcessDataRecord(const std::string& record) = 0;
+	virtual void ProcessDataBatch(const RecordBatch &batch) = 0;
 };
 
 #endif // JSON_H
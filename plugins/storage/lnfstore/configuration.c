@@ -60,6 +60,7 @@ extern const char *msg_module;
 #define BF_DEFAULT_ITEM_CNT_EST 100000
 
 #define WINDOW_SIZE             300U
+#define WRITER_THREADS_MAX      64U
 
 /**
  * \brief Compare a value of a node with string boolen value
@@ -395,6 +396,25 @@ configuration_match(xmlDocPtr doc, xmlNodePtr cur, struct conf_params *cfg)
 		return 0;
 	}
 
+	if (!xmlStrcasecmp(cur->name, (const xmlChar*) "writerThreads")) {
+		// Number of writer threads
+		uint64_t result;
+		if (xml_convert_number(doc, cur, &result)) {
+			MSG_ERROR(msg_module, "Configuration error - invalid value of "
+				"<writerThreads> (expected unsigned integer).");
+			return 1;
+		}
+
+		if (result > WRITER_THREADS_MAX) {
+			MSG_ERROR(msg_module, "Configuration error - invalid value of "
+				"<writerThreads> (maximum is %u).", WRITER_THREADS_MAX);
+			return 1;
+		}
+
+		cfg->writer.threads = (uint32_t) result;
+		return 0;
+	}
+
 	if (!xmlStrcasecmp(cur->name, (const xmlChar*) "dumpInterval")) {
 		// Get dump interval configuration
 		xmlNodePtr cur_sub = cur->xmlChildrenNode;
@@ -88,6 +88,11 @@ struct conf_params {
                             * profiles. When it is enabled, files.path is
                             * ignored                                        */
 	} profiles; /**< Profiles configuration                                  */
+
+	struct {
+		uint32_t threads; /**< Number of writer threads (0 = records are
+                            *  written by the storage thread)                */
+	} writer;   /**< Writer threads configuration                            */
 };
 
 /**
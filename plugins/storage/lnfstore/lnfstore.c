@@ -90,20 +90,38 @@ storage_init (char *params, void **config) {
 		return 1;
 	}
 
+	// Start writer threads
+	if (conf->params->writer.threads > 0) {
+		conf->workers = stg_workers_create(conf->params->writer.threads);
+		if (!conf->workers) {
+			MSG_ERROR(msg_module, "Failed to start writer threads.", NULL);
+			translator_destroy(conf->record.translator);
+			lnf_rec_free(conf->record.rec_ptr);
+			configuration_free(parsed_params);
+			free(conf);
+			return 1;
+		}
+	}
+
 	// Init basic/profile file storage
 	if (conf->params->profiles.en) {
-		conf->storage.profiles = stg_profiles_create(parsed_params);
+		conf->storage.profiles = stg_profiles_create(parsed_params,
+			conf->workers);
 	} else {
-		conf->storage.basic = stg_basic_create(parsed_params);
+		conf->storage.basic = stg_basic_create(parsed_params, conf->workers);
 	}
 
 	if (!conf->storage.basic && !conf->storage.profiles) {
 		MSG_ERROR(msg_module, "Failed to initialize an internal structure "
 			"for file storage(s).", NULL);
+		if (conf->workers) {
+			stg_workers_destroy(conf->workers);
+		}
 		translator_destroy(conf->record.translator);
 		lnf_rec_free(conf->record.rec_ptr);
 		configuration_free(parsed_params);
 		free(conf);
+		return 1;
 	}
 
 	// Save the configuration
@@ -153,8 +171,12 @@ store_packet (void *config, const struct ipfix_message *ipfix_msg,
 			continue;
 		}
 
-		// Fill record
+		// Fill record (directly in a batch of the writer threads)
 		lnf_rec_t *rec = conf->record.rec_ptr;
+		if (conf->workers) {
+			rec = stg_workers_record(conf->workers);
+		}
+
 		if (translator_translate(conf->record.translator, mdata, rec) <= 0) {
 			// Nothing to store
 			continue;
@@ -167,6 +189,11 @@ store_packet (void *config, const struct ipfix_message *ipfix_msg,
 			// Basic mode
 			stg_basic_store(conf->storage.basic, rec);
 		}
+
+		if (conf->workers) {
+			// Pass the record to the writer threads
+			stg_workers_commit(conf->workers);
+		}
 	}
 
 	return 0;
@@ -187,13 +214,17 @@ storage_close (void **config)
 	MSG_DEBUG(msg_module, "Closing...");
 	struct conf_lnfstore *conf = (struct conf_lnfstore *) *config;
 
-	// Destroy mode resources
+	// Destroy mode resources (remaining records are written first)
 	if (conf->params->profiles.en) {
 		stg_profiles_destroy(conf->storage.profiles);
 	} else {
 		stg_basic_destroy(conf->storage.basic);
 	}
 
+	if (conf->workers) {
+		stg_workers_destroy(conf->workers);
+	}
+
 	// Destroy a translator and a record
 	translator_destroy(conf->record.translator);
 	lnf_rec_free(conf->record.rec_ptr);
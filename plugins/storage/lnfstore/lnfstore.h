@@ -49,6 +49,7 @@
 #include "configuration.h"
 #include "storage_basic.h"
 #include "storage_profiles.h"
+#include "storage_workers.h"
 #include "translator.h"
 
 extern const char *msg_module;
@@ -68,6 +69,9 @@ struct conf_lnfstore {
 		stg_profiles_t *profiles; /**< Store records based on profiles       */
 	} storage; /**< Only one type of storage is initialized at the same time */
 
+	/** Writer threads (NULL if records are written by the storage thread)   */
+	stg_workers_t *workers;
+
 	struct {
 		lnf_rec_t *rec_ptr;       /**< LNF record (converted IPFIX record)   */
 		translator_t *translator; /**< IPFIX to LNF translator               */
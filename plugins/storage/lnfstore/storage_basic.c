@@ -49,11 +49,13 @@ struct stg_basic_s {
 	/** Pointer to the plugin configuration */
 	const struct conf_params *params;
 	files_mgr_t *mgr; /**< Output files     */
+	/** Writer threads (can be NULL) */
+	stg_workers_t *workers;
 };
 
 
 stg_basic_t *
-stg_basic_create(const struct conf_params *params)
+stg_basic_create(const struct conf_params *params, stg_workers_t *workers)
 {
 	// Prepare the internal structure
 	stg_basic_t *instance = (stg_basic_t *) calloc(1, sizeof(*instance));
@@ -73,12 +75,17 @@ stg_basic_create(const struct conf_params *params)
 
 	instance->params = params;
 	instance->mgr = mgr;
+	instance->workers = workers;
 	return instance;
 }
 
 void
 stg_basic_destroy(stg_basic_t *storage)
 {
+	if (storage->workers) {
+		stg_workers_sync(storage->workers);
+	}
+
 	files_mgr_destroy(storage->mgr);
 	free(storage);
 }
@@ -86,12 +93,22 @@ stg_basic_destroy(stg_basic_t *storage)
 int
 stg_basic_store(stg_basic_t *storage, lnf_rec_t *rec)
 {
+	if (storage->workers) {
+		// All records are written by the first thread
+		return stg_workers_target(storage->workers, storage->mgr, 0);
+	}
+
 	return files_mgr_add_record(storage->mgr, rec);
 }
 
 int
 stg_basic_new_window(stg_basic_t *storage, time_t window)
 {
+	if (storage->workers) {
+		// Records of the previous window must be written first
+		stg_workers_sync(storage->workers);
+	}
+
 	// Check if the output directory already exists
 	const char *dir_path = storage->params->files.path;
 	if (stg_common_dir_exists(dir_path)) {
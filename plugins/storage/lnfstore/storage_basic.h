@@ -41,6 +41,7 @@
 #define LS_STORAGE_BASIC_H
 
 #include "configuration.h"
+#include "storage_workers.h"
 #include <libnf.h>
 #include <ipfixcol.h>
 
@@ -51,11 +52,13 @@ typedef struct stg_basic_s stg_basic_t;
 
 /**
  * \brief Create a basic storage
- * \param[in] params Parameters of this plugin instance
+ * \param[in] params  Parameters of this plugin instance
+ * \param[in] workers Writer threads (can be NULL, records are written
+ *   immediately by stg_basic_store())
  * \return On success returns a pointer to the storage. Otherwise returns NULL.
  */
 stg_basic_t *
-stg_basic_create(const struct conf_params *params);
+stg_basic_create(const struct conf_params *params, stg_workers_t *workers);
 
 /**
  * \brief Delete a basic storage
@@ -68,6 +71,9 @@ stg_basic_destroy(stg_basic_t *storage);
 
 /**
  * \brief Store a LNF record to a storage
+ *
+ * If writer threads are used, the record MUST be the current record of the
+ * threads and it is only assigned to the output files.
  * \param[in,out] storage Storage
  * \param[in]     rec     LNF record
  * \return On success returns 0. Otherwise (failed to write to any of output
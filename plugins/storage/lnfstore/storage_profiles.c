@@ -62,6 +62,11 @@ struct stg_profiles_global {
 
 	/** Operation status (returns status of selected callbacks) */
 	int op_status;
+
+	/** Writer threads (NULL if records are written immediately) */
+	stg_workers_t *workers;
+	/** Writer thread of the next new channel */
+	unsigned int next_thread;
 };
 
 /**
@@ -74,6 +79,8 @@ struct stg_profiles_chnl_local {
 	 *  etc.
 	 */
 	files_mgr_t *manager;
+	/** Writer thread that writes records of this channel */
+	unsigned int thread;
 };
 
 /**
@@ -137,6 +144,20 @@ channel_get_dirname(void *channel)
 	return out_dir;
 }
 
+/**
+ * \brief Wait until the writer threads finish all assigned records
+ *
+ * Must be called before any files manager is modified or destroyed.
+ * \param[in] global Global structure shared among all channels
+ */
+static void
+channel_storage_sync(const struct stg_profiles_global *global)
+{
+	if (global->workers) {
+		stg_workers_sync(global->workers);
+	}
+}
+
 /**
  * \brief Close a channel's storage
  *
@@ -384,6 +405,10 @@ channel_create_cb(struct pevents_ctx *ctx)
 		return NULL;
 	}
 
+	// Channels are distributed among writer threads
+	struct stg_profiles_global *global = ctx->user.global;
+	local_data->thread = global->next_thread++;
+
 	void *profile = channel_get_profile(ctx->ptr.channel);
 	const enum PROFILE_TYPE type = profile_get_type(profile);
 	if (type != PT_NORMAL) {
@@ -419,6 +444,7 @@ channel_delete_cb(struct pevents_ctx *ctx)
 	struct stg_profiles_chnl_local *local_data;
 	local_data = (struct stg_profiles_chnl_local *) ctx->user.local;
 	if (local_data != NULL) {
+		channel_storage_sync(ctx->user.global);
 		channel_storage_close(local_data);
 		free(local_data);
 	}
@@ -455,6 +481,9 @@ channel_update_cb(struct pevents_ctx *ctx, uint16_t flags)
 		return;
 	}
 
+	// The files manager can be replaced or closed
+	channel_storage_sync(ctx->user.global);
+
 	void *profile = channel_get_profile(channel_ptr);
 	const enum PROFILE_TYPE type = profile_get_type(profile);
 
@@ -504,6 +533,14 @@ channel_data_cb(struct pevents_ctx *ctx, void *data)
 		return;
 	}
 
+	struct stg_profiles_global *global = ctx->user.global;
+	if (global->workers) {
+		// The record will be written by the writer thread of the channel
+		stg_workers_target(global->workers, local_data->manager,
+			local_data->thread);
+		return;
+	}
+
 	lnf_rec_t *rec_ptr = data;
 	int ret = files_mgr_add_record(local_data->manager, rec_ptr);
 	if (ret != 0) {
@@ -559,7 +596,7 @@ channel_new_window(struct pevents_ctx *ctx)
 }
 
 stg_profiles_t *
-stg_profiles_create(const struct conf_params *params)
+stg_profiles_create(const struct conf_params *params, stg_workers_t *workers)
 {
 	// Prepare an internal structure
 	stg_profiles_t *mgr = (stg_profiles_t *) calloc(1, sizeof(*mgr));
@@ -570,6 +607,7 @@ stg_profiles_create(const struct conf_params *params)
 	}
 
 	mgr->global.params = params;
+	mgr->global.workers = workers;
 
 	// Initialize an array of callbacks
 	struct pevent_cb_set channel_cb;
@@ -599,6 +637,7 @@ void
 stg_profiles_destroy(stg_profiles_t *storage)
 {
 	// Destroy a profile manager and close all files (delete callback)
+	channel_storage_sync(&storage->global);
 	pevents_destroy(storage->event_mgr);
 	free(storage);
 }
@@ -618,6 +657,9 @@ stg_profiles_new_window(stg_profiles_t *storage, time_t window)
 	storage->global.window_start = window;
 	storage->global.op_status = 0;
 
+	// Records of the previous window must be written first
+	channel_storage_sync(&storage->global);
+
 	// If the main storage directory is specified, check if it exists
 	const char *main_dir = storage->global.params->files.path;
 	if (main_dir != NULL && stg_common_dir_exists(main_dir) != 0) {
@@ -42,6 +42,7 @@
 
 #include <libnf.h>
 #include "configuration.h"
+#include "storage_workers.h"
 
 /**
  * \brief Internal type
@@ -50,11 +51,14 @@ typedef struct stg_profiles_s stg_profiles_t;
 
 /**
  * \brief Create a profile storage
- * \param[in] params Parameters of this plugin instance
+ * \param[in] params  Parameters of this plugin instance
+ * \param[in] workers Writer threads (can be NULL, records are written
+ *   immediately by stg_profiles_store()). Channels are assigned to the
+ *   threads in round-robin fashion.
  * \return On success returns a pointer to the storage. Otherwise returns NULL.
  */
 stg_profiles_t *
-stg_profiles_create(const struct conf_params *params);
+stg_profiles_create(const struct conf_params *params, stg_workers_t *workers);
 
 /**
  * \brief Delete a profile storage
@@ -67,6 +71,9 @@ stg_profiles_destroy(stg_profiles_t *storage);
 
 /**
  * \brief Store a LNF record to a storage
+ *
+ * If writer threads are used, the record MUST be the current record of the
+ * threads and it is only assigned to the output files of its channels.
  * \param[in,out] storage Storage
  * \param[in]     rec     LNF record
  * \return On success (all channels have been found) returns 0. Otherwise
@@ -0,0 +1,467 @@
+/**
+ * \file storage_workers.c
+ * \brief Pool of threads writing records to output files (source file)
+ *
+ * Copyright (C) 2015-2017 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <ipfixcol.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage_workers.h"
+#include "lnfstore.h"
+
+/** Number of records in one batch */
+#define WORKERS_BATCH_SIZE (1024U)
+/** Number of batches per thread */
+#define WORKERS_BATCH_PER_THREAD (2U)
+
+/**
+ * \brief Destination of a record
+ */
+struct workers_target {
+	files_mgr_t *mgr;    /**< Files manager                                  */
+	unsigned int thread; /**< Index of the thread that writes to the manager */
+};
+
+/**
+ * \brief Batch of records shared by all threads
+ */
+struct workers_batch {
+	/** Records */
+	lnf_rec_t *recs[WORKERS_BATCH_SIZE];
+	/** Index of the first destination of each record (the last item is the
+	 *  end of destinations of the last record) */
+	uint32_t first[WORKERS_BATCH_SIZE + 1];
+	/** Number of committed records */
+	uint32_t rec_cnt;
+
+	struct workers_target *targets; /**< Destinations of all records         */
+	size_t target_cnt;              /**< Number of destinations              */
+	size_t target_max;              /**< Size of the array of destinations   */
+
+	/** Number of threads that haven't processed the batch yet */
+	unsigned int refs;
+	/** Next free batch */
+	struct workers_batch *next;
+};
+
+/**
+ * \brief Writer thread
+ */
+struct workers_thread {
+	stg_workers_t *pool;  /**< Parent pool                                   */
+	unsigned int idx;     /**< Index of the thread                           */
+	pthread_t thread;     /**< Thread                                        */
+	uint64_t pos;         /**< Sequence number of the next batch to process  */
+	/** Private copy of a record (lnf_write() is not guaranteed to keep the
+	 *  record untouched, so the threads must not write the shared one) */
+	lnf_rec_t *rec;
+};
+
+/**
+ * \brief Internal structure of the pool
+ */
+struct stg_workers_s {
+	unsigned int count;              /**< Number of threads                  */
+	unsigned int started;            /**< Number of running threads          */
+	struct workers_thread *threads;  /**< Threads                            */
+
+	unsigned int batch_cnt;          /**< Number of batches                  */
+	struct workers_batch *batches;   /**< All batches                        */
+	struct workers_batch *current;   /**< Batch being filled (can be NULL)   */
+
+	/** Submitted batches in order of submission (indexed by sequence number
+	 *  modulo batch_cnt) */
+	struct workers_batch **ring;
+	uint64_t head;                   /**< Sequence number of the next batch  */
+
+	struct workers_batch *free;      /**< Free batches                       */
+	unsigned int free_cnt;           /**< Number of free batches             */
+
+	bool stop;                       /**< Stop the threads when idle         */
+	pthread_mutex_t lock;            /**< Protects all fields above          */
+	pthread_cond_t cond_work;        /**< New batch or stop request          */
+	pthread_cond_t cond_free;        /**< A batch has been returned          */
+};
+
+/**
+ * \brief Write records of a batch assigned to a thread
+ * \param[in,out] thread Writer thread
+ * \param[in]     batch  Batch
+ */
+static void
+workers_process(struct workers_thread *thread, struct workers_batch *batch)
+{
+	const bool shared = (thread->pool->count > 1);
+
+	for (uint32_t r = 0; r < batch->rec_cnt; r++) {
+		lnf_rec_t *rec = NULL;
+
+		for (uint32_t i = batch->first[r]; i < batch->first[r + 1]; i++) {
+			const struct workers_target *target = &batch->targets[i];
+			if (target->thread != thread->idx) {
+				continue;
+			}
+
+			if (!rec) {
+				// Only one thread can use the original record
+				rec = batch->recs[r];
+				if (shared) {
+					lnf_rec_copy(thread->rec, rec);
+					rec = thread->rec;
+				}
+			}
+
+			if (files_mgr_add_record(target->mgr, rec) != 0) {
+				MSG_DEBUG(msg_module, "Failed to store a record (writer "
+					"thread %u).", thread->idx);
+			}
+		}
+	}
+}
+
+/**
+ * \brief Main function of a writer thread
+ * \param[in,out] arg Writer thread
+ * \return NULL
+ */
+static void *
+workers_main(void *arg)
+{
+	struct workers_thread *thread = (struct workers_thread *) arg;
+	stg_workers_t *pool = thread->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (thread->pos == pool->head && !pool->stop) {
+			pthread_cond_wait(&pool->cond_work, &pool->lock);
+		}
+
+		if (thread->pos == pool->head) {
+			// Stop request and nothing to do
+			break;
+		}
+
+		struct workers_batch *batch = pool->ring[thread->pos % pool->batch_cnt];
+		thread->pos++;
+		pthread_mutex_unlock(&pool->lock);
+
+		workers_process(thread, batch);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--batch->refs == 0) {
+			// The last thread returns the batch
+			batch->next = pool->free;
+			pool->free = batch;
+			pool->free_cnt++;
+			pthread_cond_signal(&pool->cond_free);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/**
+ * \brief Get a free batch (wait for it if necessary)
+ * \param[in,out] pool Pool
+ * \return Empty batch
+ */
+static struct workers_batch *
+workers_batch_get(stg_workers_t *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->free) {
+		pthread_cond_wait(&pool->cond_free, &pool->lock);
+	}
+
+	struct workers_batch *batch = pool->free;
+	pool->free = batch->next;
+	pool->free_cnt--;
+	pthread_mutex_unlock(&pool->lock);
+
+	batch->rec_cnt = 0;
+	batch->target_cnt = 0;
+	batch->first[0] = 0;
+	batch->next = NULL;
+	return batch;
+}
+
+/**
+ * \brief Pass a batch to all threads
+ *
+ * Batches are freed in the order of submission (every thread processes them
+ * in order), so the slot of the ring is always free.
+ * \param[in,out] pool  Pool
+ * \param[in]     batch Batch
+ */
+static void
+workers_batch_submit(stg_workers_t *pool, struct workers_batch *batch)
+{
+	pthread_mutex_lock(&pool->lock);
+	batch->refs = pool->count;
+	pool->ring[pool->head % pool->batch_cnt] = batch;
+	pool->head++;
+	pthread_cond_broadcast(&pool->cond_work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * \brief Free all batches and private records of the threads
+ * \param[in,out] pool Pool
+ */
+static void
+workers_free(stg_workers_t *pool)
+{
+	if (pool->batches) {
+		for (unsigned int i = 0; i < pool->batch_cnt; i++) {
+			struct workers_batch *batch = &pool->batches[i];
+			for (uint32_t r = 0; r < WORKERS_BATCH_SIZE; r++) {
+				if (batch->recs[r]) {
+					lnf_rec_free(batch->recs[r]);
+				}
+			}
+			free(batch->targets);
+		}
+	}
+
+	if (pool->threads) {
+		for (unsigned int i = 0; i < pool->count; i++) {
+			if (pool->threads[i].rec) {
+				lnf_rec_free(pool->threads[i].rec);
+			}
+		}
+	}
+
+	free(pool->ring);
+	free(pool->batches);
+	free(pool->threads);
+	free(pool);
+}
+
+stg_workers_t *
+stg_workers_create(unsigned int count)
+{
+	stg_workers_t *pool = calloc(1, sizeof(*pool));
+	if (!pool) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)",
+			__FILE__, __LINE__);
+		return NULL;
+	}
+
+	pool->count = count;
+	pool->batch_cnt = count * WORKERS_BATCH_PER_THREAD + 1;
+	pool->threads = calloc(pool->count, sizeof(*pool->threads));
+	pool->batches = calloc(pool->batch_cnt, sizeof(*pool->batches));
+	pool->ring = calloc(pool->batch_cnt, sizeof(*pool->ring));
+	if (!pool->threads || !pool->batches || !pool->ring) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)",
+			__FILE__, __LINE__);
+		workers_free(pool);
+		return NULL;
+	}
+
+	// Prepare batches
+	for (unsigned int i = 0; i < pool->batch_cnt; i++) {
+		struct workers_batch *batch = &pool->batches[i];
+		for (uint32_t r = 0; r < WORKERS_BATCH_SIZE; r++) {
+			if (lnf_rec_init(&batch->recs[r]) != LNF_OK) {
+				MSG_ERROR(msg_module, "Failed to initialize a LNF record.");
+				workers_free(pool);
+				return NULL;
+			}
+		}
+
+		batch->target_max = 2 * WORKERS_BATCH_SIZE;
+		batch->targets = malloc(batch->target_max * sizeof(*batch->targets));
+		if (!batch->targets) {
+			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)",
+				__FILE__, __LINE__);
+			workers_free(pool);
+			return NULL;
+		}
+
+		batch->next = pool->free;
+		pool->free = batch;
+		pool->free_cnt++;
+	}
+
+	for (unsigned int i = 0; i < pool->count; i++) {
+		if (lnf_rec_init(&pool->threads[i].rec) != LNF_OK) {
+			MSG_ERROR(msg_module, "Failed to initialize a LNF record.");
+			workers_free(pool);
+			return NULL;
+		}
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond_work, NULL);
+	pthread_cond_init(&pool->cond_free, NULL);
+
+	// Start threads
+	for (unsigned int i = 0; i < pool->count; i++) {
+		struct workers_thread *thread = &pool->threads[i];
+		thread->pool = pool;
+		thread->idx = i;
+
+		if (pthread_create(&thread->thread, NULL, &workers_main, thread) != 0) {
+			MSG_ERROR(msg_module, "Failed to start a writer thread.");
+			// Stop already running threads
+			stg_workers_destroy(pool);
+			return NULL;
+		}
+
+		pool->started++;
+	}
+
+	MSG_INFO(msg_module, "Records are written by %u writer thread(s).", count);
+	return pool;
+}
+
+void
+stg_workers_destroy(stg_workers_t *workers)
+{
+	stg_workers_sync(workers);
+
+	pthread_mutex_lock(&workers->lock);
+	workers->stop = true;
+	pthread_cond_broadcast(&workers->cond_work);
+	pthread_mutex_unlock(&workers->lock);
+
+	for (unsigned int i = 0; i < workers->started; i++) {
+		pthread_join(workers->threads[i].thread, NULL);
+	}
+
+	pthread_cond_destroy(&workers->cond_free);
+	pthread_cond_destroy(&workers->cond_work);
+	pthread_mutex_destroy(&workers->lock);
+	workers_free(workers);
+}
+
+unsigned int
+stg_workers_count(const stg_workers_t *workers)
+{
+	return workers->count;
+}
+
+lnf_rec_t *
+stg_workers_record(stg_workers_t *workers)
+{
+	if (!workers->current) {
+		workers->current = workers_batch_get(workers);
+	}
+
+	struct workers_batch *batch = workers->current;
+	return batch->recs[batch->rec_cnt];
+}
+
+int
+stg_workers_target(stg_workers_t *workers, files_mgr_t *mgr,
+	unsigned int thread)
+{
+	struct workers_batch *batch = workers->current;
+	if (!batch) {
+		// stg_workers_record() hasn't been called
+		return 1;
+	}
+
+	if (batch->target_cnt == batch->target_max) {
+		size_t new_max = 2 * batch->target_max;
+		struct workers_target *new_targets;
+		new_targets = realloc(batch->targets, new_max * sizeof(*new_targets));
+		if (!new_targets) {
+			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)",
+				__FILE__, __LINE__);
+			return 1;
+		}
+
+		batch->targets = new_targets;
+		batch->target_max = new_max;
+	}
+
+	struct workers_target *target = &batch->targets[batch->target_cnt++];
+	target->mgr = mgr;
+	target->thread = thread % workers->count;
+	return 0;
+}
+
+void
+stg_workers_commit(stg_workers_t *workers)
+{
+	struct workers_batch *batch = workers->current;
+	if (!batch || batch->target_cnt == batch->first[batch->rec_cnt]) {
+		// No destinations -> the record will be overwritten
+		return;
+	}
+
+	batch->rec_cnt++;
+	batch->first[batch->rec_cnt] = batch->target_cnt;
+
+	if (batch->rec_cnt == WORKERS_BATCH_SIZE) {
+		workers_batch_submit(workers, batch);
+		workers->current = NULL;
+	}
+}
+
+void
+stg_workers_sync(stg_workers_t *workers)
+{
+	struct workers_batch *batch = workers->current;
+	if (batch) {
+		// Drop destinations of the uncommitted record
+		batch->target_cnt = batch->first[batch->rec_cnt];
+	}
+
+	if (batch && batch->rec_cnt > 0) {
+		// Move the uncommitted record to a new batch and submit the old one
+		struct workers_batch *new_batch = workers_batch_get(workers);
+		lnf_rec_t *tmp = new_batch->recs[0];
+		new_batch->recs[0] = batch->recs[batch->rec_cnt];
+		batch->recs[batch->rec_cnt] = tmp;
+
+		workers_batch_submit(workers, batch);
+		workers->current = new_batch;
+	}
+
+	// Wait until all submitted batches are processed
+	const unsigned int expected = workers->batch_cnt - (workers->current ? 1 : 0);
+	pthread_mutex_lock(&workers->lock);
+	while (workers->free_cnt < expected) {
+		pthread_cond_wait(&workers->cond_free, &workers->lock);
+	}
+	pthread_mutex_unlock(&workers->lock);
+}
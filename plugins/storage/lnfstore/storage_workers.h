@@ -0,0 +1,130 @@
+/**
+ * \file storage_workers.h
+ * \brief Pool of threads writing records to output files (header file)
+ *
+ * Copyright (C) 2015-2017 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef LS_STORAGE_WORKERS_H
+#define LS_STORAGE_WORKERS_H
+
+#include <libnf.h>
+#include "files_manager.h"
+
+/**
+ * \brief Internal type
+ */
+typedef struct stg_workers_s stg_workers_t;
+
+/**
+ * \brief Create a pool of writer threads
+ *
+ * Records are collected into batches. Each batch is shared by all threads
+ * (the last thread that finishes the batch returns it to the pool) and every
+ * thread writes records only to output files that are assigned to it. Thus,
+ * records of one files manager are always written by the same thread and
+ * in the original order.
+ *
+ * \param[in] count Number of threads
+ * \return On success returns a pointer to the pool. Otherwise returns NULL.
+ */
+stg_workers_t *
+stg_workers_create(unsigned int count);
+
+/**
+ * \brief Destroy a pool of writer threads
+ *
+ * All collected records are written before the threads are stopped.
+ * \param[in,out] workers Pool
+ */
+void
+stg_workers_destroy(stg_workers_t *workers);
+
+/**
+ * \brief Get the number of threads in a pool
+ * \param[in] workers Pool
+ * \return Number of threads
+ */
+unsigned int
+stg_workers_count(const stg_workers_t *workers);
+
+/**
+ * \brief Get a record to fill
+ *
+ * The record is a part of the current batch. It is not passed to the
+ * threads until stg_workers_commit() is called, therefore, it is possible to
+ * fill it (e.g. translator_translate()) and add its destinations using
+ * stg_workers_target().
+ * \param[in,out] workers Pool
+ * \return Pointer to the record or NULL (memory allocation error)
+ */
+lnf_rec_t *
+stg_workers_record(stg_workers_t *workers);
+
+/**
+ * \brief Add a destination of the current record
+ * \param[in,out] workers Pool
+ * \param[in]     mgr     Files manager to which the record will be written
+ * \param[in]     thread  Index of the thread that writes to the manager
+ *   (all records of the manager MUST be always written by the same thread)
+ * \return On success returns 0. Otherwise returns a non-zero value.
+ */
+int
+stg_workers_target(stg_workers_t *workers, files_mgr_t *mgr,
+	unsigned int thread);
+
+/**
+ * \brief Finish the current record
+ *
+ * If the record has no destinations, it is dropped. If the current batch is
+ * full, it is passed to the threads.
+ * \param[in,out] workers Pool
+ */
+void
+stg_workers_commit(stg_workers_t *workers);
+
+/**
+ * \brief Wait until all committed records are written
+ *
+ * The function MUST be called before any files manager used as a destination
+ * is modified (new window) or destroyed. A record that has not been committed
+ * yet is preserved (i.e. pointer returned by stg_workers_record() is still
+ * valid), but its destinations added so far are dropped because they may
+ * refer to managers that are going to be destroyed.
+ * \param[in,out] workers Pool
+ */
+void
+stg_workers_sync(stg_workers_t *workers);
+
+#endif // LS_STORAGE_WORKERS_H
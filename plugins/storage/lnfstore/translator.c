@@ -40,6 +40,8 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <inttypes.h>
 #include <ipfixcol.h>
 #include "lnfstore.h"
@@ -47,7 +49,7 @@
 #include "converters.h"
 
 /**
- * \brief Record iterator structure
+ * \brief Record field structure (input of conversion functions)
  */
 struct rec_iter {
 	/** Pointer to the current field */
@@ -59,96 +61,8 @@ struct rec_iter {
 	uint32_t pen;
 	/** ID of the current Information Element within the PEN         */
 	uint16_t ie_id;
-
-	/** Private values of the iterator (DO NOT USE DIRECTLY!)        */
-	struct private_s {
-		/** Record's description (base pointer, template, etc.)      */
-		const struct ipfix_record *rec_mdata;
-		/** Index of the next field in the template       */
-		int idx;
-		/** Offset from the start of the next record      */
-		uint32_t offset;
-	} private_;
 };
 
-/**
- * \brief Initialize a record iterator
- *
- * \note After initialization the iterator doesn't point to any field.
- *   Therefore, to prepare the first and next following fields call
- *   rec_iter_next() function.
- * \param[out] it    Instance of the iterator
- * \param[in]  mdata Pointer to a record
- */
-static void
-rec_iter_init(struct rec_iter *it, const struct metadata *mdata)
-{
-	it->private_.offset = 0;
-	it->private_.idx = 0;
-	it->private_.rec_mdata = &mdata->record;
-}
-
-/**
- * \brief Destroy a record iterator
- * \param[in] it Instance of the iterator
- */
-static void
-rec_iter_destroy(struct rec_iter *it)
-{
-	// Nothing... just a placeholder for possible future changes
-	(void) it;
-}
-
-/**
- * \brief Prepare the next field
- * \param[in,out] it Instance of the iterator
- * \return If the field is ready, returns 0. Otherwise (i.e. no more fields)
- *   returns a non-zero value.
- */
-static int
-rec_iter_next(struct rec_iter *it)
-{
-	const struct ipfix_template *rec_tmplt = it->private_.rec_mdata->templ;
-	int idx = it->private_.idx;
-	if (idx >= rec_tmplt->field_count) {
-		// No more fields
-		return 1;
-	}
-
-	const uint8_t *rec_start = it->private_.rec_mdata->record;
-	uint16_t field_size = rec_tmplt->fields[idx].ie.length;
-	uint32_t offset = it->private_.offset;
-
-	// Update info about the next field
-	it->pen = 0;
-	it->ie_id = rec_tmplt->fields[idx].ie.id;
-	if (it->ie_id & 0x8000) {
-		// Not IANA field
-		it->ie_id &= 0x7FFF;
-		it->pen = rec_tmplt->fields[++idx].enterprise_number;
-	}
-
-	// Get real size of the record
-	if (field_size == VAR_IE_LENGTH) {
-		field_size = rec_start[offset];
-		offset += 1;
-
-		if (field_size == 255) {
-			field_size = ntohs(*(uint16_t *) &rec_start[offset]);
-			offset += 2;
-		}
-	}
-
-	// Update user parameters
-	it->field_ptr = rec_start + offset;
-	it->field_size = field_size;
-
-	// Update internals
-	it->private_.idx = idx + 1;
-	it->private_.offset = offset + field_size;
-	return 0;
-}
-
 // Prototypes
 struct translator_table_rec;
 static int
@@ -464,11 +378,58 @@ translate_time(const struct rec_iter *iter,
 #define TRANSLATOR_TABLE_SIZE \
 	(sizeof(translator_table_global) / sizeof(translator_table_global[0]))
 
+// Size of the plan cache (must be power of 2)
+#define PLAN_CACHE_SIZE (1024)
+// Max. number of cached plans, the cache is flushed when exceeded
+#define PLAN_CACHE_MAX (PLAN_CACHE_SIZE / 2)
+
+/**
+ * \brief Translation step of one template field
+ */
+struct plan_step {
+	/** Offset of the field in a record (only if the plan is without
+	 *  variable-length fields) */
+	uint32_t offset;
+	/** Length of the field from the template (or VAR_IE_LENGTH) */
+	uint16_t length;
+	/** ID of the Information Element within the PEN         */
+	uint16_t ie_id;
+	/** Private Enterprise Number of the Information Element */
+	uint32_t pen;
+	/** Conversion definition (NULL if the field is not converted) */
+	const struct translator_table_rec *def;
+};
+
+/**
+ * \brief Translation plan of a template
+ */
+struct plan {
+	/** Serial number of the template         */
+	uint64_t serial;
+	/**
+	 * At least one field has variable length. All fields must be walked
+	 * and the steps are all fields of the template. Otherwise, the steps
+	 * are only converted fields with static offsets.
+	 */
+	bool var;
+	/** Number of steps                       */
+	uint16_t step_cnt;
+	/** Steps in the template order           */
+	struct plan_step steps[];
+};
+
 struct translator_s {
 	/** Private conversion table */
 	struct translator_table_rec table[TRANSLATOR_TABLE_SIZE];
 	/** Record conversion buffer */
 	uint8_t rec_buffer[REC_BUFF_SIZE];
+
+	/** Plan cache (open addressing, indexed by template serial number) */
+	struct plan *plans[PLAN_CACHE_SIZE];
+	/** Number of cached plans  */
+	unsigned int plan_cnt;
+	/** The most recently used plan */
+	struct plan *plan_last;
 };
 
 /**
@@ -541,43 +502,196 @@ translator_init()
 	return instance;
 }
 
+/**
+ * \brief Remove all plans from the cache
+ * \param[in] trans Translator instance
+ */
+static void
+translator_plans_flush(translator_t *trans)
+{
+	for (size_t i = 0; i < PLAN_CACHE_SIZE; ++i) {
+		free(trans->plans[i]);
+		trans->plans[i] = NULL;
+	}
+
+	trans->plan_cnt = 0;
+	trans->plan_last = NULL;
+}
+
 void
 translator_destroy(translator_t *trans)
 {
+	translator_plans_flush(trans);
 	free(trans);
 }
 
+/**
+ * \brief Create a translation plan of a template
+ *
+ * Conversion definitions of all fields are found only once here. Offsets of
+ * all fields are static if the template doesn't contain variable-length
+ * fields, so only the converted fields are kept.
+ * \param[in] trans Translator instance
+ * \param[in] templ Template
+ * \return Pointer to the plan or NULL (memory allocation error)
+ */
+static struct plan *
+plan_create(const translator_t *trans, const struct ipfix_template *templ)
+{
+	const size_t steps_size = templ->field_count * sizeof(struct plan_step);
+
+	struct plan *plan = calloc(1, sizeof(*plan) + steps_size);
+	if (!plan) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)",
+			__FILE__, __LINE__);
+		return NULL;
+	}
+
+	plan->serial = templ->serial;
+
+	struct translator_table_rec key;
+	const size_t table_rec_cnt = TRANSLATOR_TABLE_SIZE;
+	const size_t table_rec_size = sizeof(trans->table[0]);
+	uint32_t offset = 0;
+
+	for (int i = 0, idx = 0; i < templ->field_count; ++i, ++idx) {
+		struct plan_step *step = &plan->steps[i];
+		step->offset = offset;
+		step->length = templ->fields[idx].ie.length;
+		step->ie_id = templ->fields[idx].ie.id;
+		step->pen = 0;
+		if (step->ie_id & 0x8000) {
+			// Not IANA field
+			step->ie_id &= 0x7FFF;
+			step->pen = templ->fields[++idx].enterprise_number;
+		}
+
+		// Find a conversion function
+		key.ipfix.ie = step->ie_id;
+		key.ipfix.pen = step->pen;
+		step->def = bsearch(&key, trans->table, table_rec_cnt, table_rec_size,
+			transtator_cmp);
+
+		if (step->length == VAR_IE_LENGTH) {
+			plan->var = true;
+		} else {
+			offset += step->length;
+		}
+	}
+
+	if (plan->var) {
+		plan->step_cnt = templ->field_count;
+		return plan;
+	}
+
+	// Static offsets, keep only converted fields
+	uint16_t cnt = 0;
+	for (int i = 0; i < templ->field_count; ++i) {
+		if (plan->steps[i].def) {
+			plan->steps[cnt++] = plan->steps[i];
+		}
+	}
+
+	plan->step_cnt = cnt;
+	return plan;
+}
+
+/**
+ * \brief Get a translation plan of a template
+ *
+ * The plan is created only when the template is seen for the first time.
+ * \param[in] trans Translator instance
+ * \param[in] templ Template
+ * \return Pointer to the plan or NULL (memory allocation error)
+ */
+static const struct plan *
+translator_plan(translator_t *trans, const struct ipfix_template *templ)
+{
+	if (trans->plan_last && trans->plan_last->serial == templ->serial) {
+		return trans->plan_last;
+	}
+
+	const size_t mask = PLAN_CACHE_SIZE - 1;
+	size_t idx = (size_t) (templ->serial * 2654435761U) & mask;
+	while (trans->plans[idx] && trans->plans[idx]->serial != templ->serial) {
+		idx = (idx + 1) & mask;
+	}
+
+	struct plan *plan = trans->plans[idx];
+	if (plan) {
+		trans->plan_last = plan;
+		return plan;
+	}
+
+	if (trans->plan_cnt >= PLAN_CACHE_MAX) {
+		translator_plans_flush(trans);
+		return translator_plan(trans, templ);
+	}
+
+	// Create a new plan
+	struct plan *new_plan = plan_create(trans, templ);
+	if (!new_plan) {
+		return NULL;
+	}
+
+	trans->plan_cnt++;
+	trans->plans[idx] = new_plan;
+	trans->plan_last = new_plan;
+	return new_plan;
+}
+
 int
 translator_translate(translator_t *trans, const struct metadata *mdata,
 	lnf_rec_t *rec)
 {
 	lnf_rec_clear(rec);
 
-	// Initialize a record iterator
-	struct rec_iter it;
-	rec_iter_init(&it, mdata);
+	// Get a translation plan of the template
+	const struct plan *plan = translator_plan(trans, mdata->record.templ);
+	if (!plan) {
+		return 0;
+	}
 
 	// Try to convert all IPFIX fields
-	struct translator_table_rec key;
-	struct translator_table_rec *def;
+	struct rec_iter it;
 	int converted_fields = 0;
 
-	const size_t table_rec_cnt = TRANSLATOR_TABLE_SIZE;
-	const size_t table_rec_size = sizeof(trans->table[0]);
+	const uint8_t *rec_start = mdata->record.record;
 	uint8_t * const buffer_ptr = trans->rec_buffer;
-
-	while (rec_iter_next(&it) == 0) {
-		// Find a conversion function
-		key.ipfix.ie = it.ie_id;
-		key.ipfix.pen = it.pen;
-
-		def = bsearch(&key, trans->table, table_rec_cnt, table_rec_size,
-			transtator_cmp);
-		if (!def) {
-			// Conversion definition not found
-			continue;
+	uint32_t offset = 0;
+
+	for (uint16_t i = 0; i < plan->step_cnt; ++i) {
+		const struct plan_step *step = &plan->steps[i];
+		uint16_t field_size = step->length;
+
+		if (plan->var) {
+			// Get real size of the field
+			if (field_size == VAR_IE_LENGTH) {
+				field_size = rec_start[offset];
+				offset += 1;
+
+				if (field_size == 255) {
+					field_size = ntohs(*(uint16_t *) &rec_start[offset]);
+					offset += 2;
+				}
+			}
+
+			it.field_ptr = rec_start + offset;
+			offset += field_size;
+
+			if (!step->def) {
+				// Conversion definition not found
+				continue;
+			}
+		} else {
+			it.field_ptr = rec_start + step->offset;
 		}
 
+		it.field_size = field_size;
+		it.ie_id = step->ie_id;
+		it.pen = step->pen;
+
+		const struct translator_table_rec *def = step->def;
 		if (def->func(&it, def, buffer_ptr) != 0) {
 			// Conversion function failed
 			MSG_WARNING(msg_module, "Failed to converter a IPFIX IE field "
@@ -596,7 +710,5 @@ translator_translate(translator_t *trans, const struct metadata *mdata,
 		converted_fields++;
 	}
 
-	// Cleanup
-	rec_iter_destroy(&it);
 	return converted_fields;
 }
@@ -0,0 +1,358 @@
+/*
+ * \file compressor.cpp
+ * \brief nfdump storage plugin
+ *
+ * Copyright (C) 2015 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <config.h>
+
+extern "C" {
+#include <ipfixcol/verbose.h>
+}
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <lzo/lzoconf.h>
+#include <lzo/lzo1x.h>
+#ifdef HAVE_LIBLZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "nffile.h"
+#include "nfstore.h"
+#include "compressor.h"
+
+struct CompressContext {
+	/* LZO work memory */
+	lzo_align_t *lzoWrkmem;
+#ifdef HAVE_LIBZSTD
+	ZSTD_CCtx *zstd;
+#endif
+};
+
+static struct CompressContext *contextCreate(compressionType type){
+	struct CompressContext *ctx;
+
+	ctx = (struct CompressContext *) calloc(1, sizeof(struct CompressContext));
+	if(ctx == NULL){
+		return NULL;
+	}
+
+	if(type == COMPRESSION_LZO){
+		ctx->lzoWrkmem = (lzo_align_t *) malloc(LZO1X_1_MEM_COMPRESS);
+		if(ctx->lzoWrkmem == NULL){
+			free(ctx);
+			return NULL;
+		}
+	}
+#ifdef HAVE_LIBZSTD
+	if(type == COMPRESSION_ZSTD){
+		ctx->zstd = ZSTD_createCCtx();
+		if(ctx->zstd == NULL){
+			free(ctx);
+			return NULL;
+		}
+	}
+#endif
+	return ctx;
+}
+
+static void contextDestroy(struct CompressContext *ctx){
+	if(ctx == NULL){
+		return;
+	}
+#ifdef HAVE_LIBZSTD
+	ZSTD_freeCCtx(ctx->zstd);
+#endif
+	free(ctx->lzoWrkmem);
+	free(ctx);
+}
+
+Compressor::Compressor(){
+	type_ = COMPRESSION_NONE;
+	level_ = 0;
+	threadCnt_ = 0;
+	threads_ = NULL;
+	head_ = NULL;
+	tail_ = NULL;
+	stop_ = false;
+	ctx_ = NULL;
+	pthread_mutex_init(&mutex_, NULL);
+	pthread_cond_init(&queueCond_, NULL);
+	pthread_cond_init(&doneCond_, NULL);
+}
+
+int Compressor::init(compressionType type, int level, unsigned int threads){
+	type_ = type;
+	level_ = level;
+
+	if(type_ == COMPRESSION_NONE){
+		return 0;
+	}
+
+	if(threads == 0){
+		ctx_ = contextCreate(type_);
+		if(ctx_ == NULL){
+			MSG_ERROR(MSG_MODULE, "Can't allocate memory for compression");
+			return -1;
+		}
+		return 0;
+	}
+
+	threads_ = new pthread_t[threads];
+	for(unsigned int i = 0; i < threads; i++){
+		if(pthread_create(&threads_[i], NULL, &Compressor::worker, this) != 0){
+			MSG_ERROR(MSG_MODULE, "Can't start compression thread");
+			return -1;
+		}
+		threadCnt_++;
+	}
+	return 0;
+}
+
+Compressor::~Compressor(){
+	pthread_mutex_lock(&mutex_);
+	stop_ = true;
+	pthread_cond_broadcast(&queueCond_);
+	pthread_mutex_unlock(&mutex_);
+
+	for(unsigned int i = 0; i < threadCnt_; i++){
+		pthread_join(threads_[i], NULL);
+	}
+	delete[] threads_;
+	contextDestroy(ctx_);
+
+	pthread_cond_destroy(&doneCond_);
+	pthread_cond_destroy(&queueCond_);
+	pthread_mutex_destroy(&mutex_);
+}
+
+/* worst case size of compressed block */
+uint32_t Compressor::bound(uint32_t size){
+	switch(type_){
+	case COMPRESSION_LZO:
+		return size + size / 16 + 64 + 3;
+#ifdef HAVE_LIBLZ4
+	case COMPRESSION_LZ4:
+		return LZ4_compressBound(size);
+#endif
+#ifdef HAVE_LIBZSTD
+	case COMPRESSION_ZSTD:
+		return ZSTD_compressBound(size);
+#endif
+	default:
+		return size;
+	}
+}
+
+void Compressor::compress(struct CompressContext *ctx, struct DataBlock *block){
+	struct timespec start, end;
+	bool ok = false;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch(type_){
+	case COMPRESSION_LZO: {
+		lzo_uint oSize = block->outSize;
+		if(lzo1x_1_compress((unsigned char *) block->data, block->size,
+				(unsigned char *) block->out, &oSize, ctx->lzoWrkmem) == LZO_E_OK){
+			block->outUsed = oSize;
+			ok = true;
+		}
+		break;
+	}
+#ifdef HAVE_LIBLZ4
+	case COMPRESSION_LZ4: {
+		int oSize = LZ4_compress_default(block->data, block->out, block->size,
+				block->outSize);
+		if(oSize > 0){
+			block->outUsed = oSize;
+			ok = true;
+		}
+		break;
+	}
+#endif
+#ifdef HAVE_LIBZSTD
+	case COMPRESSION_ZSTD: {
+		size_t oSize = ZSTD_compressCCtx(ctx->zstd, block->out, block->outSize,
+				block->data, block->size, level_);
+		if(!ZSTD_isError(oSize)){
+			block->outUsed = oSize;
+			ok = true;
+		}
+		break;
+	}
+#endif
+	default:
+		break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	block->nsec = (end.tv_sec - start.tv_sec) * 1000000000ULL
+			+ end.tv_nsec - start.tv_nsec;
+	block->failed = !ok;
+}
+
+void *Compressor::worker(void *arg){
+	Compressor *self = (Compressor *) arg;
+	struct CompressContext *ctx;
+	struct DataBlock *block;
+
+	ctx = contextCreate(self->type_);
+	if(ctx == NULL){
+		MSG_ERROR(MSG_MODULE, "Can't allocate memory for compression");
+	}
+
+	pthread_mutex_lock(&self->mutex_);
+	while(true){
+		while(self->head_ == NULL && !self->stop_){
+			pthread_cond_wait(&self->queueCond_, &self->mutex_);
+		}
+		if(self->head_ == NULL){
+			break;
+		}
+
+		block = self->head_;
+		self->head_ = block->next;
+		if(self->head_ == NULL){
+			self->tail_ = NULL;
+		}
+		pthread_mutex_unlock(&self->mutex_);
+
+		if(ctx != NULL){
+			self->compress(ctx, block);
+		} else {
+			block->failed = true;
+		}
+
+		pthread_mutex_lock(&self->mutex_);
+		block->done = true;
+		pthread_cond_broadcast(&self->doneCond_);
+	}
+	pthread_mutex_unlock(&self->mutex_);
+
+	contextDestroy(ctx);
+	return NULL;
+}
+
+/* start compression of the block (block must not be changed until done) */
+void Compressor::submit(struct DataBlock *block){
+	block->outUsed = 0;
+	block->nsec = 0;
+	block->failed = false;
+	block->next = NULL;
+
+	if(threadCnt_ == 0){
+		compress(ctx_, block);
+		block->done = true;
+		return;
+	}
+
+	pthread_mutex_lock(&mutex_);
+	block->done = false;
+	if(tail_ == NULL){
+		head_ = block;
+	} else {
+		tail_->next = block;
+	}
+	tail_ = block;
+	pthread_cond_signal(&queueCond_);
+	pthread_mutex_unlock(&mutex_);
+}
+
+bool Compressor::done(struct DataBlock *block){
+	bool ret;
+
+	pthread_mutex_lock(&mutex_);
+	ret = block->done;
+	pthread_mutex_unlock(&mutex_);
+	return ret;
+}
+
+void Compressor::wait(struct DataBlock *block){
+	pthread_mutex_lock(&mutex_);
+	while(!block->done){
+		pthread_cond_wait(&doneCond_, &mutex_);
+	}
+	pthread_mutex_unlock(&mutex_);
+}
+
+/* flags of nfdump file header */
+uint32_t Compressor::fileFlags(compressionType type){
+	switch(type){
+	case COMPRESSION_LZO:
+		return FLAG_COMPRESSED;
+	case COMPRESSION_LZ4:
+		return FLAG_LZ4_COMPRESSED;
+	case COMPRESSION_ZSTD:
+		return FLAG_ZSTD_COMPRESSED;
+	default:
+		return 0;
+	}
+}
+
+const char *Compressor::name(compressionType type){
+	switch(type){
+	case COMPRESSION_LZO:
+		return "LZO";
+	case COMPRESSION_LZ4:
+		return "LZ4";
+	case COMPRESSION_ZSTD:
+		return "ZSTD";
+	default:
+		return "none";
+	}
+}
+
+/* check whether the plugin was built with support of the compression */
+bool Compressor::supported(compressionType type){
+	switch(type){
+#ifndef HAVE_LIBLZ4
+	case COMPRESSION_LZ4:
+		return false;
+#endif
+#ifndef HAVE_LIBZSTD
+	case COMPRESSION_ZSTD:
+		return false;
+#endif
+	default:
+		return true;
+	}
+}
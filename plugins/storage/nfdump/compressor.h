@@ -0,0 +1,116 @@
+/*
+ * \file compressor.h
+ * \brief nfdump storage plugin
+ *
+ * Copyright (C) 2015 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef COMPRESSOR_H_
+#define COMPRESSOR_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+
+enum compressionType {
+	COMPRESSION_NONE,
+	COMPRESSION_LZO,
+	COMPRESSION_LZ4,
+	COMPRESSION_ZSTD
+};
+
+/* block of records compressed by Compressor */
+struct DataBlock {
+	/* records of the block */
+	char *data;
+	/* size of records */
+	uint32_t size;
+	/* buffer for compressed records */
+	char *out;
+	/* allocated size of buffer for compressed records */
+	uint32_t outSize;
+	/* size of compressed records */
+	uint32_t outUsed;
+	/* time spent by compression (nanoseconds) */
+	uint64_t nsec;
+	/* compression failed */
+	bool failed;
+	/* compression finished (guarded by compressor) */
+	bool done;
+	/* next block in queue of compressor */
+	struct DataBlock *next;
+};
+
+/* compression state of one thread */
+struct CompressContext;
+
+/*
+ * Compresses full blocks of records in a pool of threads while the storage
+ * thread fills the next block. Without threads, blocks are compressed
+ * directly in submit().
+ */
+class Compressor {
+	compressionType type_;
+	int level_;
+	unsigned int threadCnt_;
+	pthread_t *threads_;
+	pthread_mutex_t mutex_;
+	/* new block in queue or stop request */
+	pthread_cond_t queueCond_;
+	/* a block is done */
+	pthread_cond_t doneCond_;
+	struct DataBlock *head_;
+	struct DataBlock *tail_;
+	bool stop_;
+	/* context for compression without threads */
+	struct CompressContext *ctx_;
+
+	static void *worker(void *arg);
+	void compress(struct CompressContext *ctx, struct DataBlock *block);
+public:
+	Compressor();
+	int init(compressionType type, int level, unsigned int threads);
+	compressionType type(){return type_;}
+	uint32_t bound(uint32_t size);
+	void submit(struct DataBlock *block);
+	bool done(struct DataBlock *block);
+	void wait(struct DataBlock *block);
+	virtual ~Compressor();
+
+	static uint32_t fileFlags(compressionType type);
+	static const char *name(compressionType type);
+	static bool supported(compressionType type);
+};
+
+#endif /* COMPRESSOR_H_ */
@@ -47,6 +47,7 @@
 
 #include "nfstore.h"
 #include "record_map.h"
+#include "compressor.h"
 
 class templateTable;
 
@@ -73,8 +74,17 @@ struct nfdumpConfig{
 	/* identification string for nffiles*/
 	std::string ident;
 
-	/* lzo compression of records */
-	bool compression;
+	/* compression of records */
+	compressionType compression;
+
+	/* compression level (ZSTD only, 0 is default level) */
+	int compressionLevel;
+
+	/* number of compression threads (0 = compress in storage thread) */
+	unsigned int compressionThreads;
+
+	/* compression of full blocks */
+	class Compressor *compressor;
 
 	/* time of last flush (used for time based rotation,
 	 * name is based on start of interval not its end!) */
@@ -98,6 +98,8 @@ typedef struct file_header_s {
 #define FLAG_COMPRESSED 	0x1		// flow records are compressed
 #define FLAG_ANONYMIZED 	0x2		// flow data are anonimized 
 #define FLAG_CATALOG		0x4		// has a file catalog record after stat record
+#define FLAG_LZ4_COMPRESSED	0x10	// flow records are LZ4 compressed
+#define FLAG_ZSTD_COMPRESSED	0x20	// flow records are ZSTD compressed
 
 									/*
 										0x1 File is compressed with LZO1X-1 compression
@@ -181,14 +181,35 @@ int processStartupXML(char *params, struct nfdumpConfig* c){
 		}
 
 		tmp=ie.node().child_value("compression");
-		if(tmp == "yes"){
-			c->compression = true;
-			if (lzo_init() != LZO_E_OK){
-				MSG_WARNING(MSG_MODULE,"Compression initialization failed (storing without compression)!");
-				c->compression = false;
-			}
+		if(tmp == "yes" || tmp == "lzo"){
+			c->compression = COMPRESSION_LZO;
+		} else if(tmp == "lz4"){
+			c->compression = COMPRESSION_LZ4;
+		} else if(tmp == "zstd"){
+			c->compression = COMPRESSION_ZSTD;
 		} else {
-			c->compression = false;
+			c->compression = COMPRESSION_NONE;
+		}
+
+		if(!Compressor::supported(c->compression)){
+			MSG_WARNING(MSG_MODULE,"%s compression is not supported by this build (using LZO instead)!",
+					Compressor::name(c->compression));
+			c->compression = COMPRESSION_LZO;
+		}
+
+		if(c->compression == COMPRESSION_LZO && lzo_init() != LZO_E_OK){
+			MSG_WARNING(MSG_MODULE,"Compression initialization failed (storing without compression)!");
+			c->compression = COMPRESSION_NONE;
+		}
+
+		tmp=ie.node().child_value("compressionLevel");
+		c->compressionLevel = atoi(tmp.c_str());
+
+		tmp=ie.node().child_value("compressionThreads");
+		if(tmp == ""){
+			c->compressionThreads = 1;
+		} else {
+			c->compressionThreads = atoi(tmp.c_str());
 		}
 
 		ie = doc.select_single_node("fileWriter/dumpInterval");
@@ -231,6 +252,7 @@ int storage_init (char *params, void **config){
 		return 1;
 	}
 	c = (struct nfdumpConfig *) (*config);
+	c->compressor = NULL;
 
 	/* allocate map for observation id to record map conversion */
 	c->files = new std::map<uint32_t,NfdumpFile*>;
@@ -244,6 +266,13 @@ int storage_init (char *params, void **config){
 		MSG_ERROR(MSG_MODULE, "Unable to parse configuration xml!");
 		return 1;
 	}
+
+	/* start compression threads */
+	c->compressor = new Compressor();
+	if(c->compressor->init(c->compression, c->compressionLevel, c->compressionThreads)){
+		MSG_ERROR(MSG_MODULE, "Unable to initialize compression!");
+		return 1;
+	}
 	return 0;
 }
 
@@ -313,6 +342,7 @@ int storage_close (void **config){
 	}
 
 	delete conf->files;
+	delete conf->compressor;
 	delete conf;
 
 	return 0;
@@ -46,26 +46,20 @@ extern "C" {
 
 #include <string.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <cstdio>
 #include "config_struct.h"
 #include "extensions.h"
 #include "record_map.h"
 #include "nfstore.h"
 #include "nffile.h"
-
-#include <lzo/lzoconf.h>
-#include <lzo/lzo1x.h>
-
-static lzo_align_t __LZO_MMODEL wrkmem[LZO1X_1_MEM_COMPRESS];
+#include "compressor.h"
 
 void FileHeader::newHeader(FILE *f, struct nfdumpConfig* conf){
 	header_.magic = MAGIC;
 	header_.version = LAYOUT_VERSION_1;
-	header_.flags = 0;
+	header_.flags = Compressor::fileFlags(conf->compression);
 	header_.NumBlocks = 0;
-	if(conf->compression){
-		header_.flags = header_.flags | FLAG_COMPRESSED;
-	}
 	memset(header_.ident,0,IDENTLEN);
 	strncpy(header_.ident,conf->ident.c_str(), IDENTLEN-1);
 	position_ = ftell(f);
@@ -147,52 +141,51 @@ void Stats::increaseSQFail(){
 }
 
 
-void BlockHeader::newBlock(FILE *f){
+void BlockHeader::newBlock(){
 	block_.NumRecords = 0;
 	block_.size = 0;
 	block_.id = 2;
-	position_ = ftell(f);
-	updateBlock(f);
+	block_.flags = 0;
 }
 
-void BlockHeader::updateBlock(FILE *f){
-	//seek block header
-	if((fseek(f, position_, SEEK_SET)) != 0){
-		MSG_ERROR(MSG_MODULE,"Can't update block header");
+int BlockHeader::writeBlock(FILE *f, const char *data, uint32_t size){
+	block_.size = size;
+
+	//append block header and data
+	if((fseek(f, 0, SEEK_END)) != 0){
+		MSG_ERROR(MSG_MODULE,"Can't write block");
+		return -1;
 	}
-	//write block header
 	if((fwrite(&block_,1,sizeof(struct data_block_header_s),f))
 			!= sizeof(struct data_block_header_s)){
-		MSG_ERROR(MSG_MODULE,"Can't update block header");
+		MSG_ERROR(MSG_MODULE,"Can't write block header");
+		return -1;
+	}
+	if(fwrite(data,1,size,f) != size){
+		MSG_ERROR(MSG_MODULE,"Can't write block");
+		return -1;
 	}
+	return 0;
 }
 
 
-
-void BlockHeader::compress(char *buffer, uint *bufferUsed){ //TODO
-	lzo_uint iSize,oSize;
-	unsigned char __LZO_MMODEL *input;
-	unsigned char __LZO_MMODEL *output;
-
-	char *ibuff;
-
-	ibuff = new char[block_.size];
-	memcpy(ibuff,buffer,block_.size);
-
-	input = (unsigned char __LZO_MMODEL *) ibuff;
-	iSize = block_.size;
-	output = (unsigned char __LZO_MMODEL *) buffer;
-	oSize = 0;
-	if(lzo1x_1_compress(input,iSize,output,&oSize,wrkmem) != LZO_E_OK){
-		MSG_ERROR(MSG_MODULE,"Compression failed");
-	}
-	*bufferUsed = oSize;
-	block_.size = oSize;
-	delete[] ibuff;
-	//TODO ret val
+NfdumpFile::NfdumpFile(){
+	f_ = NULL;
+	extMaps_ = NULL;
+	nextSQ_ = 0;
+	compressor_ = NULL;
+	memset(blocks_, 0, sizeof(blocks_));
+	current_ = 0;
+	pending_ = 0;
+	blocksWritten_ = 0;
+	rawBytes_ = 0;
+	storedBytes_ = 0;
+	compressNsec_ = 0;
+	buffer_ = NULL;
+	bufferSize_ = 0;
+	bufferUsed_ = 0;
 }
 
-
 int NfdumpFile::newFile(std::string name, struct nfdumpConfig* conf){
 	MSG_DEBUG(MSG_MODULE,"Creating new file: \"%s\"",name.c_str());
 	f_ = fopen(name.c_str(),"w+");
@@ -200,12 +193,11 @@ int NfdumpFile::newFile(std::string name, struct nfdumpConfig* conf){
 		MSG_ERROR(MSG_MODULE,"Can't create file: \"%s\"",name.c_str());
 		return -1;
 	}
+	name_ = name;
 	//create header
 	fileHeader_.newHeader(f_,conf);
 	//create stats
 	stats_.newStats(f_);
-	fileHeader_.increaseBlockCnt();
-	currentBlock_.newBlock(f_);
 
 	extMaps_ = new std::map<uint16_t,RecordMap*>;
 	if(extMaps_ == NULL){
@@ -215,46 +207,116 @@ int NfdumpFile::newFile(std::string name, struct nfdumpConfig* conf){
 
 	bufferSize_ = conf->bufferSize;
 	bufferUsed_ = 0;
-	buffer_ = new char[BUFFER_SIZE];
 
-	if(buffer_ == NULL){
-		MSG_ERROR(MSG_MODULE,"Can't allocate memory");
-		return -1;
+	//blocks are compressed to separate buffers
+	compressor_ = conf->compressor;
+	uint32_t dataSize = (bufferSize_ > BUFFER_SIZE) ? bufferSize_ : BUFFER_SIZE;
+	uint32_t outSize = 0;
+	if(compressor_->type() != COMPRESSION_NONE){
+		outSize = compressor_->bound(dataSize);
 	}
+
+	for(int i = 0; i < BLOCK_CNT; i++){
+		blocks_[i].data = new char[dataSize];
+		blocks_[i].out = (outSize > 0) ? new char[outSize] : NULL;
+		blocks_[i].outSize = outSize;
+		blocks_[i].done = true;
+	}
+
+	current_ = 0;
+	pending_ = 0;
+	blocksWritten_ = 0;
+	rawBytes_ = 0;
+	storedBytes_ = 0;
+	compressNsec_ = 0;
+
+	blockHeaders_[current_].newBlock();
+	buffer_ = blocks_[current_].data;
 	return 0;
 }
 
-void NfdumpFile::updateFile(bool compression){
-	uint check;
-
+void NfdumpFile::updateFile(){
 	if(f_ == NULL){
 		MSG_ERROR(MSG_MODULE,"Can't update file");
-		bufferUsed_ = 0;
 		return;
 	}
 	//update file header
 	fileHeader_.updateHeader(f_);
 	//update stats
 	stats_.updateStats(f_);
-	//update last block header
+}
 
+/* write block to the file (after compression) */
+void NfdumpFile::writeBlock(unsigned int idx){
+	struct DataBlock *block = &blocks_[idx];
+	const char *data = block->data;
+	uint32_t size = block->size;
+
+	if(compressor_->type() != COMPRESSION_NONE){
+		if(block->failed){
+			MSG_ERROR(MSG_MODULE,"Compression failed (%u records lost)",
+					blockHeaders_[idx].recordsCnt());
+			return;
+		}
+		data = block->out;
+		size = block->outUsed;
+		compressNsec_ += block->nsec;
+	}
 
-	if(compression){
-		currentBlock_.compress(buffer_, &bufferUsed_);
-		currentBlock_.updateBlock(f_);
-	}else{
-		currentBlock_.updateBlock(f_);
+	if(blockHeaders_[idx].writeBlock(f_, data, size) != 0){
+		return;
 	}
 
-	//flush data from buffer
-	check = fseek(f_, 0, SEEK_END);
-	if(check != 0){
-		MSG_ERROR(MSG_MODULE,"Can't update file");
+	fileHeader_.increaseBlockCnt();
+	blocksWritten_++;
+	rawBytes_ += block->size;
+	storedBytes_ += size;
+}
+
+/* write compressed blocks in order (at most max blocks) */
+void NfdumpFile::writeBlocks(bool wait, unsigned int max){
+	while(pending_ > 0 && max > 0){
+		unsigned int idx = (current_ + BLOCK_CNT - pending_) % BLOCK_CNT;
+		if(wait){
+			compressor_->wait(&blocks_[idx]);
+		} else if(!compressor_->done(&blocks_[idx])){
+			break;
+		}
+
+		writeBlock(idx);
+		pending_--;
+		max--;
 	}
-	check = fwrite(buffer_,1,bufferUsed_,f_);
-	if(check != bufferUsed_){
-		MSG_ERROR(MSG_MODULE,"Can't update file");
+}
+
+/* pass current block to compression (or write it) and start a new one */
+void NfdumpFile::flushBlock(){
+	struct DataBlock *block = &blocks_[current_];
+
+	if(blockHeaders_[current_].recordsCnt() == 0){
+		//nothing to store
+		bufferUsed_ = 0;
+		return;
+	}
+
+	block->size = bufferUsed_;
+	if(compressor_->type() == COMPRESSION_NONE){
+		writeBlock(current_);
+	} else {
+		compressor_->submit(block);
+		pending_++;
 	}
+
+	current_ = (current_ + 1) % BLOCK_CNT;
+	writeBlocks(false, BLOCK_CNT);
+	if(pending_ == BLOCK_CNT){
+		//all blocks are in compression, wait for the oldest one
+		writeBlocks(true, 1);
+	}
+	updateFile();
+
+	blockHeaders_[current_].newBlock();
+	buffer_ = blocks_[current_].data;
 	bufferUsed_ = 0;
 }
 
@@ -299,13 +361,7 @@ NfdumpFile::bufferPtk(const data_template_couple *dtcouple){
 
 		/* flush data if there is no space in buffers */
 		if(bufferSize_ <= bufferUsed_ + ext_map_it->second->maxSize()){
-			std::map<uint16_t,RecordMap*>::iterator maps_it;
-			updateFile(fileHeader_.compressed());
-			fileHeader_.increaseBlockCnt();
-			currentBlock_.newBlock(f_);
-			//for(maps_it = _ext_maps->begin(); maps_it!=_ext_maps->end();maps_it++){
-			//	maps_it->second->clean_metadata();
-			//}
+			flushBlock();
 		}
 
 		/* store this data record */
@@ -315,13 +371,13 @@ NfdumpFile::bufferPtk(const data_template_couple *dtcouple){
 			ext_map_it->second->stored(true);
 			ext_map_it->second->genereate_map(buffer);
 			bufferUsed_+= ext_map_it->second->size();
-			currentBlock_.addRecordSize(ext_map_it->second->size());
-			currentBlock_.increaseRecordsCnt();
+			blockHeaders_[current_].addRecordSize(ext_map_it->second->size());
+			blockHeaders_[current_].increaseRecordsCnt();
 			buffer = buffer_ + bufferUsed_;
 		}
 		//store extension data
 		flowCount+= ext_map_it->second->bufferData(dtcouple[i].data_set, buffer,
-						&bufferUsed_, &currentBlock_, &stats_);
+						&bufferUsed_, &blockHeaders_[current_], &stats_);
 	}
 	return flowCount;
 }
@@ -343,15 +399,33 @@ void NfdumpFile::closeFile(){
 		return;
 	}
 
-	updateFile(fileHeader_.compressed());
+	flushBlock();
+	writeBlocks(true, BLOCK_CNT);
+	updateFile();
 	fclose(f_);
+	f_ = NULL;
 
+	if(compressor_->type() != COMPRESSION_NONE && blocksWritten_ > 0){
+		double ratio = (storedBytes_ > 0) ? (double) rawBytes_ / storedBytes_ : 0.0;
+		double speed = (compressNsec_ > 0) ? (rawBytes_ * 1000.0) / compressNsec_ : 0.0;
+		MSG_INFO(MSG_MODULE,"%s: %u blocks, %" PRIu64 " -> %" PRIu64
+				" bytes (%s ratio %.2f, %.1f MB/s)", name_.c_str(), blocksWritten_,
+				rawBytes_, storedBytes_, Compressor::name(compressor_->type()),
+				ratio, speed);
+	}
 
 	for(maps_it = extMaps_->begin(); maps_it!=extMaps_->end();maps_it++){
 		delete maps_it->second;
 	}
 	delete extMaps_;
-	delete[] buffer_;
+
+	for(int i = 0; i < BLOCK_CNT; i++){
+		delete[] blocks_[i].data;
+		delete[] blocks_[i].out;
+		blocks_[i].data = NULL;
+		blocks_[i].out = NULL;
+	}
+	buffer_ = NULL;
 }
 
 RecordMap::RecordMap() {
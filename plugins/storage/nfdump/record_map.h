@@ -47,6 +47,8 @@
 #include <string>
 #include <map>
 
+#include "compressor.h"
+
 
 
 
@@ -80,14 +82,13 @@ public:
 class BlockHeader {
 	enum{HEADER_SIZE=12,MAX_SIZE=500/*MAX_SIZE=4294967295*/};
 	struct data_block_header_s block_;
-	long position_;
 public:
 	uint size(){return HEADER_SIZE;}
+	uint32_t recordsCnt(){return block_.NumRecords;}
 	void increaseRecordsCnt(){block_.NumRecords++;}
 	void addRecordSize(uint32_t size){block_.size+=size;}
-	void newBlock(FILE *f);
-	void compress(char *buffer, uint *bufferUsed);
-	void updateBlock(FILE *f);
+	void newBlock();
+	int writeBlock(FILE *f, const char *data, uint32_t size);
 };
 
 class FileHeader{
@@ -95,7 +96,6 @@ class FileHeader{
 	long position_;
 public:
 	uint size(){return sizeof(struct file_header_s);}
-	bool compressed(){return header_.flags & FLAG_COMPRESSED;}
 	void increaseBlockCnt(){header_.NumBlocks++;};
 	void newHeader(FILE *f, struct nfdumpConfig* conf);
 	void updateHeader(FILE *f);
@@ -135,23 +135,43 @@ public:
 };
 
 class NfdumpFile{
-	enum {BUFFER_SIZE_ = 512000};
+	/* one block is filled while the others are compressed */
+	enum {BUFFER_SIZE_ = 512000, BLOCK_CNT = 3};
 	FILE * f_;
+	std::string name_;
 	//HEADER
 	class FileHeader fileHeader_;
 	class Stats stats_;
-	class BlockHeader currentBlock_;
 	std::map<uint16_t,RecordMap*> *extMaps_;
 	unsigned int nextSQ_;
 
+	class Compressor *compressor_;
+	class BlockHeader blockHeaders_[BLOCK_CNT];
+	struct DataBlock blocks_[BLOCK_CNT];
+	/* index of currently filled block */
+	unsigned int current_;
+	/* number of blocks in compression (preceding the current one) */
+	unsigned int pending_;
+
+	/* statistics of written blocks */
+	unsigned int blocksWritten_;
+	uint64_t rawBytes_;
+	uint64_t storedBytes_;
+	uint64_t compressNsec_;
+
 	char *buffer_;
 	/* buffer allocated size */
 	unsigned int bufferSize_;
 	/* buffer number of bytes used in buffer */
 	unsigned int bufferUsed_;
+
+	void flushBlock();
+	void writeBlocks(bool wait, unsigned int max);
+	void writeBlock(unsigned int idx);
 public:
+	NfdumpFile();
 	int newFile(std::string name, struct nfdumpConfig* conf);
-	void updateFile(bool compression = false);
+	void updateFile();
 	unsigned int bufferPtk(const struct data_template_couple dtcouple[]);
 	void checkSQNumber(unsigned int SQ, unsigned int recFlows);
 	void closeFile();
@@ -45,6 +45,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <libpq-fe.h>
 #include <unistd.h>
 #include <string.h>
@@ -54,6 +55,8 @@
 #include <arpa/inet.h>
 #include <inttypes.h>
 #include <endian.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <ipfixcol.h>
 #include "ipfix_entities.h"
@@ -72,10 +75,86 @@ IPFIXCOL_API_VERSION;
 #define SQL_COMMAND_LENGTH 2048
 /* number of store packet call in one transaction */
 #define TRANSACTION_MAX 2
+/* default number of records in one COPY batch */
+#define DEFAULT_BATCH_SIZE 10000
+/* default maximal age of COPY batches in seconds */
+#define DEFAULT_FLUSH_INTERVAL 1
+/* number of COPY batches that can be in flight at once */
+#define COPY_PIPELINE_DEPTH 4
+/* initial size of the COPY batch buffer */
+#define COPY_BUFFER_SIZE 65536
+/* maximal amount of data passed to PQputCopyData at once */
+#define COPY_CHUNK_SIZE 65536
+/* space needed for one encoded field besides the field data itself */
+#define COPY_FIELD_OVERHEAD 32
+/* address families of the inet type in binary format (see utils/inet.h) */
+#define PGSQL_AF_INET (AF_INET + 0)
+#define PGSQL_AF_INET6 (AF_INET + 1)
+/* seconds between 1970-01-01 and 2000-01-01 (PostgreSQL epoch) */
+#define POSTGRES_EPOCH_UNIX 946684800LL
+/* seconds between 1900-01-01 (NTP epoch) and 2000-01-01 */
+#define POSTGRES_EPOCH_NTP 3155673600LL
 
 /** Identifier to MSG_* macros */
 static char *msg_module = "postgres storage";
 
+/** Header of the binary COPY format: signature, flags and header extension length */
+static const char copy_header[19] = "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0";
+
+/**
+ * \struct copy_batch
+ *
+ * \brief Records of one table encoded in binary COPY format
+ */
+struct copy_batch {
+	char table_name[TABLE_NAME_LEN];	/**< Name of the target table */
+	char *data;				/**< Encoded data including the COPY header */
+	size_t length;			/**< Length of the encoded data */
+	size_t size;			/**< Allocated size of the data */
+	uint32_t rows;			/**< Number of records in the batch */
+	struct copy_batch *next;	/**< Next batch in the queue or free list */
+};
+
+struct copy_column;
+
+/**
+ * \brief Encode one field of a data record as a binary COPY field
+ *
+ * Encoder writes the field length and value. The batch must have at least
+ * length + COPY_FIELD_OVERHEAD bytes of free space.
+ */
+typedef void (*copy_encoder)(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length);
+
+/**
+ * \struct copy_column
+ *
+ * \brief Prepared encoder of one template field
+ */
+struct copy_column {
+	uint16_t length;		/**< Field length from template (VAR_IE_LENGTH for variable length) */
+	uint8_t width;			/**< Width of the PostgreSQL integer column */
+	uint8_t is_signed;		/**< Field is a signed integer */
+	copy_encoder encode;	/**< Field encoder */
+};
+
+/**
+ * \struct copy_table
+ *
+ * \brief Column encoders and the open COPY batch of one table
+ */
+struct copy_table {
+	uint16_t id;				/**< Original template ID */
+	char name[TABLE_NAME_LEN];	/**< Name of the table */
+	uint8_t *fields;			/**< Copy of the template fields the encoders were prepared for */
+	uint16_t fields_length;		/**< Length of the template fields */
+	uint16_t min_length;		/**< Minimal length of a data record */
+	uint16_t column_count;		/**< Number of columns */
+	struct copy_column *columns;	/**< Column encoders */
+	struct copy_batch *batch;	/**< Batch being filled, NULL if there is none */
+	struct copy_table *next;	/**< Next table */
+};
+
 /**
  * \struct postgres_config
  *
@@ -87,6 +166,24 @@ struct postgres_config {
 	uint16_t table_counter;		/** number of known tables in database */
 	uint16_t table_size;		/** size of the table_names member */
 	uint32_t transaction_counter;	/**< Number of store_packet calls in current transaction */
+	uint8_t copy;				/**< Load data by COPY instead of INSERT */
+	uint32_t batch_size;		/**< Maximal number of records in one COPY batch */
+	uint32_t flush_interval;	/**< Maximal age of COPY batches in seconds */
+	struct timespec last_flush;	/**< Time when all COPY batches were flushed */
+	struct copy_table *copy_tables;	/**< Tables loaded by COPY */
+	PGconn *copy_conn;			/**< Connection used by the COPY thread */
+	pthread_t copy_thread;		/**< Thread sending COPY batches to the database */
+	pthread_mutex_t copy_mutex;	/**< Protects the queue and the free list */
+	pthread_cond_t copy_work;	/**< Signals new batch in the queue or stop request */
+	pthread_cond_t copy_space;	/**< Signals finished batch */
+	struct copy_batch *copy_queue;		/**< Batches waiting for the COPY thread */
+	struct copy_batch *copy_queue_tail;	/**< Last batch in the queue */
+	struct copy_batch *copy_free;		/**< Batches ready for reuse */
+	uint16_t copy_in_flight;	/**< Number of queued and currently sent batches */
+	uint8_t copy_stop;			/**< Stop the COPY thread when the queue is empty */
+	uint64_t copy_rows;			/**< Number of records loaded by COPY */
+	uint64_t copy_batches;		/**< Number of COPY commands */
+	uint64_t copy_failed;		/**< Number of records in failed COPY commands */
 };
 
 
@@ -149,6 +246,11 @@ inline static void commit_transaction(struct postgres_config *conf)
  */
 inline static void restart_transaction(struct postgres_config *conf)
 {
+	if (conf->copy) {
+		/* COPY mode runs in autocommit, there is no transaction to restart */
+		return;
+	}
+
 	conf->transaction_counter = 0;
 	commit_transaction(conf);
 	begin_transaction(conf);
@@ -831,6 +933,959 @@ err_sql_command:
 }
 
 
+/**
+ * \brief Append 16-bit integer to the COPY batch in network byte order
+ */
+static inline void copy_put16(struct copy_batch *batch, uint16_t value)
+{
+	value = htons(value);
+	memcpy(batch->data + batch->length, &value, sizeof(value));
+	batch->length += sizeof(value);
+}
+
+
+/**
+ * \brief Append 32-bit integer to the COPY batch in network byte order
+ */
+static inline void copy_put32(struct copy_batch *batch, uint32_t value)
+{
+	value = htonl(value);
+	memcpy(batch->data + batch->length, &value, sizeof(value));
+	batch->length += sizeof(value);
+}
+
+
+/**
+ * \brief Append 64-bit integer to the COPY batch in network byte order
+ */
+static inline void copy_put64(struct copy_batch *batch, uint64_t value)
+{
+	value = htobe64(value);
+	memcpy(batch->data + batch->length, &value, sizeof(value));
+	batch->length += sizeof(value);
+}
+
+
+/**
+ * \brief Append raw field value with its length to the COPY batch
+ */
+static inline void copy_put_raw(struct copy_batch *batch, const uint8_t *data, uint16_t length)
+{
+	copy_put32(batch, length);
+	memcpy(batch->data + batch->length, data, length);
+	batch->length += length;
+}
+
+
+/**
+ * \brief Append NULL field to the COPY batch
+ */
+static inline void copy_put_null(struct copy_batch *batch)
+{
+	copy_put32(batch, (uint32_t) -1);
+}
+
+
+/**
+ * \brief Read unsigned integer encoded in length bytes (reduced size encoding)
+ */
+static inline uint64_t copy_read_uint(const uint8_t *data, uint16_t length)
+{
+	uint64_t value = 0;
+	uint16_t i;
+
+	for (i = 0; i < length; i++) {
+		value = (value << 8) | data[i];
+	}
+
+	return value;
+}
+
+
+/**
+ * \brief Append unsigned integer as a value of numeric type
+ *
+ * Numeric is sent as a list of base 10000 digits, most significant first.
+ * Trailing zero digits are implied by the weight.
+ */
+static void copy_put_numeric(struct copy_batch *batch, uint64_t value)
+{
+	uint16_t digits[5];
+	int ndigits = 0, skip = 0, i;
+
+	while (value > 0) {
+		digits[ndigits++] = value % 10000;
+		value /= 10000;
+	}
+
+	while (skip < ndigits && digits[skip] == 0) {
+		skip++;
+	}
+
+	copy_put32(batch, 8 + 2 * (ndigits - skip));
+	copy_put16(batch, ndigits - skip);          /* number of digits */
+	copy_put16(batch, ndigits ? ndigits - 1 : 0); /* weight of the first digit */
+	copy_put16(batch, 0);                       /* sign (positive) */
+	copy_put16(batch, 0);                       /* display scale */
+	for (i = ndigits - 1; i >= skip; i--) {
+		copy_put16(batch, digits[i]);
+	}
+}
+
+
+/**
+ * \brief Encode (un)signed integer as smallint, integer or bigint
+ */
+static void copy_encode_integer(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	uint64_t value;
+	int shift;
+
+	if (length == 0 || length > sizeof(uint64_t)) {
+		copy_put_null(batch);
+		return;
+	}
+
+	value = copy_read_uint(data, length);
+	if (column->is_signed) {
+		/* extend sign of the reduced size value */
+		shift = 64 - 8 * length;
+		value = (uint64_t) (((int64_t) (value << shift)) >> shift);
+	}
+
+	copy_put32(batch, column->width);
+	switch (column->width) {
+	case sizeof(uint16_t):
+		copy_put16(batch, (uint16_t) value);
+		break;
+	case sizeof(uint32_t):
+		copy_put32(batch, (uint32_t) value);
+		break;
+	default:
+		copy_put64(batch, value);
+		break;
+	}
+}
+
+
+/**
+ * \brief Encode unsigned64 as numeric
+ */
+static void copy_encode_numeric(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	(void) column;
+
+	if (length == 0 || length > sizeof(uint64_t)) {
+		copy_put_null(batch);
+		return;
+	}
+
+	copy_put_numeric(batch, copy_read_uint(data, length));
+}
+
+
+/**
+ * \brief Encode boolean as numeric 1 (true) or 0 (false)
+ *
+ * In IPFIX, boolean is encoded in single octet, 1 means TRUE, 2 means FALSE.
+ */
+static void copy_encode_boolean(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	(void) column;
+
+	if (length != 1 || (data[0] != 1 && data[0] != 2)) {
+		copy_put_null(batch);
+		return;
+	}
+
+	copy_put_numeric(batch, data[0] == 1);
+}
+
+
+/**
+ * \brief Encode string as text, the value ends at the first zero byte
+ */
+static void copy_encode_text(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	const uint8_t *zero = memchr(data, '\0', length);
+
+	(void) column;
+
+	if (zero) {
+		length = zero - data;
+	}
+
+	copy_put_raw(batch, data, length);
+}
+
+
+/**
+ * \brief Encode field as bytea (binary data are sent as they are)
+ */
+static void copy_encode_bytea(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	(void) column;
+
+	copy_put_raw(batch, data, length);
+}
+
+
+/**
+ * \brief Encode IPv4 or IPv6 address as inet
+ */
+static void copy_encode_inet(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	(void) column;
+
+	if (length != 4 && length != 16) {
+		copy_put_null(batch);
+		return;
+	}
+
+	copy_put32(batch, 4 + length);
+	batch->data[batch->length++] = (length == 4) ? PGSQL_AF_INET : PGSQL_AF_INET6;
+	batch->data[batch->length++] = length * 8; /* netmask bits */
+	batch->data[batch->length++] = 0;          /* is_cidr */
+	batch->data[batch->length++] = length;
+	memcpy(batch->data + batch->length, data, length);
+	batch->length += length;
+}
+
+
+/**
+ * \brief Encode MAC address as macaddr
+ */
+static void copy_encode_macaddr(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	(void) column;
+
+	if (length != 6) {
+		copy_put_null(batch);
+		return;
+	}
+
+	copy_put_raw(batch, data, length);
+}
+
+
+/**
+ * \brief Append timestamp given in microseconds since the PostgreSQL epoch
+ */
+static inline void copy_put_timestamp(struct copy_batch *batch, int64_t usec)
+{
+	copy_put32(batch, sizeof(int64_t));
+	copy_put64(batch, (uint64_t) usec);
+}
+
+
+/**
+ * \brief Encode dateTimeSeconds as timestamp
+ */
+static void copy_encode_seconds(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	(void) column;
+
+	if (length != sizeof(uint32_t)) {
+		copy_put_null(batch);
+		return;
+	}
+
+	copy_put_timestamp(batch, ((int64_t) copy_read_uint(data, length) - POSTGRES_EPOCH_UNIX) * 1000000);
+}
+
+
+/**
+ * \brief Encode dateTimeMilliseconds as timestamp
+ */
+static void copy_encode_milliseconds(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	(void) column;
+
+	if (length != sizeof(uint64_t)) {
+		copy_put_null(batch);
+		return;
+	}
+
+	copy_put_timestamp(batch, ((int64_t) copy_read_uint(data, length) - POSTGRES_EPOCH_UNIX * 1000) * 1000);
+}
+
+
+/**
+ * \brief Encode dateTimeMicroseconds and dateTimeNanoseconds as timestamp
+ *
+ * Both types are encoded in NTP timestamp format (RFC 5101, section 6.1.9).
+ */
+static void copy_encode_ntp(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	uint64_t ntp;
+	int64_t usec;
+
+	(void) column;
+
+	if (length != sizeof(uint64_t)) {
+		copy_put_null(batch);
+		return;
+	}
+
+	ntp = copy_read_uint(data, length);
+	usec = ((int64_t) (ntp >> 32) - POSTGRES_EPOCH_NTP) * 1000000;
+	usec += ((ntp & 0xffffffff) * 1000000) >> 32;
+
+	copy_put_timestamp(batch, usec);
+}
+
+
+/**
+ * \brief Encode float32 or float64 as double precision
+ */
+static void copy_encode_float(struct copy_batch *batch, const struct copy_column *column,
+		const uint8_t *data, uint16_t length)
+{
+	uint32_t bits32;
+	uint64_t bits64;
+	float float32;
+	double float64;
+
+	(void) column;
+
+	switch (length) {
+	case sizeof(double):
+		/* IEEE 754 in network byte order is exactly what PostgreSQL expects */
+		copy_put_raw(batch, data, length);
+		break;
+	case sizeof(float):
+		bits32 = (uint32_t) copy_read_uint(data, length);
+		memcpy(&float32, &bits32, sizeof(float32));
+		float64 = float32;
+		memcpy(&bits64, &float64, sizeof(bits64));
+		copy_put32(batch, sizeof(double));
+		copy_put64(batch, bits64);
+		break;
+	default:
+		copy_put_null(batch);
+		break;
+	}
+}
+
+
+/**
+ * \brief Prepare encoder for a field of given IPFIX data type
+ *
+ * Encoders correspond to PostgreSQL types used by create_table.
+ *
+ * \param[out] column column to prepare
+ * \param[in] ipfix_type IPFIX data type, NULL for unknown and enterprise elements
+ */
+static void copy_prepare_column(struct copy_column *column, const char *ipfix_type)
+{
+	column->width = 0;
+	column->is_signed = 0;
+
+	switch (ipfix_type_to_internal(ipfix_type)) {
+	case (UINT8):
+		column->width = sizeof(int16_t);
+		column->encode = copy_encode_integer;
+		break;
+	case (UINT16):
+		column->width = sizeof(int32_t);
+		column->encode = copy_encode_integer;
+		break;
+	case (UINT32):
+		column->width = sizeof(int64_t);
+		column->encode = copy_encode_integer;
+		break;
+	case (INT8):
+	case (INT16):
+		column->width = sizeof(int16_t);
+		column->is_signed = 1;
+		column->encode = copy_encode_integer;
+		break;
+	case (INT32):
+		column->width = sizeof(int32_t);
+		column->is_signed = 1;
+		column->encode = copy_encode_integer;
+		break;
+	case (INT64):
+		column->width = sizeof(int64_t);
+		column->is_signed = 1;
+		column->encode = copy_encode_integer;
+		break;
+	case (UINT64):
+		column->encode = copy_encode_numeric;
+		break;
+	case (BOOLEAN):
+		column->encode = copy_encode_boolean;
+		break;
+	case (STRING):
+		column->encode = copy_encode_text;
+		break;
+	case (IPV4ADDR):
+	case (IPV6ADDR):
+		column->encode = copy_encode_inet;
+		break;
+	case (MACADDR):
+		column->encode = copy_encode_macaddr;
+		break;
+	case (DATETIMESECONDS):
+		column->encode = copy_encode_seconds;
+		break;
+	case (DATETIMEMILLISECONDS):
+		column->encode = copy_encode_milliseconds;
+		break;
+	case (DATETIMEMICROSECONDS):
+	case (DATETIMENANOSECONDS):
+		column->encode = copy_encode_ntp;
+		break;
+	case (FLOAT32):
+	case (FLOAT64):
+		column->encode = copy_encode_float;
+		break;
+	default:
+		/* octetArray, enterprise and unknown elements are stored as bytea */
+		column->encode = copy_encode_bytea;
+		break;
+	}
+}
+
+
+/**
+ * \brief Prepare column encoders of the table for given template
+ *
+ * \param[in,out] table COPY table
+ * \param[in] template IPFIX template
+ * \return 0 on success
+ */
+static int copy_prepare_table(struct copy_table *table, const struct ipfix_template *template)
+{
+	struct copy_column *columns;
+	const uint8_t *fields = (const uint8_t *) template->fields;
+	uint16_t ie_id;
+	uint16_t index = 0;
+	uint16_t min_length = 0;
+	uint16_t u;
+
+	columns = (struct copy_column *) calloc(template->field_count, sizeof(*columns));
+	if (!columns) {
+		MSG_ERROR(msg_module, "Out of memory (%s:%d)", __FILE__, __LINE__);
+		return -1;
+	}
+
+	for (u = 0; u < template->field_count; u++) {
+		ie_id = *((uint16_t *) (fields+index));
+		columns[u].length = *((uint16_t *) (fields+index+2));
+
+		if (ie_id >> 15) {
+			/* enterprise element, stored as bytea */
+			copy_prepare_column(&columns[u], NULL);
+			index += 8;
+		} else {
+			copy_prepare_column(&columns[u], get_ie_type(ie_id));
+			index += 4;
+		}
+
+		min_length += (columns[u].length == VAR_IE_LENGTH) ? 1 : columns[u].length;
+	}
+
+	free(table->fields);
+	table->fields = (uint8_t *) malloc(index);
+	if (!table->fields && index > 0) {
+		MSG_ERROR(msg_module, "Out of memory (%s:%d)", __FILE__, __LINE__);
+		free(columns);
+		table->fields_length = 0;
+		return -1;
+	}
+	memcpy(table->fields, fields, index);
+	table->fields_length = index;
+
+	free(table->columns);
+	table->columns = columns;
+	table->column_count = template->field_count;
+	table->min_length = min_length;
+
+	return 0;
+}
+
+
+/**
+ * \brief Make sure the batch has at least size bytes of free space
+ *
+ * \return 0 on success
+ */
+static inline int copy_reserve(struct copy_batch *batch, size_t size)
+{
+	char *data;
+	size_t new_size;
+
+	if (batch->length + size <= batch->size) {
+		return 0;
+	}
+
+	new_size = batch->size * 2;
+	while (new_size < batch->length + size) {
+		new_size *= 2;
+	}
+
+	data = (char *) realloc(batch->data, new_size);
+	if (!data) {
+		MSG_ERROR(msg_module, "Out of memory (%s:%d)", __FILE__, __LINE__);
+		return -1;
+	}
+
+	batch->data = data;
+	batch->size = new_size;
+
+	return 0;
+}
+
+
+/**
+ * \brief Get empty batch for the table, reuse finished batches when possible
+ *
+ * \param[in] conf config structure
+ * \param[in] table COPY table
+ * \return batch with COPY header, NULL on error
+ */
+static struct copy_batch *copy_batch_get(struct postgres_config *conf, const struct copy_table *table)
+{
+	struct copy_batch *batch;
+
+	pthread_mutex_lock(&conf->copy_mutex);
+	batch = conf->copy_free;
+	if (batch) {
+		conf->copy_free = batch->next;
+	}
+	pthread_mutex_unlock(&conf->copy_mutex);
+
+	if (!batch) {
+		batch = (struct copy_batch *) calloc(1, sizeof(*batch));
+		if (!batch) {
+			MSG_ERROR(msg_module, "Out of memory (%s:%d)", __FILE__, __LINE__);
+			return NULL;
+		}
+
+		batch->size = COPY_BUFFER_SIZE;
+		batch->data = (char *) malloc(batch->size);
+		if (!batch->data) {
+			MSG_ERROR(msg_module, "Out of memory (%s:%d)", __FILE__, __LINE__);
+			free(batch);
+			return NULL;
+		}
+	}
+
+	strncpy(batch->table_name, table->name, TABLE_NAME_LEN);
+	memcpy(batch->data, copy_header, sizeof(copy_header));
+	batch->length = sizeof(copy_header);
+	batch->rows = 0;
+	batch->next = NULL;
+
+	return batch;
+}
+
+
+/**
+ * \brief Free list of batches
+ */
+static void copy_batch_free(struct copy_batch *batch)
+{
+	struct copy_batch *next;
+
+	while (batch) {
+		next = batch->next;
+		free(batch->data);
+		free(batch);
+		batch = next;
+	}
+}
+
+
+/**
+ * \brief Pass the open batch of the table to the COPY thread
+ *
+ * Waits only when COPY_PIPELINE_DEPTH batches are already in flight.
+ *
+ * \param[in] conf config structure
+ * \param[in] table COPY table
+ */
+static void copy_submit(struct postgres_config *conf, struct copy_table *table)
+{
+	struct copy_batch *batch = table->batch;
+
+	if (!batch || batch->rows == 0) {
+		return;
+	}
+	table->batch = NULL;
+
+	/* file trailer, space for it is reserved with every record */
+	copy_put16(batch, (uint16_t) -1);
+
+	pthread_mutex_lock(&conf->copy_mutex);
+	while (conf->copy_in_flight >= COPY_PIPELINE_DEPTH) {
+		pthread_cond_wait(&conf->copy_space, &conf->copy_mutex);
+	}
+
+	if (conf->copy_queue_tail) {
+		conf->copy_queue_tail->next = batch;
+	} else {
+		conf->copy_queue = batch;
+	}
+	conf->copy_queue_tail = batch;
+	conf->copy_in_flight++;
+
+	pthread_cond_signal(&conf->copy_work);
+	pthread_mutex_unlock(&conf->copy_mutex);
+}
+
+
+/**
+ * \brief Get COPY table for the template, prepare its encoders if necessary
+ *
+ * Encoders are prepared again whenever the template fields change. This
+ * happens when the template is redefined or when two sources use the same
+ * template ID with different fields, possibly alternating message by message.
+ * Rows of one COPY stream must have the same layout, so the open batch is
+ * submitted before the encoders are replaced and each layout gets its own
+ * batch.
+ *
+ * \param[in] conf config structure
+ * \param[in] template IPFIX template
+ * \return COPY table, NULL on error
+ */
+static struct copy_table *copy_get_table(struct postgres_config *conf, const struct ipfix_template *template)
+{
+	struct copy_table *table;
+
+	for (table = conf->copy_tables; table; table = table->next) {
+		if (table->id == template->original_id) {
+			break;
+		}
+	}
+
+	if (!table) {
+		table = (struct copy_table *) calloc(1, sizeof(*table));
+		if (!table) {
+			MSG_ERROR(msg_module, "Out of memory (%s:%d)", __FILE__, __LINE__);
+			return NULL;
+		}
+
+		table->id = template->original_id;
+		snprintf(table->name, TABLE_NAME_LEN, TABLE_NAME_PREFIX "%u", template->original_id);
+		table->next = conf->copy_tables;
+		conf->copy_tables = table;
+	}
+
+	if (table->column_count != template->field_count
+			|| memcmp(table->fields, template->fields, table->fields_length) != 0) {
+		/* Rows of the open batch use the previous layout */
+		copy_submit(conf, table);
+
+		if (copy_prepare_table(table, template) != 0) {
+			return NULL;
+		}
+	}
+
+	return table;
+}
+
+
+/**
+ * \brief Pass open batches of all tables to the COPY thread
+ *
+ * \param[in] conf config structure
+ * \param[in] wait wait until all batches are stored in the database
+ */
+static void copy_flush(struct postgres_config *conf, int wait)
+{
+	struct copy_table *table;
+
+	for (table = conf->copy_tables; table; table = table->next) {
+		copy_submit(conf, table);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &conf->last_flush);
+
+	if (wait) {
+		pthread_mutex_lock(&conf->copy_mutex);
+		while (conf->copy_in_flight > 0) {
+			pthread_cond_wait(&conf->copy_space, &conf->copy_mutex);
+		}
+		pthread_mutex_unlock(&conf->copy_mutex);
+	}
+}
+
+
+/**
+ * \brief Encode records of a Data Set into the open batch of its table
+ *
+ * \param[in] conf config structure
+ * \param[in] couple template+data couple
+ * \return 0 on success
+ */
+static int copy_data_set(struct postgres_config *conf, const struct data_template_couple *couple)
+{
+	struct copy_table *table;
+	struct copy_batch *batch;
+	const struct copy_column *column;
+	const uint8_t *data = couple->data_set->records;
+	const uint8_t *end = (const uint8_t *) couple->data_set + ntohs(couple->data_set->header.length);
+	size_t record_start;
+	uint16_t length;
+	uint16_t u;
+
+	table = copy_get_table(conf, couple->data_template);
+	if (!table || table->min_length == 0) {
+		return -1;
+	}
+
+	while (end - data >= table->min_length) {
+		if (!table->batch) {
+			table->batch = copy_batch_get(conf, table);
+			if (!table->batch) {
+				return -1;
+			}
+		}
+		batch = table->batch;
+		record_start = batch->length;
+
+		/* field count and trailer of the batch */
+		if (copy_reserve(batch, 2 * sizeof(uint16_t)) != 0) {
+			return -1;
+		}
+		copy_put16(batch, table->column_count);
+
+		for (u = 0; u < table->column_count; u++) {
+			column = &table->columns[u];
+			length = column->length;
+
+			/* check whether this element has variable length */
+			if (length == VAR_IE_LENGTH) {
+				if (data >= end) {
+					goto truncated;
+				}
+				length = *data;
+				data += 1;
+				if (length == 255) {
+					if (end - data < 2) {
+						goto truncated;
+					}
+					length = (data[0] << 8) | data[1];
+					data += 2;
+				}
+			}
+
+			if (end - data < length) {
+				goto truncated;
+			}
+
+			if (copy_reserve(batch, length + COPY_FIELD_OVERHEAD + sizeof(uint16_t)) != 0) {
+				batch->length = record_start;
+				return -1;
+			}
+			column->encode(batch, column, data, length);
+			data += length;
+		}
+
+		batch->rows++;
+		if (batch->rows >= conf->batch_size) {
+			copy_submit(conf, table);
+		}
+	}
+
+	return 0;
+
+truncated:
+	MSG_WARNING(msg_module, "Truncated data record in Data Set of template %u", table->id);
+	table->batch->length = record_start;
+	return -1;
+}
+
+
+/**
+ * \brief Load one batch into the database by COPY
+ *
+ * \param[in] conf config structure
+ * \param[in] batch batch to send
+ * \return 0 on success
+ */
+static int copy_send(struct postgres_config *conf, struct copy_batch *batch)
+{
+	PGconn *conn = conf->copy_conn;
+	PGresult *res;
+	char sql_command[SQL_COMMAND_LENGTH];
+	const char *error = NULL;
+	size_t offset;
+	size_t chunk;
+	int ret = 0;
+
+	snprintf(sql_command, SQL_COMMAND_LENGTH, "COPY \"%s\" FROM STDIN (FORMAT binary)", batch->table_name);
+
+	res = PQexec(conn, sql_command);
+	if (PQresultStatus(res) != PGRES_COPY_IN) {
+		MSG_ERROR(msg_module, "PostgreSQL: %s", PQerrorMessage(conn));
+		PQclear(res);
+		ret = -1;
+		goto check_connection;
+	}
+	PQclear(res);
+
+	for (offset = 0; offset < batch->length; offset += chunk) {
+		chunk = batch->length - offset;
+		if (chunk > COPY_CHUNK_SIZE) {
+			chunk = COPY_CHUNK_SIZE;
+		}
+
+		if (PQputCopyData(conn, batch->data + offset, chunk) != 1) {
+			error = "sending data failed";
+			break;
+		}
+	}
+
+	if (PQputCopyEnd(conn, error) != 1) {
+		MSG_ERROR(msg_module, "PostgreSQL: %s", PQerrorMessage(conn));
+		ret = -1;
+	}
+
+	while ((res = PQgetResult(conn)) != NULL) {
+		if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+			MSG_ERROR(msg_module, "PostgreSQL: %s", PQerrorMessage(conn));
+			ret = -1;
+		}
+		PQclear(res);
+	}
+
+check_connection:
+	if (PQstatus(conn) == CONNECTION_BAD) {
+		MSG_WARNING(msg_module, "Connection to the database lost, reconnecting");
+		PQreset(conn);
+	}
+
+	return ret;
+}
+
+
+/**
+ * \brief COPY thread, sends queued batches to the database
+ *
+ * \param[in] arg config structure
+ * \return NULL
+ */
+static void *copy_thread(void *arg)
+{
+	struct postgres_config *conf = (struct postgres_config *) arg;
+	struct copy_batch *batch;
+	int ret;
+
+	pthread_mutex_lock(&conf->copy_mutex);
+	while (1) {
+		while (!conf->copy_queue && !conf->copy_stop) {
+			pthread_cond_wait(&conf->copy_work, &conf->copy_mutex);
+		}
+
+		batch = conf->copy_queue;
+		if (!batch) {
+			/* stop requested and nothing left to send */
+			break;
+		}
+
+		conf->copy_queue = batch->next;
+		if (!conf->copy_queue) {
+			conf->copy_queue_tail = NULL;
+		}
+		pthread_mutex_unlock(&conf->copy_mutex);
+
+		ret = copy_send(conf, batch);
+
+		pthread_mutex_lock(&conf->copy_mutex);
+		conf->copy_batches++;
+		if (ret == 0) {
+			conf->copy_rows += batch->rows;
+		} else {
+			conf->copy_failed += batch->rows;
+		}
+
+		batch->next = conf->copy_free;
+		conf->copy_free = batch;
+		conf->copy_in_flight--;
+		pthread_cond_broadcast(&conf->copy_space);
+	}
+	pthread_mutex_unlock(&conf->copy_mutex);
+
+	return NULL;
+}
+
+
+/**
+ * \brief Start COPY thread
+ *
+ * \param[in] conf config structure
+ * \return 0 on success
+ */
+static int copy_start(struct postgres_config *conf)
+{
+	if (pthread_mutex_init(&conf->copy_mutex, NULL) != 0
+			|| pthread_cond_init(&conf->copy_work, NULL) != 0
+			|| pthread_cond_init(&conf->copy_space, NULL) != 0) {
+		MSG_ERROR(msg_module, "Unable to initialize COPY thread synchronization");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &conf->last_flush);
+
+	if (pthread_create(&conf->copy_thread, NULL, copy_thread, conf) != 0) {
+		MSG_ERROR(msg_module, "Unable to create COPY thread");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * \brief Store open batches, stop COPY thread and free COPY tables
+ *
+ * \param[in] conf config structure
+ */
+static void copy_stop(struct postgres_config *conf)
+{
+	struct copy_table *table;
+
+	copy_flush(conf, 0);
+
+	pthread_mutex_lock(&conf->copy_mutex);
+	conf->copy_stop = 1;
+	pthread_cond_signal(&conf->copy_work);
+	pthread_mutex_unlock(&conf->copy_mutex);
+
+	pthread_join(conf->copy_thread, NULL);
+
+	MSG_INFO(msg_module, "COPY: %" PRIu64 " records stored in %" PRIu64 " batches, %" PRIu64 " records failed",
+			conf->copy_rows, conf->copy_batches, conf->copy_failed);
+
+	while ((table = conf->copy_tables) != NULL) {
+		conf->copy_tables = table->next;
+		free(table->fields);
+		free(table->columns);
+		free(table);
+	}
+
+	copy_batch_free(conf->copy_free);
+	conf->copy_free = NULL;
+
+	pthread_cond_destroy(&conf->copy_space);
+	pthread_cond_destroy(&conf->copy_work);
+	pthread_mutex_destroy(&conf->copy_mutex);
+}
+
+
 /**
  * \brief Process new templates
  *
@@ -912,8 +1967,12 @@ static int process_data_records(struct postgres_config *conf, const struct ipfix
 			set_index++;
 			continue;
 		}
-		snprintf(table_name, TABLE_NAME_LEN, TABLE_NAME_PREFIX "%u", ipfix_msg->data_couple[set_index].data_template->original_id);
-		insert_into(conf, table_name, &(ipfix_msg->data_couple[set_index]));
+		if (conf->copy) {
+			copy_data_set(conf, &(ipfix_msg->data_couple[set_index]));
+		} else {
+			snprintf(table_name, TABLE_NAME_LEN, TABLE_NAME_PREFIX "%u", ipfix_msg->data_couple[set_index].data_template->original_id);
+			insert_into(conf, table_name, &(ipfix_msg->data_couple[set_index]));
+		}
 
 		set_index++;
 	}
@@ -946,6 +2005,7 @@ int storage_init(char *params, void **config)
 	uint8_t dbname_allocated = 0; /* indicates whether dbname was allocated via malloc() */
 	char *user = NULL;
 	char *pass = NULL;
+	char *value;
 	size_t connection_string_len;
 	size_t str_len;
 
@@ -955,7 +2015,8 @@ int storage_init(char *params, void **config)
 		return -1;
 	}
 	memset(conf, 0, sizeof(*conf));
-
+	conf->batch_size = DEFAULT_BATCH_SIZE;
+	conf->flush_interval = DEFAULT_FLUSH_INTERVAL;
 
 	doc = xmlReadMemory(params, strlen(params), "nobase.xml", NULL, 0);
 	if (doc == NULL) {
@@ -1025,6 +2086,28 @@ int storage_init(char *params, void **config)
 			pass = (char *) xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
 		}
 
+		if ((!xmlStrcmp(cur->name, (const xmlChar *) "copy"))) {
+			value = (char *) xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
+			conf->copy = value && !xmlStrcasecmp((xmlChar *) value, (const xmlChar *) "yes");
+			xmlFree(value);
+		}
+
+		if ((!xmlStrcmp(cur->name, (const xmlChar *) "batchSize"))) {
+			value = (char *) xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
+			conf->batch_size = value ? strtoul(value, NULL, 10) : 0;
+			xmlFree(value);
+			if (conf->batch_size == 0) {
+				MSG_WARNING(msg_module, "Invalid batchSize, using default value %u", DEFAULT_BATCH_SIZE);
+				conf->batch_size = DEFAULT_BATCH_SIZE;
+			}
+		}
+
+		if ((!xmlStrcmp(cur->name, (const xmlChar *) "flushInterval"))) {
+			value = (char *) xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
+			conf->flush_interval = value ? strtoul(value, NULL, 10) : DEFAULT_FLUSH_INTERVAL;
+			xmlFree(value);
+		}
+
 		cur = cur->next;
 	}
 
@@ -1130,6 +2213,16 @@ int storage_init(char *params, void **config)
 		MSG_ERROR(msg_module, "Unable to create connection to the database(connection string = %s) : %s",connection_string+1, PQerrorMessage(conn));
 		goto err_connection_string;
 	}
+	conf->conn = conn;
+
+	if (conf->copy) {
+		/* COPY thread uses its own connection, tables are still created by the main one */
+		conf->copy_conn = PQconnectdb(connection_string+1);
+		if (PQstatus(conf->copy_conn) != CONNECTION_OK) {
+			MSG_ERROR(msg_module, "Unable to create COPY connection to the database: %s", PQerrorMessage(conf->copy_conn));
+			goto err_copy_conn;
+		}
+	}
 
 	conf->table_size = 128;	/* default value, just a guess */
 	conf->table_names = (uint16_t *) malloc(conf->table_size * sizeof(uint16_t));
@@ -1139,7 +2232,14 @@ int storage_init(char *params, void **config)
 	}
 	memset(conf->table_names, 0, conf->table_size * sizeof(uint16_t));
 
-	conf->conn = conn;
+	if (conf->copy) {
+		if (copy_start(conf) != 0) {
+			goto err_copy_start;
+		}
+		MSG_INFO(msg_module, "Storing data by COPY in batches of %u records (flush interval %u s)",
+				conf->batch_size, conf->flush_interval);
+	}
+
 	*config = conf;
 
 	/* done using connection string */
@@ -1150,7 +2250,14 @@ int storage_init(char *params, void **config)
 
 	return 0;
 
+err_copy_start:
+	free(conf->table_names);
+
 err_table_names:
+err_copy_conn:
+	if (conf->copy_conn) {
+		PQfinish(conf->copy_conn);
+	}
 	PQfinish(conf->conn);
 
 err_connection_string:
@@ -1181,6 +2288,7 @@ int store_packet(void *config, const struct ipfix_message *ipfix_msg,
 	const struct ipfix_template_mgr *template_mgr)
 {
 	struct postgres_config *conf;
+	struct timespec now;
 
 	if (config == NULL || ipfix_msg == NULL) {
 		return -1;
@@ -1188,6 +2296,19 @@ int store_packet(void *config, const struct ipfix_message *ipfix_msg,
 
 	conf = (struct postgres_config *) config;
 
+	if (conf->copy) {
+		process_new_templates(conf, ipfix_msg);
+		process_data_records(conf, ipfix_msg);
+
+		/* do not keep records in partially filled batches for too long */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec - conf->last_flush.tv_sec >= (time_t) conf->flush_interval) {
+			copy_flush(conf, 0);
+		}
+
+		return 0;
+	}
+
 	begin_transaction(conf);
 	process_new_templates(conf, ipfix_msg);
 	process_data_records(conf, ipfix_msg);
@@ -1209,6 +2330,11 @@ int store_now(const void *config)
 {
 	struct postgres_config *conf = (struct postgres_config *) config;
 
+	if (conf->copy) {
+		copy_flush(conf, 1);
+		return 0;
+	}
+
 	/* commit transaction */
 	conf->transaction_counter = 0;
 	commit_transaction(conf);
@@ -1232,6 +2358,11 @@ int storage_close(void **config)
 
 	conf = (struct postgres_config *) *config;
 
+	if (conf->copy) {
+		copy_stop(conf);
+		PQfinish(conf->copy_conn);
+	}
+
 	PQfinish(conf->conn);
 	MSG_INFO(msg_module, "Connection to the database has been closed.");
 
@@ -1258,7 +2389,7 @@ int main(int argc, char **argv)
 {
 	struct postgres_config *config;
 	int ret;
-	struct ipfix_message message;
+	struct ipfix_message *message;
 	struct ipfix_template template;
 
 	ret = storage_init(xml_configuration, (void **) &config);
@@ -1266,7 +2397,8 @@ int main(int argc, char **argv)
 		fprintf(stderr, "DEBUG: storage_init() failed with return code %d.\n", ret);
 	}
 
-	message.data_couple[0].data_template = &template;
+	message = message_create_sized(0, 0, 1);
+	message->data_couple[0].data_template = &template;
 	template.template_id = 333;
 	template.field_count = 1;
 
@@ -1281,8 +2413,9 @@ int main(int argc, char **argv)
 	}
 		PQclear(res);
 	*/
-	process_new_templates(config, &message);
-	process_data_records(config, &message);
+	process_new_templates(config, message);
+	process_data_records(config, message);
+	free(message);
 
 
 	ret = storage_close((void **) &config);
@@ -254,40 +254,296 @@ static unirecField *match_field(template_ie *element, fht_table_t *ht, uint16_t
 }
 
 /**
- * \brief Get data from data record
+ * \brief Free template copy program
  *
- * Uses conf->unirecFields to store values from this record
+ * @param prog Program to free
+ */
+static void program_destroy(ur_program *prog)
+{
+   free(prog->field_length);
+   free(prog->field_offset);
+   free(prog->value_length);
+   free(prog->required);
+   free(prog->ops);
+   free(prog);
+}
+
+/**
+ * \brief Free all cached template copy programs
  *
- * \param[in] data_record IPFIX data record
- * \param[in] template corresponding template
- * \param[out] conf structure containing necessary information for converting ipfix to unirec
- * \return length of the data record
+ * @param conf Pointer to storage plugin structure
  */
-static uint16_t process_record(char *data_record, struct ipfix_template *template, unirec_config *conf)
+static void programs_flush(unirec_config *conf)
 {
+   ur_program *prog, *next;
 
-   if (!template) {
-      /* We don't have template for this data set */
-      MSG_WARNING(msg_module, "No template for the data set\n");
-      return 0;
+   for (int i = 0; i < UR_PROGRAM_CACHE_SIZE; i++) {
+      for (prog = conf->programs[i]; prog; prog = next) {
+         next = prog->next;
+         program_destroy(prog);
+      }
+      conf->programs[i] = NULL;
    }
+   conf->program_count = 0;
+}
 
-   if (!conf) {
-      /* Configuration not given */
-      MSG_WARNING(msg_module, "No configuration given to process_record\n");
-      return 0;
+/**
+ * \brief Append an operation to the template copy program
+ *
+ * Raw copy is merged with the previous operation when both source and
+ * destination continue it.
+ *
+ * @param prog Template copy program
+ * @param type Operation type
+ * @param ifc Index of the interface
+ * @param field Index of the source field
+ * @param length Length of data
+ * @param dst Offset in the UniRec buffer
+ * @param urfield UniRec field
+ */
+static void program_add_op(ur_program *prog, uint8_t type, uint16_t ifc, uint16_t field,
+      uint16_t length, uint16_t dst, unirecField *urfield)
+{
+   ur_copy_op *last = prog->op_count ? &prog->ops[prog->op_count - 1] : NULL;
+
+   if (type == UR_OP_COPY && last && last->type == UR_OP_COPY && last->ifc == ifc
+         && field < prog->var_first
+         && last->dst + last->length == dst
+         && prog->field_offset[last->field] + last->length == prog->field_offset[field]) {
+      last->length += length;
+      return;
    }
 
+   prog->ops[prog->op_count].type = type;
+   prog->ops[prog->op_count].ifc = ifc;
+   prog->ops[prog->op_count].field = field;
+   prog->ops[prog->op_count].length = length;
+   prog->ops[prog->op_count].dst = dst;
+   prog->ops[prog->op_count].urfield = urfield;
+   prog->op_count++;
+}
+
+/**
+ * \brief Create copy program of the template
+ *
+ * Matching of template fields to UniRec fields and all decisions that depend
+ * only on the template are done here once, so that records are converted by
+ * a flat list of operations with precomputed offsets. Operations are ordered
+ * by interfaces to write each UniRec buffer sequentially.
+ *
+ * @param template Template
+ * @param conf Pointer to storage plugin structure
+ * @return New program or NULL when out of memory
+ */
+static ur_program *program_create(struct ipfix_template *template, unirec_config *conf)
+{
+   ur_program *prog;
+   unirecField **matched;
+   uint16_t *ids;
+   uint32_t *ens;
+   uint16_t index, count, offset = 0;
+   uint16_t length, dst;
+   uint8_t type;
+
+   prog = calloc(1, sizeof(ur_program));
+   if (!prog) {
+      MSG_ERROR(msg_module, "Out of memory (%s:%d)", __FILE__, __LINE__);
+      return NULL;
+   }
 
-   uint16_t offset = 0;
-   uint16_t index, count;
-   uint16_t length, size_length;
-   unirecField *matchField;
+   count = template->field_count;
+   prog->serial = template->serial;
+   prog->field_count = count;
+   prog->var_first = count;
+
+   prog->field_length = calloc(count + 1, sizeof(uint16_t));
+   prog->field_offset = calloc(count + 1, sizeof(uint16_t));
+   prog->value_length = calloc(count + 1, sizeof(uint16_t));
+   prog->required = calloc(conf->ifc_count, sizeof(uint8_t));
+   /* At most one operation per field and interface or one per dynamic field */
+   prog->ops = calloc((size_t) count * (conf->ifc_count + 1) + 1, sizeof(ur_copy_op));
+   matched = calloc(count + 1, sizeof(unirecField *));
+   ids = calloc(count + 1, sizeof(uint16_t));
+   ens = calloc(count + 1, sizeof(uint32_t));
+
+   if (!prog->field_length || !prog->field_offset || !prog->value_length
+         || !prog->required || !prog->ops || !matched || !ids || !ens) {
+      MSG_ERROR(msg_module, "Out of memory (%s:%d)", __FILE__, __LINE__);
+      free(matched);
+      free(ids);
+      free(ens);
+      program_destroy(prog);
+      return NULL;
+   }
 
-   uint16_t ipfix_id;
-   uint32_t en_id;
-   uint64_t sec, msec, frac;
+   /* Match fields and compute offsets up to the first variable-length field */
+   for (count = index = 0; count < prog->field_count; count++, index++) {
+      matched[count] = match_field(&template->fields[index], conf->ht_fields, &ids[count], &ens[count]);
+      length = template->fields[index].ie.length;
+      prog->field_length[count] = length;
 
+      if (length == VAR_IE_LENGTH && prog->var_first == prog->field_count) {
+         prog->var_first = count;
+      }
+      if (prog->var_first == prog->field_count) {
+         prog->field_offset[count] = offset;
+         prog->value_length[count] = length;
+         offset += length;
+      }
+
+      /* Skip enterprise element number if necessary */
+      if (template->fields[index].ie.id >> 15) {
+         index++;
+      }
+   }
+   prog->record_length = offset;
+
+   /* Dynamic fields first, in template order */
+   for (count = 0; count < prog->field_count; count++) {
+      if (matched[count] == NULL || matched[count]->size != -1) {
+         continue;
+      }
+      program_add_op(prog, UR_OP_DYNAMIC, 0, count, 0, 0, matched[count]);
+      for (int i = 0; i < conf->ifc_count; i++) {
+         if (matched[count]->included_ar[i]) {
+            prog->required[i] += matched[count]->required_ar[i];
+         }
+      }
+   }
+
+   /* Static fields of each interface */
+   for (int i = 0; i < conf->ifc_count; i++) {
+      for (count = 0; count < prog->field_count; count++) {
+         if (matched[count] == NULL || matched[count]->size == -1 || !matched[count]->included_ar[i]) {
+            continue;
+         }
+
+         prog->required[i] += matched[count]->required_ar[i];
+
+         length = prog->field_length[count];
+         dst = matched[count]->offset_ar[i];
+
+         switch (matched[count]->type) {
+         case UNIREC_FIELD_IP:
+            if ((ens[count] == 0 && (ids[count] == 8 || ids[count] == 12)) ||
+                (ens[count] == 39499 && ids[count] == 40)) {
+               type = UR_OP_IPV4;
+            } else {
+               type = (length == VAR_IE_LENGTH) ? UR_OP_IPV6 : UR_OP_COPY;
+            }
+            break;
+         case UNIREC_FIELD_PACKET:
+            // PACKET SIZE IS DIFFERENT FOR DIFFERENT EXPORTER!!!
+            if (length == 4) {
+               type = UR_OP_PACKET32;
+            } else if (length == 8) {
+               type = UR_OP_PACKET64;
+            } else {
+               type = UR_OP_PACKET_INVALID;
+            }
+            break;
+         case UNIREC_FIELD_TS:
+            type = UR_OP_TS;
+            break;
+         case UNIREC_FIELD_DBF:
+            type = UR_OP_DBF;
+            break;
+         case UNIREC_FIELD_LBF:
+            // Only filled from the record with ODID JOINFLOWS method
+            if (conf->ODID_get_method != ODID_JOINFLOWS_METHOD) {
+               continue;
+            }
+            type = UR_OP_LBF;
+            break;
+         default:
+            if (length == VAR_IE_LENGTH) {
+               type = UR_OP_CONVERT;
+            } else if (matched[count]->size < length) {
+               // Saturate unirec element
+               type = UR_OP_SATURATE;
+               length = matched[count]->size;
+            } else if (length == 2) {
+               type = UR_OP_SWAP16;
+            } else if (length == 4) {
+               type = UR_OP_SWAP32;
+            } else if (length == 8) {
+               type = UR_OP_SWAP64;
+            } else if (length == 16) {
+               type = UR_OP_CONVERT;
+            } else {
+               type = UR_OP_COPY;
+            }
+            break;
+         }
+
+         program_add_op(prog, type, i, count, length, dst, matched[count]);
+      }
+   }
+
+   free(matched);
+   free(ids);
+   free(ens);
+
+   return prog;
+}
+
+/**
+ * \brief Get copy program of the template
+ *
+ * Programs are cached by template serial number. Storage plugins are not
+ * notified about withdrawn templates, so the cache is flushed when it grows
+ * too large.
+ *
+ * @param template Template
+ * @param conf Pointer to storage plugin structure
+ * @return Program or NULL when out of memory
+ */
+static ur_program *program_get(struct ipfix_template *template, unirec_config *conf)
+{
+   uint32_t bucket = (uint32_t) (template->serial % UR_PROGRAM_CACHE_SIZE);
+   ur_program *prog;
+
+   for (prog = conf->programs[bucket]; prog != NULL; prog = prog->next) {
+      if (prog->serial == template->serial) {
+         return prog;
+      }
+   }
+
+   if (conf->program_count >= UR_PROGRAM_CACHE_MAX) {
+      programs_flush(conf);
+   }
+
+   prog = program_create(template, conf);
+   if (!prog) {
+      return NULL;
+   }
+
+   prog->next = conf->programs[bucket];
+   conf->programs[bucket] = prog;
+   conf->program_count++;
+
+   return prog;
+}
+
+/**
+ * \brief Get data from data record
+ *
+ * Uses conf->unirecFields to store values from this record
+ *
+ * \param[in] data_record IPFIX data record
+ * \param[in] prog copy program of the corresponding template
+ * \param[out] conf structure containing necessary information for converting ipfix to unirec
+ * \return length of the data record
+ */
+static uint16_t process_record(char *data_record, ur_program *prog, unirec_config *conf)
+{
+   uint16_t *field_offset = prog->field_offset;
+   uint16_t *value_length = prog->value_length;
+   uint16_t offset = prog->record_length;
+   uint16_t index, length;
+   uint64_t sec, msec, frac;
+   ur_copy_op *op, *end;
+   char *src, *dst;
 
     // Fill ODID (link bit field) in all ifc where it is included
     // Only do this if using ODID MANAGER method
@@ -299,126 +555,101 @@ static uint16_t process_record(char *data_record, struct ipfix_template *templat
         }
     }
 
-   /* Go over all fields */
-   for (count = index = 0; count < template->field_count; count++, index++) {
-      matchField = match_field(&template->fields[index], conf->ht_fields, &ipfix_id, &en_id);
+   /* Offsets of fields from the first variable-length one */
+   for (index = prog->var_first; index < prog->field_count; index++) {
+      length = prog->field_length[index];
 
-      length = template->fields[index].ie.length;
-      size_length = 0;
-
-      /* Handle variable length */
       if (length == VAR_IE_LENGTH) {
          /* Variable length */
          length = read8(data_record+offset);
-         size_length = 1;
+         offset += 1;
 
          if (length == 255) {
-            length = ntohs(read16(data_record+offset+size_length));
-            size_length = 3;
+            length = ntohs(read16(data_record+offset));
+            offset += 2;
          }
       }
 
-      /* Copy the element value on match */
-      if (matchField) {
-         // Determine if it is static or dynamic element
-         // If static, copy to all Unirec ifcs whose are using this element
-         // Else if dynamic, copy ptr to this element to `matchField->value` for futher use
-         if (matchField->size != -1) {
-            // Static element
-            for (int i = 0; i < conf->ifc_count; i++) {
-               // For every interface
-               if (matchField->included_ar[i]) {
-                  // If element is present in current interface
-                  // Copy special elements in special way
-                  switch (matchField->type) {
-                     case UNIREC_FIELD_IP:
-                        if ((en_id == 0 && (ipfix_id == 8 || ipfix_id == 12)) ||
-                            (en_id == 39499 && ipfix_id == 40)) {
-                           // IPv4 or INVEA_SIP_RTP_IPV4
-                           // Put IPv4 into 128 bits in a special way (see ipaddr.h in Nemea-UniRec for details)
-                           *(uint64_t*)(conf->ifc[i].buffer + matchField->offset_ar[i]) = 0;
-                           *(uint32_t*)(conf->ifc[i].buffer + matchField->offset_ar[i] + 8) = *(uint32_t*)(data_record + offset + size_length);
-                           *(uint32_t*)(conf->ifc[i].buffer + matchField->offset_ar[i] + 12) = 0xffffffff;
-                        } else {
-                           // IPv6 or INVEA_SIP_RTP_IPV6
-                           memcpy(conf->ifc[i].buffer + matchField->offset_ar[i], data_record + offset + size_length, length);
-                        }
-                        break;
-                     case UNIREC_FIELD_PACKET:
-                        // PACKET SIZE IS DIFFERENT FOR DIFFERENT EXPORTER!!!
-                        if (template->fields[index].ie.length == 4) {
-                           *(uint32_t*)(conf->ifc[i].buffer + matchField->offset_ar[i]) =  ntohl(*(uint32_t*)(data_record + offset + size_length));
-                        }
-                        else if (template->fields[index].ie.length == 8) {
-                           *(uint32_t*)(conf->ifc[i].buffer + matchField->offset_ar[i]) =  ntohl(*(uint32_t*)(data_record + offset + size_length + 4));
-                        } else {
-                           *(uint32_t*)(conf->ifc[i].buffer + matchField->offset_ar[i]) =  0xFFFFFFFF;
-                        }
-                        break;
-                     case UNIREC_FIELD_TS:
-                        // Handle Time variables
-                        msec = be64toh(*(uint64_t*)(data_record + offset + size_length));
-                        sec = msec / 1000;
-                        frac = ((msec % 1000) * 0x4189374BC6A7EFULL) >> 32;
-                        *(uint64_t*)(conf->ifc[i].buffer + matchField->offset_ar[i]) =  (sec<<32) | frac;
-                        break;
-                     case UNIREC_FIELD_DBF:
-                        // Handle DIR_BIT_FIELD
-                        // Just read the least significant byte directly and use only the least significant bit
-                        *(uint8_t*)(conf->ifc[i].buffer + matchField->offset_ar[i]) = (*(uint8_t*)(data_record + offset + (length - 1))) & 0x1;
-                        break;
-                     case UNIREC_FIELD_LBF:
-                        // Handle LINK_BIT_FIELD, is BIG ENDIAN but we are using only LSB
-                        // Only do this if ODID JOINFLOWS method
-                        if (conf->ODID_get_method == ODID_JOINFLOWS_METHOD) {
-                            *(uint64_t*)(conf->ifc[i].buffer + matchField->offset_ar[i]) = 1LLU << ((*(uint8_t*)(data_record + offset + size_length + 3)) - 1);
-                                }
-                        break;
-                     default:
-                        // Check length of ipfix element and if it is larger than unirec element, then saturate unirec element
-                        if (matchField->size >= length) {
-                           data_copy( (conf->ifc[i].buffer) + matchField->offset_ar[i],	// Offset to Unirec buffer for current ifc
-                                 (data_record + offset + size_length),		// Offset to data in Ipfix message
-                              length);						// Size of element
-                        } else {
-                           // set maximum value to unirec element
-                           memset( (conf->ifc[i].buffer) + matchField->offset_ar[i],
-                              0xFF,
-                              matchField->size);
-                        }
-                  }
+      field_offset[index] = offset;
+      value_length[index] = length;
+      offset += length;
+   }
 
-                  // if required, add required-filled count
-                  conf->ifc[i].requiredFilled += matchField->required_ar[i];
-               }
-            }
+   end = prog->ops + prog->op_count;
+   for (op = prog->ops; op < end; op++) {
+      src = data_record + field_offset[op->field];
+      dst = conf->ifc[op->ifc].buffer + op->dst;
+
+      switch (op->type) {
+      case UR_OP_COPY:
+         memcpy(dst, src, op->length);
+         break;
+      case UR_OP_SWAP16:
+         *(uint16_t *) dst = ntohs(read16(src));
+         break;
+      case UR_OP_SWAP32:
+         *(uint32_t *) dst = ntohl(read32(src));
+         break;
+      case UR_OP_SWAP64:
+         *(uint64_t *) dst = be64toh(read64(src));
+         break;
+      case UR_OP_CONVERT:
+         // Check length of ipfix element and if it is larger than unirec element, then saturate unirec element
+         if (op->urfield->size >= value_length[op->field]) {
+            data_copy(dst, src, value_length[op->field]);
          } else {
-            // Dynamic element
-            matchField->value     = (void*) (data_record + offset + size_length);
-            if (matchField->unirec_type == 0) { // string value should be trimmed
-                matchField->valueSize = strnlen(data_record + offset + size_length, length);
-            } else {
-                matchField->valueSize = length;
-            }
-            matchField->valueFilled = 1;
-            // Fill required count for Unirec where this element is required
-            for (int i = 0; i < conf->ifc_count; i++) {
-               // For every interface
-               if (matchField->included_ar[i]) {
-                  // If element is present in current ifc
-                  conf->ifc[i].requiredFilled += matchField->required_ar[i];
-               }
-            }
+            memset(dst, 0xFF, op->urfield->size);
          }
+         break;
+      case UR_OP_SATURATE:
+         memset(dst, 0xFF, op->length);
+         break;
+      case UR_OP_IPV4:
+         // Put IPv4 into 128 bits in a special way (see ipaddr.h in Nemea-UniRec for details)
+         *(uint64_t *) dst = 0;
+         *(uint32_t *) (dst + 8) = read32(src);
+         *(uint32_t *) (dst + 12) = 0xffffffff;
+         break;
+      case UR_OP_IPV6:
+         memcpy(dst, src, value_length[op->field]);
+         break;
+      case UR_OP_PACKET32:
+         *(uint32_t *) dst = ntohl(read32(src));
+         break;
+      case UR_OP_PACKET64:
+         *(uint32_t *) dst = ntohl(read32(src + 4));
+         break;
+      case UR_OP_PACKET_INVALID:
+         *(uint32_t *) dst = 0xFFFFFFFF;
+         break;
+      case UR_OP_TS:
+         msec = be64toh(read64(src));
+         sec = msec / 1000;
+         frac = ((msec % 1000) * 0x4189374BC6A7EFULL) >> 32;
+         *(uint64_t *) dst = (sec<<32) | frac;
+         break;
+      case UR_OP_DBF:
+         // Just read the least significant byte directly and use only the least significant bit
+         *(uint8_t *) dst = read8(src + value_length[op->field] - 1) & 0x1;
+         break;
+      case UR_OP_LBF:
+         // LINK_BIT_FIELD is BIG ENDIAN but we are using only LSB
+         *(uint64_t *) dst = 1LLU << (read8(src + 3) - 1);
+         break;
+      case UR_OP_DYNAMIC:
+         op->urfield->value = (void *) src;
+         if (op->urfield->unirec_type == 0) { // string value should be trimmed
+            op->urfield->valueSize = strnlen(src, value_length[op->field]);
+         } else {
+            op->urfield->valueSize = value_length[op->field];
+         }
+         op->urfield->valueFilled = 1;
+         break;
       }
+   }
 
-      /* Skip enterprise element number if necessary*/
-      if (template->fields[index].ie.id >> 15) {
-         index++;
-      }
-
-      /* Skip the length of the value */
-      offset += length + size_length;
+   for (int i = 0; i < conf->ifc_count; i++) {
+      conf->ifc[i].requiredFilled = prog->required[i];
    }
 
    return offset;
@@ -469,6 +700,7 @@ static int process_data_sets(const struct ipfix_message *ipfix_msg, unirec_confi
    struct ipfix_data_set *data_set;
    char *data_record;
    struct ipfix_template *template;
+   ur_program *prog;
    uint32_t offset;
    uint16_t min_record_length, ret = 0;
    int i;
@@ -492,6 +724,11 @@ static int process_data_sets(const struct ipfix_message *ipfix_msg, unirec_confi
          continue;
       }
 
+      prog = program_get(template, conf);
+      if (prog == NULL) {
+         return -1;
+      }
+
       min_record_length = template->data_length;
       offset = 4;  /* Size of the header */
 
@@ -504,7 +741,7 @@ static int process_data_sets(const struct ipfix_message *ipfix_msg, unirec_confi
          data_record = (((char *) data_set) + offset);
 
          // Process data record only once
-         ret = process_record(data_record, template, conf);
+         ret = process_record(data_record, prog, conf);
 
          // Check that the record was processes successfuly
          if (ret == 0) {
@@ -1469,6 +1706,7 @@ int storage_close (void **config)
       free(conf->ifc[i].dynAr);
    }
       destroy_fields(conf->fields);
+   programs_flush(conf);
 
    free(*config);
    return 0;
@@ -107,6 +107,62 @@ typedef struct unirecField {
 } unirecField;
 
 
+/**
+ * \brief Operations of template copy programs
+ */
+enum ur_copy_op_type {
+   UR_OP_COPY,           /**< Copy raw bytes (adjacent copies are merged) */
+   UR_OP_SWAP16,         /**< Copy 16 bit value in host byte order */
+   UR_OP_SWAP32,         /**< Copy 32 bit value in host byte order */
+   UR_OP_SWAP64,         /**< Copy 64 bit value in host byte order */
+   UR_OP_CONVERT,        /**< data_copy() or saturation decided by actual length */
+   UR_OP_SATURATE,       /**< Set maximum value of the UniRec field */
+   UR_OP_IPV4,           /**< Store IPv4 address as UniRec ipaddr */
+   UR_OP_IPV6,           /**< Copy IPv6 address */
+   UR_OP_PACKET32,       /**< Packets from 32 bit field */
+   UR_OP_PACKET64,       /**< Packets from 64 bit field (lower 32 bits) */
+   UR_OP_PACKET_INVALID, /**< Packets from field of unsupported size */
+   UR_OP_TS,             /**< Timestamp in milliseconds to UniRec time */
+   UR_OP_DBF,            /**< DIR_BIT_FIELD */
+   UR_OP_LBF,            /**< LINK_BIT_FIELD (ODID joinflows method) */
+   UR_OP_DYNAMIC         /**< Remember value of a dynamic field */
+};
+
+/**
+ * \brief One operation of a template copy program
+ */
+typedef struct ur_copy_op {
+   uint8_t type;           /**< Operation, one of `ur_copy_op_type` */
+   uint16_t ifc;           /**< Index of the output interface */
+   uint16_t field;         /**< Index of the source field in the template */
+   uint16_t length;        /**< Length of data (UR_OP_COPY and UR_OP_SATURATE) */
+   uint16_t dst;           /**< Offset in the UniRec buffer of the interface */
+   unirecField *urfield;   /**< UniRec field (UR_OP_CONVERT and UR_OP_DYNAMIC) */
+} ur_copy_op;
+
+/**
+ * \brief Copy program of a template
+ *
+ * Created when the template is seen for the first time. Maps fields of the
+ * template directly to offsets in UniRec buffers of all interfaces.
+ */
+typedef struct ur_program {
+   uint64_t serial;           /**< Serial number of the template */
+   uint16_t field_count;      /**< Number of template fields */
+   uint16_t var_first;        /**< Index of the first variable-length field (field_count if none) */
+   uint16_t record_length;    /**< Length of fields before the first variable-length field */
+   uint16_t *field_length;    /**< Lengths of fields from the template */
+   uint16_t *field_offset;    /**< Offsets of field values (from var_first set for each record) */
+   uint16_t *value_length;    /**< Lengths of field values (from var_first set for each record) */
+   uint8_t *required;         /**< Count of filled required fields of each interface */
+   uint16_t op_count;         /**< Number of operations */
+   ur_copy_op *ops;           /**< Operations */
+   struct ur_program *next;   /**< Next program in the same cache bucket */
+} ur_program;
+
+#define UR_PROGRAM_CACHE_SIZE 256  /**< Number of buckets of program cache */
+#define UR_PROGRAM_CACHE_MAX 1024  /**< Max. number of cached programs, cache is flushed when exceeded */
+
 /**
  * \struct interface
  *
@@ -158,6 +214,8 @@ typedef struct unirec_config {
     uint8_t ODID_get_method;
    uint8_t SF_DATA;
    fht_table_t *ht_fields;
+   ur_program *programs[UR_PROGRAM_CACHE_SIZE]; /**< Cache of template copy programs */
+   uint32_t program_count;	/**< Number of cached programs */
 } unirec_config;
 
 